@@ -27,6 +27,10 @@ drvAsynIPPortConfigure("6K","192.168.200.177:4001",0,0,0)
 
 #Create controller
 p6kCreateController("P6K","6K",0,2,500,1000)
+#Or, to poll status on a second connection to the controller:
+#(this needs the Ethernet port on the controller, not a serial connection)
+#drvAsynIPPortConfigure("6KSTATUS","192.168.200.177:5002",0,0,0)
+#p6kCreateController("P6K","6K",0,2,500,1000,"6KSTATUS")
 p6kUpload("P6K", "$(P6K_CONFIG)")
 
 #asynSetTraceMask("P6K",0,0xFF)
@@ -32,29 +32,29 @@
 using std::cout;
 using std::endl;
 
-/* TAS Status Bits (position in char array, not TAS bit position) */
+/* TAS Status Bits (0 based bit number, ignoring the _ separators. TAS bit 1 is bit 0 here.) */
 const epicsUInt32 p6kAxis::P6K_TAS_MOVING_        = 0;
 const epicsUInt32 p6kAxis::P6K_TAS_DIRECTION_     = 1;
 const epicsUInt32 p6kAxis::P6K_TAS_ACCELERATING_  = 2;
 const epicsUInt32 p6kAxis::P6K_TAS_ATVELOCITY_    = 3;
-const epicsUInt32 p6kAxis::P6K_TAS_HOMED_         = 5;
-const epicsUInt32 p6kAxis::P6K_TAS_ABSOLUTE_      = 6;
-const epicsUInt32 p6kAxis::P6K_TAS_CONTINUOUS_    = 7;
-const epicsUInt32 p6kAxis::P6K_TAS_JOG_           = 8;
-const epicsUInt32 p6kAxis::P6K_TAS_JOYSTICK_      = 10;
-const epicsUInt32 p6kAxis::P6K_TAS_STALL_         = 13;
-const epicsUInt32 p6kAxis::P6K_TAS_DRIVE_         = 15;
-const epicsUInt32 p6kAxis::P6K_TAS_DRIVEFAULT_    = 16;
-const epicsUInt32 p6kAxis::P6K_TAS_POSLIM_        = 17;
-const epicsUInt32 p6kAxis::P6K_TAS_NEGLIM_        = 18;
-const epicsUInt32 p6kAxis::P6K_TAS_POSLIMSOFT_    = 20;
-const epicsUInt32 p6kAxis::P6K_TAS_NEGLIMSOFT_    = 21;
-const epicsUInt32 p6kAxis::P6K_TAS_POSERROR_      = 27;
-const epicsUInt32 p6kAxis::P6K_TAS_TARGETZONE_    = 28;
-const epicsUInt32 p6kAxis::P6K_TAS_TARGETTIMEOUT_ = 30;
-const epicsUInt32 p6kAxis::P6K_TAS_GOWHENPEND_    = 31;
-const epicsUInt32 p6kAxis::P6K_TAS_MOVEPEND_      = 33; 
-const epicsUInt32 p6kAxis::P6K_TAS_PREEMPT_       = 36;
+const epicsUInt32 p6kAxis::P6K_TAS_HOMED_         = 4;
+const epicsUInt32 p6kAxis::P6K_TAS_ABSOLUTE_      = 5;
+const epicsUInt32 p6kAxis::P6K_TAS_CONTINUOUS_    = 6;
+const epicsUInt32 p6kAxis::P6K_TAS_JOG_           = 7;
+const epicsUInt32 p6kAxis::P6K_TAS_JOYSTICK_      = 8;
+const epicsUInt32 p6kAxis::P6K_TAS_STALL_         = 11;
+const epicsUInt32 p6kAxis::P6K_TAS_DRIVE_         = 12;
+const epicsUInt32 p6kAxis::P6K_TAS_DRIVEFAULT_    = 13;
+const epicsUInt32 p6kAxis::P6K_TAS_POSLIM_        = 14;
+const epicsUInt32 p6kAxis::P6K_TAS_NEGLIM_        = 15;
+const epicsUInt32 p6kAxis::P6K_TAS_POSLIMSOFT_    = 16;
+const epicsUInt32 p6kAxis::P6K_TAS_NEGLIMSOFT_    = 17;
+const epicsUInt32 p6kAxis::P6K_TAS_POSERROR_      = 22;
+const epicsUInt32 p6kAxis::P6K_TAS_TARGETZONE_    = 23;
+const epicsUInt32 p6kAxis::P6K_TAS_TARGETTIMEOUT_ = 24;
+const epicsUInt32 p6kAxis::P6K_TAS_GOWHENPEND_    = 25;
+const epicsUInt32 p6kAxis::P6K_TAS_MOVEPEND_      = 27;
+const epicsUInt32 p6kAxis::P6K_TAS_PREEMPT_       = 29;
 
 const epicsUInt32 p6kAxis::P6K_STEPPER_     = 0;
 const epicsUInt32 p6kAxis::P6K_SERVO_       = 1;
@@ -88,7 +88,7 @@ p6kAxis::p6kAxis(p6kController *pC, int32_t axisNo)
 {
   static const char *functionName = "p6kAxis::p6kAxis";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   if (axisNo > pC_->numAxes_-1) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -105,7 +105,18 @@ p6kAxis::p6kAxis(p6kController *pC, int32_t axisNo)
   lastTimeSecs_ = 0.0;
   doneTimeSecs_ = 0.0;
   movingLastPoll_ = false;
+  moveSequence_ = 0;
+  memset(&pollStatus_, 0, sizeof(pollStatus_));
+  memset(&config_, 0, sizeof(config_));
+  lastTas_ = 0;
+  lastStatusOk_ = false;
+  statusTime_ = 0.0;
+  statusSequence_ = 0;
   delayDoneMove_ = false;
+  settleSamples_ = 0;
+  settlePosition_ = 0.0;
+  burstPollsLeft_ = 0;
+  burstPoll_ = false;
   printNextError_ = true;
   printErrors_ = true;
   commandError_ = false;
@@ -145,6 +156,12 @@ p6kAxis::p6kAxis(p6kController *pC, int32_t axisNo)
   paramStatus = ((setIntegerParam(pC_->P6K_A_ModbusEncoder_, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_ModbusEncoderAddr_, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(pC_->P6K_A_ModbusEncoderOffset_, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_SettleWindow_, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(pC_->P6K_A_SettleSamples_, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_StatusFreshness_, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(pC_->P6K_A_MoveCheck_, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(pC_->P6K_A_BurstPolls_, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(pC_->P6K_A_BurstPeriod_, 0.0) == asynSuccess) && paramStatus);
   if (!paramStatus) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s Unable To Set Driver Parameters In Constructor. Axis:%d\n", 
@@ -186,7 +203,7 @@ asynStatus p6kAxis::modbusPortConnect(const char *modbusPort, int modbusAddr, in
  
   static const char *functionName = "p6kAxis::modbusPortConnect";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   status = pasynInt32SyncIO->connect(modbusPort, modbusAddr, &this->modbusEncPort_, "INT32_BE");
   if ((status) || (this->modbusEncPort_ == NULL)) {
@@ -208,30 +225,27 @@ asynStatus p6kAxis::modbusPortConnect(const char *modbusPort, int modbusAddr, in
 
 /**
  * Wrapper for common read int param operation at startup.
- * @param cmd The command to send
+ * @param id The command to send
  * @param param The asyn param to set with the result
  * @param val The result read back
  * @return asynStatus
  */
-asynStatus p6kAxis::readIntParam(const char *cmd, epicsUInt32 param, uint32_t *val)
+asynStatus p6kAxis::readIntParam(p6kCommandId id, epicsUInt32 param, uint32_t *val)
 {
-  char command[P6K_MAXBUF] = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
-  char scan[P6K_MAXBUF] = {0};
-  uint32_t nvals = 0;
-  uint32_t axisNum = 0;
+  epicsInt32 intVal = 0;
   asynStatus status = asynSuccess; 
 
   static const char *functionName = "p6kAxis::readIntParam";
   
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, cmd);
-  status = pC_->lowLevelWriteRead(command, response);
+  p6kCommand::encode(&command, id, axisNo_);
+  status = pC_->lowLevelWriteRead(command.c_str(), response);
   if (status == asynSuccess) {
-    epicsSnprintf(scan,  P6K_MAXBUF, "%%d%s%%d", cmd);
-    nvals = sscanf(response, scan, &axisNum, val);    
-    if (nvals == 2) {
+    if (p6kCommand::decode(response, id, axisNo_, &intVal)) {
+      *val = intVal;
       if (param != 0) {
 	setIntegerParam(param, *val);
       }
@@ -243,7 +257,7 @@ asynStatus p6kAxis::readIntParam(const char *cmd, epicsUInt32 param, uint32_t *v
 
   if (status != asynSuccess) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
-	      "%s ERROR: Failed to read %s at startup.\n", functionName, cmd);
+	      "%s ERROR: Failed to read %s at startup.\n", functionName, p6kCommand::info(id)->mnemonic);
   }
   
   return status;
@@ -253,30 +267,25 @@ asynStatus p6kAxis::readIntParam(const char *cmd, epicsUInt32 param, uint32_t *v
 
 /**
  * Wrapper for common read double param operation at startup.
- * @param cmd The command to send
+ * @param id The command to send
  * @param param The asyn param to set with the result
  * @param val The result read back
  * @return asynStatus
  */
-asynStatus p6kAxis::readDoubleParam(const char *cmd, epicsUInt32 param, double *val)
+asynStatus p6kAxis::readDoubleParam(p6kCommandId id, epicsUInt32 param, double *val)
 {
-  char command[P6K_MAXBUF] = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
-  char scan[P6K_MAXBUF] = {0};
-  uint32_t nvals = 0;
-  uint32_t axisNum = 0;
   asynStatus status = asynSuccess; 
 
   static const char *functionName = "p6kAxis::readDoubleParam";
   
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, cmd);
-  status = pC_->lowLevelWriteRead(command, response);
+  p6kCommand::encode(&command, id, axisNo_);
+  status = pC_->lowLevelWriteRead(command.c_str(), response);
   if (status == asynSuccess) {
-    epicsSnprintf(scan,  P6K_MAXBUF, "%%d%s%%lf", cmd);
-    nvals = sscanf(response, scan, &axisNum, val);
-    if (nvals == 2) {
+    if (p6kCommand::decode(response, id, axisNo_, val)) {
       if (param != 0) {
 	setDoubleParam(param, *val);
       }
@@ -288,7 +297,7 @@ asynStatus p6kAxis::readDoubleParam(const char *cmd, epicsUInt32 param, double *
 
   if (status != asynSuccess) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
-	      "%s ERROR: Failed to read %s at startup.\n", functionName, cmd);
+	      "%s ERROR: Failed to read %s at startup.\n", functionName, p6kCommand::info(id)->mnemonic);
   }
 
   return status;
@@ -308,20 +317,20 @@ asynStatus p6kAxis::getAxisInitialStatus(void)
 
   static const char *functionName = "p6kAxis::getAxisInitialStatus";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   if (axisNo_ != 0) {
-    char command[P6K_MAXBUF] = {0};
+    p6kBuffer command;
     char response[P6K_MAXBUF] = {0};
-    strncpy(command, P6K_CMD_TREV, P6K_MAXBUF);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+    p6kCommand::encode(&command, P6K_CMDID_TREV, 0);
+    stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
     std::string revisionStr(response);
     if(revisionStr.find(" GEM6K GT6K") != std::string::npos) {
       driveType_ = P6K_STEPPER_;
     } else if(revisionStr.find(" GEM6K GV6K") != std::string::npos) {
       driveType_ = P6K_SERVO_;
     } else if(revisionStr.find(" 6K") != std::string::npos) {
-      stat = (readIntParam(P6K_CMD_AXSDEF, pC_->P6K_A_AXSDEF_, &intVal) == asynSuccess) && stat;
+      stat = (readIntParam(P6K_CMDID_AXSDEF, pC_->P6K_A_AXSDEF_, &intVal) == asynSuccess) && stat;
       if (stat) {
         driveType_ = intVal;
       }
@@ -330,22 +339,22 @@ asynStatus p6kAxis::getAxisInitialStatus(void)
 		"%s ERROR: Unsupported controller model.\n", functionName);
     }
 
-    stat = (readIntParam(P6K_CMD_DRES, pC_->P6K_A_DRES_, &intVal) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_ERES, pC_->P6K_A_ERES_, &intVal) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_DRIVE, pC_->motorStatusPowerOn_, &intVal) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_DRES, pC_->P6K_A_DRES_, &intVal) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_ERES, pC_->P6K_A_ERES_, &intVal) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_DRIVE, pC_->motorStatusPowerOn_, &intVal) == asynSuccess) && stat;
     //Don't bother reading ENCCNT and setting motorStatusHasEncoder_ (see note in constructor made on 1/16/18).
-    //stat = (readIntParam(P6K_CMD_ENCCNT, pC_->motorStatusHasEncoder_, &intVal) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_LH, pC_->P6K_A_LH_, &intVal) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_LS, pC_->P6K_A_LS_, &intVal) == asynSuccess) && stat;
-    stat = (readDoubleParam(P6K_CMD_LSPOS, pC_->motorHighLimit_, &doubleVal) == asynSuccess) && stat;
-    stat = (readDoubleParam(P6K_CMD_LSNEG, pC_->motorLowLimit_, &doubleVal) == asynSuccess) && stat;
+    //stat = (readIntParam(P6K_CMDID_ENCCNT, pC_->motorStatusHasEncoder_, &intVal) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_LH, pC_->P6K_A_LH_, &intVal) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_LS, pC_->P6K_A_LS_, &intVal) == asynSuccess) && stat;
+    stat = (readDoubleParam(P6K_CMDID_LSPOS, pC_->motorHighLimit_, &doubleVal) == asynSuccess) && stat;
+    stat = (readDoubleParam(P6K_CMDID_LSNEG, pC_->motorLowLimit_, &doubleVal) == asynSuccess) && stat;
 
     //Read some params that don't need to go in paramLib.
-    stat = (readIntParam(P6K_CMD_CMDDIR, 0, &p6k_cmddir_) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_DRFEN,  0, &p6k_drfen_) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_ENCPOL, 0, &p6k_encpol_) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_ESK,    0, &p6k_esk_) == asynSuccess) && stat;
-    stat = (readIntParam(P6K_CMD_ESTALL, 0, &p6k_estall_) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_CMDDIR, 0, &p6k_cmddir_) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_DRFEN,  0, &p6k_drfen_) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_ENCPOL, 0, &p6k_encpol_) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_ESK,    0, &p6k_esk_) == asynSuccess) && stat;
+    stat = (readIntParam(P6K_CMDID_ESTALL, 0, &p6k_estall_) == asynSuccess) && stat;
   }
 
   if (!stat) {
@@ -424,14 +433,13 @@ void p6kAxis::printAxisParams(void)
 asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity, double max_velocity, double acceleration)
 {
   asynStatus status = asynError;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::move";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
-  int32_t maxDigits = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_MaxDigits_, &maxDigits);
+  int32_t maxDigits = config_.maxDigits;
 
   int32_t scale = getScaleFactor();
   if (scale == 0) {
@@ -443,12 +451,12 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
   // switch already active. These commands would cause
   // "INVALID CONDITIONS FOR COMMAND-AXIS" Asyn errors as well as STATE MAJOR
   // alarms.
-  int32_t limitDriveEnable = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_LimitDriveEnable_, &limitDriveEnable);
-
-  if (limitDriveEnable) {
-    bool moving = true;
-    getAxisStatus(&moving);
+  if (config_.limitDriveEnable) {
+    //Use the limit status from the last poll if it is recent enough (see statusFresh).
+    if (!statusFresh()) {
+      bool moving = true;
+      getAxisStatus(&moving);
+    }
 
     int32_t highLimitHit = 0;
     pC_->getIntegerParam(axisNo_, pC_->motorStatusHighLimit_, &highLimitHit);
@@ -468,6 +476,15 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
     }
   }
 
+  //Optionally reject moves that the controller would refuse, without sending anything.
+  if (config_.moveCheck) {
+    double current = 0.0;
+    pC_->getDoubleParam(axisNo_, pC_->motorPosition_, &current);
+    if (!checkMove(relative ? (current + position) : position, current)) {
+      return asynError;
+    }
+  }
+
   //Enable the drive if we are using this drivers parameter to control power.
   //NOTE: this function will fail if the drive is not on.
   if (autoDriveEnable() != asynSuccess) {
@@ -477,20 +494,17 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
   if (relative > 1) {
     relative = 1;
   }
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_MA, !relative);
-  status = pC_->lowLevelWriteRead(command, response);
-  memset(command, 0, sizeof(command));
+  p6kCommand::encode(&command, P6K_CMDID_MA, axisNo_, !relative);
+  status = pC_->lowLevelWriteRead(command.c_str(), response);
 
   //If SendPositionOnly is active, then we don't want to set velocity and accel params
-  int32_t sendPositionOnly = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_SendPositionOnly_, &sendPositionOnly);
+  int32_t sendPositionOnly = config_.sendPositionOnly;
 
   if (sendPositionOnly == 0) {
     if (max_velocity != 0) {
       epicsFloat64 vel = max_velocity / scale;
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_V, maxDigits, vel);
-      status = pC_->lowLevelWriteRead(command, response);
-      memset(command, 0, sizeof(command));
+      p6kCommand::encode(&command, P6K_CMDID_V, axisNo_, vel, maxDigits);
+      status = pC_->lowLevelWriteRead(command.c_str(), response);
     }
   }
 
@@ -507,22 +521,18 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
     if (iA != 0) {
       if (max_velocity != 0) {
 	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_A, maxDigits, dA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_A, axisNo_, dA, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
 	
 	//Set S curve parameters too
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_AA, maxDigits, dAA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_AA, axisNo_, dAA, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
 	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_AD, maxDigits, dA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_AD, axisNo_, dA, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
 	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_ADA, maxDigits, dA);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_ADA, axisNo_, dA, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
       } else {
 	asynPrint(pC_->pasynUserSelf, ASYN_TRACE_WARNING,
 		  "%s: maximum velocity too small (exactly 0 or close to 0). Skip setting S curve parameters.\n",
@@ -539,38 +549,37 @@ asynStatus p6kAxis::move(double position, int32_t relative, double min_velocity,
   //In case we cancel the deferred move.
   epicsUInt32 pos = static_cast<epicsUInt32>(position);
   if (pC_->movesDeferred_ == 0) {
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_D, pos);
-    status = pC_->lowLevelWriteRead(command, response);
-    memset(command, 0, sizeof(command));
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_GO);
+    p6kCommand::encode(&command, P6K_CMDID_D, axisNo_, pos);
+    status = pC_->lowLevelWriteRead(command.c_str(), response);
+    p6kCommand::encode(&command, P6K_CMDID_GO, axisNo_);
     movingLastPoll_ = true;
+    ++moveSequence_;
+    startBurst();
   } else { /* deferred moves */
+    command.clear();
     deferredPosition_ = pos;
     deferredMove_ = 1;
     //deferredRelative_ = relative; //This is already taken care of on the controller by the MA command
   }
         
-  status = pC_->lowLevelWriteRead(command, response);
+  status = pC_->lowLevelWriteRead(command.c_str(), response);
 
   //Detect a "DRIVE SHUTDOWN" error. Here we attempt to retry the drive enable.
   if (strstr(response, P6K_DRIVE_SHUTDOWN_STR_) != NULL) {
-    int32_t retryDriveEnable = 0;
-    pC_->getIntegerParam(axisNo_, pC_->P6K_A_DriveRetry_, &retryDriveEnable);
-    if (retryDriveEnable == 1) {
+    if (config_.driveRetry == 1) {
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s We detected a DRIVE SHUTDOWN on axis %d. Waiting 10s...\n", functionName, axisNo_);
-      epicsThreadSleep(10);
+      p6kClock::getClock()->sleep(10);
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
                 "%s Sending DRIVE1 again on axis %d...\n", functionName, axisNo_);
-      sprintf(command, "%d%s1",  axisNo_, P6K_CMD_DRIVE);
-      status = pC_->lowLevelWriteRead(command, response); 
+      p6kCommand::encode(&command, P6K_CMDID_DRIVE, axisNo_, 1);
+      status = pC_->lowLevelWriteRead(command.c_str(), response); 
       if (status == asynSuccess) {
         setIntegerParam(pC_->motorStatusPowerOn_, 1);
         asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
                   "%s Successfully sent DRIVE1 on axis %d. Now sending %dGO...\n", functionName, axisNo_, axisNo_);
-        memset(command, 0, sizeof(command));
-        epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_GO);
-        status = pC_->lowLevelWriteRead(command, response);
+        p6kCommand::encode(&command, P6K_CMDID_GO, axisNo_);
+        status = pC_->lowLevelWriteRead(command.c_str(), response);
       }
     }
   }
@@ -595,13 +604,11 @@ int32_t p6kAxis::getScaleFactor(void)
 {
   static const char *functionName = "p6kAxis::getScaleFactor";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   //Read DRES and ERES for velocity and accel scaling
-  int32_t dres = 0;
-  int32_t eres = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_DRES_, &dres);
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_ERES_, &eres);
+  int32_t dres = config_.dres;
+  int32_t eres = config_.eres;
   int32_t scale = 0;
   if (driveType_ == P6K_SERVO_) {
     scale = eres;
@@ -609,8 +616,8 @@ int32_t p6kAxis::getScaleFactor(void)
     scale = dres;
   }
   
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s DRES=%d, ERES=%d\n", functionName, dres, eres);
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s scale=%d\n", functionName, scale);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s DRES=%d, ERES=%d\n", functionName, dres, eres);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s scale=%d\n", functionName, scale);
 
   return scale;
 }
@@ -631,12 +638,10 @@ asynStatus p6kAxis::autoDriveEnable(void)
 {
   static const char *functionName = "p6kAxis::autoDriveEnable";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
-  int32_t auto_drive_enable = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_AutoDriveEnable_, &auto_drive_enable);
-  if (auto_drive_enable == 1) {
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+  if (config_.autoDriveEnable == 1) {
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
 	      "%s Auto drive enable\n", functionName);
     if (setClosedLoop(true) != asynSuccess) {
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -659,12 +664,11 @@ asynStatus p6kAxis::autoDriveEnable(void)
       }
   }
 
-  int32_t drive_enable_delay = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_AutoDriveEnableDelay_, &drive_enable_delay);
+  int32_t drive_enable_delay = config_.autoDriveEnableDelay;
   if (drive_enable_delay > 0) {
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
 	      "%s Auto drive enable delay: %d\n", functionName, drive_enable_delay);
-    epicsThreadSleep(static_cast<double>(drive_enable_delay) / 1000.0);
+    p6kClock::getClock()->sleep(static_cast<double>(drive_enable_delay) / 1000.0);
   }
 
   return asynSuccess;
@@ -677,20 +681,26 @@ asynStatus p6kAxis::autoDriveEnable(void)
 asynStatus p6kAxis::home(double min_velocity, double max_velocity, double acceleration, int32_t forwards)
 {
   asynStatus status = asynError;
-  char command[P6K_MAXBUF] = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::home";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
-  int32_t maxDigits = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_MaxDigits_, &maxDigits);
+  int32_t maxDigits = config_.maxDigits;
 
   int32_t scale = getScaleFactor();
   if (scale == 0) {
     return asynError;
   }
 
+  //Optionally reject a home that the controller would refuse, without sending anything.
+  if (config_.moveCheck) {
+    if (!checkHome()) {
+      return asynError;
+    }
+  }
+
   //Enable the drive if we are using this drivers parameter to control power.
   //NOTE: this function will fail if the drive is not on.
   if (autoDriveEnable() != asynSuccess) {
@@ -698,15 +708,13 @@ asynStatus p6kAxis::home(double min_velocity, double max_velocity, double accele
   }
 
   //If SendPositionOnly is active, then we don't want to set velocity and accel params
-  int32_t sendPositionOnly = 0;
-  pC_->getIntegerParam(axisNo_, pC_->P6K_A_SendPositionOnly_, &sendPositionOnly);
+  int32_t sendPositionOnly = config_.sendPositionOnly;
 
   if (sendPositionOnly == 0) {
     if (max_velocity != 0) {
       epicsFloat64 vel = max_velocity / scale;
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMV, maxDigits, vel);
-      status = pC_->lowLevelWriteRead(command, response);
-      memset(command, 0, sizeof(command));
+      p6kCommand::encode(&command, P6K_CMDID_HOMV, axisNo_, vel, maxDigits);
+      status = pC_->lowLevelWriteRead(command.c_str(), response);
     }
   }
 
@@ -714,29 +722,26 @@ asynStatus p6kAxis::home(double min_velocity, double max_velocity, double accele
     if (acceleration != 0) {
       if (max_velocity != 0) {
 	epicsFloat64 accel = acceleration / scale;
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMA, maxDigits, accel);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_HOMA, axisNo_, accel, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
 	
 	//Set S curve parameters too
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMAA, maxDigits, accel/2);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_HOMAA, axisNo_, accel/2, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
 	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMAD, maxDigits, accel);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_HOMAD, axisNo_, accel, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
 	
-	epicsSnprintf(command, P6K_MAXBUF, "%d%s%.*f", axisNo_, P6K_CMD_HOMADA, maxDigits, accel);
-	status = pC_->lowLevelWriteRead(command, response);
-	memset(command, 0, sizeof(command));
+	p6kCommand::encode(&command, P6K_CMDID_HOMADA, axisNo_, accel, maxDigits);
+	status = pC_->lowLevelWriteRead(command.c_str(), response);
       }
     }
   } // end if (sendPositionOnly == 0)
   
-  epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_HOM, (forwards>0?0:1));
-  status = pC_->lowLevelWriteRead(command, response);
-  memset(command, 0, sizeof(command));
+  p6kCommand::encode(&command, P6K_CMDID_HOM, axisNo_, (forwards>0?0:1));
+  ++moveSequence_;
+  startBurst();
+  status = pC_->lowLevelWriteRead(command.c_str(), response);
 
 
   return status;
@@ -752,7 +757,7 @@ asynStatus p6kAxis::moveVelocity(double min_velocity, double max_velocity, doubl
   //char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::moveVelocity";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, "%s moveVelocity not implemented yet.\n", functionName);
 
@@ -766,27 +771,26 @@ asynStatus p6kAxis::setPosition(double position)
 {
   asynStatus asynStatus = asynError;
   bool stat = true;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::setPosition";
   
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   /*Set position on motor axis.*/
   epicsInt32 pos = static_cast<epicsInt32>(floor(position + 0.5));
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
 	    "%s: Set axis %d on controller %s to position %d\n", 
 	    functionName, axisNo_, pC_->portName, pos);
 
-  epicsSnprintf(command, P6K_MAXBUF, "!%d%s", axisNo_, P6K_CMD_S);
-  stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-  memset(command, 0, sizeof(command));
+  p6kCommand::encode(&command, P6K_CMDID_S, axisNo_);
+  stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
 
+  ++moveSequence_;
   if (stat) {
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_PSET, pos);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-  memset(command, 0, sizeof(command));
+    p6kCommand::encode(&command, P6K_CMDID_PSET, axisNo_, pos);
+    stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
   }
 
   /*Now set position on encoder axis.*/
@@ -796,13 +800,12 @@ asynStatus p6kAxis::setPosition(double position)
   if (stat) {             
     if (encRatio != 0) {
       
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+      P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
 		"%s: Set encoder axis %d on controller %s to position %d, encRatio: %f\n", 
 		functionName, axisNo_, pC_->portName, pos, encRatio);
       
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_PESET, encpos);
-      stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-      memset(command, 0, sizeof(command));
+      p6kCommand::encode(&command, P6K_CMDID_PESET, axisNo_, encpos);
+      stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
     } else {
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: encRation is zero. Not setting encoder position.\n", 
@@ -816,9 +819,14 @@ asynStatus p6kAxis::setPosition(double position)
   setDoubleParam(pC_->motorPosition_, pos);
   setDoubleParam(pC_->motorEncoderPosition_, encpos);
 
-  /*Now do a fast update, to get the new position from the controller.*/
-  bool moving = true;
-  getAxisStatus(&moving);
+  /*Now do a fast update, to get the new position from the controller.
+    If a status freshness is set, we leave this to the poller instead of waiting for it here.*/
+  if (config_.statusFreshness > 0.0) {
+    pC_->wakeupPoller();
+  } else {
+    bool moving = true;
+    getAxisStatus(&moving);
+  }
  
   if (!stat) {
     asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -838,14 +846,20 @@ asynStatus p6kAxis::setPosition(double position)
 asynStatus p6kAxis::stop(double acceleration)
 {
   asynStatus status = asynError;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
+  epicsTimeStamp startTime;
+  epicsTimeStamp endTime;
   static const char *functionName = "p6kAxis::stopAxis";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
-  epicsSnprintf(command, P6K_MAXBUF, "!%d%s", axisNo_, P6K_CMD_S);
-  status = pC_->lowLevelWriteRead(command, response);
+  //This is an immediate command, so it doesn't wait behind a status query.
+  p6kClock::getClock()->getCurrent(&startTime);
+  p6kCommand::encode(&command, P6K_CMDID_S, axisNo_);
+  status = pC_->lowLevelWriteRead(command.c_str(), response);
+  p6kClock::getClock()->getCurrent(&endTime);
+  pC_->setStopLatency(epicsTimeDiffInSeconds(&endTime, &startTime));
 
   deferredMove_ = 0;
 
@@ -860,7 +874,7 @@ asynStatus p6kAxis::setEncoderRatio(double ratio)
   asynStatus status = asynSuccess;
   static const char *functionName = "p6kAxis::setEncoderRatio";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   status = setDoubleParam(pC_->motorEncoderRatio_, ratio);
   return status;
@@ -873,21 +887,21 @@ asynStatus p6kAxis::setHighLimit(double highLimit)
 {
   asynStatus status = asynSuccess;
   bool stat = true;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::setHighLimit";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   if(highLimit != std::numeric_limits<double>::infinity()) {
     epicsInt32 limit = static_cast<epicsInt32>(floor(highLimit + 0.5));
     
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW,
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf,
               "%s: Setting high limit on controller %s, axis %d to %d\n",
               functionName, pC_->portName, axisNo_, limit);
     
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_LSPOS, limit);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+    p6kCommand::encode(&command, P6K_CMDID_LSPOS, axisNo_, limit);
+    stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
     
     if (!stat) {
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -907,21 +921,21 @@ asynStatus p6kAxis::setLowLimit(double lowLimit)
 {
   asynStatus status = asynSuccess;
   bool stat = true;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::setLowLimit";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
 
   if(lowLimit != -std::numeric_limits<double>::infinity()) {
     epicsInt32 limit = static_cast<epicsInt32>(floor(lowLimit + 0.5));
     
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW,
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf,
               "%s: Setting high limit on controller %s, axis %d to %d\n",
               functionName, pC_->portName, axisNo_, limit);
     
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s%d", axisNo_, P6K_CMD_LSNEG, limit);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+    p6kCommand::encode(&command, P6K_CMDID_LSNEG, axisNo_, limit);
+    stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
     
     if (!stat) {
       asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -941,26 +955,26 @@ asynStatus p6kAxis::disableSoftwareLimits(bool disable)
 {
   asynStatus status = asynSuccess;
   bool stat = true;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::disableSoftwareLimits";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
   
   if (disable) {
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW,
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf,
 	      "%s: Disabling software limits on controller %s, axis %d.\n",
 	      functionName, pC_->portName, axisNo_);
     
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s0", axisNo_, P6K_CMD_LS);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+    p6kCommand::encode(&command, P6K_CMDID_LS, axisNo_, static_cast<epicsInt32>(P6K_LIM_DISABLE_));
+    stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
   } else {
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW,
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf,
 	      "%s: Enabling software limits on controller %s, axis %d.\n",
 	      functionName, pC_->portName, axisNo_);
     
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s3", axisNo_, P6K_CMD_LS);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+    p6kCommand::encode(&command, P6K_CMDID_LS, axisNo_, static_cast<epicsInt32>(P6K_LIM_ENABLE_));
+    stat = (pC_->lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
   }
 
   if (!stat) {
@@ -968,6 +982,8 @@ asynStatus p6kAxis::disableSoftwareLimits(bool disable)
 	      "%s: ERROR: Failed to control LS on controller %s, axis %d\n",
 	      functionName, pC_->portName, axisNo_);
     status = asynError;
+  } else {
+    setIntegerParam(pC_->P6K_A_LS_, disable ? P6K_LIM_DISABLE_ : P6K_LIM_ENABLE_);
   }
 
   return status;
@@ -983,11 +999,11 @@ asynStatus p6kAxis::disableSoftwareLimits(bool disable)
 asynStatus p6kAxis::setClosedLoop(bool closedLoop)
 {
   asynStatus status = asynError;
-  char command[P6K_MAXBUF]  = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF] = {0};
   static const char *functionName = "p6kAxis::setClosedLoop";
  
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s closedLoop: %d\n", functionName, closedLoop);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s closedLoop: %d\n", functionName, closedLoop);
 
   int32_t done = 0;
   pC_->getIntegerParam(axisNo_, pC_->motorStatusDone_, &done);
@@ -1006,15 +1022,15 @@ asynStatus p6kAxis::setClosedLoop(bool closedLoop)
     }
 
     if (closedLoop) {
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+      P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
 		"%s Drive enable on axis %d\n", functionName, axisNo_);
-      sprintf(command, "%d%s1",  axisNo_, P6K_CMD_DRIVE);
+      p6kCommand::encode(&command, P6K_CMDID_DRIVE, axisNo_, 1);
     } else {
-      asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+      P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
 		"%s Drive disable on axis %d\n", functionName, axisNo_);
-      sprintf(command, "%d%s0",  axisNo_, P6K_CMD_DRIVE);
+      p6kCommand::encode(&command, P6K_CMDID_DRIVE, axisNo_, 0);
     }
-    status = pC_->lowLevelWriteRead(command, response);
+    status = pC_->lowLevelWriteRead(command.c_str(), response);
     
     if (status == asynSuccess) {
       setIntegerParam(pC_->motorStatusPowerOn_, static_cast<int>(closedLoop));
@@ -1032,7 +1048,7 @@ asynStatus p6kAxis::poll(bool *moving)
   asynStatus status = asynSuccess;
   static const char *functionName = "p6kAxis::poll";
 
-  asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s Polling axis: %d\n", functionName, this->axisNo_);
+  P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s Polling axis: %d\n", functionName, this->axisNo_);
 
   if (axisNo_ != 0) {
 
@@ -1040,6 +1056,17 @@ asynStatus p6kAxis::poll(bool *moving)
       setIntegerParam(pC_->motorStatusCommsError_, 1);
       return asynError;
     }
+
+    //Only the axes in a burst are read during a burst poll (see p6kController::updateBurst).
+    //The others keep their status from the last full poll, as do all the axes 
+    //during an upload on a single port.
+    if ((pC_->burstPoll_ && !burstPoll_) || pC_->uploadPoll_) {
+      int32_t done = 1;
+      pC_->getIntegerParam(axisNo_, pC_->motorStatusDone_, &done);
+      *moving = (done == 0);
+      pC_->axisPolled(axisNo_);
+      return asynSuccess;
+    }
     
     //Now poll axis status
     if ((status = getAxisStatus(moving)) != asynSuccess) {
@@ -1056,44 +1083,371 @@ asynStatus p6kAxis::poll(bool *moving)
       }
       setIntegerParam(pC_->motorStatusCommsError_, 0);
     }
+
+    //A burst ends early once the axis is done.
+    if (!*moving) {
+      burstPollsLeft_ = 0;
+    }
   }
   
   callParamCallbacks();
+  if (axisNo_ != 0) {
+    pC_->axisPolled(axisNo_);
+  }
   return status;
 }
 
 
+/**
+ * Get ready to read the axis status. This reads the params that decide
+ * what we need to read. This must be called with the lock held.
+ * @param pStatus The status structure to fill in
+ */
+void p6kAxis::prepareAxisStatus(p6kAxisStatus *pStatus)
+{
+  pStatus->valid = false;
+  pStatus->moveSequence = moveSequence_;
+  pStatus->stat = true;
+  pStatus->tas = 0;
+  pStatus->havePosition = false;
+  pStatus->position = 0;
+  pStatus->externalEncoderUse = 0;
+  pStatus->haveEncoderPosition = false;
+  pStatus->encoderPosition = 0;
+  pStatus->modbusStatus = asynSuccess;
+  pStatus->modbusEncoder = 0;
+  pStatus->time = 0.0;
+  pStatus->externalEncoderUse = config_.externalEncoderUse;
+}
+
+/**
+ * Read the axis status from the controller (and the modbus encoder, if there is one).
+ * This does not touch the params, so it should be called without the lock, so that
+ * other threads can use the driver while we wait for the controller.
+ * @param pStatus The status structure, which must have been set up by prepareAxisStatus.
+ * @return asynStatus
+ */
+asynStatus p6kAxis::readAxisStatus(p6kAxisStatus *pStatus)
+{
+    p6kBuffer commands[3];
+    char responses[3][P6K_MAXBUF];
+    asynStatus statuses[3] = {asynError, asynError, asynError};
+    bool stat = true;
+    epicsInt32 intVal = 0;
+
+    static const char *functionName = "p6kAxis::readAxisStatus";
+    
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
+
+    pStatus->time = p6kClock::getClock()->now();
+
+    /* Transfer axis status, current position and encoder position. These are sent together,
+       so on a native TCP link they take one round trip (see p6kController::lowLevelStatusWriteRead). */
+    bool readEncoder = ((pStatus->externalEncoderUse != 1) && (modbusEncPort_ == NULL));
+    p6kCommand::encode(&commands[0], P6K_CMDID_TAS, axisNo_);
+    p6kCommand::encode(&commands[1], P6K_CMDID_TPC, axisNo_);
+    p6kCommand::encode(&commands[2], P6K_CMDID_TPE, axisNo_);
+    const char *pCommands[3] = {commands[0].c_str(), commands[1].c_str(), commands[2].c_str()};
+    pC_->lowLevelStatusWriteRead(pCommands, responses, statuses, (readEncoder ? 3 : 2));
+
+    stat = (statuses[0] == asynSuccess) && stat;
+    if (stat) {
+      if (!p6kCommand::decode(responses[0], P6K_CMDID_TAS, axisNo_, &pStatus->tas, NULL)) {
+	stat = false;
+      } 
+    }
+
+    stat = (statuses[1] == asynSuccess) && stat;
+    if (stat) {
+      if (p6kCommand::decode(responses[1], P6K_CMDID_TPC, axisNo_, &intVal)) {
+	pStatus->position = intVal;
+	pStatus->havePosition = true;
+      }
+    }
+
+    //First check if we read the encoder position from a parameter.
+    //Then check if we are reading the encoder via modbus.
+    //Otherwise read from controller.
+    if (pStatus->externalEncoderUse == 1) {
+      //The encoder position is written to a param, which we read when we set the axis status.
+    } else if (modbusEncPort_ != NULL) {
+      //We are reading the encoder position over modbus
+      //Apply a small delay to ensure we have an up to date value.
+      p6kClock::getClock()->sleep(0.1);
+      pStatus->modbusStatus = pasynInt32SyncIO->read(this->modbusEncPort_, &pStatus->modbusEncoder, 1.0);
+    } else {
+      //Else we are just reading the encoder from the controller as normal
+      stat = (statuses[2] == asynSuccess) && stat;
+      if (stat) {
+        if (p6kCommand::decode(responses[2], P6K_CMDID_TPE, axisNo_, &intVal)) {
+          pStatus->encoderPosition = intVal;
+          pStatus->haveEncoderPosition = true;
+        }
+      }
+    }
+
+    pStatus->stat = stat;
+
+    if (!stat) {
+      return asynError;
+    }
+    return asynSuccess;
+}
+
+/**
+ * Check if the encoder has settled at the end of a move. It has settled when
+ * P6K_A_SettleSamples consecutive polls (which are made at the moving poll rate
+ * while the done moving delay runs) have read an encoder position within 
+ * P6K_A_SettleWindow counts of the first of them. This is only used during the
+ * done moving delay (P6K_A_DelayTime), which is the longest time to wait.
+ * Call with the lock held.
+ * @param haveEncoder true if the encoder position was read on this poll
+ * @param encoderPosition The encoder position (TPE, Modbus or external)
+ * @return true if the axis has settled
+ */
+bool p6kAxis::settled(bool haveEncoder, epicsFloat64 encoderPosition)
+{
+  epicsInt32 samples = config_.settleSamples;
+  double window = config_.settleWindow;
+
+  if ((samples <= 0) || (!haveEncoder)) {
+    settleSamples_ = 0;
+    return false;
+  }
+
+  if ((settleSamples_ == 0) || (fabs(encoderPosition - settlePosition_) > window)) {
+    settlePosition_ = encoderPosition;
+    settleSamples_ = 1;
+  } else {
+    ++settleSamples_;
+  }
+
+  return (settleSamples_ >= samples);
+}
+
+/**
+ * Check a move before it is sent, using what we already know about the axis: the
+ * soft limits (LSPOS and LSNEG, if LS is enabled), and the limit and drive fault 
+ * bits from the last TAS (if LH is enabled, for the hard limits). A move that the
+ * controller would refuse is rejected here, rather than waiting for an error reply.
+ * The soft limits are only checked if they describe a range (LSPOS > LSNEG).
+ * Call with the lock held.
+ * @param target The target position (steps)
+ * @param current The current position (steps)
+ * @return true if the move can be sent. Otherwise P6K_A_MoveError says why.
+ */
+bool p6kAxis::checkMove(double target, double current)
+{
+  char message[P6K_MAXBUF] = {0};
+  static const char *functionName = "p6kAxis::checkMove";
+
+  if (static_cast<epicsUInt32>(config_.softLimits) == P6K_LIM_ENABLE_) {
+    double highLimit = 0.0;
+    double lowLimit = 0.0;
+    pC_->getDoubleParam(axisNo_, pC_->motorHighLimit_, &highLimit);
+    pC_->getDoubleParam(axisNo_, pC_->motorLowLimit_, &lowLimit);
+    if (highLimit > lowLimit) {
+      if (target > highLimit) {
+	epicsSnprintf(message, sizeof(message), "ERROR: Target %.0f is above the soft limit (LSPOS %.0f)", target, highLimit);
+      } else if (target < lowLimit) {
+	epicsSnprintf(message, sizeof(message), "ERROR: Target %.0f is below the soft limit (LSNEG %.0f)", target, lowLimit);
+      }
+    }
+  }
+
+  if (message[0] == '\0') {
+    bool hardLimits = (static_cast<epicsUInt32>(config_.hardLimits) == P6K_LIM_ENABLE_);
+    if (lastTasBit(P6K_TAS_DRIVEFAULT_)) {
+      epicsSnprintf(message, sizeof(message), "ERROR: Drive fault");
+    } else if ((target > current) && 
+	       ((hardLimits && lastTasBit(P6K_TAS_POSLIM_)) || lastTasBit(P6K_TAS_POSLIMSOFT_))) {
+      epicsSnprintf(message, sizeof(message), "ERROR: Positive limit is active");
+    } else if ((target < current) && 
+	       ((hardLimits && lastTasBit(P6K_TAS_NEGLIM_)) || lastTasBit(P6K_TAS_NEGLIMSOFT_))) {
+      epicsSnprintf(message, sizeof(message), "ERROR: Negative limit is active");
+    }
+  }
+
+  if (message[0] != '\0') {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: Not sending move on controller %s, axis %d. %s\n", 
+	      functionName, pC_->portName, axisNo_, message);
+    setStringParam(pC_->P6K_A_MoveError_, message);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Check a home move before it is sent. Homing may use the limits, so 
+ * only a drive fault (from the last TAS) stops it. Call with the lock held.
+ * @return true if the home can be sent. Otherwise P6K_A_MoveError says why.
+ */
+bool p6kAxis::checkHome(void)
+{
+  static const char *functionName = "p6kAxis::checkHome";
+
+  if (lastTasBit(P6K_TAS_DRIVEFAULT_)) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: Not sending home on controller %s, axis %d. Drive fault.\n", 
+	      functionName, pC_->portName, axisNo_);
+    setStringParam(pC_->P6K_A_MoveError_, "ERROR: Drive fault");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Test a bit of the TAS read by the last good status read.
+ * @param bit The bit number (eg. P6K_TAS_MOVING_)
+ * @return true if the bit is on
+ */
+bool p6kAxis::lastTasBit(epicsUInt32 bit) const
+{
+  return ((lastTas_ >> bit) & 0x1) != 0;
+}
+
+/**
+ * Check if the axis status params are recent enough to use without reading
+ * the status again. They are if they were set from a good status read less
+ * than P6K_A_STATUS_FRESHNESS seconds ago, and the axis has not been moved
+ * (or had its position set) since then. A freshness of 0 means the status
+ * is never reused. Call with the lock held.
+ * @return true if the status params can be used as they are
+ */
+bool p6kAxis::statusFresh(void)
+{
+  if ((config_.statusFreshness <= 0.0) || (statusTime_ <= 0.0)) {
+    return false;
+  }
+  if (statusSequence_ != moveSequence_) {
+    return false;
+  }
+  return ((p6kClock::getClock()->now() - statusTime_) <= config_.statusFreshness);
+}
+
+/**
+ * Start a burst of P6K_A_BURST_POLLS fast polls of this axis, P6K_A_BURST_PERIOD
+ * apart, after a move has been started (see p6kController::updateBurst). This catches
+ * short moves that are done, or that failed, well before the next normal poll. The 
+ * burst ends early once the axis is done. Call with the lock held.
+ */
+void p6kAxis::startBurst(void)
+{
+  if (config_.burstPolls > 0) {
+    burstPollsLeft_ = static_cast<epicsUInt32>(config_.burstPolls);
+  }
+}
+
+/**
+ * Update the copy of an integer config param (see p6kAxisConfig). 
+ * This is called by p6kController::setIntegerParam for every integer param
+ * set on this axis, so it ignores the params that are not copied.
+ * @param index The param index
+ * @param value The new value
+ */
+void p6kAxis::updateConfig(int index, epicsInt32 value)
+{
+  if (index == pC_->P6K_A_DRES_) {
+    config_.dres = value;
+  } else if (index == pC_->P6K_A_ERES_) {
+    config_.eres = value;
+  } else if (index == pC_->P6K_A_MaxDigits_) {
+    config_.maxDigits = value;
+  } else if (index == pC_->P6K_A_LimitDriveEnable_) {
+    config_.limitDriveEnable = value;
+  } else if (index == pC_->P6K_A_SendPositionOnly_) {
+    config_.sendPositionOnly = value;
+  } else if (index == pC_->P6K_A_AutoDriveEnable_) {
+    config_.autoDriveEnable = value;
+  } else if (index == pC_->P6K_A_AutoDriveEnableDelay_) {
+    config_.autoDriveEnableDelay = value;
+  } else if (index == pC_->P6K_A_DriveRetry_) {
+    config_.driveRetry = value;
+  } else if (index == pC_->P6K_A_ExternalEncoderUse_) {
+    config_.externalEncoderUse = value;
+  } else if (index == pC_->P6K_A_ModbusEncoderCheck_) {
+    config_.modbusEncoderCheck = value;
+  } else if (index == pC_->P6K_A_SettleSamples_) {
+    config_.settleSamples = value;
+  } else if (index == pC_->P6K_A_LS_) {
+    config_.softLimits = value;
+  } else if (index == pC_->P6K_A_LH_) {
+    config_.hardLimits = value;
+  } else if (index == pC_->P6K_A_MoveCheck_) {
+    config_.moveCheck = value;
+  } else if (index == pC_->P6K_A_BurstPolls_) {
+    config_.burstPolls = value;
+  }
+}
+
+/**
+ * Update the copy of a double config param (see p6kAxisConfig).
+ * @param index The param index
+ * @param value The new value
+ */
+void p6kAxis::updateConfig(int index, epicsFloat64 value)
+{
+  if (index == pC_->P6K_A_DelayTime_) {
+    config_.delayTime = value;
+  } else if (index == pC_->P6K_A_SettleWindow_) {
+    config_.settleWindow = value;
+  } else if (index == pC_->P6K_A_StatusFreshness_) {
+    config_.statusFreshness = value;
+  } else if (index == pC_->P6K_A_BurstPeriod_) {
+    config_.burstPeriod = value;
+  }
+}
+
+/**
+ * @return The copies of the config params used on the move and poll paths.
+ */
+const p6kAxisConfig* p6kAxis::getConfig(void) const
+{
+  return &config_;
+}
+
+/**
+ * Test a TAS bit.
+ * @param status The axis status read by readAxisStatus
+ * @param bit The bit number (eg. P6K_TAS_MOVING_)
+ * @return true if the bit is on
+ */
+bool p6kAxis::tasBit(const p6kAxisStatus &status, epicsUInt32 bit)
+{
+  return ((status.tas >> bit) & 0x1) != 0;
+}
+
 /**
  * Read the axis status and set axis related parameters.
+ * When called by the poller this uses the status that the controller poll has
+ * already read (without the lock). Otherwise the status is read now, and the 
+ * lock is released while we wait for the controller.
  * @param moving Boolean flag to indicate if the axis is moving. This is set by this function
  * to indcate to the polling thread how quickly to poll for status.
  * @return asynStatus
  */
 asynStatus p6kAxis::getAxisStatus(bool *moving)
 {
-    char command[P6K_MAXBUF] = {0};
-    char response[P6K_MAXBUF] = {0};
     bool stat = true;
-    int32_t nvals = 0;
-    int32_t axisNum = 0;
-    int32_t intVal = 0;
-    int32_t externalEncoderUse = 0;
     int32_t externalEncoder = 0;
     epicsInt32 modbusEncoder = 0;
-    char stringVal[P6K_MAXBUF] = {0};
     bool doneMoving = false;
     bool controllerDoneMoving = false;
+    bool haveEncoder = false;
+    epicsFloat64 encoderPosition = 0.0;
     uint32_t problem = 0;
+    p6kAxisStatus status;
     
     static const char *functionName = "p6kAxis::getAxisStatus";
     
-    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+    P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, "%s\n", functionName);
     
     axisError_ = false;
 
     //Get the time and decide if we want to print errors.
     //Crude error message throttling.
-    epicsTimeGetCurrent(&nowTime_);
+    p6kClock::getClock()->getCurrent(&nowTime_);
     nowTimeSecs_ = nowTime_.secPastEpoch;
     if ((nowTimeSecs_ - lastTimeSecs_) < pC_->P6K_ERROR_PRINT_TIME_) {
       printErrors_ = false;
@@ -1106,53 +1460,47 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       printErrors_ = true;
     }
 
-    /* Transfer axis status */
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_TAS);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
+    if (pollStatus_.valid) {
+      status = pollStatus_;
+      pollStatus_.valid = false;
+    } else {
+      prepareAxisStatus(&status);
+      pC_->unlock();
+      readAxisStatus(&status);
+      pC_->lock();
+    }
+    stat = status.stat;
+    lastStatusOk_ = stat;
     if (stat) {
-      nvals = sscanf(response, "%d"P6K_CMD_TAS"%s", &axisNum, stringVal);
-      if (nvals != 2) {
-	stat = false;
-      } 
+      lastTas_ = status.tas;
     }
-    memset(command, 0, sizeof(command));
 
-    /* Transfer current position and encoder position.*/
-    epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_TPC);
-    stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-    if (stat) {
-      nvals = sscanf(response, "%d"P6K_CMD_TPC"%d", &axisNum, &intVal);
-      if (nvals == 2) {
-	setDoubleParam(pC_->motorPosition_, intVal);
-      }
+    //The lock was released while we read the status. If a move was started 
+    //(or the position set) in the meantime then what we read is out of date, 
+    //so leave the status alone until the next poll.
+    if (status.moveSequence != moveSequence_) {
+      *moving = true;
+      return asynSuccess;
     }
-    memset(command, 0, sizeof(command));
 
-    //First check if we read the encoder position from a parameter.
-    //Then check if we are reading the encoder via modbus.
-    //Otherwise read from controller.
-    pC_->getIntegerParam(axisNo_, pC_->P6K_A_ExternalEncoderUse_, &externalEncoderUse);
-    if (externalEncoderUse == 1) {
-      //Allow time for encoder position to be written from data via writeFloat64
-      //Otherwise the positions are stale because we are blocked by the poller lock taken
-      //in asynMotorController::asynMotorPoller.
-      pC_->unlock();
-      epicsThreadSleep(0.01);
-      pC_->lock();
+    if (status.havePosition) {
+      setDoubleParam(pC_->motorPosition_, status.position);
+    }
+
+    if (status.externalEncoderUse == 1) {
       if (pC_->getIntegerParam(axisNo_, pC_->P6K_A_ExternalEncoder_, &externalEncoder) == asynSuccess) {
         setDoubleParam(pC_->motorEncoderPosition_, externalEncoder);
-        asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+        encoderPosition = externalEncoder;
+        haveEncoder = true;
+        P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
                     "%s: External encoder position on controller %s axis %d is %d\n", 
                     functionName, pC_->portName, axisNo_, externalEncoder);
       }
     } else if (modbusEncPort_ != NULL) {
-      //We are reading the encoder position over modbus
-      //Apply a small delay to ensure we have an up to date value
-      epicsThreadSleep(0.1);
       //Check if we care about bad readings
-      epicsInt32 modbusEncCheck = 0;
-      pC_->getIntegerParam(axisNo_, pC_->P6K_A_ModbusEncoderCheck_, &modbusEncCheck);
-      if (pasynInt32SyncIO->read(this->modbusEncPort_, &modbusEncoder, 1.0) != asynSuccess) {
+      epicsInt32 modbusEncCheck = config_.modbusEncoderCheck;
+      modbusEncoder = status.modbusEncoder;
+      if (status.modbusStatus != asynSuccess) {
         if (modbusEncCheck != 0) {
           asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR, 
                     "%s: ERROR: Problem reading modbus encoder position axis %d\n", 
@@ -1172,26 +1520,21 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
           }
           setDoubleParam(pC_->motorEncoderPosition_, 0.0);
         } else {
-          asynPrint(pC_->pasynUserSelf, ASYN_TRACE_FLOW, 
+          P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
                     "%s: Modbus encoder position on controller %s axis %d is %d\n", 
                     functionName, pC_->portName, axisNo_, modbusEncoder);
           //Apply the count offset that we specified in the IOC startup script
           modbusEncoder = modbusEncoder + modbusEncOffset_;
           setDoubleParam(pC_->motorEncoderPosition_, modbusEncoder);
+          encoderPosition = modbusEncoder;
+          haveEncoder = true;
         }
       }
-    } else {
-      //Else we are just reading the encoder from the controller as normal
-      epicsSnprintf(command, P6K_MAXBUF, "%d%s", axisNo_, P6K_CMD_TPE);
-      stat = (pC_->lowLevelWriteRead(command, response) == asynSuccess) && stat;
-      if (stat) {
-        nvals = sscanf(response, "%d"P6K_CMD_TPE"%d", &axisNum, &intVal);
-        if (nvals == 2) {
-          setDoubleParam(pC_->motorEncoderPosition_, intVal);
-        }
-      }
+    } else if (status.haveEncoderPosition) {
+      setDoubleParam(pC_->motorEncoderPosition_, status.encoderPosition);
+      encoderPosition = status.encoderPosition;
+      haveEncoder = true;
     }
-    memset(command, 0, sizeof(command));
 
     if (!stat) {
       if (printErrors_) {
@@ -1205,30 +1548,36 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       if (deferredMove_) {
 	doneMoving = false; 
       } else {
-	doneMoving = !(stringVal[P6K_TAS_MOVING_] == pC_->P6K_ON_);
+	doneMoving = !tasBit(status, P6K_TAS_MOVING_);
       }
       
       if (doneMoving) {
 	if (driveType_ == P6K_SERVO_) {
-	  bool targetZone = (stringVal[P6K_TAS_TARGETZONE_] == pC_->P6K_ON_);
-	  doneMoving = targetZone && !(stringVal[P6K_TAS_TARGETTIMEOUT_] == pC_->P6K_ON_);
+	  bool targetZone = tasBit(status, P6K_TAS_TARGETZONE_);
+	  doneMoving = targetZone && !tasBit(status, P6K_TAS_TARGETTIMEOUT_);
 	}
       }
 
       controllerDoneMoving = doneMoving;
 
-      //Optionally delay the done moving callback at the end of a move
-      double delayTime = 0.0;
-      pC_->getDoubleParam(axisNo_, pC_->P6K_A_DelayTime_, &delayTime);
+      //Optionally delay the done moving callback at the end of a move.
+      //If a settle window is set, the delay ends early once the encoder has settled.
+      double delayTime = config_.delayTime;
       if (delayTime > 0) {
 	if (doneMoving) {
 	  if (movingLastPoll_) {
 	    delayDoneMove_ = true;
 	    doneTimeSecs_ = nowTimeSecs_;
+	    settleSamples_ = 0;
 	  }
 	  if (delayDoneMove_) {
 	    if ((nowTimeSecs_ - doneTimeSecs_) > delayTime) {
 	      delayDoneMove_ = false;
+	    } else if (settled(haveEncoder, encoderPosition)) {
+	      P6K_TRACE_FLOW(pC_->traceMask_, pC_->pasynUserSelf, 
+			     "%s: Axis %d settled after %d samples\n", 
+			     functionName, axisNo_, settleSamples_);
+	      delayDoneMove_ = false;
 	    }
 	  }
 	}
@@ -1248,72 +1597,70 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       stat = (setIntegerParam(pC_->motorStatusDone_, 
 	      doneMoving) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusMoving_, 
-	     (stringVal[P6K_TAS_MOVING_] == pC_->P6K_ON_)) == asynSuccess) && stat;
+	     tasBit(status, P6K_TAS_MOVING_)) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusDirection_, 
-             (stringVal[P6K_TAS_DIRECTION_] == pC_->P6K_OFF_)) == asynSuccess) && stat;
+             !tasBit(status, P6K_TAS_DIRECTION_)) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusHighLimit_, 
-	    ((stringVal[P6K_TAS_POSLIM_] == pC_->P6K_ON_) || 
-	     (stringVal[P6K_TAS_POSLIMSOFT_] == pC_->P6K_ON_))) == asynSuccess) && stat;
+	    (tasBit(status, P6K_TAS_POSLIM_) || 
+	     tasBit(status, P6K_TAS_POSLIMSOFT_))) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusLowLimit_, 
-	    ((stringVal[P6K_TAS_NEGLIM_] == pC_->P6K_ON_) || 
-             (stringVal[P6K_TAS_NEGLIMSOFT_] == pC_->P6K_ON_))) == asynSuccess) && stat;
+	    (tasBit(status, P6K_TAS_NEGLIM_) || 
+             tasBit(status, P6K_TAS_NEGLIMSOFT_))) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusHomed_, 
-	     (stringVal[P6K_TAS_HOMED_] == pC_->P6K_ON_)) == asynSuccess) && stat;
+	     tasBit(status, P6K_TAS_HOMED_)) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusPowerOn_, 
-	     (stringVal[P6K_TAS_DRIVE_] == pC_->P6K_OFF_)) == asynSuccess) && stat;
+	     !tasBit(status, P6K_TAS_DRIVE_)) == asynSuccess) && stat;
 
-      //Check TLIM uint32_t from controller object for limit switch status
+      //Check TLIM bits from controller object for limit switch status
       //We do this so that the axis object can reflect the limit
       //switch status even if TAS doesn't reflect limit switch status. 
       //To disable this, disable polling TLIM in the controller object.
       //NOTE: I don't check LIMLVL. I assume we are using fail safe inputs
       //so that 1=not activated, and 0=activated.
-      int32_t tlim_bits = 0;
-      int32_t tlim_size = 0;
-      pC_->getIntegerParam(pC_->P6K_C_TLIM_Bits_, &tlim_bits);
+      size_t tlim_start = 0;
       stat = (setIntegerParam(pC_->motorStatusAtHome_, 0) == asynSuccess) && stat;
       stat = (setIntegerParam(pC_->motorStatusHome_, 0) == asynSuccess) && stat;
-      if (tlim_bits > 0) {
-	tlim_size = (axisNo_ - 1)*pC_->P6K_TLIM_SIZE_;
-	if ((tlim_bits & (0x1 << (tlim_size + pC_->P6K_TLIM_BIT1_))) == 0) {
+      tlim_start = pC_->tlimBits_.groupStart(axisNo_ - 1);
+      if ((tlim_start + pC_->P6K_TLIM_BIT3_) < pC_->tlimBits_.size()) {
+	if (!pC_->tlimBits_.test(tlim_start + pC_->P6K_TLIM_BIT1_)) {
 	  stat = (setIntegerParam(pC_->motorStatusHighLimit_, 1) == asynSuccess) && stat;
 	}
-	if ((tlim_bits & (0x1 << (tlim_size + pC_->P6K_TLIM_BIT2_))) == 0) {
+	if (!pC_->tlimBits_.test(tlim_start + pC_->P6K_TLIM_BIT2_)) {
 	  stat = (setIntegerParam(pC_->motorStatusLowLimit_, 1) == asynSuccess) && stat;
 	}
-	if (tlim_bits & (0x1 << (tlim_size + pC_->P6K_TLIM_BIT3_))) {
+	if (pC_->tlimBits_.test(tlim_start + pC_->P6K_TLIM_BIT3_)) {
 	  stat = (setIntegerParam(pC_->motorStatusAtHome_, 1) == asynSuccess) && stat;
 	  stat = (setIntegerParam(pC_->motorStatusHome_, 1) == asynSuccess) && stat;
 	}
       }
       
       //Set limit error message for users
-      if (stringVal[P6K_TAS_POSLIM_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_POSLIM_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Hardware High Limit");
       }
-      if (stringVal[P6K_TAS_NEGLIM_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_NEGLIM_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Hardware Low Limit");
       }
-      if (stringVal[P6K_TAS_POSLIMSOFT_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_POSLIMSOFT_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Software High Limit");
       }
-      if (stringVal[P6K_TAS_NEGLIMSOFT_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_NEGLIMSOFT_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Software Low Limit");
       }
 
       if (driveType_ == P6K_SERVO_) {
 	stat = (setIntegerParam(pC_->motorStatusFollowingError_, 
-               (stringVal[P6K_TAS_POSERROR_] == pC_->P6K_ON_)) == asynSuccess) && stat;
+               tasBit(status, P6K_TAS_POSERROR_)) == asynSuccess) && stat;
       } else {
 	stat = (setIntegerParam(pC_->motorStatusFollowingError_, 
-               (stringVal[P6K_TAS_STALL_] == pC_->P6K_ON_)) == asynSuccess) && stat;
+               tasBit(status, P6K_TAS_STALL_)) == asynSuccess) && stat;
       }
       
-      if (stringVal[P6K_TAS_STALL_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_STALL_)) {
 	axisError_ = true;
 	setStringParam(pC_->P6K_A_Error_, "ERROR: Stall Detected");
       }
@@ -1325,7 +1672,7 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       //We only detect drive fault input when a move is attempted.
       //Unless we also poll extended axis status (TASX), which always 
       //reports drive fault status.
-      if (stringVal[P6K_TAS_DRIVEFAULT_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_DRIVEFAULT_)) {
 	stat = (setIntegerParam(pC_->P6K_A_TAS_DriveFault_, 1) == asynSuccess) && stat;
 	problem = 1;
 	if (printErrors_) {
@@ -1338,7 +1685,7 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
 	stat = (setIntegerParam(pC_->P6K_A_TAS_DriveFault_, 0) == asynSuccess) && stat;
       }
 
-      if (stringVal[P6K_TAS_TARGETTIMEOUT_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_TARGETTIMEOUT_)) {
 	stat = (setIntegerParam(pC_->P6K_A_TAS_Timeout_, 1) == asynSuccess) && stat;
 	problem = 1;
 	if (printErrors_) {
@@ -1351,7 +1698,7 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
 	stat = (setIntegerParam(pC_->P6K_A_TAS_Timeout_, 0) == asynSuccess) && stat;
       }
 
-      if (stringVal[P6K_TAS_POSERROR_] == pC_->P6K_ON_) {
+      if (tasBit(status, P6K_TAS_POSERROR_)) {
 	stat = (setIntegerParam(pC_->P6K_A_TAS_PosErr_, 1) == asynSuccess) && stat;
 	problem = 1;
 	if (printErrors_) {
@@ -1380,6 +1727,12 @@ asynStatus p6kAxis::getAxisStatus(bool *moving)
       }
     }
     
+    //Remember when the params were last set from a good status (see statusFresh).
+    if (stat) {
+      statusTime_ = status.time;
+      statusSequence_ = status.moveSequence;
+    }
+
     //Clear error print flag for this axis if problem has been removed.
     if (stat) {
       if (!problem && !printErrors_) {
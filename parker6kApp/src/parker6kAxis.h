@@ -17,9 +17,57 @@
 
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
+#include "parker6kCommand.h"
 
 class p6kController;
 
+/**
+ * Axis status read from the controller by p6kAxis::readAxisStatus. This is
+ * read without the lock, and then used to set the params with the lock held.
+ */
+typedef struct p6kAxisStatus {
+  bool valid;                     /**< Set when the poller has read the status, but it has not been used yet */
+  epicsUInt32 moveSequence;       /**< The axis moveSequence_ before we read the status */
+  bool stat;                      /**< Set to false if any of the status queries failed */
+  epicsUInt64 tas;                /**< The TAS bits (bit 0 is the first bit of the reply) */
+  bool havePosition;
+  epicsInt32 position;
+  epicsInt32 externalEncoderUse;
+  bool haveEncoderPosition;
+  epicsInt32 encoderPosition;
+  asynStatus modbusStatus;
+  epicsInt32 modbusEncoder;
+  double time;                    /**< When the status was read (p6kClock::now) */
+} p6kAxisStatus;
+
+/**
+ * Copies of the axis config params that are read on every move or poll, so that 
+ * they can be read without looking them up in the param list. They are updated by
+ * p6kController::setIntegerParam and setDoubleParam (so every write to the param, 
+ * from a record or from the driver, is seen). The params are still the master copy.
+ */
+typedef struct p6kAxisConfig {
+  epicsInt32 dres;                  /**< P6K_A_DRES */
+  epicsInt32 eres;                  /**< P6K_A_ERES */
+  epicsInt32 maxDigits;             /**< P6K_A_MAXDIGITS */
+  epicsInt32 limitDriveEnable;      /**< P6K_A_LIMIT_DRIVE_ENABLE */
+  epicsInt32 sendPositionOnly;      /**< P6K_A_SEND_POSITION_ONLY */
+  epicsInt32 autoDriveEnable;       /**< P6K_A_AUTO_DRIVE_ENABLE */
+  epicsInt32 autoDriveEnableDelay;  /**< P6K_A_AUTO_DRIVE_ENABLE_DELAY (ms) */
+  epicsInt32 driveRetry;            /**< P6K_A_DRIVE_RETRY */
+  epicsInt32 externalEncoderUse;    /**< P6K_A_EXT_ENC_USE */
+  epicsInt32 modbusEncoderCheck;    /**< P6K_A_MODBUS_ENC_CHECK */
+  epicsInt32 settleSamples;         /**< P6K_A_SETTLE_SAMPLES */
+  epicsInt32 softLimits;            /**< P6K_A_LS */
+  epicsInt32 hardLimits;            /**< P6K_A_LH */
+  epicsInt32 moveCheck;             /**< P6K_A_MOVE_CHECK */
+  epicsInt32 burstPolls;            /**< P6K_A_BURST_POLLS */
+  epicsFloat64 settleWindow;        /**< P6K_A_SETTLE_WINDOW */
+  epicsFloat64 delayTime;           /**< P6K_A_DELAYTIME (s) */
+  epicsFloat64 statusFreshness;     /**< P6K_A_STATUS_FRESHNESS (s) */
+  epicsFloat64 burstPeriod;         /**< P6K_A_BURST_PERIOD (ms) */
+} p6kAxisConfig;
+
 /**
  * p6kAxis derives from the virtual class asynMotorAxis. It re-implements some functions
  * and defines all the axis specific logic, including the polling function that
@@ -43,6 +91,7 @@ class p6kAxis : public asynMotorAxis
   asynStatus setLowLimit(double lowLimit);
   asynStatus disableSoftwareLimits(bool disable);
   asynStatus modbusPortConnect(const char *modbusPort, int modbusAddr, int modbusOffset);
+  const p6kAxisConfig* getConfig(void) const;
   
   private:
   p6kController *pC_;
@@ -52,14 +101,36 @@ class p6kAxis : public asynMotorAxis
   epicsInt32 modbusEncOffset_;
 
   bool movingLastPoll_;
+  epicsUInt32 moveSequence_;
+  p6kAxisStatus pollStatus_;
+  p6kAxisConfig config_;
+  epicsUInt64 lastTas_;
+  bool lastStatusOk_;
+  double statusTime_;
+  epicsUInt32 statusSequence_;
   bool delayDoneMove_;
   epicsFloat64 doneTimeSecs_;
+  epicsInt32 settleSamples_;
+  epicsFloat64 settlePosition_;
+  epicsUInt32 burstPollsLeft_;
+  bool burstPoll_;
   
 
   asynStatus getAxisStatus(bool *moving);
+  void prepareAxisStatus(p6kAxisStatus *pStatus);
+  asynStatus readAxisStatus(p6kAxisStatus *pStatus);
+  static bool tasBit(const p6kAxisStatus &status, epicsUInt32 bit);
+  bool settled(bool haveEncoder, epicsFloat64 encoderPosition);
+  bool statusFresh(void);
+  bool checkMove(double target, double current);
+  bool checkHome(void);
+  bool lastTasBit(epicsUInt32 bit) const;
+  void startBurst(void);
+  void updateConfig(int index, epicsInt32 value);
+  void updateConfig(int index, epicsFloat64 value);
   asynStatus getAxisInitialStatus(void);
-  asynStatus readIntParam(const char *cmd, epicsUInt32 param, uint32_t *val);
-  asynStatus readDoubleParam(const char *cmd, epicsUInt32 param, double *val);
+  asynStatus readIntParam(p6kCommandId id, epicsUInt32 param, uint32_t *val);
+  asynStatus readDoubleParam(p6kCommandId id, epicsUInt32 param, double *val);
   void printAxisParams(void);
   asynStatus autoDriveEnable(void);
   int32_t getScaleFactor(void);
@@ -0,0 +1,436 @@
+/********************************************
+ *  parker6kBits.cpp
+ *
+ *  Dynamically sized bit mask, used for
+ *  axis masks (eg. GO) and the bit strings
+ *  returned by TLIM, TIN and TOUT.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "parker6kBits.h"
+
+const char p6kBitMask::P6K_BIT_ON_        = '1';
+const char p6kBitMask::P6K_BIT_OFF_       = '0';
+const char p6kBitMask::P6K_BIT_NOCHANGE_  = 'X';
+const char p6kBitMask::P6K_BIT_SEPARATOR_ = '_';
+const char p6kBitMask::P6K_LIST_SEPARATOR_ = ',';
+
+const size_t p6kBitMask::P6K_WORD_BITS_ = 64;
+const size_t p6kBitMask::P6K_CHUNK_CHARS_ = 16;
+
+/**
+ * Index of the lowest set bit. The value must not be 0.
+ */
+static inline unsigned int lowestBit(unsigned int value)
+{
+#if defined(__GNUC__)
+  return __builtin_ctz(value);
+#else
+  unsigned int bit = 0;
+  while ((value & 0x1) == 0) {
+    value >>= 1;
+    ++bit;
+  }
+  return bit;
+#endif
+}
+
+/**
+ * Classify up to 16 characters of a bit string. Bit n of each mask
+ * is set if character n is a 1, a 0 or a separator.
+ * @param input The characters
+ * @param count The number of characters (at most 16)
+ */
+static inline void classifyChunk(const char *input, size_t count,
+				 unsigned int *pOnes, unsigned int *pZeros, unsigned int *pSeps)
+{
+#if defined(__SSE2__)
+  if (count == 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input));
+    *pOnes  = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8(p6kBitMask::P6K_BIT_ON_)));
+    *pZeros = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8(p6kBitMask::P6K_BIT_OFF_)));
+    *pSeps  = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8(p6kBitMask::P6K_BIT_SEPARATOR_)));
+    return;
+  }
+#endif
+  unsigned int ones = 0;
+  unsigned int zeros = 0;
+  unsigned int seps = 0;
+  for (size_t i=0; i<count; ++i) {
+    if (input[i] == p6kBitMask::P6K_BIT_ON_) {
+      ones |= (0x1u << i);
+    } else if (input[i] == p6kBitMask::P6K_BIT_OFF_) {
+      zeros |= (0x1u << i);
+    } else if (input[i] == p6kBitMask::P6K_BIT_SEPARATOR_) {
+      seps |= (0x1u << i);
+    }
+  }
+  *pOnes = ones;
+  *pZeros = zeros;
+  *pSeps = seps;
+}
+
+/**
+ * Constructor.
+ * @param size The number of bits (all cleared).
+ */
+p6kBitMask::p6kBitMask(size_t size)
+  : size_(0)
+{
+  resize(size);
+}
+
+/**
+ * Change the number of bits. Any new bits are cleared.
+ * @param size The number of bits
+ */
+void p6kBitMask::resize(size_t size)
+{
+  words_.resize((size + P6K_WORD_BITS_ - 1) / P6K_WORD_BITS_, 0);
+  //Clear any bits beyond the end of the mask in the last word
+  if ((size % P6K_WORD_BITS_) != 0) {
+    words_.back() &= ((static_cast<epicsUInt64>(1) << (size % P6K_WORD_BITS_)) - 1);
+  }
+  size_ = size;
+}
+
+/**
+ * @return The number of bits
+ */
+size_t p6kBitMask::size(void) const
+{
+  return size_;
+}
+
+/**
+ * Clear all the bits (the size is not changed).
+ */
+void p6kBitMask::clear(void)
+{
+  setAll(false);
+}
+
+/**
+ * Set all the bits on or off.
+ * @param value The value for every bit
+ */
+void p6kBitMask::setAll(bool value)
+{
+  for (size_t word=0; word<words_.size(); ++word) {
+    words_[word] = (value ? ~static_cast<epicsUInt64>(0) : 0);
+  }
+  resize(size_);
+}
+
+/**
+ * Set a bit. The mask is resized if the bit is beyond the end.
+ * @param bit The bit number (0 based)
+ * @param value The value to set
+ */
+void p6kBitMask::set(size_t bit, bool value)
+{
+  if (bit >= size_) {
+    resize(bit+1);
+  }
+  epicsUInt64 mask = static_cast<epicsUInt64>(1) << (bit % P6K_WORD_BITS_);
+  if (value) {
+    words_[bit / P6K_WORD_BITS_] |= mask;
+  } else {
+    words_[bit / P6K_WORD_BITS_] &= ~mask;
+  }
+}
+
+/**
+ * Test a bit. Bits beyond the end of the mask are off.
+ * @param bit The bit number (0 based)
+ * @return true if the bit is on
+ */
+bool p6kBitMask::test(size_t bit) const
+{
+  if (bit >= size_) {
+    return false;
+  }
+  return ((words_[bit / P6K_WORD_BITS_] >> (bit % P6K_WORD_BITS_)) & 0x1) != 0;
+}
+
+/**
+ * @return true if any bit is on
+ */
+bool p6kBitMask::any(void) const
+{
+  for (size_t word=0; word<words_.size(); ++word) {
+    if (words_[word] != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Pack up to 32 bits into a uint32 (eg. for an asynInt32 parameter).
+ * @param first The first bit to pack, which becomes bit 0 of the result.
+ * @return The packed bits
+ */
+epicsUInt32 p6kBitMask::toUInt32(size_t first) const
+{
+  epicsUInt32 bits = 0;
+  for (size_t bit=0; bit<32; ++bit) {
+    if (test(first+bit)) {
+      bits |= (0x1u << bit);
+    }
+  }
+  return bits;
+}
+
+/**
+ * Parse a bit string sent back by the controller (eg. 1110_0001_1).
+ * Parsing stops at the first character that is not a 1, 0 or underscore.
+ * The mask is resized to the number of bits found.
+ * @param input The bit string (not including the command name)
+ * @return The number of bits found
+ */
+size_t p6kBitMask::parse(const char *input)
+{
+  resize(0);
+  groups_.clear();
+
+  if (input == NULL) {
+    return 0;
+  }
+
+  return decode(input, input + strlen(input), this, NULL, NULL);
+}
+
+/**
+ * Parse a bit string into an integer, without building a mask. 
+ * Bit 0 of the result is the first bit of the string. Only the first
+ * 64 bits are kept, but the whole string is parsed.
+ * @param input The bit string (not including the command name)
+ * @param pBits The bits
+ * @param ppEnd If not NULL, this is set to the first character that was not parsed.
+ * @return The number of bits found
+ */
+size_t p6kBitMask::parseUInt64(const char *input, epicsUInt64 *pBits, const char **ppEnd)
+{
+  *pBits = 0;
+  if (input == NULL) {
+    if (ppEnd != NULL) {
+      *ppEnd = NULL;
+    }
+    return 0;
+  }
+
+  return decode(input, input + strlen(input), NULL, pBits, ppEnd);
+}
+
+/**
+ * Parse a comma separated list of bit strings (eg. the reply to TAS 
+ * without an axis number, which has one bit string per axis). Spaces
+ * after each comma are skipped.
+ * @param input The list (not including the command name)
+ * @param pValues Array for the bits of each string (the first 64 bits of each)
+ * @param maxValues The size of pValues
+ * @return The number of bit strings found
+ */
+size_t p6kBitMask::parseList(const char *input, epicsUInt64 *pValues, size_t maxValues)
+{
+  size_t values = 0;
+
+  if (input == NULL) {
+    return 0;
+  }
+
+  const char *pChar = input;
+  const char *pEnd = input + strlen(input);
+  while (values < maxValues) {
+    const char *pStop = NULL;
+    if (decode(pChar, pEnd, NULL, &pValues[values], &pStop) == 0) {
+      break;
+    }
+    ++values;
+    if ((pStop >= pEnd) || (*pStop != P6K_LIST_SEPARATOR_)) {
+      break;
+    }
+    pChar = pStop + 1;
+    while ((pChar < pEnd) && (*pChar == ' ')) {
+      ++pChar;
+    }
+  }
+
+  return values;
+}
+
+/**
+ * Add bits to the end of the mask.
+ * @param first The first bit to set (this must be the current size)
+ * @param bits The bits to add, starting at bit 0
+ * @param count The number of bits to add (at most 64)
+ */
+void p6kBitMask::appendBits(size_t first, epicsUInt64 bits, size_t count)
+{
+  size_t size = first + count;
+  size_t word = first / P6K_WORD_BITS_;
+  size_t offset = first % P6K_WORD_BITS_;
+
+  words_.resize((size + P6K_WORD_BITS_ - 1) / P6K_WORD_BITS_, 0);
+  words_[word] |= (bits << offset);
+  if ((offset + count) > P6K_WORD_BITS_) {
+    words_[word+1] |= (bits >> (P6K_WORD_BITS_ - offset));
+  }
+  size_ = size;
+}
+
+/**
+ * Decode a bit string, 16 characters at a time. Each chunk is classified 
+ * into 1, 0 and separator masks, and then each run of bits between 
+ * separators is added in one go.
+ * @param pStart The first character
+ * @param pEnd One past the last character that may be read
+ * @param pMask If not NULL, the bits and groups are added to this mask.
+ * @param pBits Otherwise, the first 64 bits are packed into this.
+ * @param ppStop If not NULL, this is set to the first character that was not parsed.
+ * @return The number of bits found
+ */
+size_t p6kBitMask::decode(const char *pStart, const char *pEnd, p6kBitMask *pMask,
+			  epicsUInt64 *pBits, const char **ppStop)
+{
+  size_t bit = 0;
+  bool groupStarted = false;
+  const char *pChar = pStart;
+
+  if (pBits != NULL) {
+    *pBits = 0;
+  }
+
+  while (pChar < pEnd) {
+    size_t count = static_cast<size_t>(pEnd - pChar);
+    if (count > P6K_CHUNK_CHARS_) {
+      count = P6K_CHUNK_CHARS_;
+    }
+
+    unsigned int ones = 0;
+    unsigned int zeros = 0;
+    unsigned int seps = 0;
+    classifyChunk(pChar, count, &ones, &zeros, &seps);
+
+    //Stop at the first character that isn't a bit or separator
+    unsigned int all = (0x1u << count) - 1;
+    unsigned int valid = (ones | zeros | seps) & all;
+    size_t length = count;
+    if (valid != all) {
+      length = lowestBit(~valid);
+    }
+
+    size_t pos = 0;
+    while (pos < length) {
+      if ((seps >> pos) & 0x1) {
+	groupStarted = false;
+	++pos;
+	continue;
+      }
+      //The run of bits up to the next separator
+      size_t runEnd = length;
+      unsigned int nextSeps = seps >> pos;
+      if (nextSeps != 0) {
+	size_t next = pos + lowestBit(nextSeps);
+	if (next < runEnd) {
+	  runEnd = next;
+	}
+      }
+      if (!groupStarted) {
+	if (pMask != NULL) {
+	  pMask->groups_.push_back(bit);
+	}
+	groupStarted = true;
+      }
+      size_t runLength = runEnd - pos;
+      epicsUInt64 run = (ones >> pos) & ((0x1u << runLength) - 1);
+      if (pMask != NULL) {
+	pMask->appendBits(bit, run, runLength);
+      } else if (bit < P6K_WORD_BITS_) {
+	*pBits |= (run << bit);
+      }
+      bit += runLength;
+      pos = runEnd;
+    }
+
+    pChar += length;
+    if (length < count) {
+      break;
+    }
+  }
+
+  if (ppStop != NULL) {
+    *ppStop = pChar;
+  }
+
+  return bit;
+}
+
+/**
+ * @return The number of underscore separated groups found by the last parse.
+ */
+size_t p6kBitMask::groups(void) const
+{
+  return groups_.size();
+}
+
+/**
+ * Find the first bit of a group found by the last parse.
+ * @param group The group number (0 based)
+ * @return The bit number, or size() if there is no such group.
+ */
+size_t p6kBitMask::groupStart(size_t group) const
+{
+  if (group >= groups_.size()) {
+    return size_;
+  }
+  return groups_[group];
+}
+
+/**
+ * Write the bits as a string of 1 and 0 characters, as used
+ * by commands like GO and OUT. The string is null terminated.
+ * @param output Buffer to write to
+ * @param maxChars Size of the buffer
+ * @return The number of characters written (not including the null), or -1 if the buffer is too small.
+ */
+int p6kBitMask::format(char *output, size_t maxChars) const
+{
+  if ((output == NULL) || (maxChars < size_+1)) {
+    return -1;
+  }
+  for (size_t bit=0; bit<size_; ++bit) {
+    output[bit] = (test(bit) ? P6K_BIT_ON_ : P6K_BIT_OFF_);
+  }
+  output[size_] = '\0';
+  return static_cast<int>(size_);
+}
+
+/**
+ * Write the bits as a string of 1 and 0 characters, but only for
+ * bits set in changeMask. The other bits are written as X (no change).
+ * @param changeMask The bits to change
+ * @param output Buffer to write to
+ * @param maxChars Size of the buffer
+ * @return The number of characters written (not including the null), or -1 if the buffer is too small.
+ */
+int p6kBitMask::formatMasked(const p6kBitMask &changeMask, char *output, size_t maxChars) const
+{
+  if (format(output, maxChars) < 0) {
+    return -1;
+  }
+  for (size_t bit=0; bit<size_; ++bit) {
+    if (!changeMask.test(bit)) {
+      output[bit] = P6K_BIT_NOCHANGE_;
+    }
+  }
+  return static_cast<int>(size_);
+}
@@ -0,0 +1,73 @@
+/********************************************
+ *  parker6kBits.h
+ *
+ *  Dynamically sized bit mask, used for
+ *  axis masks (eg. GO) and the bit strings
+ *  returned by TLIM, TIN and TOUT.
+ *
+ ********************************************/
+
+#ifndef parker6kBits_H
+#define parker6kBits_H
+
+#include <stddef.h>
+#include <vector>
+
+#include <epicsTypes.h>
+
+/**
+ * p6kBitMask holds any number of bits. Bit 0 is the first character of a
+ * P6K bit string (eg. axis 1 in GO11, or the first bit of TOUT).
+ *
+ * The bit strings sent back by the controller are groups of 1 and 0
+ * characters separated by underscores (eg. 1110_0001_). The underscores are
+ * not stored, but the position of each group is recorded so that the
+ * per-axis groups of TLIM can be found however many axes there are.
+ *
+ * Bit strings are decoded 16 characters at a time, using SSE2 when it
+ * is available (and plain C otherwise). parseUInt64 and parseList decode
+ * straight into integers, for replies that fit in 64 bits (eg. TAS and TSS).
+ */
+class p6kBitMask {
+
+ public:
+  p6kBitMask(size_t size = 0);
+
+  void resize(size_t size);
+  size_t size(void) const;
+  void clear(void);
+  void setAll(bool value);
+  void set(size_t bit, bool value = true);
+  bool test(size_t bit) const;
+  bool any(void) const;
+  epicsUInt32 toUInt32(size_t first = 0) const;
+
+  size_t parse(const char *input);
+  static size_t parseUInt64(const char *input, epicsUInt64 *pBits, const char **ppEnd = NULL);
+  static size_t parseList(const char *input, epicsUInt64 *pValues, size_t maxValues);
+  size_t groups(void) const;
+  size_t groupStart(size_t group) const;
+
+  int format(char *output, size_t maxChars) const;
+  int formatMasked(const p6kBitMask &changeMask, char *output, size_t maxChars) const;
+
+  static const char P6K_BIT_ON_;
+  static const char P6K_BIT_OFF_;
+  static const char P6K_BIT_NOCHANGE_;
+  static const char P6K_BIT_SEPARATOR_;
+  static const char P6K_LIST_SEPARATOR_;
+
+ private:
+  void appendBits(size_t first, epicsUInt64 bits, size_t count);
+  static size_t decode(const char *pStart, const char *pEnd, p6kBitMask *pMask,
+		       epicsUInt64 *pBits, const char **ppStop);
+
+  std::vector<epicsUInt64> words_;
+  std::vector<size_t> groups_;
+  size_t size_;
+
+  static const size_t P6K_WORD_BITS_;
+  static const size_t P6K_CHUNK_CHARS_;
+};
+
+#endif /* parker6kBits_H */
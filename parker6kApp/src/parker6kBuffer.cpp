@@ -0,0 +1,153 @@
+/********************************************
+ *  parker6kBuffer.cpp
+ *
+ *  Fixed size character buffer, used to
+ *  build commands and hold responses
+ *  without clearing it on every use.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include "parker6kBuffer.h"
+
+/**
+ * Constructor. Only the first character is cleared.
+ */
+p6kBuffer::p6kBuffer(void)
+  : length_(0),
+    overflow_(false)
+{
+  buffer_[0] = '\0';
+}
+
+/**
+ * Empty the buffer.
+ */
+void p6kBuffer::clear(void)
+{
+  length_ = 0;
+  overflow_ = false;
+  buffer_[0] = '\0';
+}
+
+/**
+ * Replace the contents of the buffer with a formatted string.
+ * @param fmt printf style format string
+ * @return The new length, or -1 if the string did not fit.
+ */
+int p6kBuffer::format(const char *fmt, ...)
+{
+  va_list args;
+  int status = 0;
+
+  clear();
+  va_start(args, fmt);
+  status = vappend(fmt, args);
+  va_end(args);
+
+  return status;
+}
+
+/**
+ * Add a formatted string to the end of the buffer.
+ * @param fmt printf style format string
+ * @return The new length, or -1 if the string did not fit.
+ */
+int p6kBuffer::append(const char *fmt, ...)
+{
+  va_list args;
+  int status = 0;
+
+  va_start(args, fmt);
+  status = vappend(fmt, args);
+  va_end(args);
+
+  return status;
+}
+
+/**
+ * Replace the contents of the buffer with the first length characters of input.
+ * @param input The characters to copy
+ * @param length The number of characters to copy
+ * @return The new length, or -1 if the input did not fit.
+ */
+int p6kBuffer::assign(const char *input, size_t length)
+{
+  clear();
+  if (input == NULL) {
+    return 0;
+  }
+  if (length > (P6K_BUFFER_SIZE - 1)) {
+    length = P6K_BUFFER_SIZE - 1;
+    overflow_ = true;
+  }
+  memcpy(buffer_, input, length);
+  setLength(length);
+
+  return overflow_ ? -1 : static_cast<int>(length_);
+}
+
+/**
+ * Direct access to the storage, for functions that fill in the buffer
+ * themselves (eg. pasynOctetSyncIO->writeRead). Call setLength afterwards.
+ * There is room for capacity() characters, including the terminator.
+ */
+char *p6kBuffer::data(void)
+{
+  return buffer_;
+}
+
+/**
+ * Set the length after writing directly into data(), and terminate the string.
+ * @param length The number of characters that were written.
+ */
+void p6kBuffer::setLength(size_t length)
+{
+  if (length > (P6K_BUFFER_SIZE - 1)) {
+    length = P6K_BUFFER_SIZE - 1;
+    overflow_ = true;
+  }
+  length_ = length;
+  buffer_[length_] = '\0';
+}
+
+const char *p6kBuffer::c_str(void) const
+{
+  return buffer_;
+}
+
+size_t p6kBuffer::length(void) const
+{
+  return length_;
+}
+
+size_t p6kBuffer::capacity(void) const
+{
+  return P6K_BUFFER_SIZE;
+}
+
+bool p6kBuffer::overflow(void) const
+{
+  return overflow_;
+}
+
+/**
+ * Format into the unused part of the buffer.
+ */
+int p6kBuffer::vappend(const char *fmt, va_list args)
+{
+  size_t space = P6K_BUFFER_SIZE - length_;
+  int n = epicsVsnprintf(buffer_ + length_, space, fmt, args);
+
+  if ((n < 0) || (static_cast<size_t>(n) >= space)) {
+    //Truncated. Keep what fitted.
+    overflow_ = true;
+    buffer_[P6K_BUFFER_SIZE - 1] = '\0';
+    length_ += strlen(buffer_ + length_);
+    return -1;
+  }
+  length_ += n;
+
+  return static_cast<int>(length_);
+}
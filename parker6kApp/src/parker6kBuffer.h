@@ -0,0 +1,55 @@
+/********************************************
+ *  parker6kBuffer.h
+ *
+ *  Fixed size character buffer, used to
+ *  build commands and hold responses
+ *  without clearing it on every use.
+ *
+ ********************************************/
+
+#ifndef parker6kBuffer_H
+#define parker6kBuffer_H
+
+#include <stddef.h>
+#include <stdarg.h>
+
+#include <epicsStdio.h>
+
+#define P6K_BUFFER_SIZE 1024
+
+/**
+ * p6kBuffer is a fixed size, null terminated character buffer that
+ * keeps track of its own length. Only the characters that are written
+ * are touched, so it can be reused for every command and response
+ * without zeroing the whole buffer each time.
+ *
+ * If a format or append does not fit, the contents are truncated
+ * and the overflow flag is set (it is cleared by clear() and format()).
+ */
+class p6kBuffer {
+
+ public:
+  p6kBuffer(void);
+
+  void clear(void);
+  int format(const char *fmt, ...) EPICS_PRINTF_STYLE(2,3);
+  int append(const char *fmt, ...) EPICS_PRINTF_STYLE(2,3);
+  int assign(const char *input, size_t length);
+
+  char *data(void);
+  void setLength(size_t length);
+
+  const char *c_str(void) const;
+  size_t length(void) const;
+  size_t capacity(void) const;
+  bool overflow(void) const;
+
+ private:
+  int vappend(const char *fmt, va_list args);
+
+  char buffer_[P6K_BUFFER_SIZE];
+  size_t length_;
+  bool overflow_;
+};
+
+#endif /* parker6kBuffer_H */
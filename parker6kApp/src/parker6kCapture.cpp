@@ -0,0 +1,264 @@
+/********************************************
+ *  parker6kCapture.cpp
+ *
+ *  Record the commands and raw replies
+ *  exchanged with a controller (with timing)
+ *  into a binary capture file, and read them
+ *  back for p6kReplayPort.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parker6kCapture.h"
+#include "parker6kClock.h"
+
+p6kCaptureWriter::p6kCaptureWriter()
+  : fptr_(NULL),
+    open_(false),
+    records_(0)
+{
+  lastTime_.secPastEpoch = 0;
+  lastTime_.nsec = 0;
+}
+
+p6kCaptureWriter::~p6kCaptureWriter()
+{
+  close();
+}
+
+/**
+ * Start a new capture file. Any capture already in progress is closed first.
+ * @param fileName The file to write (it is overwritten if it exists).
+ * @return asynStatus
+ */
+asynStatus p6kCaptureWriter::open(const char *fileName)
+{
+  close();
+
+  mutex_.lock();
+  fptr_ = fopen(fileName, "wb");
+  if (fptr_ == NULL) {
+    mutex_.unlock();
+    return asynError;
+  }
+
+  p6kClock::getClock()->getCurrent(&lastTime_);
+  records_ = 0;
+
+  fwrite(P6K_CAPTURE_MAGIC, 1, P6K_CAPTURE_MAGIC_SIZE, fptr_);
+  putUInt(P6K_CAPTURE_VERSION, 1);
+  putUInt(0, 1);
+  putUInt(lastTime_.secPastEpoch, 4);
+  putUInt(lastTime_.nsec, 4);
+
+  open_ = true;
+  mutex_.unlock();
+
+  return asynSuccess;
+}
+
+/**
+ * Stop capturing and close the file.
+ */
+void p6kCaptureWriter::close(void)
+{
+  mutex_.lock();
+  open_ = false;
+  if (fptr_ != NULL) {
+    fclose(fptr_);
+    fptr_ = NULL;
+  }
+  mutex_.unlock();
+}
+
+/**
+ * This is a cheap check that doesn't take the mutex, so that
+ * p6kController::lowLevelWriteRead only reads the clock when capturing.
+ * @return true if a capture is in progress.
+ */
+bool p6kCaptureWriter::isOpen(void) const
+{
+  return open_;
+}
+
+/**
+ * @return The number of records written to the current (or last) capture.
+ */
+epicsUInt32 p6kCaptureWriter::records(void) const
+{
+  return records_;
+}
+
+/**
+ * Add a record to the capture file. This is thread safe, so the command and
+ * status ports can both write to the same file.
+ * @param channel Which port the command was sent on.
+ * @param status The status returned by the write/read.
+ * @param pStart The time the command was written.
+ * @param pEnd The time the reply was read.
+ * @param command The command (without the output terminator).
+ * @param commandLength The number of characters in command.
+ * @param reply The reply, as read from the port.
+ * @param replyLength The number of characters in reply.
+ * @return asynStatus
+ */
+asynStatus p6kCaptureWriter::write(p6kCaptureChannel channel, asynStatus status,
+				   const epicsTimeStamp *pStart, const epicsTimeStamp *pEnd,
+				   const char *command, size_t commandLength,
+				   const char *reply, size_t replyLength)
+{
+  mutex_.lock();
+  if (fptr_ == NULL) {
+    mutex_.unlock();
+    return asynError;
+  }
+
+  //Lengths are 16 bits. Commands and replies are limited to P6K_MAXBUF, so this doesn't truncate in practice.
+  if (commandLength > 0xFFFF) {
+    commandLength = 0xFFFF;
+  }
+  if (replyLength > 0xFFFF) {
+    replyLength = 0xFFFF;
+  }
+
+  double delta = epicsTimeDiffInSeconds(pStart, &lastTime_);
+  if (delta < 0.0) {
+    //The other port started its command earlier but finished later.
+    delta = 0.0;
+  } else {
+    lastTime_ = *pStart;
+  }
+
+  putUInt(channel, 1);
+  putUInt(status, 1);
+  putUInt(toMicroseconds(delta), 4);
+  putUInt(toMicroseconds(epicsTimeDiffInSeconds(pEnd, pStart)), 4);
+  putUInt(commandLength, 2);
+  putUInt(replyLength, 2);
+  fwrite(command, 1, commandLength, fptr_);
+  fwrite(reply, 1, replyLength, fptr_);
+  ++records_;
+
+  mutex_.unlock();
+
+  return asynSuccess;
+}
+
+/**
+ * Write a little endian number. Must be called with the mutex held.
+ */
+void p6kCaptureWriter::putUInt(epicsUInt32 value, size_t bytes)
+{
+  for (size_t i=0; i<bytes; ++i) {
+    fputc(static_cast<int>((value >> (8*i)) & 0xFF), fptr_);
+  }
+}
+
+/**
+ * Convert a time to microseconds, clamped to fit in 32 bits (about 71 minutes).
+ */
+epicsUInt32 p6kCaptureWriter::toMicroseconds(double seconds)
+{
+  double us = seconds * 1.0e6 + 0.5;
+  if (us <= 0.0) {
+    return 0;
+  }
+  if (us >= 4294967295.0) {
+    return 0xFFFFFFFF;
+  }
+  return static_cast<epicsUInt32>(us);
+}
+
+/**
+ * Read all the records in a capture file.
+ * @param fileName The file to read.
+ * @param pRecords The records are appended to this.
+ * @return asynError if the file can't be opened, isn't a capture file, or is truncated.
+ * The records before a truncated one are still returned.
+ */
+asynStatus p6kCaptureReader::read(const char *fileName, std::vector<p6kCaptureRecord> *pRecords)
+{
+  char magic[P6K_CAPTURE_MAGIC_SIZE] = {0};
+  epicsUInt32 version = 0;
+  epicsUInt32 spare = 0;
+  epicsUInt32 sec = 0;
+  epicsUInt32 nsec = 0;
+  double time = 0.0;
+
+  FILE *fptr = fopen(fileName, "rb");
+  if (fptr == NULL) {
+    return asynError;
+  }
+
+  if ((fread(magic, 1, P6K_CAPTURE_MAGIC_SIZE, fptr) != P6K_CAPTURE_MAGIC_SIZE) ||
+      (memcmp(magic, P6K_CAPTURE_MAGIC, P6K_CAPTURE_MAGIC_SIZE) != 0) ||
+      !getUInt(fptr, 1, &version) || (version != P6K_CAPTURE_VERSION) ||
+      !getUInt(fptr, 1, &spare) || !getUInt(fptr, 4, &sec) || !getUInt(fptr, 4, &nsec)) {
+    fclose(fptr);
+    return asynError;
+  }
+
+  for (;;) {
+    epicsUInt32 channel = 0;
+    epicsUInt32 status = 0;
+    epicsUInt32 delta = 0;
+    epicsUInt32 duration = 0;
+    epicsUInt32 commandLength = 0;
+    epicsUInt32 replyLength = 0;
+    p6kCaptureRecord record;
+
+    if (!getUInt(fptr, 1, &channel)) {
+      //Clean end of file
+      break;
+    }
+    if (!getUInt(fptr, 1, &status) || !getUInt(fptr, 4, &delta) || !getUInt(fptr, 4, &duration) ||
+	!getUInt(fptr, 2, &commandLength) || !getUInt(fptr, 2, &replyLength) ||
+	!getString(fptr, commandLength, &record.command) || !getString(fptr, replyLength, &record.reply)) {
+      fclose(fptr);
+      return asynError;
+    }
+
+    time += delta / 1.0e6;
+    record.channel = static_cast<epicsUInt8>(channel);
+    record.status = static_cast<epicsUInt8>(status);
+    record.time = time;
+    record.duration = duration / 1.0e6;
+    pRecords->push_back(record);
+  }
+
+  fclose(fptr);
+  return asynSuccess;
+}
+
+/**
+ * Read a little endian number.
+ * @return false at the end of the file.
+ */
+bool p6kCaptureReader::getUInt(FILE *fptr, size_t bytes, epicsUInt32 *pValue)
+{
+  *pValue = 0;
+  for (size_t i=0; i<bytes; ++i) {
+    int c = fgetc(fptr);
+    if (c == EOF) {
+      return false;
+    }
+    *pValue |= static_cast<epicsUInt32>(c & 0xFF) << (8*i);
+  }
+  return true;
+}
+
+/**
+ * Read a fixed number of characters.
+ * @return false at the end of the file.
+ */
+bool p6kCaptureReader::getString(FILE *fptr, size_t length, std::string *pValue)
+{
+  pValue->resize(length);
+  if (length == 0) {
+    return true;
+  }
+  return (fread(&(*pValue)[0], 1, length, fptr) == length);
+}
@@ -0,0 +1,100 @@
+/********************************************
+ *  parker6kCapture.h
+ *
+ *  Record the commands and raw replies
+ *  exchanged with a controller (with timing)
+ *  into a binary capture file, and read them
+ *  back for p6kReplayPort.
+ *
+ ********************************************/
+
+#ifndef parker6kCapture_H
+#define parker6kCapture_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+
+#include "asynDriver.h"
+
+/** Which session on the controller a record was exchanged on */
+typedef enum {
+  P6K_CAPTURE_COMMAND = 0,   /**< The main port (motion, config and immediate commands) */
+  P6K_CAPTURE_STATUS = 1     /**< The optional status port used by the poller */
+} p6kCaptureChannel;
+
+/**
+ * One command and the reply to it, as read back from a capture file.
+ */
+typedef struct p6kCaptureRecord {
+  epicsUInt8 channel;        /**< p6kCaptureChannel */
+  epicsUInt8 status;         /**< The asynStatus returned by the write/read */
+  double time;               /**< Seconds since the start of the capture */
+  double duration;           /**< Seconds the write/read took */
+  std::string command;       /**< The command, without the output terminator */
+  std::string reply;         /**< The reply, exactly as read from the port (before trimming) */
+} p6kCaptureRecord;
+
+/**
+ * Write a capture file.
+ *
+ * The file starts with an 8 byte header ("P6KCAP", the format version and
+ * a spare byte) followed by the capture start time (two 32 bit words,
+ * seconds and nanoseconds past the EPICS epoch). Each record is then:
+ *
+ *  channel (8 bits), status (8 bits), time since the previous record (32 bits, us),
+ *  duration (32 bits, us), command length (16 bits), reply length (16 bits),
+ *  command, reply.
+ *
+ * All the numbers are little endian. Records from the command and status ports
+ * are written in the order that the replies arrived.
+ */
+class p6kCaptureWriter {
+
+ public:
+  p6kCaptureWriter();
+  virtual ~p6kCaptureWriter();
+
+  asynStatus open(const char *fileName);
+  void close(void);
+  bool isOpen(void) const;
+  asynStatus write(p6kCaptureChannel channel, asynStatus status,
+		   const epicsTimeStamp *pStart, const epicsTimeStamp *pEnd,
+		   const char *command, size_t commandLength,
+		   const char *reply, size_t replyLength);
+  epicsUInt32 records(void) const;
+
+ private:
+  void putUInt(epicsUInt32 value, size_t bytes);
+  static epicsUInt32 toMicroseconds(double seconds);
+
+  epicsMutex mutex_;
+  FILE *fptr_;
+  bool open_;
+  epicsTimeStamp lastTime_;
+  epicsUInt32 records_;
+};
+
+/**
+ * Read a capture file.
+ */
+class p6kCaptureReader {
+
+ public:
+  static asynStatus read(const char *fileName, std::vector<p6kCaptureRecord> *pRecords);
+
+ private:
+  static bool getUInt(FILE *fptr, size_t bytes, epicsUInt32 *pValue);
+  static bool getString(FILE *fptr, size_t length, std::string *pValue);
+};
+
+#define P6K_CAPTURE_MAGIC "P6KCAP"
+#define P6K_CAPTURE_MAGIC_SIZE 6
+#define P6K_CAPTURE_VERSION 1
+
+#endif /* parker6kCapture_H */
@@ -0,0 +1,175 @@
+/********************************************
+ *  parker6kClock.cpp
+ *
+ *  The clock used by the driver for all its
+ *  timing (done move delay, error throttling,
+ *  drive enable delay, poll deadlines). This
+ *  can be replaced by a simulated clock in
+ *  tests and benchmarks.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+
+#include <epicsThread.h>
+
+#include "parker6kClock.h"
+
+p6kClock p6kClock::systemClock_;
+p6kClock *p6kClock::pClock_ = &p6kClock::systemClock_;
+
+//Start the simulated clock at a fixed time, so that runs are repeatable.
+const epicsUInt32 p6kSimulatedClock::P6K_SIMULATED_CLOCK_START_ = 1000000000;
+
+p6kClock::p6kClock()
+{
+}
+
+p6kClock::~p6kClock()
+{
+}
+
+/**
+ * Read the current time.
+ * @param pTime Set to the current time
+ */
+void p6kClock::getCurrent(epicsTimeStamp *pTime)
+{
+  epicsTimeGetCurrent(pTime);
+}
+
+/**
+ * Sleep the calling thread.
+ * @param seconds The time to sleep (in seconds)
+ */
+void p6kClock::sleep(double seconds)
+{
+  epicsThreadSleep(seconds);
+}
+
+/**
+ * Wait for an event, or until a timeout.
+ * @param event The event to wait for
+ * @param timeout The longest time to wait (in seconds)
+ * @return true if the event was signalled, false if we timed out
+ */
+bool p6kClock::waitEvent(epicsEventId event, double timeout)
+{
+  return (epicsEventWaitWithTimeout(event, timeout) == epicsEventWaitOK);
+}
+
+/**
+ * @return The current time, in seconds past the EPICS epoch.
+ */
+double p6kClock::now(void)
+{
+  epicsTimeStamp time;
+  getCurrent(&time);
+  return time.secPastEpoch + (time.nsec / 1.0e9);
+}
+
+/**
+ * Return the clock that the driver should use.
+ */
+p6kClock* p6kClock::getClock(void)
+{
+  return pClock_;
+}
+
+/**
+ * Replace the clock. This should be done before creating any controllers,
+ * and the clock must not be deleted while they exist.
+ * @param pClock The new clock, or NULL to go back to the system clock.
+ */
+void p6kClock::setClock(p6kClock *pClock)
+{
+  pClock_ = (pClock != NULL) ? pClock : &systemClock_;
+}
+
+
+/**
+ * Constructor. The time starts at P6K_SIMULATED_CLOCK_START_ seconds past the EPICS epoch.
+ */
+p6kSimulatedClock::p6kSimulatedClock()
+  : slept_(0.0)
+{
+  time_.secPastEpoch = P6K_SIMULATED_CLOCK_START_;
+  time_.nsec = 0;
+}
+
+p6kSimulatedClock::~p6kSimulatedClock()
+{
+}
+
+/**
+ * Read the simulated time.
+ */
+void p6kSimulatedClock::getCurrent(epicsTimeStamp *pTime)
+{
+  mutex_.lock();
+  *pTime = time_;
+  mutex_.unlock();
+}
+
+/**
+ * Move the simulated time on, without sleeping.
+ */
+void p6kSimulatedClock::sleep(double seconds)
+{
+  if (seconds <= 0.0) {
+    return;
+  }
+  mutex_.lock();
+  epicsTimeAddSeconds(&time_, seconds);
+  slept_ += seconds;
+  mutex_.unlock();
+}
+
+/**
+ * Check the event without blocking. If it has not been signalled then
+ * the simulated time moves on by the timeout.
+ */
+bool p6kSimulatedClock::waitEvent(epicsEventId event, double timeout)
+{
+  if (epicsEventTryWait(event) == epicsEventWaitOK) {
+    return true;
+  }
+  sleep(timeout);
+  return false;
+}
+
+/**
+ * Move the simulated time on (eg. for time spent outside the driver).
+ * This is not counted by slept().
+ * @param seconds The time to add
+ */
+void p6kSimulatedClock::advance(double seconds)
+{
+  if (seconds <= 0.0) {
+    return;
+  }
+  mutex_.lock();
+  epicsTimeAddSeconds(&time_, seconds);
+  mutex_.unlock();
+}
+
+/**
+ * Set the simulated time.
+ */
+void p6kSimulatedClock::set(const epicsTimeStamp *pTime)
+{
+  mutex_.lock();
+  time_ = *pTime;
+  mutex_.unlock();
+}
+
+/**
+ * @return The total time that callers have slept on this clock.
+ */
+double p6kSimulatedClock::slept(void)
+{
+  mutex_.lock();
+  double slept = slept_;
+  mutex_.unlock();
+  return slept;
+}
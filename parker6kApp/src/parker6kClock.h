@@ -0,0 +1,74 @@
+/********************************************
+ *  parker6kClock.h
+ *
+ *  The clock used by the driver for all its
+ *  timing (done move delay, error throttling,
+ *  drive enable delay, poll deadlines). This
+ *  can be replaced by a simulated clock in
+ *  tests and benchmarks.
+ *
+ ********************************************/
+
+#ifndef parker6kClock_H
+#define parker6kClock_H
+
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+
+/**
+ * The driver reads the time and sleeps through p6kClock::getClock(),
+ * rather than calling epicsTimeGetCurrent and epicsThreadSleep directly.
+ * The default clock is the system clock.
+ *
+ * A test or benchmark can install a p6kSimulatedClock with setClock before
+ * creating any controllers. The driver then sees simulated time, and sleeping
+ * just moves the simulated time on, so a run covering hours of moves against
+ * a fake controller takes seconds and gives the same result every time.
+ */
+class p6kClock {
+
+ public:
+  p6kClock();
+  virtual ~p6kClock();
+
+  virtual void getCurrent(epicsTimeStamp *pTime);
+  virtual void sleep(double seconds);
+  virtual bool waitEvent(epicsEventId event, double timeout);
+  double now(void);
+
+  static p6kClock* getClock(void);
+  static void setClock(p6kClock *pClock);
+
+ private:
+  static p6kClock systemClock_;
+  static p6kClock *pClock_;
+};
+
+/**
+ * A clock that only moves when it is told to (by sleep, waitEvent or advance).
+ * All the threads using it share the same time, so it is best suited to
+ * tests that drive the controller from a single thread (eg. using pollSweep).
+ */
+class p6kSimulatedClock : public p6kClock {
+
+ public:
+  p6kSimulatedClock();
+  virtual ~p6kSimulatedClock();
+
+  virtual void getCurrent(epicsTimeStamp *pTime);
+  virtual void sleep(double seconds);
+  virtual bool waitEvent(epicsEventId event, double timeout);
+  void advance(double seconds);
+  void set(const epicsTimeStamp *pTime);
+  double slept(void);
+
+  static const epicsUInt32 P6K_SIMULATED_CLOCK_START_;
+
+ private:
+  epicsMutex mutex_;
+  epicsTimeStamp time_;
+  double slept_;
+};
+
+#endif /* parker6kClock_H */
@@ -0,0 +1,452 @@
+/********************************************
+ *  parker6kCommand.cpp
+ *
+ *  Table of the P6K commands used by the
+ *  driver, and functions to build commands
+ *  and parse the responses using the table.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "parker6kBits.h"
+#include "parker6kCommand.h"
+
+const char p6kCommand::P6K_IMMEDIATE_ = '!';
+
+/**
+ * The command table. This must be in the same order as p6kCommandId.
+ * The argument type is what the driver sends. The reply type is what
+ * comes back when the command is sent without an argument, as a query.
+ */
+const p6kCommandInfo p6kCommand::commands_[] = {
+  /* id                 mnemonic         axis prefix        argument        reply             immediate */
+  {P6K_CMDID_A,      P6K_CMD_A,      P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_AA,     P6K_CMD_AA,     P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_AD,     P6K_CMD_AD,     P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_ADA,    P6K_CMD_ADA,    P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_AXSDEF, P6K_CMD_AXSDEF, P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_CMDDIR, P6K_CMD_CMDDIR, P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_COMEXC, P6K_CMD_COMEXC, P6K_AXIS_NONE,     P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_D,      P6K_CMD_D,      P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_DRES,   P6K_CMD_DRES,   P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_DRFEN,  P6K_CMD_DRFEN,  P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_DRIVE,  P6K_CMD_DRIVE,  P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_ECHO,   P6K_CMD_ECHO,   P6K_AXIS_NONE,     P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_ENCCNT, P6K_CMD_ENCCNT, P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_ENCPOL, P6K_CMD_ENCPOL, P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_ERES,   P6K_CMD_ERES,   P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_ESK,    P6K_CMD_ESK,    P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_ESTALL, P6K_CMD_ESTALL, P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_GO,     P6K_CMD_GO,     P6K_AXIS_OPTIONAL, P6K_ARG_BITS,   P6K_REPLY_NONE,   false},
+  {P6K_CMDID_HOM,    P6K_CMD_HOM,    P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_NONE,   false},
+  {P6K_CMDID_HOMA,   P6K_CMD_HOMA,   P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_HOMAA,  P6K_CMD_HOMAA,  P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_HOMAD,  P6K_CMD_HOMAD,  P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_HOMADA, P6K_CMD_HOMADA, P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_HOMV,   P6K_CMD_HOMV,   P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_K,      P6K_CMD_K,      P6K_AXIS_OPTIONAL, P6K_ARG_NONE,   P6K_REPLY_NONE,   true},
+  {P6K_CMDID_LH,     P6K_CMD_LH,     P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_LS,     P6K_CMD_LS,     P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_LSNEG,  P6K_CMD_LSNEG,  P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_LSPOS,  P6K_CMD_LSPOS,  P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_DOUBLE, false},
+  {P6K_CMDID_MA,     P6K_CMD_MA,     P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_INT,    false},
+  {P6K_CMDID_OUT,    P6K_CMD_OUT,    P6K_AXIS_NONE,     P6K_ARG_BITS,   P6K_REPLY_NONE,   false},
+  {P6K_CMDID_PESET,  P6K_CMD_PESET,  P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_NONE,   false},
+  {P6K_CMDID_PSET,   P6K_CMD_PSET,   P6K_AXIS_REQUIRED, P6K_ARG_INT,    P6K_REPLY_NONE,   false},
+  {P6K_CMDID_S,      P6K_CMD_S,      P6K_AXIS_OPTIONAL, P6K_ARG_NONE,   P6K_REPLY_NONE,   true},
+  {P6K_CMDID_TAS,    P6K_CMD_TAS,    P6K_AXIS_REQUIRED, P6K_ARG_NONE,   P6K_REPLY_BITS,   false},
+  {P6K_CMDID_TIN,    P6K_CMD_TIN,    P6K_AXIS_NONE,     P6K_ARG_NONE,   P6K_REPLY_BITS,   false},
+  {P6K_CMDID_TLIM,   P6K_CMD_TLIM,   P6K_AXIS_NONE,     P6K_ARG_NONE,   P6K_REPLY_BITS,   false},
+  {P6K_CMDID_TOUT,   P6K_CMD_TOUT,   P6K_AXIS_NONE,     P6K_ARG_NONE,   P6K_REPLY_BITS,   false},
+  {P6K_CMDID_TPC,    P6K_CMD_TPC,    P6K_AXIS_REQUIRED, P6K_ARG_NONE,   P6K_REPLY_INT,    false},
+  {P6K_CMDID_TPE,    P6K_CMD_TPE,    P6K_AXIS_REQUIRED, P6K_ARG_NONE,   P6K_REPLY_INT,    false},
+  {P6K_CMDID_TREV,   P6K_CMD_TREV,   P6K_AXIS_NONE,     P6K_ARG_NONE,   P6K_REPLY_STRING, false},
+  {P6K_CMDID_TSS,    P6K_CMD_TSS,    P6K_AXIS_NONE,     P6K_ARG_NONE,   P6K_REPLY_BITS,   false},
+  {P6K_CMDID_V,      P6K_CMD_V,      P6K_AXIS_REQUIRED, P6K_ARG_DOUBLE, P6K_REPLY_DOUBLE, false}
+};
+
+/**
+ * Look up a command in the table.
+ * @param id The command
+ * @return Pointer to the table entry, or NULL if id is not valid.
+ */
+const p6kCommandInfo *p6kCommand::info(p6kCommandId id)
+{
+  if ((id < 0) || (id >= P6K_NUM_COMMANDS)) {
+    return NULL;
+  }
+  return &commands_[id];
+}
+
+/**
+ * Build a command with no argument. This is used for queries (eg. 1TPC),
+ * for commands that don't take an argument (eg. !1S) and for the short
+ * form of commands that do (eg. 1GO).
+ * @param pCommand The buffer to build the command in
+ * @param id The command
+ * @param axis The axis number, or 0 for a controller wide command.
+ * @return The length of the command, or -1 if the command can't be built.
+ */
+int p6kCommand::encode(p6kBuffer *pCommand, p6kCommandId id, int axis)
+{
+  return encodeHeader(pCommand, info(id), axis);
+}
+
+/**
+ * Build a command with an integer argument (eg. 1MA1).
+ * @param pCommand The buffer to build the command in
+ * @param id The command
+ * @param axis The axis number, or 0 for a controller wide command.
+ * @param value The argument
+ * @return The length of the command, or -1 if the command can't be built.
+ */
+int p6kCommand::encode(p6kBuffer *pCommand, p6kCommandId id, int axis, epicsInt32 value)
+{
+  const p6kCommandInfo *pInfo = info(id);
+
+  if ((pInfo == NULL) || (pInfo->argType != P6K_ARG_INT)) {
+    pCommand->clear();
+    return -1;
+  }
+  if (encodeHeader(pCommand, pInfo, axis) < 0) {
+    return -1;
+  }
+  return pCommand->append("%d", value);
+}
+
+/**
+ * Build a command with a floating point argument (eg. 1V1.5).
+ * @param pCommand The buffer to build the command in
+ * @param id The command
+ * @param axis The axis number, or 0 for a controller wide command.
+ * @param value The argument
+ * @param precision The number of digits after the decimal point
+ * @return The length of the command, or -1 if the command can't be built.
+ */
+int p6kCommand::encode(p6kBuffer *pCommand, p6kCommandId id, int axis, double value, int precision)
+{
+  const p6kCommandInfo *pInfo = info(id);
+
+  if ((pInfo == NULL) || (pInfo->argType != P6K_ARG_DOUBLE)) {
+    pCommand->clear();
+    return -1;
+  }
+  if (encodeHeader(pCommand, pInfo, axis) < 0) {
+    return -1;
+  }
+  return pCommand->append("%.*f", precision, value);
+}
+
+/**
+ * Build a command with a bit string argument (eg. GO1100).
+ * @param pCommand The buffer to build the command in
+ * @param id The command
+ * @param axis The axis number, or 0 for a controller wide command.
+ * @param bits The bit string
+ * @return The length of the command, or -1 if the command can't be built.
+ */
+int p6kCommand::encode(p6kBuffer *pCommand, p6kCommandId id, int axis, const char *bits)
+{
+  const p6kCommandInfo *pInfo = info(id);
+
+  if ((pInfo == NULL) || (pInfo->argType != P6K_ARG_BITS) || (bits == NULL)) {
+    pCommand->clear();
+    return -1;
+  }
+  if (encodeHeader(pCommand, pInfo, axis) < 0) {
+    return -1;
+  }
+  return pCommand->append("%s", bits);
+}
+
+/**
+ * Read an integer from the response to a query (eg. 1TPC+1000).
+ * @param response The trimmed response
+ * @param id The command that was sent
+ * @param axis The axis number the command was sent to, or 0.
+ * @param pValue The value read
+ * @return true if the value was read.
+ */
+bool p6kCommand::decode(const char *response, p6kCommandId id, int axis, epicsInt32 *pValue)
+{
+  const p6kCommandInfo *pInfo = info(id);
+  const char *pStart = NULL;
+  char *pEnd = NULL;
+
+  if ((pInfo == NULL) || (pInfo->replyType != P6K_REPLY_INT)) {
+    return false;
+  }
+  if ((pStart = decodeHeader(response, pInfo, axis)) == NULL) {
+    return false;
+  }
+  long value = strtol(pStart, &pEnd, 10);
+  if (pEnd == pStart) {
+    return false;
+  }
+  *pValue = static_cast<epicsInt32>(value);
+
+  return true;
+}
+
+/**
+ * Read a floating point value from the response to a query (eg. 1LSPOS+1000.0).
+ * Integer replies can be read this way too.
+ * @param response The trimmed response
+ * @param id The command that was sent
+ * @param axis The axis number the command was sent to, or 0.
+ * @param pValue The value read
+ * @return true if the value was read.
+ */
+bool p6kCommand::decode(const char *response, p6kCommandId id, int axis, double *pValue)
+{
+  const p6kCommandInfo *pInfo = info(id);
+  const char *pStart = NULL;
+  char *pEnd = NULL;
+
+  if ((pInfo == NULL) ||
+      ((pInfo->replyType != P6K_REPLY_DOUBLE) && (pInfo->replyType != P6K_REPLY_INT))) {
+    return false;
+  }
+  if ((pStart = decodeHeader(response, pInfo, axis)) == NULL) {
+    return false;
+  }
+  double value = strtod(pStart, &pEnd);
+  if (pEnd == pStart) {
+    return false;
+  }
+  *pValue = value;
+
+  return true;
+}
+
+/**
+ * Read a bit string (eg. 1TAS0000_0001) or free text (eg. TREV) from a response.
+ * Bit strings stop at the first space. Text is copied to the end of the response.
+ * @param response The trimmed response
+ * @param id The command that was sent
+ * @param axis The axis number the command was sent to, or 0.
+ * @param pValue The buffer for the string
+ * @param maxChars The size of pValue, including the terminator
+ * @return true if the string was read. It may have been truncated.
+ */
+bool p6kCommand::decode(const char *response, p6kCommandId id, int axis, char *pValue, size_t maxChars)
+{
+  const p6kCommandInfo *pInfo = info(id);
+  const char *pStart = NULL;
+  size_t length = 0;
+
+  if ((pInfo == NULL) || (pValue == NULL) || (maxChars == 0) ||
+      ((pInfo->replyType != P6K_REPLY_BITS) && (pInfo->replyType != P6K_REPLY_STRING))) {
+    return false;
+  }
+  if ((pStart = decodeHeader(response, pInfo, axis)) == NULL) {
+    return false;
+  }
+  if (pInfo->replyType == P6K_REPLY_BITS) {
+    while ((pStart[length] != '\0') && !isspace(static_cast<unsigned char>(pStart[length]))) {
+      length++;
+    }
+    if (length == 0) {
+      return false;
+    }
+  } else {
+    length = strlen(pStart);
+  }
+  if (length > (maxChars - 1)) {
+    length = maxChars - 1;
+  }
+  memcpy(pValue, pStart, length);
+  pValue[length] = '\0';
+
+  return true;
+}
+
+/**
+ * Read a bit string (eg. 1TAS0000_0001) from a response, packed into an integer.
+ * Bit 0 is the first bit of the string. Only the first 64 bits are kept.
+ * @param response The trimmed response
+ * @param id The command that was sent
+ * @param axis The axis number the command was sent to, or 0.
+ * @param pBits The bits
+ * @param pCount If not NULL, this is set to the number of bits in the string.
+ * @return true if the bits were read.
+ */
+bool p6kCommand::decode(const char *response, p6kCommandId id, int axis, epicsUInt64 *pBits, size_t *pCount)
+{
+  const p6kCommandInfo *pInfo = info(id);
+  const char *pStart = NULL;
+
+  if ((pInfo == NULL) || (pInfo->replyType != P6K_REPLY_BITS)) {
+    return false;
+  }
+  if ((pStart = decodeHeader(response, pInfo, axis)) == NULL) {
+    return false;
+  }
+  //Don't touch the caller's bits unless the reply is good
+  epicsUInt64 bits = 0;
+  size_t count = p6kBitMask::parseUInt64(pStart, &bits);
+  if (count == 0) {
+    return false;
+  }
+  *pBits = bits;
+  if (pCount != NULL) {
+    *pCount = count;
+  }
+
+  return true;
+}
+
+/**
+ * The P6K will send back an error string with a ? prompt after it.
+ * We search for this before dealing with a successful command. An error
+ * response would have caused an Asyn timeout, because there was no standard
+ * IEOS character and by default we search for the character that terminates a
+ * successful command.
+ * @param input The raw reply. This will be modified if it is an error.
+ * @param output Buffer for the error message (or NULL).
+ * @param maxChars The size of output, including the terminator.
+ * @return true if the reply is an error.
+ */
+bool p6kCommand::errorResponse(char *input, char *output, size_t maxChars)
+{
+  static const char *trailer = "?";
+  static const char *header = "*";
+
+  if (input == NULL) {
+    return false;
+  }
+
+  char *pTrailer = strstr(input, trailer);
+
+  if (pTrailer != NULL) {
+    *pTrailer = '\0';
+    //Remove leading '*' character. Make sure it's there first.
+    //For error strings there may be some leading chars before the '*'
+    char *pHeader = strstr(input, header);
+    if (pHeader != NULL) {
+      pHeader++;
+      copyResponse(pHeader, output, maxChars);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Remove a \r\r\n (or \r\n) from a raw reply.
+ * Also remove the leading '*' character, and anything before it.
+ * @param input The raw reply. This will be modified.
+ * @param output Buffer for the trimmed reply (or NULL). This is left alone if there is no '*'.
+ * @param maxChars The size of output, including the terminator.
+ * @return false if the line ending was not found.
+ */
+bool p6kCommand::trimResponse(char *input, char *output, size_t maxChars)
+{
+  bool stat = true;
+  static const char *trailer = "\r\r\n";
+  static const char *smallTrailer = "\r\n";
+  static const char *header = "*";
+
+  if (input == NULL) {
+    return false;
+  }
+
+  char *pTrailer = strstr(input, trailer);
+  if (pTrailer == NULL) {
+    //Try the smallTrailer instead
+    pTrailer = strstr(input, smallTrailer);
+  }
+  if (pTrailer != NULL) {
+    *pTrailer = '\0';
+  } else {
+    stat = false;
+  }
+
+  //Remove leading '*' character. Make sure it's there first.
+  //Occasionally there may be some leading chars before the '*', eg a space.
+  char *pHeader = strstr(input, header);
+  if (pHeader != NULL) {
+    pHeader++;
+    copyResponse(pHeader, output, maxChars);
+  }
+
+  return stat;
+}
+
+/**
+ * Copy a response string into a caller's buffer, truncating it if necessary.
+ * Unlike strncpy, this doesn't pad the rest of the buffer with zeros.
+ */
+void p6kCommand::copyResponse(const char *input, char *output, size_t maxChars)
+{
+  if ((output == NULL) || (maxChars == 0)) {
+    return;
+  }
+  size_t length = strlen(input);
+  if (length > (maxChars - 1)) {
+    length = maxChars - 1;
+  }
+  memcpy(output, input, length);
+  output[length] = '\0';
+}
+
+/**
+ * Start building a command: the immediate prefix, the axis number and the mnemonic.
+ */
+int p6kCommand::encodeHeader(p6kBuffer *pCommand, const p6kCommandInfo *pInfo, int axis)
+{
+  pCommand->clear();
+
+  if (pInfo == NULL) {
+    return -1;
+  }
+  if (((pInfo->axisPrefix == P6K_AXIS_NONE) && (axis != 0)) ||
+      ((pInfo->axisPrefix == P6K_AXIS_REQUIRED) && (axis <= 0)) ||
+      (axis < 0)) {
+    return -1;
+  }
+
+  if (pInfo->immediate) {
+    pCommand->append("%c", P6K_IMMEDIATE_);
+  }
+  if (axis > 0) {
+    pCommand->append("%d", axis);
+  }
+  return pCommand->append("%s", pInfo->mnemonic);
+}
+
+/**
+ * Check that a response starts with the command that was sent.
+ * @return Pointer to the value after the mnemonic, or NULL if the response doesn't match.
+ */
+const char *p6kCommand::decodeHeader(const char *response, const p6kCommandInfo *pInfo, int axis)
+{
+  const char *pStart = response;
+  char *pEnd = NULL;
+  size_t size = strlen(pInfo->mnemonic);
+
+  if (response == NULL) {
+    return NULL;
+  }
+  while (isspace(static_cast<unsigned char>(*pStart))) {
+    pStart++;
+  }
+
+  if (axis > 0) {
+    long axisNum = strtol(pStart, &pEnd, 10);
+    if ((pEnd == pStart) || (axisNum != axis)) {
+      return NULL;
+    }
+    pStart = pEnd;
+  }
+
+  if (strncmp(pStart, pInfo->mnemonic, size) != 0) {
+    return NULL;
+  }
+
+  return pStart + size;
+}
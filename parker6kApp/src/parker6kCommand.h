@@ -0,0 +1,190 @@
+/********************************************
+ *  parker6kCommand.h
+ *
+ *  Table of the P6K commands used by the
+ *  driver, and functions to build commands
+ *  and parse the responses using the table.
+ *
+ ********************************************/
+
+#ifndef parker6kCommand_H
+#define parker6kCommand_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+
+#include "parker6kBuffer.h"
+
+//Controller commands
+#define P6K_CMD_A        "A"
+#define P6K_CMD_AA       "AA"
+#define P6K_CMD_AD       "AD"
+#define P6K_CMD_ADA      "ADA"
+#define P6K_CMD_AXSDEF   "AXSDEF"
+#define P6K_CMD_CMDDIR   "CMDDIR"
+#define P6K_CMD_COMEXC   "COMEXC"
+#define P6K_CMD_D        "D"
+#define P6K_CMD_DRES     "DRES"
+#define P6K_CMD_DRFEN    "DRFEN"
+#define P6K_CMD_DRIVE    "DRIVE"
+#define P6K_CMD_ECHO     "ECHO"
+#define P6K_CMD_ENCCNT   "ENCCNT"
+#define P6K_CMD_ENCPOL   "ENCPOL"
+#define P6K_CMD_ERES     "ERES"
+#define P6K_CMD_ESK      "ESK"
+#define P6K_CMD_ESTALL   "ESTALL"
+#define P6K_CMD_GO       "GO"
+#define P6K_CMD_HOM      "HOM"
+#define P6K_CMD_HOMA     "HOMA"
+#define P6K_CMD_HOMAA    "HOMAA"
+#define P6K_CMD_HOMAD    "HOMAD"
+#define P6K_CMD_HOMADA   "HOMADA"
+#define P6K_CMD_HOMV     "HOMV"
+#define P6K_CMD_K        "K"
+#define P6K_CMD_LH       "LH"
+#define P6K_CMD_LS       "LS"
+#define P6K_CMD_LSNEG    "LSNEG"
+#define P6K_CMD_LSPOS    "LSPOS"
+#define P6K_CMD_MA       "MA"
+#define P6K_CMD_OUT      "OUT"
+#define P6K_CMD_PESET    "PESET"
+#define P6K_CMD_PSET     "PSET"
+#define P6K_CMD_S        "S"
+#define P6K_CMD_TAS      "TAS"
+#define P6K_CMD_TIN      "TIN"
+#define P6K_CMD_TLIM     "TLIM"
+#define P6K_CMD_TOUT     "TOUT"
+#define P6K_CMD_TPC      "TPC"
+#define P6K_CMD_TPE      "TPE"
+#define P6K_CMD_TREV     "TREV"
+#define P6K_CMD_TSS      "TSS"
+#define P6K_CMD_V        "V"
+
+/**
+ * Index of each command in p6kCommand::commands_.
+ * These must be in the same order as the table.
+ */
+typedef enum {
+  P6K_CMDID_A,
+  P6K_CMDID_AA,
+  P6K_CMDID_AD,
+  P6K_CMDID_ADA,
+  P6K_CMDID_AXSDEF,
+  P6K_CMDID_CMDDIR,
+  P6K_CMDID_COMEXC,
+  P6K_CMDID_D,
+  P6K_CMDID_DRES,
+  P6K_CMDID_DRFEN,
+  P6K_CMDID_DRIVE,
+  P6K_CMDID_ECHO,
+  P6K_CMDID_ENCCNT,
+  P6K_CMDID_ENCPOL,
+  P6K_CMDID_ERES,
+  P6K_CMDID_ESK,
+  P6K_CMDID_ESTALL,
+  P6K_CMDID_GO,
+  P6K_CMDID_HOM,
+  P6K_CMDID_HOMA,
+  P6K_CMDID_HOMAA,
+  P6K_CMDID_HOMAD,
+  P6K_CMDID_HOMADA,
+  P6K_CMDID_HOMV,
+  P6K_CMDID_K,
+  P6K_CMDID_LH,
+  P6K_CMDID_LS,
+  P6K_CMDID_LSNEG,
+  P6K_CMDID_LSPOS,
+  P6K_CMDID_MA,
+  P6K_CMDID_OUT,
+  P6K_CMDID_PESET,
+  P6K_CMDID_PSET,
+  P6K_CMDID_S,
+  P6K_CMDID_TAS,
+  P6K_CMDID_TIN,
+  P6K_CMDID_TLIM,
+  P6K_CMDID_TOUT,
+  P6K_CMDID_TPC,
+  P6K_CMDID_TPE,
+  P6K_CMDID_TREV,
+  P6K_CMDID_TSS,
+  P6K_CMDID_V,
+  P6K_NUM_COMMANDS
+} p6kCommandId;
+
+/** Whether a command is sent with an axis number in front of it (eg. 1TAS) */
+typedef enum {
+  P6K_AXIS_NONE,       /**< Controller wide command (eg. TSS) */
+  P6K_AXIS_REQUIRED,   /**< Axis command (eg. 1TPC) */
+  P6K_AXIS_OPTIONAL    /**< Either (eg. !S or !1S) */
+} p6kAxisPrefix;
+
+/** The type of the argument sent with a command */
+typedef enum {
+  P6K_ARG_NONE,
+  P6K_ARG_INT,
+  P6K_ARG_DOUBLE,
+  P6K_ARG_BITS         /**< Bit string (eg. GO1100 or OUTXX1) */
+} p6kArgType;
+
+/** The type of value sent back when the command is used as a query */
+typedef enum {
+  P6K_REPLY_NONE,      /**< Not a query */
+  P6K_REPLY_INT,
+  P6K_REPLY_DOUBLE,
+  P6K_REPLY_BITS,      /**< Bit string, possibly with _ separators (eg. TAS, TLIM) */
+  P6K_REPLY_STRING     /**< Free text (eg. TREV) */
+} p6kReplyType;
+
+/**
+ * Description of a single command.
+ */
+typedef struct p6kCommandInfo {
+  p6kCommandId id;
+  const char *mnemonic;
+  p6kAxisPrefix axisPrefix;
+  p6kArgType argType;
+  p6kReplyType replyType;
+  bool immediate;            /**< Always sent with the ! prefix */
+} p6kCommandInfo;
+
+/**
+ * Build commands and parse responses using the command table.
+ *
+ * The encode functions check the argument type against the table,
+ * and the decode functions check that the response echoes the
+ * command (eg. 1TPC+1000 for a 1TPC query) before reading the value.
+ * Both return -1 (or false) if the command is not used that way.
+ *
+ * errorResponse and trimResponse take the raw reply read from the
+ * port and find the text between the * and the line ending, which
+ * is what the decode functions expect.
+ */
+class p6kCommand {
+
+ public:
+  static const p6kCommandInfo *info(p6kCommandId id);
+
+  static int encode(p6kBuffer *pCommand, p6kCommandId id, int axis);
+  static int encode(p6kBuffer *pCommand, p6kCommandId id, int axis, epicsInt32 value);
+  static int encode(p6kBuffer *pCommand, p6kCommandId id, int axis, double value, int precision);
+  static int encode(p6kBuffer *pCommand, p6kCommandId id, int axis, const char *bits);
+
+  static bool decode(const char *response, p6kCommandId id, int axis, epicsInt32 *pValue);
+  static bool decode(const char *response, p6kCommandId id, int axis, double *pValue);
+  static bool decode(const char *response, p6kCommandId id, int axis, char *pValue, size_t maxChars);
+  static bool decode(const char *response, p6kCommandId id, int axis, epicsUInt64 *pBits, size_t *pCount);
+
+  static bool errorResponse(char *input, char *output, size_t maxChars);
+  static bool trimResponse(char *input, char *output, size_t maxChars);
+
+ private:
+  static void copyResponse(const char *input, char *output, size_t maxChars);
+  static int encodeHeader(p6kBuffer *pCommand, const p6kCommandInfo *pInfo, int axis);
+  static const char *decodeHeader(const char *response, const p6kCommandInfo *pInfo, int axis);
+
+  static const p6kCommandInfo commands_[];
+  static const char P6K_IMMEDIATE_;
+};
+
+#endif /* parker6kCommand_H */
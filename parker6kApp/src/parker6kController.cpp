@@ -14,10 +14,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include <errno.h>
 #include <unistd.h>
 
 #include <iostream>
+#include <map>
+#include <string>
 using std::cout;
 using std::endl;
 using std::dec;
@@ -33,46 +36,47 @@ using std::dec;
 #include "asynOctetSyncIO.h"
 
 #include "parker6kController.h"
+#include "parker6kPollScheduler.h"
 
 static const char *driverName = "parker6k";
 
+//Capture files given to p6kCapture before the controller was created (see p6kCapture)
+static std::map<std::string, std::string> pendingCaptures;
+
 const epicsUInt32 p6kController::P6K_MAXBUF_ = P6K_MAXBUF;
-const epicsUInt32 p6kController::P6K_MAXAXES_ = 8;
 const epicsFloat64 p6kController::P6K_TIMEOUT_ = 5.0;
 const epicsUInt32 p6kController::P6K_ERROR_PRINT_TIME_ = 600; //seconds (this should be set larger when we finish debugging)
 const epicsUInt32 p6kController::P6K_FORCED_FAST_POLLS_ = 10;
+const epicsFloat64 p6kController::P6K_MIN_MOVING_POLL_PERIOD_ = 10.0; //ms
 const epicsUInt32 p6kController::P6K_OK_ = 0;
 const epicsUInt32 p6kController::P6K_ERROR_ = 1;
 const epicsUInt32 p6kController::P6K_MAX_DIGITS_ = 4;
+const epicsUInt32 p6kController::P6K_NUM_OUTPUTS_ = 8; //Used if we can't read TOUT at startup
 
 const char * p6kController::P6K_ASYN_IEOS_ = ">";
-const char * p6kController::P6K_ASYN_IEOS_PROG_ = "-";
 const char * p6kController::P6K_ASYN_OEOS_ = "\n";
 
 const char p6kController::P6K_ON_         = '1';
 const char p6kController::P6K_OFF_        = '0';
 const char p6kController::P6K_NOCHANGE_   = 'X';
-const char p6kController::P6K_UNDERSCORE_ = '_';
+const char p6kController::P6K_IMMEDIATE_  = '!';
 
-//TSS Status Bits (position in char array, not TSS bit position) 
+//TSS Status Bits (0 based bit number, ignoring the _ separators. TSS bit 1 is bit 0 here.)
 const epicsUInt32 p6kController::P6K_TSS_SYSTEMREADY_ = 0;
 const epicsUInt32 p6kController::P6K_TSS_PROGRUNNING_ = 2;
 const epicsUInt32 p6kController::P6K_TSS_IMMEDIATE_   = 3;
-const epicsUInt32 p6kController::P6K_TSS_CMDERROR_    = 12;
-const epicsUInt32 p6kController::P6K_TSS_MEMERROR_    = 26;
+const epicsUInt32 p6kController::P6K_TSS_CMDERROR_    = 10;
+const epicsUInt32 p6kController::P6K_TSS_MEMERROR_    = 21;
 
-//TLIM Bits (position in char array of first axis)
+//TLIM Bits (position in the group of bits for each axis)
 const epicsUInt32 p6kController::P6K_TLIM_BIT1_ = 0;
 const epicsUInt32 p6kController::P6K_TLIM_BIT2_ = 1;
 const epicsUInt32 p6kController::P6K_TLIM_BIT3_ = 2;
-const epicsUInt32 p6kController::P6K_TLIM_SIZE_ = 4;
-
-const epicsUInt32 p6kController::P6K_UINT32_SIZE_ = 32;
 
 //C function prototypes, for the functions that can be called on IOC shell.
 extern "C" {
   asynStatus p6kCreateController(const char *portName, const char *lowLevelPortName, int lowLevelPortAddress, 
-				 int numAxes, int movingPollPeriod, int idlePollPeriod);
+				 int numAxes, int movingPollPeriod, int idlePollPeriod, const char *statusPortName);
   
   asynStatus p6kCreateAxis(const char *p6kName, int axis);
 
@@ -90,9 +94,15 @@ extern "C" {
  * @param numAxes The number of axes on the controller (1 based)
  * @param movingPollPeriod The time (in milliseconds) between polling when axes are moving
  * @param idlePollPeriod The time (in milliseconds) between polling when axes are idle
+ * @param statusPortName Optional name of a second low level port, connected to another
+ *        session on the same controller. If this is set, the status queries made by the
+ *        poller are sent on this port, and motion and config commands on the first port.
+ * Either of the low level port names can instead be the name of a native TCP link
+ * (see p6kTcpLink), which the controller then reads and writes itself.
  */
 p6kController::p6kController(const char *portName, const char *lowLevelPortName, int lowLevelPortAddress, 
-			     int numAxes, double movingPollPeriod, double idlePollPeriod)
+			     int numAxes, double movingPollPeriod, double idlePollPeriod, 
+			     const char *statusPortName)
   : asynMotorController(portName, numAxes+1, NUM_MOTOR_DRIVER_PARAMS,
 			0, // No additional interfaces
 			0, // No addition interrupt interfaces
@@ -107,11 +117,25 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
 
   //Initialize non static data members
   lowLevelPortUser_ = NULL;
+  statusPortUser_ = NULL;
+  immediatePortUser_ = NULL;
+  commandTcpLink_ = NULL;
+  statusTcpLink_ = NULL;
   movesDeferred_ = 0;
   nowTimeSecs_ = 0.0;
   lastTimeSecs_ = 0.0;
   printNextError_ = false;
   printErrors_ = true;
+  sharedPoller_ = false;
+  forcedFastPollsLeft_ = 0;
+  burstPoll_ = false;
+  numOutputs_ = P6K_NUM_OUTPUTS_;
+  logComms_ = false;
+  uploading_ = false;
+  uploadThread_ = NULL;
+  uploadPoll_ = false;
+  statusArray_.assign(numAxes * P6K_STATUS_ARRAY_STRIDE, 0.0);
+  updateTraceMasks();
 
   pAxes_ = (p6kAxis **)(asynMotorController::pAxes_);
 
@@ -138,6 +162,14 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   createParam(P6K_C_OUT_BitString,          asynParamInt32, &P6K_C_OUT_Bit_);
   createParam(P6K_C_OUT_ValString,          asynParamInt32, &P6K_C_OUT_Val_);
   createParam(P6K_C_OUT_AllString,          asynParamInt32, &P6K_C_OUT_All_);
+  createParam(P6K_C_StopLatencyString,      asynParamFloat64, &P6K_C_StopLatency_);
+  createParam(P6K_C_StopLatencyMaxString,   asynParamFloat64, &P6K_C_StopLatencyMax_);
+  createParam(P6K_C_StopAllString,          asynParamInt32, &P6K_C_StopAll_);
+  createParam(P6K_C_KillAllString,          asynParamInt32, &P6K_C_KillAll_);
+  createParam(P6K_C_StatusArrayString,      asynParamFloat64Array, &P6K_C_StatusArray_);
+  createParam(P6K_C_MovingPollPeriodString, asynParamFloat64, &P6K_C_MovingPollPeriod_);
+  createParam(P6K_C_IdlePollPeriodString,   asynParamFloat64, &P6K_C_IdlePollPeriod_);
+  createParam(P6K_C_ForcedFastPollsString,  asynParamInt32, &P6K_C_ForcedFastPolls_);
   createParam(P6K_C_LastParamString,        asynParamInt32, &P6K_C_LastParam_);
 
   //Create axis specific parameters
@@ -158,6 +190,12 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   createParam(P6K_A_ErrorString,            asynParamOctet, &P6K_A_Error_);
   createParam(P6K_A_MoveErrorString,        asynParamOctet, &P6K_A_MoveError_);
   createParam(P6K_A_DelayTimeString,        asynParamFloat64, &P6K_A_DelayTime_);
+  createParam(P6K_A_SettleWindowString,     asynParamFloat64, &P6K_A_SettleWindow_);
+  createParam(P6K_A_SettleSamplesString,    asynParamInt32, &P6K_A_SettleSamples_);
+  createParam(P6K_A_StatusFreshnessString,  asynParamFloat64, &P6K_A_StatusFreshness_);
+  createParam(P6K_A_MoveCheckString,        asynParamInt32, &P6K_A_MoveCheck_);
+  createParam(P6K_A_BurstPollsString,       asynParamInt32, &P6K_A_BurstPolls_);
+  createParam(P6K_A_BurstPeriodString,      asynParamFloat64, &P6K_A_BurstPeriod_);
   createParam(P6K_A_TAS_DriveFaultString,   asynParamInt32, &P6K_A_TAS_DriveFault_);
   createParam(P6K_A_TAS_TimeoutString,      asynParamInt32, &P6K_A_TAS_Timeout_);
   createParam(P6K_A_TAS_PosErrString,       asynParamInt32, &P6K_A_TAS_PosErr_);
@@ -183,32 +221,81 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
   // Error responses are handled differently, and unfortunately rely on a asyn timeout.
   printf("%s: Connect to low level Asyn port.\n", functionName);
   if (lowLevelPortConnect(lowLevelPortName, lowLevelPortAddress, &lowLevelPortUser_, 
-			  P6K_ASYN_IEOS_, P6K_ASYN_OEOS_) != asynSuccess) {
+			  P6K_ASYN_IEOS_, P6K_ASYN_OEOS_, &commandTcpLink_) != asynSuccess) {
     printf("%s: Failed to connect to low level asynOctetSyncIO port %s\n", functionName, lowLevelPortName);
     setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
   } else {
     setIntegerParam(P6K_C_CommsError_, P6K_OK_);
   }
 
-  char command[P6K_MAXBUF_] = {0};
+  //Immediate commands (eg. stop) get their own asynUser on the same port, so that they
+  //only have to wait for the command on the wire to finish, rather than for the link mutex.
+  //A native TCP link is one session, so they go through the link mutex like any other command.
+  if ((lowLevelPortUser_ != NULL) && (commandTcpLink_ == NULL)) {
+    if (lowLevelPortConnect(lowLevelPortName, lowLevelPortAddress, &immediatePortUser_, 
+			    P6K_ASYN_IEOS_, P6K_ASYN_OEOS_, NULL) != asynSuccess) {
+      printf("%s: Failed to connect immediate command asynUser to port %s\n", functionName, lowLevelPortName);
+      immediatePortUser_ = NULL;
+    }
+  }
+
+  //Optionally connect to a second session on the controller, used for status polling.
+  //If this fails we carry on, and use the first port for everything.
+  if ((statusPortName != NULL) && (strlen(statusPortName) > 0)) {
+    printf("%s: Connect to status Asyn port.\n", functionName);
+    if (lowLevelPortConnect(statusPortName, lowLevelPortAddress, &statusPortUser_, 
+			    P6K_ASYN_IEOS_, P6K_ASYN_OEOS_, &statusTcpLink_) != asynSuccess) {
+      printf("%s: Failed to connect to status asynOctetSyncIO port %s. Using %s for status.\n", 
+	     functionName, statusPortName, lowLevelPortName);
+      statusPortUser_ = NULL;
+    }
+  }
+
+  updateTraceMasks();
+
+  //If p6kCapture was called before the controller was created, start capturing
+  //now so that the capture includes the startup queries.
+  std::map<std::string, std::string>::iterator pendingCapture = pendingCaptures.find(portName);
+  if (pendingCapture != pendingCaptures.end()) {
+    capture(pendingCapture->second.c_str());
+    pendingCaptures.erase(pendingCapture);
+  }
+
+  p6kBuffer command;
   char response[P6K_MAXBUF_] = {0};
 
   //Disable command echo
-  epicsSnprintf(command, P6K_MAXBUF_, "%s0", P6K_CMD_ECHO);
-  if (lowLevelWriteRead(command, response) != asynSuccess) {
+  p6kCommand::encode(&command, P6K_CMDID_ECHO, 0, 0);
+  if (lowLevelWriteRead(command.c_str(), response) != asynSuccess) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: Setting %s failed.\n", functionName, P6K_CMD_ECHO);
     setStringParam(P6K_C_Error_, "Startup failed. Not starting poller.");
   } else {
 
-    memset(command, 0, sizeof(command));
+    //Disable command echo on the status session too.
+    if (statusPortUser_ != NULL) {
+      if (lowLevelWriteRead(statusPortUser_, &statusLinkMutex_, command.c_str(), response) != asynSuccess) {
+	asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		  "%s: Setting %s on the status port failed.\n", functionName, P6K_CMD_ECHO);
+      }
+    }
+
     //Enable continuous command execution mode
-    epicsSnprintf(command, P6K_MAXBUF_, "%s1", P6K_CMD_COMEXC);
-    if (lowLevelWriteRead(command, response) != asynSuccess) {
+    p6kCommand::encode(&command, P6K_CMDID_COMEXC, 0, 1);
+    if (lowLevelWriteRead(command.c_str(), response) != asynSuccess) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 		"%s: Continuous command execution mode (%s) failed.\n", functionName, P6K_CMD_COMEXC);
     }
 
+    //Find out how many digital outputs there are, so we can build OUT commands.
+    asynStatus toutStatus = getDigital(P6K_CMDID_TOUT, &toutBits_);
+    if ((toutStatus == asynSuccess) && (toutBits_.size() > 0)) {
+      numOutputs_ = toutBits_.size();
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+		"%s: Could not read %s. Assuming %d outputs.\n", functionName, P6K_CMD_TOUT, numOutputs_);
+    }
+
     startPoller();
 
     bool paramStatus = true;
@@ -227,6 +314,13 @@ p6kController::p6kController(const char *portName, const char *lowLevelPortName,
     paramStatus = ((setIntegerParam(P6K_C_TIN_Bits_, 0) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(P6K_C_OUT_Bit_, 1) == asynSuccess) && paramStatus);
     paramStatus = ((setIntegerParam(P6K_C_OUT_All_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_StopLatency_, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_StopLatencyMax_, 0.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_StopAll_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_KillAll_, 0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_MovingPollPeriod_, movingPollPeriod_ * 1000.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setDoubleParam(P6K_C_IdlePollPeriod_, idlePollPeriod_ * 1000.0) == asynSuccess) && paramStatus);
+    paramStatus = ((setIntegerParam(P6K_C_ForcedFastPolls_, P6K_FORCED_FAST_POLLS_) == asynSuccess) && paramStatus);
     callParamCallbacks();
 
     if (!paramStatus) {
@@ -250,22 +344,46 @@ p6kController::~p6kController(void)
 /**
  * Connect to the underlying low level Asyn port that is used for comms.
  * This uses the asynOctetSyncIO interface, and also sets the input and output terminators.
+ * If port is the name of a native TCP link (see p6kTcpLink), the link is used instead.
+ * The asynUser is then only used to tell the links apart, and for the trace (it is 
+ * connected to this controller's port).
  * @param port The port to connect to
  * @param addr The address of the port to connect to
  * @param ppasynUser A pointer to the pasynUser structure used by the controller
  * @param inputEos The input EOS character
  * @param outputEos The output EOS character
+ * @param ppTcpLink Returns the native TCP link, if port is one (or NULL if it can't be used)
  * @return asynStatus  
  */
 asynStatus p6kController::lowLevelPortConnect(const char *port, int addr, 
 					      asynUser **ppasynUser, const char *inputEos, 
-					      const char *outputEos)
+					      const char *outputEos, p6kTcpLink **ppTcpLink)
 {
   asynStatus status = asynSuccess;
  
   static const char *functionName = "p6kController::lowLevelPortConnect";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
+
+  p6kTcpLink *pTcpLink = p6kTcpLink::find(port);
+  if (pTcpLink != NULL) {
+    if ((ppTcpLink == NULL) || !pTcpLink->claim()) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+		"%s: TCP link %s is already in use\n", functionName, port);
+      return asynError;
+    }
+    *ppasynUser = pasynManager->createAsynUser(NULL, NULL);
+    status = pasynManager->connectDevice(*ppasynUser, this->portName, 0);
+    if (status) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+		"%s: unable to connect asynUser for TCP link %s\n", functionName, port);
+      pasynManager->freeAsynUser(*ppasynUser);
+      *ppasynUser = NULL;
+      return status;
+    }
+    *ppTcpLink = pTcpLink;
+    return asynSuccess;
+  }
 
   status = pasynOctetSyncIO->connect( port, addr, ppasynUser, NULL);
   if (status) {
@@ -317,7 +435,7 @@ asynStatus p6kController::printConnectedStatus()
 		"p6kController: Error calling pasynManager::isConnected.\n");
       return status;
       } else {
-	asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s isConnected: %d\n", 
+	P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s isConnected: %d\n", 
 		  functionName, asynManagerConnected);
     }
   }
@@ -325,181 +443,346 @@ asynStatus p6kController::printConnectedStatus()
 }
 
 /**
- * Wrapper for asynOctetSyncIO write/read functions.
+ * Send a motion or config command, and read the response.
+ * Immediate commands (those that start with !) are sent using their 
+ * own asynUser, so they don't wait for a status query that is in progress.
  * @param command - String command to send.
  * @response response - String response back.
  */
 asynStatus p6kController::lowLevelWriteRead(const char *command, char *response)
 {
-  bool stat = true;
-  int32_t eomReason = 0;
-  size_t nwrite = 0;
-  size_t nread = 0;
-  char temp[P6K_MAXBUF_] = {0};
-  static const char *functionName = "p6kController::lowLevelWriteRead";
+  asynStatus status = asynSuccess;
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
-  
-  if (!lowLevelPortUser_) {
-    setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
-    return asynError;
+  if ((command[0] == P6K_IMMEDIATE_) && (immediatePortUser_ != NULL)) {
+    status = lowLevelWriteRead(immediatePortUser_, NULL, command, response);
+  } else {
+    status = lowLevelWriteRead(lowLevelPortUser_, &commandLinkMutex_, command, response);
   }
-  
-  asynPrint(lowLevelPortUser_, ASYN_TRACEIO_DRIVER, "%s: command: %s\n", functionName, command);
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: command: %s\n", functionName, command);   
 
-  int32_t log = 0;
-  getIntegerParam(P6K_C_Log_, &log);
-  if (log != 0) {
-    printf("%s > %s\n", this->portName, command);
+  //A command refused during an upload (see upload) is not a comms error
+  if (status == asynDisabled) {
+    setStringParam(P6K_C_Error_, "ERROR: Command refused during upload");
+  } else if (status != asynSuccess) {
+    setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
+  } else {
+    setIntegerParam(P6K_C_CommsError_, P6K_OK_);
   }
 
-  memset(response, 0, strlen(response));
+  return status;
+}
 
-  // Check if we are defining a program using DEF. If so, change the 
-  // input EOS character from > to -. If we sending an END then change it back.
-  if (strncmp(command, "DEF", 3) == 0) {
-    pasynOctetSyncIO->setInputEos(lowLevelPortUser_, P6K_ASYN_IEOS_PROG_, strlen(P6K_ASYN_IEOS_PROG_) );
-  } else if (strncmp(command, "END", 3) == 0) {
-    pasynOctetSyncIO->setInputEos(lowLevelPortUser_, P6K_ASYN_IEOS_, strlen(P6K_ASYN_IEOS_) );
+/**
+ * Send a status query, and read the response. This uses the status port
+ * if one was configured, otherwise the same port as lowLevelWriteRead.
+ * This does not touch the params, so it can be called without holding the 
+ * driver lock (which is how the poller uses it). The caller is responsible
+ * for setting the comms error params.
+ * @param command - String command to send.
+ * @response response - String response back.
+ */
+asynStatus p6kController::lowLevelStatusWriteRead(const char *command, char *response)
+{
+  if (statusPortUser_ == NULL) {
+    return lowLevelWriteRead(lowLevelPortUser_, &commandLinkMutex_, command, response);
   }
-  
-  stat = (pasynOctetSyncIO->writeRead(lowLevelPortUser_ ,
-				       command, strlen(command),
-				       temp, P6K_MAXBUF_,
-				       P6K_TIMEOUT_,
-				       &nwrite, &nread, &eomReason ) == asynSuccess) && stat;
-  
-  if (!stat) {
-    if (printErrors_) {
-      asynPrint(lowLevelPortUser_, ASYN_TRACE_ERROR, 
-		"%s: Error from pasynOctetSyncIO->writeRead. command: %s\n", 
-		functionName, command);
+  return lowLevelWriteRead(statusPortUser_, &statusLinkMutex_, command, response);
+}
+
+/**
+ * Send several status queries, and read the responses. On a native TCP link
+ * (see p6kTcpLink) the queries are all written before the first reply is read,
+ * so they take one round trip rather than one each. Otherwise, or while capturing
+ * (so that each reply is recorded with its command), they are sent one at a time.
+ * Like lowLevelStatusWriteRead, this does not touch the params.
+ * @param commands - The commands to send.
+ * @param responses - The responses back, one for each command.
+ * @param statuses - The status of each command.
+ * @param count - The number of commands.
+ * @return asynError if any of the commands failed.
+ */
+asynStatus p6kController::lowLevelStatusWriteRead(const char * const *commands, char (*responses)[P6K_MAXBUF], 
+						  asynStatus *statuses, size_t count)
+{
+  asynStatus status = asynSuccess;
+  size_t nread = 0;
+  static const char *functionName = "p6kController::lowLevelStatusWriteRead";
+
+  asynUser *pasynUser = (statusPortUser_ != NULL) ? statusPortUser_ : lowLevelPortUser_;
+  epicsMutex *pLinkMutex = (statusPortUser_ != NULL) ? &statusLinkMutex_ : &commandLinkMutex_;
+  p6kTcpLink *pTcpLink = tcpLink(pasynUser);
+
+  if ((pTcpLink == NULL) || capture_.isOpen()) {
+    for (size_t i=0; i<count; i++) {
+      statuses[i] = lowLevelWriteRead(pasynUser, pLinkMutex, commands[i], responses[i]);
+      if (statuses[i] != asynSuccess) {
+	status = asynError;
+      }
     }
-    setIntegerParam(P6K_C_CommsError_, P6K_ERROR_);
-  } else {
-    setIntegerParam(P6K_C_CommsError_, P6K_OK_);
+    return status;
   }
 
-  //Search for an error response
-  if (errorResponse(temp, response) == asynSuccess) {
-    asynPrint(lowLevelPortUser_, ASYN_TRACE_ERROR, 
-	      "%s: ERROR: Command %s returned an error: %s\n", functionName, command, response);
-    stat = false;
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
+
+  int ioTraceMask = (pasynUser == statusPortUser_) ? statusTraceMask_ : commandTraceMask_;
+  bool log = logComms_;
+  for (size_t i=0; i<count; i++) {
+    P6K_TRACE_IO(ioTraceMask, pasynUser, "%s: command: %s\n", functionName, commands[i]);
+    if (log) {
+      printf("%s > %s\n", this->portName, commands[i]);
+    }
+    responses[i][0] = '\0';
+    statuses[i] = asynError;
   }
 
-  //The P6K will send back a command with a \r\r\n> \n>
-  //The low level port asyn EOS will remove the first >
-  //(or we removed the error char in the errorResponse function)
-  //We deal with the rest in this function.
-  stat = (trimResponse(temp, response) == asynSuccess) && stat;
+  pLinkMutex->lock();
 
-  asynPrint(lowLevelPortUser_, ASYN_TRACEIO_DRIVER, "%s: response: %s\n", functionName, response); 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: response: %s\n", functionName, response); 
+  //The same as in lowLevelWriteRead. The status queries are never part of an upload.
+  if (uploading_ && (pasynUser == lowLevelPortUser_)) {
+    pLinkMutex->unlock();
+    for (size_t i=0; i<count; i++) {
+      statuses[i] = asynDisabled;
+    }
+    return asynError;
+  }
 
-  if (log != 0) {
-    printf("%s < %s\n", this->portName, response);
+  p6kFramer *pFramer = framer(pasynUser);
+  for (size_t i=0; i<count; i++) {
+    pFramer->command(commands[i]);
+  }
+  pFramer->reset();
+
+  //Each read leaves the next reply at the front of the framer
+  asynStatus ioStatus = pTcpLink->write(commands, count, P6K_TIMEOUT_);
+  size_t replies = 0;
+  while ((ioStatus == asynSuccess) && (replies < count)) {
+    ioStatus = pTcpLink->read(pFramer, P6K_TIMEOUT_, &nread);
+    p6kFrame frame;
+    if ((ioStatus == asynSuccess) && pFramer->front(&frame)) {
+      pFramer->copyText(frame, responses[replies], P6K_MAXBUF);
+      if (frame.type == P6K_FRAME_ERROR) {
+	asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+		  "%s: ERROR: Command %s returned an error: %s\n", functionName, commands[replies], responses[replies]);
+      } else if (!frame.lineEnd) {
+	if (printErrors_) {
+	  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		    "%s Could not find correct trailer.\n", functionName);
+	}
+      } else {
+	statuses[replies] = asynSuccess;
+      }
+      pFramer->pop();
+      ++replies;
+    }
+  }
+  if ((ioStatus != asynSuccess) && printErrors_) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+	      "%s: Error from %s. command: %s\n", 
+	      functionName, pTcpLink->error(), commands[replies]);
   }
 
-  if (!stat) {
-    return asynError;
+  pLinkMutex->unlock();
+
+  for (size_t i=0; i<count; i++) {
+    if (statuses[i] != asynSuccess) {
+      status = asynError;
+    }
+    P6K_TRACE_IO(ioTraceMask, pasynUser, "%s: response: %s\n", functionName, responses[i]); 
+    if (log) {
+      printf("%s < %s\n", this->portName, responses[i]);
+    }
   }
 
-  return asynSuccess;
+  return status;
 }
 
 /**
- * The P6K will send back an error string with a ? prompt afterwards it.
- * We search for this before dealing with a successful command. An error
- * response would have caused an Asyn timeout, because there was no standard
- * IEOS character and by defaut we search for the character that terminates a
- * successful command.
- * @param input - input buffer. This will be modified.
- * @param output - output buffer. No bigger than P6K_MAXBUF_.
+ * Get the framer for the replies read with an asynUser. Each framer is only
+ * used with the same lock as its asynUser (the link mutex, or the driver lock
+ * for the immediate command asynUser).
+ * @param pasynUser - The low level port asynUser.
  */
-asynStatus p6kController::errorResponse(char *input, char *output)
+p6kFramer *p6kController::framer(asynUser *pasynUser)
 {
-  static const char *trailer = "?";
-  static const char *header = "*";
-  
-  static const char *functionName = "p6kController::errorResponse";
+  if (pasynUser == statusPortUser_) {
+    return &statusFramer_;
+  } else if (pasynUser == immediatePortUser_) {
+    return &immediateFramer_;
+  }
+  return &commandFramer_;
+}
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+/**
+ * Get the native TCP link used by an asynUser.
+ * @param pasynUser - The low level port asynUser.
+ * @return The link, or NULL if the asynUser is on an asyn port.
+ */
+p6kTcpLink *p6kController::tcpLink(asynUser *pasynUser)
+{
+  if (pasynUser == NULL) {
+    return NULL;
+  } else if (pasynUser == statusPortUser_) {
+    return statusTcpLink_;
+  } else if (pasynUser == lowLevelPortUser_) {
+    return commandTcpLink_;
+  }
+  return NULL;
+}
 
-  if (input == NULL) {
+/**
+ * Wrapper for asynOctetSyncIO write/read functions (or the native TCP link, see p6kTcpLink).
+ * This only uses the link mutex, and does not read or write params.
+ * @param pasynUser - The low level port to use.
+ * @param pLinkMutex - The mutex for exclusive use of pasynUser (or NULL if it's only used with the driver lock held).
+ * @param command - String command to send.
+ * @response response - String response back.
+ */
+asynStatus p6kController::lowLevelWriteRead(asynUser *pasynUser, epicsMutex *pLinkMutex,
+					    const char *command, char *response)
+{
+  bool stat = true;
+  int32_t eomReason = 0;
+  size_t nwrite = 0;
+  size_t nread = 0;
+  static const char *functionName = "p6kController::lowLevelWriteRead";
+
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
+  
+  if (!pasynUser) {
     return asynError;
   }
+  
+  int ioTraceMask = (pasynUser == statusPortUser_) ? statusTraceMask_ : commandTraceMask_;
+  P6K_TRACE_IO(ioTraceMask, pasynUser, "%s: command: %s\n", functionName, command);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s: command: %s\n", functionName, command);   
 
-  char *pTrailer = strstr(input, trailer);
+  bool log = logComms_;
+  if (log) {
+    printf("%s > %s\n", this->portName, command);
+  }
 
-  if (pTrailer != NULL) {
-    *pTrailer = '\0';
-    //Remove leading '*' character. Make sure it's there first.
-    //For error strings there may be some leading chars before the '*'
-    char *pHeader = strstr(input, header);
-    if (pHeader != NULL) {
-      pHeader++;
-      if (output != NULL) {
-	strncpy(output, pHeader, P6K_MAXBUF_-1);
-      }
-      return asynSuccess;
-    }
-  } 
+  response[0] = '\0';
 
-  //asynError is used to indicate we have not found an error
-  return asynError;
-}
+  //The link mutex may be taken with or without the driver lock,
+  //but the driver lock must never be taken while holding the link mutex.
+  if (pLinkMutex != NULL) {
+    pLinkMutex->lock();
+  }
 
-/**
- * Remove a \r\r\n from an input buffer.
- * Also remove leading '*' character. 
- * @param input - input buffer. This will be modified.
- * @param output - output buffer. No bigger than P6K_MAXBUF_.
- */
-asynStatus p6kController::trimResponse(char *input, char *output)
-{
-  asynStatus status = asynSuccess;
-  static const char *trailer = "\r\r\n";
-  static const char *smallTrailer = "\r\n";
-  static const char *header = "*";
-  static const char *functionName = "p6kController::trimResponse";
+  //While an upload is in progress, only the upload and immediate commands can use 
+  //the command port. Anything else would end up inside a program definition (see upload).
+  if (uploading_ && (pasynUser == lowLevelPortUser_) && (command[0] != P6K_IMMEDIATE_) 
+      && (epicsThreadGetIdSelf() != uploadThread_)) {
+    if (pLinkMutex != NULL) {
+      pLinkMutex->unlock();
+    }
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: Command %s refused during upload.\n", functionName, command);
+    return asynDisabled;
+  }
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  //The framer knows when the prompt changes from > to - (after a DEF) and back (after an END).
+  //The low level port still ends each read at the prompt, so its input EOS has to follow.
+  p6kFramer *pFramer = framer(pasynUser);
+  p6kTcpLink *pTcpLink = tcpLink(pasynUser);
+  if (pFramer->command(command) && (pTcpLink == NULL)) {
+    char eos[2] = {pFramer->prompt(), '\0'};
+    pasynOctetSyncIO->setInputEos(pasynUser, eos, strlen(eos));
+  }
 
-  if (input == NULL) {
-    return asynError;
+  //Read straight into the framer's ring buffer
+  size_t space = 0;
+  pFramer->reset();
+  char *pReply = pFramer->prepare(&space);
+  
+  //Only read the clock if we are capturing (see p6kController::capture)
+  bool capturing = capture_.isOpen();
+  epicsTimeStamp startTime = {0, 0};
+  if (capturing) {
+    p6kClock::getClock()->getCurrent(&startTime);
   }
 
-  char *pTrailer = strstr(input, trailer);
-  if (pTrailer != NULL) {
-    *pTrailer = '\0';
+  asynStatus ioStatus = asynSuccess;
+  const char *ioSource = "pasynOctetSyncIO->writeRead";
+  char ioError[P6K_MAXBUF];
+  if (pTcpLink != NULL) {
+    //The link reads into the framer itself, up to the end of the reply (including the prompt)
+    ioStatus = pTcpLink->write(&command, 1, P6K_TIMEOUT_);
+    if (ioStatus == asynSuccess) {
+      ioStatus = pTcpLink->read(pFramer, P6K_TIMEOUT_, &nread);
+    }
+    if (ioStatus != asynSuccess) {
+      epicsSnprintf(ioError, sizeof(ioError), "%s", pTcpLink->error());
+      ioSource = ioError;
+    }
   } else {
-    //Try the smallTrailer instead
-    pTrailer = strstr(input, smallTrailer);
-    if (pTrailer != NULL) {
-      *pTrailer = '\0';
-    } else {
-      if (printErrors_) {
-	asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-		  "%s Could not find correct trailer.\n", functionName);
-      }
-      status = asynError;
+    ioStatus = pasynOctetSyncIO->writeRead(pasynUser ,
+					   command, strlen(command),
+					   pReply, space,
+					   P6K_TIMEOUT_,
+					   &nwrite, &nread, &eomReason);
+  }
+  stat = (ioStatus == asynSuccess) && stat;
+
+  //Record the raw reply, with the link mutex held so the records for each port are in order.
+  if (capturing) {
+    epicsTimeStamp endTime;
+    p6kClock::getClock()->getCurrent(&endTime);
+    capture_.write((pasynUser == statusPortUser_) ? P6K_CAPTURE_STATUS : P6K_CAPTURE_COMMAND,
+		   ioStatus, &startTime, &endTime, command, strlen(command), pReply, nread);
+  }
+
+  //The P6K will send back a command with a \r\r\n> \n>
+  //The low level port asyn EOS will remove the first >, so we end the frame there.
+  //An error reply ends with a ? instead, so the read times out and the framer finds the ?.
+  if (pTcpLink == NULL) {
+    pFramer->commit(nread);
+    if ((ioStatus == asynSuccess) && ((eomReason & ASYN_EOM_EOS) != 0)) {
+      pFramer->terminate();
     }
   }
+  p6kFrame frame;
+  bool haveFrame = pFramer->front(&frame);
+  if (haveFrame) {
+    pFramer->copyText(frame, response, P6K_MAXBUF_);
+  }
 
-  //Remove leading '*' character. Make sure it's there first.
-  //Occasionally there may be some leading chars before the '*', eg a space.
-  char *pHeader = strstr(input, header);
-  if (pHeader != NULL) {
-    pHeader++;
-    if (output != NULL) {
-      strncpy(output, pHeader, P6K_MAXBUF_-1);
+  if (pLinkMutex != NULL) {
+    pLinkMutex->unlock();
+  }
+  
+  if (!stat) {
+    if (printErrors_) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+		"%s: Error from %s. command: %s\n", 
+		functionName, ioSource, command);
     }
   }
 
-  return status;
-}
+  if (haveFrame && (frame.type == P6K_FRAME_ERROR)) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: Command %s returned an error: %s\n", functionName, command, response);
+    stat = false;
+  } else if (!haveFrame || !frame.lineEnd) {
+    if (printErrors_) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		"%s Could not find correct trailer.\n", functionName);
+    }
+    stat = false;
+  }
+
+  P6K_TRACE_IO(ioTraceMask, pasynUser, "%s: response: %s\n", functionName, response); 
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s: response: %s\n", functionName, response); 
+
+  if (log) {
+    printf("%s < %s\n", this->portName, response);
+  }
 
+  if (!stat) {
+    return asynError;
+  }
+
+  return asynSuccess;
+}
 
 /**
  * asynReport function. Currently this just calls the base class. 
@@ -509,8 +792,23 @@ void p6kController::report(FILE *fp, int level)
   int32_t axis = 0;
   p6kAxis *pAxis = NULL;
 
-  fprintf(fp, "p6k motor driver %s, numAxes=%d, moving poll period=%f, idle poll period=%f\n", 
-          this->portName, numAxes_, movingPollPeriod_, idlePollPeriod_);
+  fprintf(fp, "p6k motor driver %s, numAxes=%d, moving poll period=%f, idle poll period=%f%s\n", 
+          this->portName, numAxes_, movingPollPeriod_, idlePollPeriod_,
+	  (sharedPoller_ ? " (shared poller)" : ""));
+  fprintf(fp, "  %s\n", (statusPortUser_ ? "separate status port" : "single port"));
+  if (commandTcpLink_ != NULL) {
+    commandTcpLink_->report(fp, level);
+  }
+  if (statusTcpLink_ != NULL) {
+    statusTcpLink_->report(fp, level);
+  }
+  if (level > 0) {
+    double latency = 0.0;
+    double latencyMax = 0.0;
+    getDoubleParam(P6K_C_StopLatency_, &latency);
+    getDoubleParam(P6K_C_StopLatencyMax_, &latencyMax);
+    fprintf(fp, "  stop latency=%f ms, max=%f ms\n", latency, latencyMax);
+  }
 
   if (level > 0) {
     for (axis=0; axis<numAxes_; axis++) {
@@ -539,7 +837,7 @@ asynStatus p6kController::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 	
   static const char *functionName = "p6kController::writeFloat64";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
 
   pAxis = this->getAxis(pasynUser);
   if (!pAxis) {
@@ -549,12 +847,25 @@ asynStatus p6kController::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
   /* Set the parameter and readback in the parameter library. */
   status = (pAxis->setDoubleParam(function, value) == asynSuccess) && status;
 
-  if (function == P6K_A_DelayTime_) {
-    if (value < 0.0) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-		"%s: ERROR: forcing done moving delay time to be >=0. Axis %d\n", 
-		functionName, pAxis->axisNo_);
-      value = 0.0;
+  if ((function == P6K_A_DelayTime_) || (function == P6K_A_SettleWindow_) ||
+      (function == P6K_A_StatusFreshness_) || (function == P6K_A_BurstPeriod_) ||
+      (function == P6K_C_IdlePollPeriod_)) {
+    value = limitFloat64(function, pAxis->axisNo_, value, 0.0, DBL_MAX);
+  } else if (function == P6K_C_MovingPollPeriod_) {
+    //Zero would stop the polls while axes are moving, so they would never be done.
+    value = limitFloat64(function, pAxis->axisNo_, value, P6K_MIN_MOVING_POLL_PERIOD_, DBL_MAX);
+  }
+
+  if ((function == P6K_C_MovingPollPeriod_) || (function == P6K_C_IdlePollPeriod_)) {
+    //The poller (or pollSweep) reads the base class periods on every loop, 
+    //so the new period is used from the end of the next poll. An idle period 
+    //of zero means only poll on a wakeup, as for p6kCreateController.
+    if (function == P6K_C_MovingPollPeriod_) {
+      movingPollPeriod_ = value / 1000.0;
+      asynMotorController::movingPollPeriod_ = movingPollPeriod_;
+    } else {
+      idlePollPeriod_ = value / 1000.0;
+      asynMotorController::idlePollPeriod_ = idlePollPeriod_;
     }
   }
 
@@ -572,6 +883,72 @@ asynStatus p6kController::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 
 }
 
+/**
+ * Force a value written to a float64 param to be within its limits.
+ * @param function The param index
+ * @param axis The axis number, for the error message
+ * @param value The value written
+ * @param minimum The lowest value allowed
+ * @param maximum The highest value allowed
+ * @return The value, or the limit that it was past
+ */
+epicsFloat64 p6kController::limitFloat64(int function, int axis, epicsFloat64 value, 
+					  epicsFloat64 minimum, epicsFloat64 maximum)
+{
+  const char *paramName = "";
+  static const char *functionName = "p6kController::limitFloat64";
+
+  if ((value >= minimum) && (value <= maximum)) {
+    return value;
+  }
+  getParamName(function, &paramName);
+  value = (value < minimum) ? minimum : maximum;
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+	    "%s: ERROR: forcing %s to be %g. Axis %d\n", 
+	    functionName, paramName, value, axis);
+  return value;
+}
+
+/**
+ * Set an integer param, and keep the axis copy of it up to date if it's
+ * one of the axis config params (see p6kAxisConfig).
+ * @param list The param list (axis number)
+ * @param index The param index
+ * @param value The new value
+ * @return asynStatus
+ */
+asynStatus p6kController::setIntegerParam(int list, int index, int value)
+{
+  asynStatus status = asynMotorController::setIntegerParam(list, index, value);
+  if ((status == asynSuccess) && (index > FIRST_P6K_PARAM)) {
+    p6kAxis *pAxis = getAxis(list);
+    if (pAxis != NULL) {
+      pAxis->updateConfig(index, static_cast<epicsInt32>(value));
+    }
+  }
+  return status;
+}
+
+/**
+ * Set a double param, and keep the axis copy of it up to date if it's
+ * one of the axis config params (see p6kAxisConfig).
+ * @param list The param list (axis number)
+ * @param index The param index
+ * @param value The new value
+ * @return asynStatus
+ */
+asynStatus p6kController::setDoubleParam(int list, int index, double value)
+{
+  asynStatus status = asynMotorController::setDoubleParam(list, index, value);
+  if ((status == asynSuccess) && (index > FIRST_P6K_PARAM)) {
+    p6kAxis *pAxis = getAxis(list);
+    if (pAxis != NULL) {
+      pAxis->updateConfig(index, static_cast<epicsFloat64>(value));
+    }
+  }
+  return status;
+}
+
 /**
  * Deal with controller specific epicsInt32 params.
  * @param pasynUser
@@ -585,7 +962,7 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
   p6kAxis *pAxis = NULL;
   static const char *functionName = "p6kController::writeInt32";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
 
   pAxis = this->getAxis(pasynUser);
   if (!pAxis) {
@@ -599,6 +976,20 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
 		functionName, pAxis->axisNo_);
       value = 0;
     }
+  } else if (function == P6K_A_SettleSamples_) {
+    if (value < 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		"%s: ERROR: forcing settle samples to be >=0. Axis %d\n", 
+		functionName, pAxis->axisNo_);
+      value = 0;
+    }
+  } else if (function == P6K_A_BurstPolls_) {
+    if (value < 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		"%s: ERROR: forcing burst polls to be >=0. Axis %d\n", 
+		functionName, pAxis->axisNo_);
+      value = 0;
+    }
   } else if (function == P6K_A_LS_Enable_) {
     if (value !=0 ) {
       status = (pAxis->disableSoftwareLimits(false) == asynSuccess) && status;
@@ -606,7 +997,7 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = (pAxis->disableSoftwareLimits(true) == asynSuccess) && status;
     }
   } else if (function == P6K_C_OUT_Bit_) {
-    if ((value < 1) || (value > 8)) {
+    if ((value < 1) || (static_cast<epicsUInt32>(value) > numOutputs_)) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 		"%s: ERROR: forcing OUT bit to be 1. Axis %d\n", 
 		functionName, pAxis->axisNo_);
@@ -620,6 +1011,21 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
   } else if (function == P6K_C_OUT_All_) {
     if (value != 0) value = 1;
     status = (setDigitalOutputs(value) == asynSuccess) && status;
+  } else if (function == P6K_C_Log_) {
+    logComms_ = (value != 0);
+  } else if (function == P6K_C_ForcedFastPolls_) {
+    if (value < 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		"%s: ERROR: forcing forced fast polls to be >=0.\n", functionName);
+      value = 0;
+    }
+    //Used from the next wakeup of the poller.
+    asynMotorController::forcedFastPolls_ = value;
+  } else if ((function == P6K_C_StopAll_) || (function == P6K_C_KillAll_)) {
+    if (value != 0) {
+      status = (stopAll(function == P6K_C_KillAll_) == asynSuccess) && status;
+    }
+    value = 0;
   }
 
   status = (pAxis->setIntegerParam(function, value) == asynSuccess) && status;
@@ -640,34 +1046,37 @@ asynStatus p6kController::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
 /**
  * Set a digital output. Leave the rest unchanged.
- * @param bit (1 to 8)
+ * @param bit (1 to the number of outputs)
  * @param enable (0=off, 1=on)
  * @return asynStatus
  */
 asynStatus p6kController::setDigitalOutput(epicsInt32 bit, epicsInt32 enable)
 {
   char out_cmd[P6K_MAXBUF_] = {0};
-  char command[P6K_MAXBUF_] = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF_] = {0};  
+  p6kBitMask outBits(numOutputs_);
+  p6kBitMask changeBits(numOutputs_);
   bool stat = true;
 
   const char *functionName = "parker6kController::setDigitalOutput";
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s.\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s.\n", functionName);
 
-  for (uint32_t axis=1; axis<P6K_MAXAXES_; ++axis) {
-    if (axis == static_cast<uint32_t>(bit)) {
-      if (enable == 1) {
-	out_cmd[axis-1] = P6K_ON_;
-      } else {
-	out_cmd[axis-1] = P6K_OFF_;
-      }
-    } else {
-      	out_cmd[axis-1] = P6K_NOCHANGE_;
-    }
+  if ((bit < 1) || (static_cast<epicsUInt32>(bit) > numOutputs_)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: bit %d out of range (1 to %d)\n", 
+	      functionName, bit, numOutputs_);
+    return asynError;
   }
 
-  epicsSnprintf(command, P6K_MAXBUF_, "%s%s", P6K_CMD_OUT, out_cmd);
-  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  outBits.set(bit-1, (enable == 1));
+  changeBits.set(bit-1);
+  stat = (outBits.formatMasked(changeBits, out_cmd, P6K_MAXBUF_) >= 0) && stat;
+
+  if (stat) {
+    p6kCommand::encode(&command, P6K_CMDID_OUT, 0, out_cmd);
+    stat = (lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
+  }
   if (!stat) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: ERROR: failed to set bit %d %s\n", 
@@ -686,20 +1095,22 @@ asynStatus p6kController::setDigitalOutput(epicsInt32 bit, epicsInt32 enable)
  */
 asynStatus p6kController::setDigitalOutputs(epicsInt32 enable)
 {
-  char command[P6K_MAXBUF_] = {0};
+  char out_cmd[P6K_MAXBUF_] = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF_] = {0};  
+  p6kBitMask outBits(numOutputs_);
   bool stat = true;
 
   const char *functionName = "parker6kController::setDigitalOutputs";
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s.\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s.\n", functionName);
 
-  if (enable == 1) {
-    epicsSnprintf(command, P6K_MAXBUF_, "%s%s", P6K_CMD_OUT, "11111111");
-  } else {
-    epicsSnprintf(command, P6K_MAXBUF_, "%s%s", P6K_CMD_OUT, "00000000");
-  }
+  outBits.setAll(enable == 1);
+  stat = (outBits.format(out_cmd, P6K_MAXBUF_) >= 0) && stat;
 
-  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  if (stat) {
+    p6kCommand::encode(&command, P6K_CMDID_OUT, 0, out_cmd);
+    stat = (lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
+  }
   if (!stat) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: ERROR: failed to set all bits %s\n", 
@@ -714,43 +1125,44 @@ asynStatus p6kController::setDigitalOutputs(epicsInt32 enable)
  * This is a generic function that sends a command to the controller 
  * and expects back a string of format 0000_0000_0000_ etc. Or any number
  * of digits with underscore separating each block (eg. 000_000_ etc.) 
- * The underscores are ignored and the bits are placed into a uint32_t. 
+ * The underscores are ignored and the bits are placed into a p6kBitMask,
+ * which is sized to the number of bits in the response. 
  * This can be used to read the state of the digital inputs, outputs and limits.
- * @param command Pointer to char array command to send
- * @param size Number of characters in char array command (not including EOL)
- * @param bits Pointer to uint32_t that will be modified to contain the bits.
+ * @param id The command to send (eg. P6K_CMDID_TLIM)
+ * @param pBits Pointer to the p6kBitMask that will be modified to contain the bits.
  * @return asynStatus
  */
-asynStatus p6kController::getDigital(const char *command, size_t size, uint32_t *bits)
+asynStatus p6kController::getDigital(p6kCommandId id, p6kBitMask *pBits)
 {
-  char response[P6K_MAXBUF_] = {0};  
+  p6kBuffer command;
+  char response[P6K_MAXBUF_];
+  char bits[P6K_MAXBUF_];
   bool stat = true;
-  uint32_t offset = 0;
 
-  *bits = 0;
+  pBits->resize(0);
 
   const char *functionName = "parker6kController::getDigital";
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s.\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s.\n", functionName);
 
-  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
+  p6kCommand::encode(&command, id, 0);
+  stat = (lowLevelStatusWriteRead(command.c_str(), response) == asynSuccess) && stat;
   if (!stat) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 	      "%s: ERROR: failed to send %s\n", 
-	      functionName, command);
+	      functionName, command.c_str());
+    return asynError;
+  } 
+
+  //The response starts with the command name
+  if (!p6kCommand::decode(response, id, 0, bits, sizeof(bits))) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: unexpected response to %s: %s\n", 
+	      functionName, command.c_str(), response);
     return asynError;
-  } else {
-    for (uint32_t bit=size; bit<P6K_MAXBUF_; ++bit) {
-      if (bit >= P6K_UINT32_SIZE_) {
-	break;
-      }
-      if (response[bit] == P6K_UNDERSCORE_) {
-	++offset;
-      } else {
-	*bits |= ((response[bit] == P6K_ON_) << (bit-offset-size));
-      }
-    }
   }
 
+  pBits->parse(bits);
+
   return asynSuccess;
 }
 
@@ -774,7 +1186,7 @@ asynStatus p6kController::writeOctet(asynUser *pasynUser, const char *value,
     char error[P6K_MAXBUF_] = {0};
     const char *functionName = "parker6kController::writeOctet";
 
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s.\n", functionName);
+    P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s.\n", functionName);
 
     pAxis = this->getAxis(pasynUser);
     if (!pAxis) {
@@ -853,20 +1265,250 @@ p6kAxis* p6kController::getAxis(int axisNo)
 
 /**
  * Wrapper for asynMotorController::startPoller.
+ * If the shared poll scheduler has been created then this controller
+ * is added to it, instead of starting a poller thread for this controller.
  * @return asynStatus
  */
 asynStatus p6kController::startPoller(void)
 {
   asynStatus status = asynError;
+  p6kPollScheduler *pScheduler = p6kPollScheduler::getInstance();
   static const char *functionName = "p6kController::startPoller";
 
-  printf("%s: Starting poller.\n", functionName);
-
-  status = asynMotorController::startPoller(movingPollPeriod_, idlePollPeriod_, P6K_FORCED_FAST_POLLS_);
+  if (pScheduler != NULL) {
+    printf("%s: Using shared poll scheduler.\n", functionName);
+    //Set the base class poll periods, even though the base class poller is not used.
+    asynMotorController::movingPollPeriod_ = movingPollPeriod_;
+    asynMotorController::idlePollPeriod_ = idlePollPeriod_;
+    asynMotorController::forcedFastPolls_ = P6K_FORCED_FAST_POLLS_;
+    sharedPoller_ = true;
+    status = pScheduler->addController(this);
+  } else {
+    printf("%s: Starting poller.\n", functionName);
+    status = asynMotorController::startPoller(movingPollPeriod_, idlePollPeriod_, P6K_FORCED_FAST_POLLS_);
+  }
 
   return status;
 }
 
+/**
+ * Wake up the poller. If we are using the shared poll scheduler
+ * then ask it to poll this controller now, otherwise call the base class.
+ * @return asynStatus
+ */
+asynStatus p6kController::wakeupPoller(void)
+{
+  if (sharedPoller_) {
+    return p6kPollScheduler::getInstance()->wakeup(this);
+  }
+  return asynMotorController::wakeupPoller();
+}
+
+/**
+ * Do a single poll of the controller and all the axes. This is called by 
+ * the shared poll scheduler, and does the same as one loop of 
+ * asynMotorController::asynMotorPoller, including the auto power off.
+ * @param wakeup Set to true if this poll was requested by wakeupPoller.
+ * @return The time (in seconds) until the next poll, or a negative value if we are shutting down.
+ */
+double p6kController::pollSweep(bool wakeup)
+{
+  bool anyMoving = false;
+  bool moving = false;
+  double timeout = 0.0;
+  int autoPower = 0;
+  double autoPowerOffDelay = 0.0;
+  p6kAxis *pAxis = NULL;
+
+  lock();
+
+  if (shuttingDown_) {
+    unlock();
+    return -1.0;
+  }
+
+  if (wakeup) {
+    forcedFastPollsLeft_ = asynMotorController::forcedFastPolls_;
+  }
+
+  poll();
+  for (int32_t axis=0; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if (!pAxis) continue;
+    getIntegerParam(axis, motorPowerAutoOnOff_, &autoPower);
+    getDoubleParam(axis, motorPowerOffDelay_, &autoPowerOffDelay);
+    pAxis->poll(&moving);
+    if (moving) {
+      anyMoving = true;
+      pAxis->setWasMovingFlag(1);
+    } else if ((pAxis->getWasMovingFlag() == 1) && (autoPower == 1)) {
+      pAxis->setDisableFlag(1);
+      pAxis->setWasMovingFlag(0);
+      pAxis->setLastEndOfMoveTime(p6kClock::getClock()->now());
+    }
+
+    //Auto power off drive, if:
+    // a) motorPowerAutoOnOff_ is on.
+    // b) We have waited for motorPowerOffDelay_.
+    // c) The drive has been told to disable.
+    if ((autoPower == 1) && (pAxis->getDisableFlag() == 1)) {
+      if ((p6kClock::getClock()->now() - pAxis->getLastEndOfMoveTime()) >= autoPowerOffDelay) {
+	pAxis->setClosedLoop(false);
+	pAxis->setIntegerParam(motorStatusPowerOn_, 0);
+	pAxis->setDisableFlag(0);
+	pAxis->callParamCallbacks();
+      }
+    }
+  }
+
+  if (forcedFastPollsLeft_ > 0) {
+    timeout = asynMotorController::movingPollPeriod_;
+    --forcedFastPollsLeft_;
+  } else if (anyMoving) {
+    timeout = asynMotorController::movingPollPeriod_;
+  } else {
+    timeout = asynMotorController::idlePollPeriod_;
+  }
+
+  unlock();
+
+  return timeout;
+}
+
+/**
+ * @return The controller port name, for the shared poll scheduler report.
+ */
+const char *p6kController::pollName(void) const
+{
+  return this->portName;
+}
+
+
+/**
+ * Called at the end of each axis poll. Once the last axis has been polled,
+ * post the status array, so that it is updated once per poll with either
+ * poller (asynMotorPoller or the shared poll scheduler). Call with the lock held.
+ * @param axis The axis that was just polled
+ */
+void p6kController::axisPolled(int32_t axis)
+{
+  for (int32_t last=numAxes_-1; last>axis; --last) {
+    if (getAxis(last) != NULL) {
+      return;
+    }
+  }
+  updateStatusArray();
+}
+
+/**
+ * Fill in P6K_C_STATUS_ARRAY from the axis params set by this poll, and
+ * post it with the poll time. This gives one coherent snapshot of all the
+ * axes for clients that would otherwise monitor many records per axis.
+ * The layout is described in parker6kController.h. Call with the lock held.
+ */
+void p6kController::updateStatusArray(void)
+{
+  for (int32_t axis=1; axis<numAxes_; ++axis) {
+    epicsFloat64 *pValues = &statusArray_[(axis - 1) * P6K_STATUS_ARRAY_STRIDE];
+    p6kAxis *pAxis = getAxis(axis);
+    epicsInt32 problem = 0;
+    epicsInt32 commsError = 0;
+    epicsInt32 error = 0;
+
+    if (pAxis == NULL) {
+      pValues[P6K_STATUS_ARRAY_POSITION] = 0.0;
+      pValues[P6K_STATUS_ARRAY_ENCODER] = 0.0;
+      pValues[P6K_STATUS_ARRAY_TAS] = 0.0;
+      pValues[P6K_STATUS_ARRAY_ERROR] = P6K_STATUS_ERROR_NOSTATUS;
+      continue;
+    }
+
+    getDoubleParam(axis, motorPosition_, &pValues[P6K_STATUS_ARRAY_POSITION]);
+    getDoubleParam(axis, motorEncoderPosition_, &pValues[P6K_STATUS_ARRAY_ENCODER]);
+    pValues[P6K_STATUS_ARRAY_TAS] = static_cast<epicsFloat64>(pAxis->lastTas_);
+    getIntegerParam(axis, motorStatusProblem_, &problem);
+    getIntegerParam(axis, motorStatusCommsError_, &commsError);
+    if (problem != 0) {
+      error |= P6K_STATUS_ERROR_PROBLEM;
+    }
+    if (commsError != 0) {
+      error |= P6K_STATUS_ERROR_COMMS;
+    }
+    if (!pAxis->lastStatusOk_) {
+      error |= P6K_STATUS_ERROR_NOSTATUS;
+    }
+    pValues[P6K_STATUS_ARRAY_ERROR] = error;
+  }
+
+  //The poll time is only for the array, so put the port time stamp back afterwards
+  epicsTimeStamp portTime;
+  getTimeStamp(&portTime);
+  setTimeStamp(&nowTime_);
+  doCallbacksFloat64Array(&statusArray_[0], (numAxes_ - 1) * P6K_STATUS_ARRAY_STRIDE, P6K_C_StatusArray_, 0);
+  setTimeStamp(&portTime);
+}
+
+/**
+ * Decide if this poll is part of a burst of fast polls after a move was started
+ * (see p6kAxis::startBurst and P6K_A_BURST_POLLS). If any axis has burst polls left
+ * then this poll only reads those axes, and the moving poll period is set to the
+ * shortest of their burst periods until the last burst poll. Otherwise it is set
+ * back to the normal moving poll period. Call with the lock held, at the start of a poll.
+ * @return true if this is a burst poll
+ */
+bool p6kController::updateBurst(void)
+{
+  double period = movingPollPeriod_;
+
+  burstPoll_ = false;
+  for (int32_t axis=1; axis<numAxes_; axis++) {
+    p6kAxis *pAxis = getAxis(axis);
+    if (pAxis == NULL) continue;
+    pAxis->burstPoll_ = (pAxis->burstPollsLeft_ > 0);
+    if (!pAxis->burstPoll_) continue;
+    burstPoll_ = true;
+    --pAxis->burstPollsLeft_;
+    if (pAxis->burstPollsLeft_ > 0) {
+      double burstPeriod = pAxis->config_.burstPeriod / 1000.0;
+      if ((burstPeriod > 0.0) && (burstPeriod < period)) {
+	period = burstPeriod;
+      }
+    }
+  }
+
+  //asynMotorPoller and pollSweep use this for the time to the next poll.
+  asynMotorController::movingPollPeriod_ = period;
+
+  return burstPoll_;
+}
+
+/**
+ * Read the status array (P6K_C_STATUS_ARRAY) built by the last poll.
+ * @param pasynUser
+ * @param value The array to fill in
+ * @param nElements The size of value
+ * @param nIn Set to the number of elements filled in
+ * @return asynStatus
+ */
+asynStatus p6kController::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, 
+					   size_t nElements, size_t *nIn)
+{
+  if (pasynUser->reason != P6K_C_StatusArray_) {
+    return asynMotorController::readFloat64Array(pasynUser, value, nElements, nIn);
+  }
+
+  size_t size = (numAxes_ - 1) * P6K_STATUS_ARRAY_STRIDE;
+  if (nElements < size) {
+    size = nElements;
+  }
+  for (size_t i=0; i<size; ++i) {
+    value[i] = statusArray_[i];
+  }
+  *nIn = size;
+  pasynUser->timestamp = nowTime_;
+
+  return asynSuccess;
+}
 
 /** 
  * Polls the controller, rather than individual axis.
@@ -874,22 +1516,23 @@ asynStatus p6kController::startPoller(void)
  */
 asynStatus p6kController::poll()
 {
-  char command[P6K_MAXBUF] = {0};
-  char response[P6K_MAXBUF] = {0};
+  p6kBuffer command;
+  char response[P6K_MAXBUF];
   bool stat = true;
-  int32_t nvals = 0;
-  uint32_t bits = 0;
-  char stringVal[P6K_MAXBUF] = {0};
+  epicsUInt64 tss = 0;
   static const char *functionName = "p6kController::poll";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
 
   if (!lowLevelPortUser_) {
     return asynError;
   }
 
+  //Pick up any change to the trace masks (see parker6kTrace.h)
+  updateTraceMasks();
+
   /* Get the time and decide if we want to print errors.*/
-  epicsTimeGetCurrent(&nowTime_);
+  p6kClock::getClock()->getCurrent(&nowTime_);
   nowTimeSecs_ = nowTime_.secPastEpoch;
   if ((nowTimeSecs_ - lastTimeSecs_) < P6K_ERROR_PRINT_TIME_) {
     printErrors_ = false;
@@ -902,56 +1545,108 @@ asynStatus p6kController::poll()
     printErrors_ = true;
   }
 
-  //Set any controller specific parameters. 
-  //Some of these may be used by the axis poll to set axis bits.
+  //With a single port, the status queries would be refused during an upload.
+  //The axes keep their last status until it's finished (see p6kAxis::poll).
+  uploadPoll_ = (uploading_ && (statusPortUser_ == NULL));
+  if (uploadPoll_) {
+    return asynSuccess;
+  }
+
+  //The poller holds the lock when it calls this function. We only keep
+  //it while reading and writing params. Everything is read from the controller 
+  //with the lock released (so that motion commands and param writes are not held up),
+  //and then the params are set in one go once we have the lock back.
+  //The axis polls then use the status that we read for them here.
 
-  //Transfer limit and home status and pack into uint32_t param.
   int32_t tlim = 0;
   getIntegerParam(P6K_C_TLIM_Enable_, &tlim);
-  setIntegerParam(P6K_C_TLIM_Bits_, 0);
-  if (tlim == 1) {
-    bits = 0;
-    stat = (getDigital(P6K_CMD_TLIM, (sizeof(P6K_CMD_TLIM)-1), &bits) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TLIM_Bits_, bits) == asynSuccess) && stat;
-  }
-
-  //Transfer input and output signals and pack into uint32_t param.
   int32_t inout = 0;
   getIntegerParam(P6K_C_INOUT_Enable_, &inout);
-  setIntegerParam(P6K_C_TOUT_Bits_, 0);
-  setIntegerParam(P6K_C_TIN_Bits_, 0);
-  if (inout == 1) {
-    bits = 0;
-    stat = (getDigital(P6K_CMD_TOUT, (sizeof(P6K_CMD_TOUT)-1), &bits) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TOUT_Bits_, bits) == asynSuccess) && stat;
 
-    bits = 0;
-    stat = (getDigital(P6K_CMD_TIN, (sizeof(P6K_CMD_TIN)-1), &bits) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TIN_Bits_, bits) == asynSuccess) && stat;
+  //A burst poll (just after a move started) only reads the axes in the burst.
+  bool burst = updateBurst();
+
+  for (int32_t axis=1; axis<numAxes_; axis++) {
+    p6kAxis *pAxis = getAxis(axis);
+    if ((pAxis != NULL) && (!burst || pAxis->burstPoll_)) {
+      pAxis->prepareAxisStatus(&pAxis->pollStatus_);
+    }
   }
+
+  unlock();
+
+  if (!burst) {
+    //Transfer limit and home status. The axis poll uses tlimBits_ to set
+    //the limit and home status.
+    tlimPollBits_.resize(0);
+    if (tlim == 1) {
+      stat = (getDigital(P6K_CMDID_TLIM, &tlimPollBits_) == asynSuccess) && stat;
+    }
+
+    //Transfer input and output signals.
+    toutPollBits_.resize(0);
+    tinPollBits_.resize(0);
+    if (inout == 1) {
+      stat = (getDigital(P6K_CMDID_TOUT, &toutPollBits_) == asynSuccess) && stat;
+      stat = (getDigital(P6K_CMDID_TIN, &tinPollBits_) == asynSuccess) && stat;
+    }
   
-  //Transfer system status
-  epicsSnprintf(command, P6K_MAXBUF, "%s", P6K_CMD_TSS);
-  stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
-  if (stat) {
-    nvals = sscanf(response, P6K_CMD_TSS"%s", stringVal);
-    if (nvals <= 0) {
-      stat = false;
-      if (printErrors_) {
-	asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-		  "%s: ERROR: Problem reading TSS on controller %s\n", 
-		  functionName, this->portName);
+    //Transfer system status
+    p6kCommand::encode(&command, P6K_CMDID_TSS, 0);
+    stat = (lowLevelStatusWriteRead(command.c_str(), response) == asynSuccess) && stat;
+    if (stat) {
+      if (!p6kCommand::decode(response, P6K_CMDID_TSS, 0, &tss, NULL)) {
+	stat = false;
+	if (printErrors_) {
+	  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+		    "%s: ERROR: Problem reading TSS on controller %s\n", 
+		    functionName, this->portName);
+	}
       }
     }
   }
-  memset(command, 0, sizeof(command));
+
+  //Transfer axis status
+  for (int32_t axis=1; axis<numAxes_; axis++) {
+    p6kAxis *pAxis = getAxis(axis);
+    if ((pAxis != NULL) && (!burst || pAxis->burstPoll_)) {
+      pAxis->readAxisStatus(&pAxis->pollStatus_);
+    }
+  }
+
+  lock();
+
+  //Set any controller specific parameters. 
+  //Some of these may be used by the axis poll to set axis bits.
+  for (int32_t axis=1; axis<numAxes_; axis++) {
+    p6kAxis *pAxis = getAxis(axis);
+    if ((pAxis != NULL) && (!burst || pAxis->burstPoll_)) {
+      pAxis->pollStatus_.valid = true;
+    }
+  }
+
+  //The controller status was not read, so leave it as it was.
+  if (burst) {
+    return asynSuccess;
+  }
+
+  //Pack the first 32 bits of the limits, inputs and outputs into uint32_t params.
+  tlimBits_ = tlimPollBits_;
+  toutBits_ = toutPollBits_;
+  tinBits_ = tinPollBits_;
+  setIntegerParam(P6K_C_TLIM_Bits_, tlimBits_.toUInt32());
+  setIntegerParam(P6K_C_TOUT_Bits_, toutBits_.toUInt32());
+  setIntegerParam(P6K_C_TIN_Bits_, tinBits_.toUInt32());
+  if (toutBits_.size() > 0) {
+    numOutputs_ = toutBits_.size();
+  }
    
   if (stat) {
-    stat = (setIntegerParam(P6K_C_TSS_SystemReady_, (stringVal[P6K_TSS_SYSTEMREADY_] == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_ProgRunning_, (stringVal[P6K_TSS_PROGRUNNING_] == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_Immediate_,   (stringVal[P6K_TSS_IMMEDIATE_]   == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_CmdError_,    (stringVal[P6K_TSS_CMDERROR_]    == P6K_ON_)) == asynSuccess) && stat;
-    stat = (setIntegerParam(P6K_C_TSS_MemError_,    (stringVal[P6K_TSS_MEMERROR_]    == P6K_ON_)) == asynSuccess) && stat;
+    stat = (setIntegerParam(P6K_C_TSS_SystemReady_, ((tss >> P6K_TSS_SYSTEMREADY_) & 0x1)) == asynSuccess) && stat;
+    stat = (setIntegerParam(P6K_C_TSS_ProgRunning_, ((tss >> P6K_TSS_PROGRUNNING_) & 0x1)) == asynSuccess) && stat;
+    stat = (setIntegerParam(P6K_C_TSS_Immediate_,   ((tss >> P6K_TSS_IMMEDIATE_)   & 0x1)) == asynSuccess) && stat;
+    stat = (setIntegerParam(P6K_C_TSS_CmdError_,    ((tss >> P6K_TSS_CMDERROR_)    & 0x1)) == asynSuccess) && stat;
+    stat = (setIntegerParam(P6K_C_TSS_MemError_,    ((tss >> P6K_TSS_MEMERROR_)    & 0x1)) == asynSuccess) && stat;
   }
   
   callParamCallbacks();
@@ -980,6 +1675,36 @@ asynStatus p6kController::poll()
 }
 
 
+/**
+ * Start or stop recording the commands and raw replies on all the ports
+ * used by this controller (see p6kCaptureWriter for the file format).
+ * The file can be served back to a controller with p6kCreateReplayPort.
+ * This doesn't need the driver lock.
+ * @param filename The capture file to write, or NULL or an empty string to stop capturing.
+ * @return asynStatus
+ */
+asynStatus p6kController::capture(const char *filename)
+{
+  static const char *functionName = "p6kController::capture";
+
+  if ((filename == NULL) || (filename[0] == '\0')) {
+    if (capture_.isOpen()) {
+      capture_.close();
+      printf("%s: %s stopped capture after %u records.\n", functionName, this->portName, capture_.records());
+    }
+    return asynSuccess;
+  }
+
+  if (capture_.open(filename) != asynSuccess) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s ERROR: Could not open capture file %s.\n", functionName, filename);
+    return asynError;
+  }
+
+  printf("%s: %s capturing to %s\n", functionName, this->portName, filename);
+  return asynSuccess;
+}
+
 /**
  * Write a configuration file to the controller. This function reads a ASCII file
  * that should only contain P6K commands terminated by a newline. 
@@ -993,6 +1718,13 @@ asynStatus p6kController::poll()
  * the axis objects are instantiated. Calling this function to setup the controller
  * is optional. The driver can be used without it if the user has another means of 
  * pre-configuring the controller.
+ *
+ * The caller must hold the lock. The lock is released between commands, and while
+ * each command is sent, so a stop only waits for one upload line. If there is a 
+ * separate status port polling carries on during the upload, otherwise it is paused.
+ * Any other command for the command port (eg. a move, or the auto power off)
+ * is refused with asynDisabled until the upload is finished, so that it can't
+ * end up between a DEF and END. Immediate commands (eg. !S) are still sent.
  * 
  * @param filename (and full path)
  * @return asynStatus
@@ -1004,13 +1736,19 @@ asynStatus p6kController::upload(const char *filename)
   char line[P6K_MAXBUF_] = {0};
   char response[P6K_MAXBUF_] = {0};
   const char *whitespace = "# \n\t";
+  asynStatus lineStatus = asynSuccess;
   uint32_t count = 0;
   const char *functionName = "p6kController::upload";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);  
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);  
 
   printf("%s: Uploading file: %s\n", functionName, filename);  
 
+  commandLinkMutex_.lock();
+  uploading_ = true;
+  uploadThread_ = epicsThreadGetIdSelf();
+  commandLinkMutex_.unlock();
+
   if (access(filename, R_OK) != 0) {
     perror(functionName);
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -1033,8 +1771,12 @@ asynStatus p6kController::upload(const char *filename)
       //reject if any whitespace (but allow in IF statements)
       if ((strpbrk(line, whitespace) == NULL) || (strncmp(line, "IF", 2) == 0)) {
 	printf("%s: %s\n", functionName, line);
-	epicsThreadSleep(0.05);
-	if (lowLevelWriteRead(line, response) != asynSuccess) {
+	uploadSleep(0.05);
+	unlock();
+	lineStatus = lowLevelWriteRead(lowLevelPortUser_, &commandLinkMutex_, line, response);
+	lock();
+	setIntegerParam(P6K_C_CommsError_, (lineStatus == asynSuccess) ? P6K_OK_ : P6K_ERROR_);
+	if (lineStatus != asynSuccess) {
 	  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 		    "%s: Command %s failed.\n", functionName, line);
 	  status = asynError;
@@ -1067,11 +1809,103 @@ asynStatus p6kController::upload(const char *filename)
     callParamCallbacks();
   }
 
-  epicsThreadSleep(5);
+  uploadSleep(5);
+
+  commandLinkMutex_.lock();
+  uploading_ = false;
+  uploadThread_ = NULL;
+  commandLinkMutex_.unlock();
+
+  return status;
+}
+
+
+/**
+ * Stop (or kill) all the axes with a single immediate command (!S or !K),
+ * rather than stopping each axis in turn. Any pending deferred moves are 
+ * cancelled, and the poller is woken up to read the new status.
+ * @param kill Set to true to kill motion (!K), rather than decelerate to a stop (!S).
+ * @return asynStatus
+ */
+asynStatus p6kController::stopAll(bool kill)
+{
+  asynStatus status = asynSuccess;
+  p6kBuffer command;
+  char response[P6K_MAXBUF_] = {0};
+  epicsTimeStamp startTime;
+  epicsTimeStamp endTime;
+  p6kAxis *pAxis = NULL;
+  static const char *functionName = "p6kController::stopAll";
+
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
+
+  p6kClock::getClock()->getCurrent(&startTime);
+  p6kCommand::encode(&command, (kill ? P6K_CMDID_K : P6K_CMDID_S), 0);
+  status = lowLevelWriteRead(command.c_str(), response);
+  p6kClock::getClock()->getCurrent(&endTime);
+  setStopLatency(epicsTimeDiffInSeconds(&endTime, &startTime));
+
+  if (status != asynSuccess) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+	      "%s: ERROR: %s failed on controller %s\n", functionName, command.c_str(), this->portName);
+    setStringParam(P6K_C_Error_, (kill ? "ERROR: Kill all failed" : "ERROR: Stop all failed"));
+  }
+
+  //Cancel any deferred moves that have not been sent yet
+  for (int32_t axis=0; axis<numAxes_; ++axis) {
+    pAxis = getAxis(axis);
+    if (pAxis != NULL) {
+      pAxis->deferredMove_ = 0;
+    }
+  }
+
+  wakeupPoller();
 
   return status;
 }
 
+/**
+ * Record how long a stop command took. This sets the last and 
+ * maximum stop latency params (in ms) and does callbacks.
+ * @param latency The time (in seconds) from receiving the stop to the controller acknowledging it.
+ */
+void p6kController::setStopLatency(double latency)
+{
+  double latencyMax = 0.0;
+
+  latency = latency * 1000.0;
+  getDoubleParam(P6K_C_StopLatencyMax_, &latencyMax);
+  setDoubleParam(P6K_C_StopLatency_, latency);
+  if (latency > latencyMax) {
+    setDoubleParam(P6K_C_StopLatencyMax_, latency);
+  }
+  callParamCallbacks();
+}
+
+/**
+ * Take a copy of the asyn trace masks, for P6K_TRACE_FLOW and P6K_TRACE_IO.
+ * This is done on every poll, so that the hot paths don't have to ask asynTrace
+ * for the mask on every call.
+ */
+void p6kController::updateTraceMasks(void)
+{
+  traceMask_ = pasynTrace->getTraceMask(this->pasynUserSelf);
+  commandTraceMask_ = (lowLevelPortUser_ != NULL) ? pasynTrace->getTraceMask(lowLevelPortUser_) : 0;
+  statusTraceMask_ = (statusPortUser_ != NULL) ? pasynTrace->getTraceMask(statusPortUser_) : commandTraceMask_;
+}
+
+/**
+ * Sleep between upload commands, with the lock released so that stops and
+ * polls are not held up. The command port is kept for the upload (see upload),
+ * and with a single port the poller skips its status queries (see poll).
+ * @param delay The time to sleep (in seconds)
+ */
+void p6kController::uploadSleep(double delay)
+{
+  unlock();
+  p6kClock::getClock()->sleep(delay);
+  lock();
+}
 
 /**
  * Implement co-ordinated moves.
@@ -1083,15 +1917,16 @@ asynStatus p6kController::setDeferredMoves(bool deferMoves)
 {
   asynStatus status = asynSuccess;
   bool stat = true;
-  char command[P6K_MAXBUF_] = {0};
+  p6kBuffer command;
   char response[P6K_MAXBUF_] = {0};
-  uint32_t move[P6K_MAXAXES_+1] = {0};
+  char go_cmd[P6K_MAXBUF_] = {0};
+  p6kBitMask move(numAxes_-1);
   p6kAxis *pAxis = NULL;
   static const char *functionName = "p6kController::setDeferredMoves";
 
   cout << functionName << endl;
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s\n", functionName);
+  P6K_TRACE_FLOW(traceMask_, this->pasynUserSelf, "%s\n", functionName);
 
   //If we are not ending deferred moves then return
   if (deferMoves || !movesDeferred_) {
@@ -1104,16 +1939,20 @@ asynStatus p6kController::setDeferredMoves(bool deferMoves)
     pAxis = getAxis(axis);
     if (pAxis != NULL) {
       if (pAxis->deferredMove_) {
-	epicsSnprintf(command, P6K_MAXBUF, "%dD%d", pAxis->axisNo_, pAxis->deferredPosition_);
-	stat = (lowLevelWriteRead(command, response) == asynSuccess) && stat;
-	if (static_cast<uint32_t>(axis) <= P6K_MAXAXES_) {
-	  move[axis] = 1;
+	p6kCommand::encode(&command, P6K_CMDID_D, pAxis->axisNo_, static_cast<epicsInt32>(pAxis->deferredPosition_));
+	stat = (lowLevelWriteRead(command.c_str(), response) == asynSuccess) && stat;
+	//Bit 0 of the GO command is axis 1
+	if (pAxis->axisNo_ > 0) {
+	  move.set(pAxis->axisNo_-1);
 	}
-	memset(command, 0, sizeof(command));
+	++pAxis->moveSequence_;
+	pAxis->startBurst();
       }
     }
   }
 
+  stat = (move.format(go_cmd, P6K_MAXBUF_) >= 0) && stat;
+
   //If any commands failed, don't execute, cancel deferred move and return
   if (!stat) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -1122,9 +1961,8 @@ asynStatus p6kController::setDeferredMoves(bool deferMoves)
   } else {
   
     //Execute the deferred move
-    epicsSnprintf(command, P6K_MAXBUF, "GO%d%d%d%d%d%d%d%d", 
-	     move[1],move[2],move[3],move[4],move[5],move[6],move[7],move[8]);
-    if (lowLevelWriteRead(command, response) != asynSuccess) {
+    p6kCommand::encode(&command, P6K_CMDID_GO, 0, go_cmd);
+    if (lowLevelWriteRead(command.c_str(), response) != asynSuccess) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
 		"%s ERROR Sending Deferred Move Command.\n", functionName);
       setStringParam(P6K_C_Error_, "ERROR: Deferred Move Failed");
@@ -1167,12 +2005,14 @@ extern "C" {
  */
 asynStatus p6kCreateController(const char *portName, const char *lowLevelPortName, 
 			       int lowLevelPortAddress, int numAxes, 
-			       int movingPollPeriod, int idlePollPeriod)
+			       int movingPollPeriod, int idlePollPeriod,
+			       const char *statusPortName)
 {
 
     p6kController *pp6kController
       = new p6kController(portName, lowLevelPortName, lowLevelPortAddress, 
-			  numAxes, movingPollPeriod/1000., idlePollPeriod/1000.);
+			  numAxes, movingPollPeriod/1000., idlePollPeriod/1000.,
+			  statusPortName);
     if (pp6kController) {
       pp6kController = NULL;
     }
@@ -1326,6 +2166,39 @@ asynStatus p6kUpload(const char *p6kName, const char *filename)
 
 
 
+/**
+ * Wrapper for p6kController::capture.
+ * If the controller has not been created yet, capturing starts when 
+ * it is created, so that the capture includes the startup queries.
+ * @param p6kName Controller port name
+ * @param filename The capture file to write, or an empty string to stop capturing.
+ */
+asynStatus p6kCapture(const char *p6kName, const char *filename)
+{
+  p6kController *pC;
+  static const char *functionName = "p6kCapture";
+
+  if (p6kName == NULL) {
+    return asynError;
+  }
+
+  pC = (p6kController*) findAsynPortDriver(p6kName);
+  if (!pC) {
+    if ((filename == NULL) || (filename[0] == '\0')) {
+      pendingCaptures.erase(p6kName);
+    } else {
+      pendingCaptures[p6kName] = filename;
+      printf("%s:%s: Port %s not created yet. Capture will start when it is.\n",
+	     driverName, functionName, p6kName);
+    }
+    return asynSuccess;
+  }
+
+  return pC->capture(filename);
+}
+
+
+
 /* Code for iocsh registration */
 
 /* p6kCreateController */
@@ -1335,16 +2208,18 @@ static const iocshArg p6kCreateControllerArg2 = {"Low level port address", iocsh
 static const iocshArg p6kCreateControllerArg3 = {"Number of axes", iocshArgInt};
 static const iocshArg p6kCreateControllerArg4 = {"Moving poll rate (ms)", iocshArgInt};
 static const iocshArg p6kCreateControllerArg5 = {"Idle poll rate (ms)", iocshArgInt};
+static const iocshArg p6kCreateControllerArg6 = {"Status port name (optional)", iocshArgString};
 static const iocshArg * const p6kCreateControllerArgs[] = {&p6kCreateControllerArg0,
 							    &p6kCreateControllerArg1,
 							    &p6kCreateControllerArg2,
 							    &p6kCreateControllerArg3,
 							    &p6kCreateControllerArg4,
-							    &p6kCreateControllerArg5};
-static const iocshFuncDef configp6kCreateController = {"p6kCreateController", 6, p6kCreateControllerArgs};
+							    &p6kCreateControllerArg5,
+							    &p6kCreateControllerArg6};
+static const iocshFuncDef configp6kCreateController = {"p6kCreateController", 7, p6kCreateControllerArgs};
 static void configp6kCreateControllerCallFunc(const iocshArgBuf *args)
 {
-  p6kCreateController(args[0].sval, args[1].sval, args[2].ival, args[3].ival, args[4].ival, args[5].ival);
+  p6kCreateController(args[0].sval, args[1].sval, args[2].ival, args[3].ival, args[4].ival, args[5].ival, args[6].sval);
 }
 
 
@@ -1401,6 +2276,17 @@ static void configp6kUploadCallFunc(const iocshArgBuf *args)
   p6kUpload(args[0].sval, args[1].sval);
 }
 
+/* p6kCapture */
+static const iocshArg p6kCaptureArg0 = {"Controller port name", iocshArgString};
+static const iocshArg p6kCaptureArg1 = {"Filename (empty to stop)", iocshArgString};
+static const iocshArg * const p6kCaptureArgs[] = {&p6kCaptureArg0,
+						  &p6kCaptureArg1};
+static const iocshFuncDef configp6kCapture = {"p6kCapture", 2, p6kCaptureArgs};
+static void configp6kCaptureCallFunc(const iocshArgBuf *args)
+{
+  p6kCapture(args[0].sval, args[1].sval);
+}
+
 
 static void p6kControllerRegister(void)
 {
@@ -1409,6 +2295,7 @@ static void p6kControllerRegister(void)
   iocshRegister(&configp6kModbusEncAxis,      configp6kModbusEncAxisCallFunc);
   iocshRegister(&configp6kAxes,               configp6kAxesCallFunc);
   iocshRegister(&configp6kUpload,             configp6kUploadCallFunc);
+  iocshRegister(&configp6kCapture,            configp6kCaptureCallFunc);
 }
 epicsExportRegistrar(p6kControllerRegister);
 
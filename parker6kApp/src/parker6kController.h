@@ -12,9 +12,23 @@
 #ifndef parker6kController_H
 #define parker6kController_H
 
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
 #include "parker6kAxis.h"
+#include "parker6kBits.h"
+#include "parker6kBuffer.h"
+#include "parker6kCommand.h"
+#include "parker6kCapture.h"
+#include "parker6kClock.h"
+#include "parker6kFramer.h"
+#include "parker6kPollScheduler.h"
+#include "parker6kTcpLink.h"
+#include "parker6kTrace.h"
 
 #define P6K_C_FirstParamString "P6K_C_FIRSTPARAM"
 #define P6K_C_LastParamString  "P6K_C_LASTPARAM"
@@ -39,6 +53,14 @@
 #define P6K_C_OUT_BitString         "P6K_C_OUT_BIT"
 #define P6K_C_OUT_ValString         "P6K_C_OUT_VAL"
 #define P6K_C_OUT_AllString         "P6K_C_OUT_ALL"
+#define P6K_C_StopLatencyString     "P6K_C_STOP_LATENCY"
+#define P6K_C_StopLatencyMaxString  "P6K_C_STOP_LATENCY_MAX"
+#define P6K_C_StopAllString         "P6K_C_STOP_ALL"
+#define P6K_C_KillAllString         "P6K_C_KILL_ALL"
+#define P6K_C_StatusArrayString     "P6K_C_STATUS_ARRAY"
+#define P6K_C_MovingPollPeriodString "P6K_C_MOVING_POLL_PERIOD"
+#define P6K_C_IdlePollPeriodString  "P6K_C_IDLE_POLL_PERIOD"
+#define P6K_C_ForcedFastPollsString "P6K_C_FORCED_FAST_POLLS"
 
 //Axis specific parameters
 #define P6K_A_DRESString       "P6K_A_DRES"
@@ -56,6 +78,12 @@
 #define P6K_A_ErrorString      "P6K_A_ERROR"
 #define P6K_A_MoveErrorString  "P6K_A_MOVEERROR"
 #define P6K_A_DelayTimeString  "P6K_A_DELAYTIME"
+#define P6K_A_SettleWindowString  "P6K_A_SETTLE_WINDOW"
+#define P6K_A_SettleSamplesString  "P6K_A_SETTLE_SAMPLES"
+#define P6K_A_StatusFreshnessString  "P6K_A_STATUS_FRESHNESS"
+#define P6K_A_MoveCheckString  "P6K_A_MOVE_CHECK"
+#define P6K_A_BurstPollsString  "P6K_A_BURST_POLLS"
+#define P6K_A_BurstPeriodString  "P6K_A_BURST_PERIOD"
 #define P6K_A_TAS_DriveFaultString  "P6K_A_TAS_DRIVEFAULT"
 #define P6K_A_TAS_TimeoutString  "P6K_A_TAS_TIMEOUT"
 #define P6K_A_TAS_PosErrString  "P6K_A_TAS_POSERR"
@@ -71,59 +99,27 @@
 
 #define P6K_MAXBUF 1024
 
-//Controller commands
-#define P6K_CMD_A        "A"
-#define P6K_CMD_AA       "AA"
-#define P6K_CMD_AD       "AD"
-#define P6K_CMD_ADA      "ADA"
-#define P6K_CMD_AXSDEF   "AXSDEF"
-#define P6K_CMD_CMDDIR   "CMDDIR"
-#define P6K_CMD_COMEXC   "COMEXC"
-#define P6K_CMD_D        "D"
-#define P6K_CMD_DRES     "DRES"
-#define P6K_CMD_DRFEN    "DRFEN"
-#define P6K_CMD_DRIVE    "DRIVE"
-#define P6K_CMD_ECHO     "ECHO"
-#define P6K_CMD_ENCCNT   "ENCCNT"
-#define P6K_CMD_ENCPOL   "ENCPOL"
-#define P6K_CMD_ERES     "ERES"
-#define P6K_CMD_ESK      "ESK"
-#define P6K_CMD_ESTALL   "ESTALL"
-#define P6K_CMD_GO       "GO"
-#define P6K_CMD_HOM      "HOM"
-#define P6K_CMD_HOMA     "HOMA"
-#define P6K_CMD_HOMAA    "HOMAA"
-#define P6K_CMD_HOMAD    "HOMAD"
-#define P6K_CMD_HOMADA   "HOMADA"
-#define P6K_CMD_HOMV     "HOMV"
-#define P6K_CMD_LH       "LH"
-#define P6K_CMD_LS       "LS"
-#define P6K_CMD_LSNEG    "LSNEG"
-#define P6K_CMD_LSPOS    "LSPOS"
-#define P6K_CMD_MA       "MA"
-#define P6K_CMD_OUT      "OUT"
-#define P6K_CMD_PESET    "PESET"
-#define P6K_CMD_PSET     "PSET"
-#define P6K_CMD_S        "S"
-#define P6K_CMD_TAS      "TAS"
-#define P6K_CMD_TIN      "TIN"
-#define P6K_CMD_TLIM     "TLIM"
-#define P6K_CMD_TOUT     "TOUT"
-#define P6K_CMD_TPC      "TPC"
-#define P6K_CMD_TPE      "TPE"
-#define P6K_CMD_TREV     "TREV"
-#define P6K_CMD_TSS      "TSS"
-#define P6K_CMD_V        "V"
+/* Layout of P6K_C_STATUS_ARRAY. There are P6K_STATUS_ARRAY_STRIDE values for 
+   each axis, starting with axis 1 at index 0. */
+#define P6K_STATUS_ARRAY_STRIDE    4
+#define P6K_STATUS_ARRAY_POSITION  0   /* Commanded position (motorPosition) */
+#define P6K_STATUS_ARRAY_ENCODER   1   /* Encoder position (motorEncoderPosition) */
+#define P6K_STATUS_ARRAY_TAS       2   /* TAS bits, packed (bit 0 is the first bit of the reply) */
+#define P6K_STATUS_ARRAY_ERROR     3   /* Error code, made of the P6K_STATUS_ERROR bits */
+
+#define P6K_STATUS_ERROR_PROBLEM   0x1 /* motorStatusProblem is set */
+#define P6K_STATUS_ERROR_COMMS     0x2 /* motorStatusCommsError is set */
+#define P6K_STATUS_ERROR_NOSTATUS  0x4 /* The status was not read on the last poll */
 
 /**
  * p6kController derives from the virtual class asynMotorController.
- * 
+ * It can also be polled by the shared poll scheduler (see p6kPollClient).
  */
-class p6kController : public asynMotorController {
+class p6kController : public asynMotorController, public p6kPollClient {
 
  public:
   p6kController(const char *portName, const char *lowLevelPortName, int lowLevelPortAddress, int numAxes, double movingPollPeriod, 
-		double idlePollPeriod);
+		double idlePollPeriod, const char *statusPortName = NULL);
 
   virtual ~p6kController();
 
@@ -132,6 +128,11 @@ class p6kController : public asynMotorController {
   /* These are the methods that we override */
   asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
   asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+  asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
+  using asynMotorController::setIntegerParam;
+  using asynMotorController::setDoubleParam;
+  asynStatus setIntegerParam(int list, int index, int value);
+  asynStatus setDoubleParam(int list, int index, double value);
   asynStatus setDeferredMoves(bool deferMoves);
   virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, 
                                     size_t nChars, size_t *nActual);
@@ -139,8 +140,12 @@ class p6kController : public asynMotorController {
   p6kAxis* getAxis(asynUser *pasynUser);
   p6kAxis* getAxis(int axisNo);
   asynStatus poll();
+  asynStatus wakeupPoller();
+  double pollSweep(bool wakeup);
+  const char *pollName(void) const;
 
   asynStatus upload(const char *filename); 
+  asynStatus capture(const char *filename);
 
  protected:
   p6kAxis **pAxes_;       /**< Array of pointers to axis objects */
@@ -169,6 +174,12 @@ class p6kController : public asynMotorController {
   int P6K_C_Config_;
   int P6K_C_Log_;
   int P6K_A_DelayTime_;
+  int P6K_A_SettleWindow_;
+  int P6K_A_SettleSamples_;
+  int P6K_A_StatusFreshness_;
+  int P6K_A_MoveCheck_;
+  int P6K_A_BurstPolls_;
+  int P6K_A_BurstPeriod_;
   int P6K_A_TAS_DriveFault_;
   int P6K_A_TAS_Timeout_;
   int P6K_A_TAS_PosErr_;
@@ -194,12 +205,29 @@ class p6kController : public asynMotorController {
   int P6K_C_OUT_Bit_;
   int P6K_C_OUT_Val_;
   int P6K_C_OUT_All_;
+  int P6K_C_StopLatency_;
+  int P6K_C_StopLatencyMax_;
+  int P6K_C_StopAll_;
+  int P6K_C_KillAll_;
+  int P6K_C_StatusArray_;
+  int P6K_C_MovingPollPeriod_;
+  int P6K_C_IdlePollPeriod_;
+  int P6K_C_ForcedFastPolls_;
   int P6K_C_LastParam_;
   #define LAST_P6K_PARAM P6K_C_LastParam_
 
  private:
   p6kAxis *pAxisZero;
   asynUser* lowLevelPortUser_;
+  asynUser* statusPortUser_;
+  asynUser* immediatePortUser_;
+  epicsMutex commandLinkMutex_;
+  epicsMutex statusLinkMutex_;
+  p6kFramer commandFramer_;
+  p6kFramer statusFramer_;
+  p6kFramer immediateFramer_;
+  p6kTcpLink *commandTcpLink_;
+  p6kTcpLink *statusTcpLink_;
   epicsUInt32 movesDeferred_;
   epicsTimeStamp nowTime_;
   epicsFloat64 nowTimeSecs_;
@@ -208,34 +236,67 @@ class p6kController : public asynMotorController {
   bool printErrors_;
   double movingPollPeriod_;
   double idlePollPeriod_;
+  bool sharedPoller_;
+  epicsUInt32 forcedFastPollsLeft_;
+  bool burstPoll_;
+  epicsUInt32 numOutputs_;
+  p6kBitMask tlimBits_;
+  p6kBitMask toutBits_;
+  p6kBitMask tinBits_;
+  p6kBitMask tlimPollBits_;
+  p6kBitMask toutPollBits_;
+  p6kBitMask tinPollBits_;
+  bool logComms_;
+  bool uploading_;
+  epicsThreadId uploadThread_;
+  bool uploadPoll_;
+  p6kCaptureWriter capture_;
+  int traceMask_;
+  int commandTraceMask_;
+  int statusTraceMask_;
+  std::vector<epicsFloat64> statusArray_;
   asynStatus lowLevelWriteRead(const char *command, char *response);
-  asynStatus trimResponse(char *input, char *output);
-  asynStatus errorResponse(char *input, char *output);
-  asynStatus lowLevelPortConnect(const char *port, int addr, asynUser **ppasynUser, const char *inputEos, const char *outputEos);
+  asynStatus lowLevelStatusWriteRead(const char *command, char *response);
+  asynStatus lowLevelStatusWriteRead(const char * const *commands, char (*responses)[P6K_MAXBUF], 
+				     asynStatus *statuses, size_t count);
+  asynStatus lowLevelWriteRead(asynUser *pasynUser, epicsMutex *pLinkMutex, 
+			       const char *command, char *response);
+  p6kFramer *framer(asynUser *pasynUser);
+  p6kTcpLink *tcpLink(asynUser *pasynUser);
+  asynStatus lowLevelPortConnect(const char *port, int addr, asynUser **ppasynUser, const char *inputEos, const char *outputEos,
+				 p6kTcpLink **ppTcpLink);
   asynStatus startPoller(void);
+  void updateTraceMasks(void);
+  void uploadSleep(double delay);
+  void setStopLatency(double latency);
+  void axisPolled(int32_t axis);
+  void updateStatusArray(void);
+  bool updateBurst(void);
+  epicsFloat64 limitFloat64(int function, int axis, epicsFloat64 value, epicsFloat64 minimum, epicsFloat64 maximum);
+  asynStatus stopAll(bool kill);
   asynStatus setDigitalOutput(epicsInt32 bit, epicsInt32 enable);
   asynStatus setDigitalOutputs(epicsInt32 enable);
-  asynStatus getDigital(const char *command, size_t size, uint32_t *bits);
+  asynStatus getDigital(p6kCommandId id, p6kBitMask *pBits);
 
   //static class data members
 
   static const epicsUInt32 P6K_MAXBUF_;
-  static const epicsUInt32 P6K_MAXAXES_;
   static const epicsFloat64 P6K_TIMEOUT_;
   static const epicsUInt32 P6K_FORCED_FAST_POLLS_;
+  static const epicsFloat64 P6K_MIN_MOVING_POLL_PERIOD_;
   static const epicsUInt32 P6K_OK_;
   static const epicsUInt32 P6K_ERROR_;
   static const epicsUInt32 P6K_ERROR_PRINT_TIME_;
   static const epicsUInt32 P6K_MAX_DIGITS_;
+  static const epicsUInt32 P6K_NUM_OUTPUTS_;
 
   static const char * P6K_ASYN_IEOS_;
-  static const char * P6K_ASYN_IEOS_PROG_;
   static const char * P6K_ASYN_OEOS_;
 
   static const char P6K_ON_;
   static const char P6K_OFF_;
   static const char P6K_NOCHANGE_;
-  static const char P6K_UNDERSCORE_;
+  static const char P6K_IMMEDIATE_;
 
   static const epicsUInt32 P6K_TSS_SYSTEMREADY_;
   static const epicsUInt32 P6K_TSS_PROGRUNNING_;
@@ -246,9 +307,6 @@ class p6kController : public asynMotorController {
   static const epicsUInt32 P6K_TLIM_BIT1_;
   static const epicsUInt32 P6K_TLIM_BIT2_;
   static const epicsUInt32 P6K_TLIM_BIT3_;
-  static const epicsUInt32 P6K_TLIM_SIZE_;
-
-  static const epicsUInt32 P6K_UINT32_SIZE_;
 
   friend class p6kAxis;
 
@@ -0,0 +1,337 @@
+/********************************************
+ *  parker6kFramer.cpp
+ *
+ *  Incremental framer for the replies from
+ *  a 6K, which works on any size of chunk
+ *  read from the link.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include "parker6kFramer.h"
+
+#define P6K_FRAMER_MASK (P6K_FRAMER_SIZE - 1)
+
+const char p6kFramer::P6K_PROMPT_ = '>';
+const char p6kFramer::P6K_PROMPT_ERROR_ = '?';
+const char p6kFramer::P6K_PROMPT_PROGRAM_ = '-';
+
+/**
+ * Constructor. The framer starts outside of a program definition.
+ */
+p6kFramer::p6kFramer(void)
+  : program_(false),
+    overflows_(0)
+{
+  reset();
+}
+
+/**
+ * Throw away everything in the ring buffer, including any complete frames.
+ * This does not change the prompt, or the overflow count.
+ */
+void p6kFramer::reset(void)
+{
+  tail_ = 0;
+  scan_ = 0;
+  head_ = 0;
+  firstFrame_ = 0;
+  numFrames_ = 0;
+  startFrame(0);
+}
+
+/**
+ * Note a command that is about to be sent. A DEF starts a program definition,
+ * during which the 6K prompts with a -, and an END finishes it.
+ * @param command The command string
+ * @return true if the prompt changed.
+ */
+bool p6kFramer::command(const char *command)
+{
+  bool program = program_;
+
+  if (command == NULL) {
+    return false;
+  }
+
+  if (strncmp(command, "DEF", 3) == 0) {
+    program = true;
+  } else if (strncmp(command, "END", 3) == 0) {
+    program = false;
+  }
+
+  if (program == program_) {
+    return false;
+  }
+  program_ = program;
+  return true;
+}
+
+/**
+ * @return The prompt that ends a successful reply (> or -).
+ */
+char p6kFramer::prompt(void) const
+{
+  return program_ ? P6K_PROMPT_PROGRAM_ : P6K_PROMPT_;
+}
+
+/**
+ * Get the free space at the head of the ring buffer, to read into directly.
+ * This is contiguous, so it may be less than the total free space if it
+ * would wrap around (it is all of the ring buffer after a reset).
+ * If a partial frame has filled the ring buffer, it is thrown away first.
+ * @param pSpace Returns the number of characters that can be written
+ * @return Where to write them. Follow this with commit.
+ */
+char *p6kFramer::prepare(size_t *pSpace)
+{
+  size_t space = P6K_FRAMER_SIZE - (head_ - tail_);
+
+  if ((space == 0) && (numFrames_ == 0)) {
+    //The partial frame is all that is left, and it will never fit
+    ++overflows_;
+    tail_ = head_;
+    scan_ = head_;
+    startFrame(head_);
+    space = P6K_FRAMER_SIZE;
+  }
+
+  size_t index = head_ & P6K_FRAMER_MASK;
+  if (space > (P6K_FRAMER_SIZE - index)) {
+    space = P6K_FRAMER_SIZE - index;
+  }
+
+  *pSpace = space;
+  return &ring_[index];
+}
+
+/**
+ * Add characters that were written to the space returned by prepare, and scan them.
+ * @param length The number of characters written
+ */
+void p6kFramer::commit(size_t length)
+{
+  head_ += length;
+  scan();
+}
+
+/**
+ * Copy a chunk of data into the ring buffer, and scan it.
+ * @param data The characters read from the link
+ * @param length The number of characters
+ * @return The number of characters accepted. This is less than length
+ * if the ring buffer is full of complete frames (pop some, then try again).
+ */
+size_t p6kFramer::consume(const char *data, size_t length)
+{
+  size_t done = 0;
+
+  while (done < length) {
+    size_t space = 0;
+    char *pSpace = prepare(&space);
+    if (space == 0) {
+      break;
+    }
+    if (space > (length - done)) {
+      space = length - done;
+    }
+    memcpy(pSpace, data + done, space);
+    commit(space);
+    done += space;
+  }
+
+  return done;
+}
+
+/**
+ * End the partial frame as if the prompt had been read. This is used when
+ * the low level port has already removed the prompt (it is the input EOS).
+ * @return false if there is no room in the frame queue.
+ */
+bool p6kFramer::terminate(void)
+{
+  if ((scan_ != head_) || (numFrames_ == P6K_FRAMER_FRAMES)) {
+    return false;
+  }
+
+  endFrame(program_ ? P6K_FRAME_PROGRAM : P6K_FRAME_REPLY, head_, head_);
+  return true;
+}
+
+/**
+ * Get the oldest complete frame. It stays in the ring buffer until pop is called.
+ * @param pFrame Returns the frame
+ * @return false if there are no complete frames.
+ */
+bool p6kFramer::front(p6kFrame *pFrame) const
+{
+  if (numFrames_ == 0) {
+    return false;
+  }
+  *pFrame = queue_[firstFrame_];
+  return true;
+}
+
+/**
+ * Release the oldest complete frame, and scan anything that was waiting for room in the queue.
+ */
+void p6kFramer::pop(void)
+{
+  if (numFrames_ == 0) {
+    return;
+  }
+
+  const p6kFrame &frame = queue_[firstFrame_];
+  tail_ = frame.start + frame.length;
+  firstFrame_ = (firstFrame_ + 1) % P6K_FRAMER_FRAMES;
+  --numFrames_;
+
+  scan();
+}
+
+/**
+ * @return The number of complete frames.
+ */
+size_t p6kFramer::frames(void) const
+{
+  return numFrames_;
+}
+
+/**
+ * @param offset A frame offset (see p6kFrame)
+ * @return The character at that offset.
+ */
+char p6kFramer::at(size_t offset) const
+{
+  return ring_[offset & P6K_FRAMER_MASK];
+}
+
+/**
+ * Copy the text of a frame into a caller's buffer, truncating it if necessary.
+ * The frame must not have been popped.
+ * @param frame The frame
+ * @param output Buffer for the text
+ * @param maxChars The size of output, including the terminator.
+ * @return The number of characters copied.
+ */
+size_t p6kFramer::copyText(const p6kFrame &frame, char *output, size_t maxChars) const
+{
+  if ((output == NULL) || (maxChars == 0)) {
+    return 0;
+  }
+
+  size_t length = frame.textLength;
+  if (length > (maxChars - 1)) {
+    length = maxChars - 1;
+  }
+
+  //The text may wrap around the end of the ring buffer
+  size_t index = frame.text & P6K_FRAMER_MASK;
+  size_t first = P6K_FRAMER_SIZE - index;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(output, &ring_[index], first);
+  memcpy(output + first, &ring_[0], length - first);
+  output[length] = '\0';
+
+  return length;
+}
+
+/**
+ * @return The number of characters in the ring buffer, including complete frames.
+ */
+size_t p6kFramer::pending(void) const
+{
+  return head_ - tail_;
+}
+
+/**
+ * @return The number of partial frames that were thrown away because they filled the ring buffer.
+ */
+epicsUInt32 p6kFramer::overflows(void) const
+{
+  return overflows_;
+}
+
+/**
+ * Scan the new characters, until they run out or the frame queue is full.
+ */
+void p6kFramer::scan(void)
+{
+  char promptChar = prompt();
+
+  while ((scan_ != head_) && (numFrames_ < P6K_FRAMER_FRAMES)) {
+    size_t pos = scan_++;
+    char c = ring_[pos & P6K_FRAMER_MASK];
+
+    //A prompt is only recognised at the start of a line
+    if (lineStart_ && (c == P6K_PROMPT_ERROR_)) {
+      endFrame(P6K_FRAME_ERROR, pos, scan_);
+      continue;
+    }
+    if (lineStart_ && (c == promptChar)) {
+      endFrame(program_ ? P6K_FRAME_PROGRAM : P6K_FRAME_REPLY, pos, scan_);
+      continue;
+    }
+
+    if ((c == '\r') || (c == '\n')) {
+      //The reply text is the rest of the line after the '*'
+      if (haveHeader_ && !textDone_) {
+	partial_.textLength = pos - partial_.text;
+	textDone_ = true;
+      }
+      if (c == '\n') {
+	partial_.lineEnd = partial_.lineEnd || (lastChar_ == '\r');
+	lineStart_ = true;
+      }
+    } else {
+      //There may be some leading chars before the '*', eg. a space
+      if ((c == '*') && !haveHeader_) {
+	haveHeader_ = true;
+	partial_.text = scan_;
+      }
+      lineStart_ = false;
+    }
+    lastChar_ = c;
+  }
+}
+
+/**
+ * Queue the partial frame, and start a new one.
+ * @param type How the frame was ended
+ * @param textEnd Where the reply text ends, if there was no line ending
+ * @param end The offset after the last character of the frame
+ */
+void p6kFramer::endFrame(p6kFrameType type, size_t textEnd, size_t end)
+{
+  partial_.type = type;
+  partial_.length = end - partial_.start;
+  if (haveHeader_ && !textDone_) {
+    partial_.textLength = textEnd - partial_.text;
+  }
+
+  queue_[(firstFrame_ + numFrames_) % P6K_FRAMER_FRAMES] = partial_;
+  ++numFrames_;
+
+  startFrame(end);
+}
+
+/**
+ * Start scanning a new frame.
+ * @param start The offset of the first character
+ */
+void p6kFramer::startFrame(size_t start)
+{
+  partial_.type = P6K_FRAME_REPLY;
+  partial_.start = start;
+  partial_.length = 0;
+  partial_.text = start;
+  partial_.textLength = 0;
+  partial_.lineEnd = false;
+  lineStart_ = true;
+  haveHeader_ = false;
+  textDone_ = false;
+  lastChar_ = '\0';
+}
@@ -0,0 +1,113 @@
+/********************************************
+ *  parker6kFramer.h
+ *
+ *  Incremental framer for the replies from
+ *  a 6K, which works on any size of chunk
+ *  read from the link.
+ *
+ ********************************************/
+
+#ifndef parker6kFramer_H
+#define parker6kFramer_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+
+/** Size of the ring buffer. This must be a power of 2. */
+#define P6K_FRAMER_SIZE 2048
+/** Number of complete frames that can be queued before the framer stops scanning. */
+#define P6K_FRAMER_FRAMES 16
+
+/** How a frame was ended */
+typedef enum {
+  P6K_FRAME_REPLY,      /**< The > prompt, after a command was accepted */
+  P6K_FRAME_ERROR,      /**< The ? prompt, after a command was rejected */
+  P6K_FRAME_PROGRAM     /**< The - prompt, while defining a program (between DEF and END) */
+} p6kFrameType;
+
+/**
+ * A complete reply, found by p6kFramer. The offsets are positions in
+ * the framer's ring buffer (see p6kFramer::at), so nothing is copied
+ * until the caller asks for the text (see p6kFramer::copyText).
+ */
+typedef struct p6kFrame {
+  p6kFrameType type;
+  size_t start;         /**< Offset of the first character */
+  size_t length;        /**< Length of the frame, including the prompt */
+  size_t text;          /**< Offset of the reply text (after the '*') */
+  size_t textLength;    /**< Length of the reply text, not including the line ending */
+  bool lineEnd;         /**< Set if a \r\n was found before the prompt */
+} p6kFrame;
+
+/**
+ * p6kFramer splits the byte stream from a 6K into replies. A reply is
+ * optional text (a line starting with '*', eg. "*1TPC+0\r\r\n") followed
+ * by a prompt. A prompt is only recognised at the start of a line (or at
+ * the start of a frame), so the '-' in eg. a TREV reply is not taken to
+ * be the program definition prompt.
+ *
+ * Data is either read straight into the ring buffer (see prepare and
+ * commit), or copied in with consume. Complete frames are then taken
+ * off the front of the queue (see front and pop).
+ *
+ * The framer also tracks the prompt that ends a successful reply, which
+ * changes from > to - while a program is being defined. Each command
+ * should be passed to p6kFramer::command before it is sent.
+ *
+ * If a partial frame fills the whole ring buffer, it is thrown away
+ * and counted (see overflows).
+ */
+class p6kFramer {
+
+ public:
+  p6kFramer(void);
+
+  void reset(void);
+  bool command(const char *command);
+  char prompt(void) const;
+
+  char *prepare(size_t *pSpace);
+  void commit(size_t length);
+  size_t consume(const char *data, size_t length);
+  bool terminate(void);
+
+  bool front(p6kFrame *pFrame) const;
+  void pop(void);
+  size_t frames(void) const;
+
+  char at(size_t offset) const;
+  size_t copyText(const p6kFrame &frame, char *output, size_t maxChars) const;
+  size_t pending(void) const;
+  epicsUInt32 overflows(void) const;
+
+  static const char P6K_PROMPT_;
+  static const char P6K_PROMPT_ERROR_;
+  static const char P6K_PROMPT_PROGRAM_;
+
+ private:
+  void scan(void);
+  void endFrame(p6kFrameType type, size_t textEnd, size_t end);
+  void startFrame(size_t start);
+
+  char ring_[P6K_FRAMER_SIZE];
+  size_t tail_;                  /**< Start of the oldest frame still in use */
+  size_t scan_;                  /**< Next character to scan */
+  size_t head_;                  /**< Where the next character read goes */
+
+  p6kFrame queue_[P6K_FRAMER_FRAMES];
+  size_t firstFrame_;
+  size_t numFrames_;
+
+  //State of the partial frame being scanned
+  p6kFrame partial_;
+  bool lineStart_;
+  bool haveHeader_;
+  bool textDone_;
+  char lastChar_;
+
+  bool program_;
+  epicsUInt32 overflows_;
+};
+
+#endif /* parker6kFramer_H */
@@ -0,0 +1,317 @@
+/********************************************
+ *  parker6kPollScheduler.cpp
+ *
+ *  Shared poll scheduler that can service
+ *  many p6kController objects from a small
+ *  pool of worker threads.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsExport.h>
+#include <iocsh.h>
+
+#include "parker6kPollScheduler.h"
+#include "parker6kClock.h"
+
+p6kPollScheduler *p6kPollScheduler::pInstance_ = NULL;
+const int p6kPollScheduler::P6K_MAX_POLL_THREADS_ = 16;
+
+/**
+ * Worker thread entry point.
+ */
+static void p6kPollSchedulerTaskC(void *pPvt)
+{
+  p6kPollScheduler *pScheduler = static_cast<p6kPollScheduler *>(pPvt);
+  pScheduler->workerTask();
+}
+
+/**
+ * Create the shared poll scheduler. This can only be done once per IOC, and it must
+ * be done before creating the controllers that should use it.
+ * @param numThreads The number of worker threads to create.
+ * @return asynStatus
+ */
+asynStatus p6kPollScheduler::create(int numThreads)
+{
+  static const char *functionName = "p6kPollScheduler::create";
+
+  if (pInstance_ != NULL) {
+    printf("%s: ERROR: The shared poll scheduler has already been created.\n", functionName);
+    return asynError;
+  }
+
+  if ((numThreads < 1) || (numThreads > P6K_MAX_POLL_THREADS_)) {
+    printf("%s: ERROR: Number of threads must be between 1 and %d.\n",
+	   functionName, P6K_MAX_POLL_THREADS_);
+    return asynError;
+  }
+
+  pInstance_ = new p6kPollScheduler(numThreads);
+
+  return asynSuccess;
+}
+
+/**
+ * Return the shared poll scheduler, or NULL if it has not been created.
+ */
+p6kPollScheduler* p6kPollScheduler::getInstance(void)
+{
+  return pInstance_;
+}
+
+/**
+ * Constructor. Start the worker threads.
+ * @param numThreads The number of worker threads to create.
+ */
+p6kPollScheduler::p6kPollScheduler(int numThreads)
+  : numThreads_(numThreads)
+{
+  char threadName[32] = {0};
+  static const char *functionName = "p6kPollScheduler::p6kPollScheduler";
+
+  printf("%s: Starting %d poll threads.\n", functionName, numThreads_);
+
+  wakeupEvent_ = epicsEventMustCreate(epicsEventEmpty);
+
+  for (int thread=0; thread<numThreads_; ++thread) {
+    epicsSnprintf(threadName, sizeof(threadName), "p6kPoller%d", thread);
+    epicsThreadCreate(threadName,
+		      epicsThreadPriorityMedium,
+		      epicsThreadGetStackSize(epicsThreadStackMedium),
+		      (EPICSTHREADFUNC)p6kPollSchedulerTaskC, this);
+  }
+}
+
+p6kPollScheduler::~p6kPollScheduler()
+{
+  //Destructor. Should never get here.
+}
+
+/**
+ * The current time in seconds, used for deadlines.
+ */
+double p6kPollScheduler::timeNow(void)
+{
+  return p6kClock::getClock()->now();
+}
+
+/**
+ * Register a controller with the scheduler. The first poll happens straight away.
+ * @param pClient The controller to poll
+ * @return asynStatus
+ */
+asynStatus p6kPollScheduler::addController(p6kPollClient *pClient)
+{
+  static const char *functionName = "p6kPollScheduler::addController";
+
+  mutex_.lock();
+  if (findEntry(pClient) != NULL) {
+    mutex_.unlock();
+    printf("%s: ERROR: Controller %s is already registered.\n", functionName, pClient->pollName());
+    return asynError;
+  }
+
+  p6kPollEntry *pEntry = new p6kPollEntry;
+  pEntry->pClient = pClient;
+  pEntry->deadline = 0.0;
+  pEntry->queued = false;
+  pEntry->running = false;
+  pEntry->wakeupPending = true;
+  pEntry->stopped = false;
+  pEntry->sweeps = 0;
+  entries_.push_back(pEntry);
+  schedule(pEntry, timeNow());
+  mutex_.unlock();
+
+  epicsEventSignal(wakeupEvent_);
+
+  return asynSuccess;
+}
+
+/**
+ * Request an immediate poll of a controller (the equivalent of
+ * asynMotorController::wakeupPoller). If the controller is being polled
+ * right now, it will be polled again as soon as that sweep is finished.
+ * A controller that has stopped polling (because it is shutting down) is left alone.
+ * @param pClient The controller to poll
+ * @return asynStatus
+ */
+asynStatus p6kPollScheduler::wakeup(p6kPollClient *pClient)
+{
+  double now = 0.0;
+
+  mutex_.lock();
+  p6kPollEntry *pEntry = findEntry(pClient);
+  if (pEntry == NULL) {
+    mutex_.unlock();
+    return asynError;
+  }
+  if (pEntry->stopped) {
+    mutex_.unlock();
+    return asynSuccess;
+  }
+  pEntry->wakeupPending = true;
+  //Don't move a controller back if it is already due, so repeated wakeups can't starve it
+  now = timeNow();
+  if (!pEntry->running && (!pEntry->queued || (pEntry->deadline > now))) {
+    schedule(pEntry, now);
+  }
+  mutex_.unlock();
+
+  epicsEventSignal(wakeupEvent_);
+
+  return asynSuccess;
+}
+
+/**
+ * Put an entry on the queue (or move it if it's already there).
+ * This must be called with mutex_ held.
+ */
+void p6kPollScheduler::schedule(p6kPollEntry *pEntry, double deadline)
+{
+  if (pEntry->queued) {
+    queue_.erase(pEntry->position);
+  }
+  pEntry->deadline = deadline;
+  pEntry->position = queue_.insert(std::make_pair(deadline, pEntry));
+  pEntry->queued = true;
+}
+
+/**
+ * Find the entry for a controller. This must be called with mutex_ held.
+ */
+p6kPollScheduler::p6kPollEntry* p6kPollScheduler::findEntry(p6kPollClient *pClient)
+{
+  for (std::vector<p6kPollEntry*>::iterator it=entries_.begin(); it!=entries_.end(); ++it) {
+    if ((*it)->pClient == pClient) {
+      return *it;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Worker thread. Wait for the earliest deadline, then poll that controller.
+ */
+void p6kPollScheduler::workerTask(void)
+{
+  double now = 0.0;
+  double timeout = 0.0;
+  bool wakeup = false;
+  p6kPollEntry *pEntry = NULL;
+
+  mutex_.lock();
+
+  while (1) {
+
+    if (queue_.empty()) {
+      mutex_.unlock();
+      epicsEventWait(wakeupEvent_);
+      mutex_.lock();
+      continue;
+    }
+
+    pEntry = queue_.begin()->second;
+    now = timeNow();
+    if (pEntry->deadline > now) {
+      mutex_.unlock();
+      p6kClock::getClock()->waitEvent(wakeupEvent_, pEntry->deadline - now);
+      mutex_.lock();
+      continue;
+    }
+
+    //Take the controller off the queue while we poll it
+    queue_.erase(pEntry->position);
+    pEntry->queued = false;
+    pEntry->running = true;
+    wakeup = pEntry->wakeupPending;
+    pEntry->wakeupPending = false;
+
+    //Let another worker look at the next deadline
+    if (!queue_.empty()) {
+      epicsEventSignal(wakeupEvent_);
+    }
+    mutex_.unlock();
+
+    timeout = pEntry->pClient->pollSweep(wakeup);
+
+    mutex_.lock();
+    pEntry->running = false;
+    ++pEntry->sweeps;
+    if (timeout < 0) {
+      //The controller is shutting down. Leave it off the queue.
+      pEntry->stopped = true;
+      continue;
+    }
+    //A zero timeout means only poll again on a wakeup (the same as asynMotorPoller).
+    if (pEntry->wakeupPending) {
+      schedule(pEntry, timeNow());
+    } else if (timeout > 0) {
+      schedule(pEntry, timeNow() + timeout);
+    }
+  }
+}
+
+/**
+ * Print the state of the scheduler.
+ */
+void p6kPollScheduler::report(FILE *fp, int level)
+{
+  double now = timeNow();
+
+  mutex_.lock();
+  fprintf(fp, "p6k shared poll scheduler, threads=%d, controllers=%d\n",
+	  numThreads_, static_cast<int>(entries_.size()));
+  if (level > 0) {
+    for (std::vector<p6kPollEntry*>::iterator it=entries_.begin(); it!=entries_.end(); ++it) {
+      fprintf(fp, "  %s sweeps=%u %s next poll in %f s\n",
+	      (*it)->pClient->pollName(), (*it)->sweeps,
+	      ((*it)->running ? "(polling)" : ((*it)->stopped ? "(stopped)" : "")),
+	      ((*it)->queued ? (*it)->deadline - now : 0.0));
+    }
+  }
+  mutex_.unlock();
+}
+
+
+/*************************************************************************************/
+/** The following functions have C linkage, and can be called directly or from iocsh */
+
+extern "C" {
+
+/**
+ * Create the shared poll scheduler.
+ * Controllers created after this will be polled by the shared threads
+ * instead of having their own poller thread.
+ * @param numThreads Number of worker threads.
+ */
+asynStatus p6kCreatePollScheduler(int numThreads)
+{
+  return p6kPollScheduler::create(numThreads);
+}
+
+/* Code for iocsh registration */
+
+/* p6kCreatePollScheduler */
+static const iocshArg p6kCreatePollSchedulerArg0 = {"Number of threads", iocshArgInt};
+static const iocshArg * const p6kCreatePollSchedulerArgs[] = {&p6kCreatePollSchedulerArg0};
+static const iocshFuncDef configp6kCreatePollScheduler = {"p6kCreatePollScheduler", 1, p6kCreatePollSchedulerArgs};
+static void configp6kCreatePollSchedulerCallFunc(const iocshArgBuf *args)
+{
+  p6kCreatePollScheduler(args[0].ival);
+}
+
+static void p6kPollSchedulerRegister(void)
+{
+  iocshRegister(&configp6kCreatePollScheduler, configp6kCreatePollSchedulerCallFunc);
+}
+epicsExportRegistrar(p6kPollSchedulerRegister);
+
+} // extern "C"
+
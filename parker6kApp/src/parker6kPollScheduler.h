@@ -0,0 +1,104 @@
+/********************************************
+ *  parker6kPollScheduler.h
+ *
+ *  Shared poll scheduler that can service
+ *  many p6kController objects from a small
+ *  pool of worker threads.
+ *
+ ********************************************/
+
+#ifndef parker6kPollScheduler_H
+#define parker6kPollScheduler_H
+
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+#include "asynDriver.h"
+
+/**
+ * Something that the shared poll scheduler can poll. p6kController implements
+ * this, and the scheduler tests use it to check the scheduling on its own.
+ */
+class p6kPollClient {
+
+ public:
+  virtual ~p6kPollClient() {}
+
+  /**
+   * Do one poll.
+   * @param wakeup Set to true if this poll was requested by a wakeup.
+   * @return The time (in seconds) until the next poll, zero to only poll
+   * again on a wakeup, or a negative value to stop polling altogether.
+   */
+  virtual double pollSweep(bool wakeup) = 0;
+
+  /** @return A name for the scheduler report. */
+  virtual const char *pollName(void) const = 0;
+};
+
+/**
+ * p6kPollScheduler replaces the per controller asynMotorController poller
+ * thread with a fixed number of worker threads that are shared between all
+ * the controllers registered with it.
+ *
+ * Each controller is held in a deadline ordered queue. A worker takes the controller
+ * with the earliest deadline, does one poll sweep of it (controller then all axes),
+ * and puts it back on the queue with the next deadline (moving or idle poll period).
+ * A controller is only ever in the queue once, so the polls for a single controller
+ * always run in order and never run on two threads at the same time.
+ *
+ * A controller that is shutting down (pollSweep returns a negative time) is taken
+ * off the queue for good, and any later wakeups are ignored.
+ *
+ * The scheduler is opt-in. It is created using p6kCreatePollScheduler in the IOC
+ * startup file, and any p6kController created after that will use it.
+ */
+class p6kPollScheduler {
+
+ public:
+  static asynStatus create(int numThreads);
+  static p6kPollScheduler* getInstance(void);
+
+  asynStatus addController(p6kPollClient *pClient);
+  asynStatus wakeup(p6kPollClient *pClient);
+  void report(FILE *fp, int level);
+  void workerTask(void);
+
+ private:
+  p6kPollScheduler(int numThreads);
+  virtual ~p6kPollScheduler();
+
+  /**
+   * Scheduling state for one controller.
+   */
+  struct p6kPollEntry {
+    p6kPollClient *pClient;
+    double deadline;
+    bool queued;
+    bool running;
+    bool wakeupPending;
+    bool stopped;
+    epicsUInt32 sweeps;
+    std::multimap<double, p6kPollEntry*>::iterator position;
+  };
+
+  void schedule(p6kPollEntry *pEntry, double deadline);
+  p6kPollEntry* findEntry(p6kPollClient *pClient);
+  static double timeNow(void);
+
+  epicsMutex mutex_;
+  epicsEventId wakeupEvent_;
+  std::multimap<double, p6kPollEntry*> queue_;
+  std::vector<p6kPollEntry*> entries_;
+  int numThreads_;
+
+  static p6kPollScheduler *pInstance_;
+  static const int P6K_MAX_POLL_THREADS_;
+};
+
+#endif /* parker6kPollScheduler_H */
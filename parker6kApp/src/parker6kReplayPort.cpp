@@ -0,0 +1,241 @@
+/********************************************
+ *  parker6kReplayPort.cpp
+ *
+ *  asyn octet port that plays back the replies
+ *  in a capture file written by p6kCapture,
+ *  so a session with a real 6K can be repeated
+ *  without the controller.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <epicsExport.h>
+#include <iocsh.h>
+
+#include "parker6kReplayPort.h"
+#include "parker6kClock.h"
+
+static const char *driverName = "p6kReplayPort";
+
+/**
+ * p6kReplayPort constructor. This reads the capture file and registers the asyn port.
+ * @param portName The asyn port name to give to p6kCreateController
+ * @param fileName The capture file written by p6kCapture
+ * @param channel Which port's records to serve (0=command port, 1=status port)
+ * @param realTime Set to 1 to wait for the recorded duration of each reply
+ */
+p6kReplayPort::p6kReplayPort(const char *portName, const char *fileName, int channel, int realTime)
+  : asynPortDriver(portName, 1,
+		   1, // Param table size (no params are used)
+		   asynOctetMask | asynDrvUserMask,
+		   0, // No interrupts
+		   ASYN_CANBLOCK, // Like the IP port, so realTime waits don't block the caller's thread
+		   1, // autoconnect
+		   0, 0), // Default priority and stack size
+    fileName_(fileName),
+    realTime_(realTime != 0),
+    next_(0),
+    mismatches_(0),
+    pPending_(NULL)
+{
+  static const char *functionName = "p6kReplayPort::p6kReplayPort";
+  std::vector<p6kCaptureRecord> all;
+
+  if (p6kCaptureReader::read(fileName, &all) != asynSuccess) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+	      "%s: ERROR: Could not read all of capture file %s (read %lu records).\n",
+	      functionName, fileName, static_cast<unsigned long>(all.size()));
+  }
+
+  for (size_t i=0; i<all.size(); ++i) {
+    if (all[i].channel == channel) {
+      records_.push_back(all[i]);
+    }
+  }
+}
+
+p6kReplayPort::~p6kReplayPort()
+{
+}
+
+/**
+ * @return The number of records for this port's channel.
+ */
+size_t p6kReplayPort::records(void) const
+{
+  return records_.size();
+}
+
+/**
+ * @return The number of replies served since the start (or the last rewind).
+ */
+size_t p6kReplayPort::served(void)
+{
+  mutex_.lock();
+  size_t n = next_;
+  mutex_.unlock();
+  return n;
+}
+
+/**
+ * @return The number of commands that didn't match the recording.
+ */
+size_t p6kReplayPort::mismatches(void)
+{
+  mutex_.lock();
+  size_t n = mismatches_;
+  mutex_.unlock();
+  return n;
+}
+
+/**
+ * Start serving replies from the beginning of the capture again.
+ */
+void p6kReplayPort::rewind(void)
+{
+  mutex_.lock();
+  next_ = 0;
+  mismatches_ = 0;
+  pPending_ = NULL;
+  mutex_.unlock();
+}
+
+/**
+ * Take the next record, and check that the command matches the recording.
+ */
+asynStatus p6kReplayPort::writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual)
+{
+  static const char *functionName = "p6kReplayPort::writeOctet";
+  std::string command(value, maxChars);
+
+  mutex_.lock();
+  if (next_ >= records_.size()) {
+    pPending_ = NULL;
+    mutex_.unlock();
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+	      "%s: ERROR: End of capture file %s. command: %s\n", functionName, fileName_.c_str(), command.c_str());
+    *nActual = 0;
+    return asynError;
+  }
+
+  pPending_ = &records_[next_++];
+  if (pPending_->command != command) {
+    ++mismatches_;
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+	      "%s: ERROR: Record %lu command mismatch. Expected: %s, Got: %s\n",
+	      functionName, static_cast<unsigned long>(next_ - 1), pPending_->command.c_str(), command.c_str());
+  }
+  mutex_.unlock();
+
+  *nActual = maxChars;
+  return asynSuccess;
+}
+
+/**
+ * Return the recorded reply to the last command written.
+ */
+asynStatus p6kReplayPort::readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason)
+{
+  double delay = 0.0;
+  asynStatus status = asynError;
+  size_t length = 0;
+
+  *nActual = 0;
+
+  mutex_.lock();
+  if (pPending_ != NULL) {
+    length = pPending_->reply.size();
+    if (length > maxChars) {
+      length = maxChars;
+    }
+    memcpy(value, pPending_->reply.data(), length);
+    if (length < maxChars) {
+      value[length] = '\0';
+    }
+    status = static_cast<asynStatus>(pPending_->status);
+    delay = pPending_->duration;
+    pPending_ = NULL;
+  }
+  mutex_.unlock();
+
+  if (realTime_ && (delay > 0.0)) {
+    p6kClock::getClock()->sleep(delay);
+  }
+
+  *nActual = length;
+  if (eomReason != NULL) {
+    *eomReason = (status == asynSuccess) ? ASYN_EOM_EOS : 0;
+  }
+  return status;
+}
+
+/**
+ * asynReport function.
+ */
+void p6kReplayPort::report(FILE *fp, int level)
+{
+  mutex_.lock();
+  fprintf(fp, "p6k replay port %s, file=%s, records=%lu, served=%lu, mismatches=%lu%s\n",
+	  this->portName, fileName_.c_str(), static_cast<unsigned long>(records_.size()),
+	  static_cast<unsigned long>(next_), static_cast<unsigned long>(mismatches_),
+	  (realTime_ ? " (real time)" : ""));
+  mutex_.unlock();
+
+  asynPortDriver::report(fp, level);
+}
+
+
+/*************************************************************************************/
+/** The following functions have C linkage, and can be called directly or from iocsh */
+
+extern "C" {
+
+/**
+ * C wrapper for the p6kReplayPort constructor.
+ * See p6kReplayPort::p6kReplayPort.
+ */
+asynStatus p6kCreateReplayPort(const char *portName, const char *fileName, int channel, int realTime)
+{
+  static const char *functionName = "p6kCreateReplayPort";
+
+  if ((channel != P6K_CAPTURE_COMMAND) && (channel != P6K_CAPTURE_STATUS)) {
+    printf("%s::%s: ERROR Channel must be %d (command port) or %d (status port).\n",
+	   driverName, functionName, P6K_CAPTURE_COMMAND, P6K_CAPTURE_STATUS);
+    return asynError;
+  }
+
+  p6kReplayPort *pPort = new p6kReplayPort(portName, fileName, channel, realTime);
+  printf("%s::%s: %s serving %lu records from %s\n",
+	 driverName, functionName, portName, static_cast<unsigned long>(pPort->records()), fileName);
+
+  return asynSuccess;
+}
+
+/* Code for iocsh registration */
+
+/* p6kCreateReplayPort */
+static const iocshArg p6kCreateReplayPortArg0 = {"Port name", iocshArgString};
+static const iocshArg p6kCreateReplayPortArg1 = {"Capture filename", iocshArgString};
+static const iocshArg p6kCreateReplayPortArg2 = {"Channel (0=command, 1=status)", iocshArgInt};
+static const iocshArg p6kCreateReplayPortArg3 = {"Real time (0 or 1)", iocshArgInt};
+static const iocshArg * const p6kCreateReplayPortArgs[] = {&p6kCreateReplayPortArg0,
+							    &p6kCreateReplayPortArg1,
+							    &p6kCreateReplayPortArg2,
+							    &p6kCreateReplayPortArg3};
+static const iocshFuncDef configp6kCreateReplayPort = {"p6kCreateReplayPort", 4, p6kCreateReplayPortArgs};
+static void configp6kCreateReplayPortCallFunc(const iocshArgBuf *args)
+{
+  p6kCreateReplayPort(args[0].sval, args[1].sval, args[2].ival, args[3].ival);
+}
+
+static void p6kReplayPortRegister(void)
+{
+  iocshRegister(&configp6kCreateReplayPort, configp6kCreateReplayPortCallFunc);
+}
+epicsExportRegistrar(p6kReplayPortRegister);
+
+} // extern "C"
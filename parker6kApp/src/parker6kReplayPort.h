@@ -0,0 +1,64 @@
+/********************************************
+ *  parker6kReplayPort.h
+ *
+ *  asyn octet port that plays back the replies
+ *  in a capture file written by p6kCapture,
+ *  so a session with a real 6K can be repeated
+ *  without the controller.
+ *
+ ********************************************/
+
+#ifndef parker6kReplayPort_H
+#define parker6kReplayPort_H
+
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+
+#include "asynPortDriver.h"
+#include "parker6kCapture.h"
+
+/**
+ * p6kReplayPort is used in place of the IP port (or the status port) given to
+ * p6kCreateController. Each command written to it is answered with the next
+ * reply recorded for that channel, byte for byte, including any odd characters
+ * the firmware sent before the *. If the recorded write/read failed, the read
+ * fails in the same way.
+ *
+ * The replies are served in the recorded order regardless of the command,
+ * so the replay is deterministic. Commands that don't match the recording
+ * are counted (and printed with ASYN_TRACE_ERROR) so that a change in
+ * behaviour of the driver is easy to spot.
+ *
+ * If realTime is set, each read waits for as long as the recorded one took.
+ * Otherwise replies are served as fast as possible, which is useful for
+ * benchmarking the driver itself.
+ */
+class p6kReplayPort : public asynPortDriver {
+
+ public:
+  p6kReplayPort(const char *portName, const char *fileName, int channel, int realTime);
+  virtual ~p6kReplayPort();
+
+  size_t records(void) const;
+  size_t served(void);
+  size_t mismatches(void);
+  void rewind(void);
+
+  /* These are the methods that we override from asynPortDriver */
+  asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual);
+  asynStatus readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason);
+  void report(FILE *fp, int level);
+
+ private:
+  epicsMutex mutex_;
+  std::string fileName_;
+  std::vector<p6kCaptureRecord> records_;
+  bool realTime_;
+  size_t next_;
+  size_t mismatches_;
+  const p6kCaptureRecord *pPending_;
+};
+
+#endif /* parker6kReplayPort_H */
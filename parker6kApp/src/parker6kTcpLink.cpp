@@ -0,0 +1,526 @@
+/********************************************
+ *  parker6kTcpLink.cpp
+ *
+ *  Native TCP link to a 6K, using a
+ *  non-blocking socket and epoll, which can
+ *  be used in place of an asyn IP port.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <map>
+
+#ifdef __linux__
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <epicsExport.h>
+#include <iocsh.h>
+
+#include "parker6kTcpLink.h"
+
+static const char *driverName = "p6kTcpLink";
+
+//The links created by p6kCreateTcpLink, by name
+static std::map<std::string, p6kTcpLink *> tcpLinks;
+
+/**
+ * p6kTcpLink constructor. This does not connect (see write).
+ * @param name The name to give to p6kCreateController
+ * @param host The host name or IP address of the controller
+ * @param service The TCP port (eg. 5002)
+ */
+p6kTcpLink::p6kTcpLink(const char *name, const char *host, const char *service)
+  : name_(name),
+    host_(host),
+    service_(service),
+    address_(std::string(host) + ":" + service),
+    fd_(-1),
+    epollFd_(-1),
+    events_(0),
+    retryTime_(0.0),
+    connects_(0),
+    claimed_(false)
+{
+#ifdef __linux__
+  epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd_ < 0) {
+    setError("Can't create epoll instance", errno);
+  }
+#endif
+}
+
+/**
+ * Create a link, and add it to the list that p6kController looks in.
+ * @param name The name to give to p6kCreateController
+ * @param address The controller's address, as host:port (eg. 192.168.200.177:5002)
+ * @return asynStatus
+ */
+asynStatus p6kTcpLink::create(const char *name, const char *address)
+{
+  static const char *functionName = "p6kTcpLink::create";
+
+  if ((name == NULL) || (strlen(name) == 0) || (address == NULL)) {
+    printf("%s::%s: ERROR A name and an address must be given.\n", driverName, functionName);
+    return asynError;
+  }
+
+  if (find(name) != NULL) {
+    printf("%s::%s: ERROR Link %s already exists.\n", driverName, functionName, name);
+    return asynError;
+  }
+
+  const char *colon = strrchr(address, ':');
+  if ((colon == NULL) || (colon == address) || (strlen(colon + 1) == 0)) {
+    printf("%s::%s: ERROR Address %s should be host:port.\n", driverName, functionName, address);
+    return asynError;
+  }
+
+#ifndef __linux__
+  printf("%s::%s: ERROR The native TCP link is only supported on Linux.\n", driverName, functionName);
+  return asynError;
+#else
+  std::string host(address, colon - address);
+  p6kTcpLink *pLink = new p6kTcpLink(name, host.c_str(), colon + 1);
+  if (pLink->epollFd_ < 0) {
+    printf("%s::%s: ERROR %s\n", driverName, functionName, pLink->error());
+    delete pLink;
+    return asynError;
+  }
+
+  tcpLinks[name] = pLink;
+  return asynSuccess;
+#endif
+}
+
+/**
+ * Find a link created by p6kCreateTcpLink.
+ * @param name The link name
+ * @return The link, or NULL if there isn't one with that name.
+ */
+p6kTcpLink *p6kTcpLink::find(const char *name)
+{
+  if (name == NULL) {
+    return NULL;
+  }
+
+  std::map<std::string, p6kTcpLink *>::iterator pLink = tcpLinks.find(name);
+  if (pLink == tcpLinks.end()) {
+    return NULL;
+  }
+  return pLink->second;
+}
+
+/**
+ * Take the link for the caller's use. Each link can only be claimed once.
+ * @return false if the link has already been claimed.
+ */
+bool p6kTcpLink::claim(void)
+{
+  if (claimed_) {
+    return false;
+  }
+  claimed_ = true;
+  return true;
+}
+
+/**
+ * @return true if the socket is open.
+ */
+bool p6kTcpLink::isConnected(void) const
+{
+  return (fd_ >= 0);
+}
+
+/**
+ * @return The number of times the link has connected.
+ */
+epicsUInt32 p6kTcpLink::connects(void) const
+{
+  return connects_;
+}
+
+/**
+ * @return The address the link connects to (host:port).
+ */
+const char *p6kTcpLink::address(void) const
+{
+  return address_.c_str();
+}
+
+/**
+ * @return The message for the last error.
+ */
+const char *p6kTcpLink::error(void) const
+{
+  return error_.c_str();
+}
+
+/**
+ * Print the state of the link.
+ */
+void p6kTcpLink::report(FILE *fp, int level) const
+{
+  fprintf(fp, "  TCP link %s to %s, %s, connects=%u\n", name_.c_str(), address_.c_str(),
+	  (isConnected() ? "connected" : "not connected"), connects_);
+  if ((level > 0) && (error_.size() > 0)) {
+    fprintf(fp, "    last error: %s\n", error_.c_str());
+  }
+}
+
+/**
+ * Save the message for an error (see error).
+ * @param message What failed
+ * @param errorNumber The errno value, or 0 if there isn't one.
+ */
+void p6kTcpLink::setError(const char *message, int errorNumber)
+{
+  error_ = name_ + ": " + message;
+  if (errorNumber != 0) {
+    error_ += std::string(": ") + strerror(errorNumber);
+  }
+}
+
+#ifdef __linux__
+
+/**
+ * The time used for the timeouts. This is the monotonic clock rather
+ * than p6kClock, because the socket waits always take real time.
+ * @return The time in seconds.
+ */
+double p6kTcpLink::now(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + (time.tv_nsec / 1e9);
+}
+
+/**
+ * Write commands to the controller, each followed by a \n. They are
+ * all written with one send, so that the controller gets them together.
+ * This connects first if the link is not connected. Anything left
+ * in the socket from an earlier reply is thrown away.
+ * @param commands The commands
+ * @param count The number of commands
+ * @param timeout How long to wait for the connect and the write (seconds)
+ * @return asynStatus
+ */
+asynStatus p6kTcpLink::write(const char * const *commands, size_t count, double timeout)
+{
+  char buffer[P6K_TCP_WRITE_SIZE];
+  size_t length = 0;
+  double deadline = now() + timeout;
+
+  for (size_t i=0; i<count; i++) {
+    size_t commandLength = strlen(commands[i]);
+    if ((length + commandLength + 1) > sizeof(buffer)) {
+      setError("Commands are too long to write together", 0);
+      return asynError;
+    }
+    memcpy(buffer + length, commands[i], commandLength);
+    length += commandLength;
+    buffer[length++] = '\n';
+  }
+
+  //If the controller closed the session since the last command, connect again now
+  if ((fd_ >= 0) && !drain()) {
+    disconnect();
+  }
+  if (fd_ < 0) {
+    asynStatus status = connect(deadline);
+    if (status != asynSuccess) {
+      return status;
+    }
+  }
+
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = send(fd_, buffer + done, length - done, MSG_NOSIGNAL);
+    if (n >= 0) {
+      done += n;
+    } else if (errno == EINTR) {
+      continue;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      if (!wait(EPOLLOUT, deadline)) {
+	setError("Timeout writing", 0);
+	disconnect();
+	return asynTimeout;
+      }
+    } else {
+      setError("Error writing", errno);
+      disconnect();
+      return asynError;
+    }
+  }
+
+  return asynSuccess;
+}
+
+/**
+ * Read from the controller into a framer, until it has a complete frame.
+ * A prompt without a reply line (like the second prompt in "*1TPC+0\r\r\n> \n>")
+ * is skipped. If this fails or times out, the link is disconnected.
+ * @param pFramer The framer to read into. The frame is left at the front of its queue.
+ * @param timeout How long to wait for the frame (seconds)
+ * @param pRead Returns the number of characters read
+ * @return asynStatus
+ */
+asynStatus p6kTcpLink::read(p6kFramer *pFramer, double timeout, size_t *pRead)
+{
+  double deadline = now() + timeout;
+  p6kFrame frame;
+
+  *pRead = 0;
+
+  if (fd_ < 0) {
+    setError("Not connected", 0);
+    return asynError;
+  }
+
+  for (;;) {
+    while (pFramer->front(&frame) && (frame.type != P6K_FRAME_ERROR) &&
+	   !frame.lineEnd && (frame.text == frame.start)) {
+      pFramer->pop();
+    }
+    if (pFramer->frames() > 0) {
+      return asynSuccess;
+    }
+
+    size_t space = 0;
+    char *pSpace = pFramer->prepare(&space);
+    ssize_t n = recv(fd_, pSpace, space, 0);
+    if (n > 0) {
+      pFramer->commit(n);
+      *pRead += n;
+    } else if (n == 0) {
+      setError("Connection closed by the controller", 0);
+      disconnect();
+      return asynError;
+    } else if (errno == EINTR) {
+      continue;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      if (!wait(EPOLLIN, deadline)) {
+	setError("Timeout reading", 0);
+	disconnect();
+	return asynTimeout;
+      }
+    } else {
+      setError("Error reading", errno);
+      disconnect();
+      return asynError;
+    }
+  }
+}
+
+/**
+ * Close the socket. The next write connects again.
+ */
+void p6kTcpLink::disconnect(void)
+{
+  if (fd_ >= 0) {
+    //Closing the socket also takes it out of the epoll set
+    close(fd_);
+    fd_ = -1;
+    events_ = 0;
+  }
+}
+
+/**
+ * Connect to the controller, unless the last connect failed less than P6K_TCP_RETRY_TIME ago.
+ * @param deadline When to give up (see now)
+ * @return asynStatus
+ */
+asynStatus p6kTcpLink::connect(double deadline)
+{
+  struct addrinfo hints;
+  struct addrinfo *pResult = NULL;
+
+  if (now() < retryTime_) {
+    //Keep the error from the failed connect
+    return asynError;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int result = getaddrinfo(host_.c_str(), service_.c_str(), &hints, &pResult);
+  if (result != 0) {
+    error_ = name_ + ": Can't find " + address_ + ": " + gai_strerror(result);
+    retryTime_ = now() + P6K_TCP_RETRY_TIME;
+    return asynError;
+  }
+
+  for (struct addrinfo *pAddress = pResult; (pAddress != NULL) && (fd_ < 0); pAddress = pAddress->ai_next) {
+    fd_ = socket(pAddress->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, pAddress->ai_protocol);
+    if (fd_ < 0) {
+      setError("Can't create socket", errno);
+      continue;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLOUT;
+    event.data.fd = fd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd_, &event) != 0) {
+      setError("Can't add socket to epoll", errno);
+      disconnect();
+      continue;
+    }
+    events_ = EPOLLOUT;
+
+    //The connect finishes in the background, and the socket is writable when it's done
+    if ((::connect(fd_, pAddress->ai_addr, pAddress->ai_addrlen) != 0) && (errno != EINPROGRESS)) {
+      setError("Can't connect", errno);
+      disconnect();
+      continue;
+    }
+    if (!wait(EPOLLOUT, deadline)) {
+      setError("Timeout connecting", 0);
+      disconnect();
+      continue;
+    }
+    int socketError = 0;
+    socklen_t length = sizeof(socketError);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &socketError, &length) != 0) {
+      socketError = errno;
+    }
+    if (socketError != 0) {
+      setError("Can't connect", socketError);
+      disconnect();
+      continue;
+    }
+  }
+  freeaddrinfo(pResult);
+
+  if (fd_ < 0) {
+    retryTime_ = now() + P6K_TCP_RETRY_TIME;
+    return asynError;
+  }
+
+  //Each command is a small write, which we don't want held back
+  int noDelay = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  retryTime_ = 0.0;
+  ++connects_;
+  return asynSuccess;
+}
+
+/**
+ * Wait for the socket to be readable or writable.
+ * @param events EPOLLIN or EPOLLOUT
+ * @param deadline When to give up (see now)
+ * @return false if the deadline passed (or epoll failed).
+ */
+bool p6kTcpLink::wait(epicsUInt32 events, double deadline)
+{
+  struct epoll_event event;
+
+  if (events != events_) {
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd_, &event) != 0) {
+      return false;
+    }
+    events_ = events;
+  }
+
+  for (;;) {
+    double left = deadline - now();
+    if (left <= 0.0) {
+      return false;
+    }
+    //An error or hangup also wakes us up, and the next send or recv reports it
+    int n = epoll_wait(epollFd_, &event, 1, static_cast<int>(ceil(left * 1000.0)));
+    if (n > 0) {
+      return true;
+    }
+    if ((n < 0) && (errno != EINTR)) {
+      return false;
+    }
+  }
+}
+
+/**
+ * Throw away anything waiting to be read, eg. a late reply to a command that timed out.
+ * @return false if the controller has closed the session.
+ */
+bool p6kTcpLink::drain(void)
+{
+  char buffer[256];
+
+  for (;;) {
+    ssize_t n = recv(fd_, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      continue;
+    }
+    if (n == 0) {
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+  }
+}
+
+#else
+
+//A link can't be created on other OSs (see create), so these are never called.
+double p6kTcpLink::now(void) { return 0.0; }
+asynStatus p6kTcpLink::write(const char * const *commands, size_t count, double timeout) { return asynError; }
+asynStatus p6kTcpLink::read(p6kFramer *pFramer, double timeout, size_t *pRead) { *pRead = 0; return asynError; }
+void p6kTcpLink::disconnect(void) {}
+asynStatus p6kTcpLink::connect(double deadline) { return asynError; }
+bool p6kTcpLink::wait(epicsUInt32 events, double deadline) { return false; }
+bool p6kTcpLink::drain(void) { return false; }
+
+#endif /* __linux__ */
+
+
+/*************************************************************************************/
+/** The following functions have C linkage, and can be called directly or from iocsh */
+
+extern "C" {
+
+/**
+ * C wrapper for p6kTcpLink::create.
+ * See p6kTcpLink::create.
+ */
+asynStatus p6kCreateTcpLink(const char *name, const char *address)
+{
+  return p6kTcpLink::create(name, address);
+}
+
+/* Code for iocsh registration */
+
+/* p6kCreateTcpLink */
+static const iocshArg p6kCreateTcpLinkArg0 = {"Link name", iocshArgString};
+static const iocshArg p6kCreateTcpLinkArg1 = {"Address (host:port)", iocshArgString};
+static const iocshArg * const p6kCreateTcpLinkArgs[] = {&p6kCreateTcpLinkArg0,
+							 &p6kCreateTcpLinkArg1};
+static const iocshFuncDef configp6kCreateTcpLink = {"p6kCreateTcpLink", 2, p6kCreateTcpLinkArgs};
+static void configp6kCreateTcpLinkCallFunc(const iocshArgBuf *args)
+{
+  p6kCreateTcpLink(args[0].sval, args[1].sval);
+}
+
+static void p6kTcpLinkRegister(void)
+{
+  iocshRegister(&configp6kCreateTcpLink, configp6kCreateTcpLinkCallFunc);
+}
+epicsExportRegistrar(p6kTcpLinkRegister);
+
+} // extern "C"
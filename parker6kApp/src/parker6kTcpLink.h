@@ -0,0 +1,85 @@
+/********************************************
+ *  parker6kTcpLink.h
+ *
+ *  Native TCP link to a 6K, using a
+ *  non-blocking socket and epoll, which can
+ *  be used in place of an asyn IP port.
+ *
+ ********************************************/
+
+#ifndef parker6kTcpLink_H
+#define parker6kTcpLink_H
+
+#include <stdio.h>
+#include <string>
+
+#include <epicsTypes.h>
+
+#include "asynDriver.h"
+#include "parker6kFramer.h"
+
+/** Size of the buffer for the commands written by one call to p6kTcpLink::write */
+#define P6K_TCP_WRITE_SIZE 1024
+/** How long to wait before trying again after a connect fails (seconds) */
+#define P6K_TCP_RETRY_TIME 2.0
+
+/**
+ * p6kTcpLink is a session with a 6K on its Ethernet port. It is created by
+ * name with p6kCreateTcpLink, and is given to p6kCreateController in place
+ * of the name of an asyn IP port. The controller then reads and writes the
+ * socket itself, rather than going through pasynOctetSyncIO.
+ *
+ * The socket is non-blocking, and each wait for it is an epoll_wait with
+ * the time left before the timeout. The replies are read straight into
+ * a p6kFramer, which finds the end of each reply (the prompt). So
+ * several commands can be written before the first reply is read
+ * (see p6kController::lowLevelStatusWriteRead).
+ *
+ * The link connects when it is first used. It disconnects if a read times
+ * out (a late reply would otherwise be taken for the next one), or if the
+ * controller closes the session, and connects again on the next write. After
+ * a failed connect, writes fail straight away for P6K_TCP_RETRY_TIME.
+ *
+ * A link is not thread safe. It can only be used by one controller,
+ * which only uses it with its link mutex held.
+ */
+class p6kTcpLink {
+
+ public:
+  static asynStatus create(const char *name, const char *address);
+  static p6kTcpLink *find(const char *name);
+
+  bool claim(void);
+  asynStatus write(const char * const *commands, size_t count, double timeout);
+  asynStatus read(p6kFramer *pFramer, double timeout, size_t *pRead);
+  void disconnect(void);
+
+  bool isConnected(void) const;
+  epicsUInt32 connects(void) const;
+  const char *address(void) const;
+  const char *error(void) const;
+  void report(FILE *fp, int level) const;
+
+ private:
+  p6kTcpLink(const char *name, const char *host, const char *service);
+
+  asynStatus connect(double deadline);
+  bool wait(epicsUInt32 events, double deadline);
+  bool drain(void);
+  void setError(const char *message, int errorNumber);
+  static double now(void);
+
+  std::string name_;
+  std::string host_;
+  std::string service_;
+  std::string address_;
+  std::string error_;
+  int fd_;
+  int epollFd_;
+  epicsUInt32 events_;          /**< The events that epollFd_ is waiting for */
+  double retryTime_;            /**< When to try to connect again, after a failed connect */
+  epicsUInt32 connects_;
+  bool claimed_;
+};
+
+#endif /* parker6kTcpLink_H */
@@ -0,0 +1,54 @@
+/********************************************
+ *  parker6kTrace.h
+ *
+ *  Trace macros for the poll and command
+ *  paths, which run many times a second.
+ *
+ ********************************************/
+
+#ifndef parker6kTrace_H
+#define parker6kTrace_H
+
+#include "asynDriver.h"
+
+/**
+ * P6K_TRACE_FLOW and P6K_TRACE_IO print like asynPrint, but first test a copy
+ * of the asyn trace mask held by the controller (see p6kController::updateTraceMasks),
+ * so that when tracing is off they cost one test of an integer. The copy is updated
+ * on every poll, so a change made with asynSetTraceMask takes effect within one poll period.
+ *
+ * Building with P6K_NO_FLOW_TRACE defined (set P6K_FLOW_TRACE=NO in configure/CONFIG_SITE,
+ * or on the make command line) removes the flow trace completely. The I/O trace
+ * (ASYN_TRACEIO_DRIVER) stays, so the commands and replies can still be traced.
+ *
+ * Errors should still use asynPrint with ASYN_TRACE_ERROR directly.
+ *
+ * @param mask The copy of the trace mask for pasynUser
+ * @param pasynUser The asynUser to print with (as for asynPrint)
+ */
+#ifdef P6K_NO_FLOW_TRACE
+/* The arguments are still compiled (so there are no unused variable warnings), but never run. */
+#define P6K_TRACE_FLOW(mask, pasynUser, ...)				\
+  do {									\
+    if (0) {								\
+      (void)(mask);							\
+      asynPrint((pasynUser), ASYN_TRACE_FLOW, __VA_ARGS__);		\
+    }									\
+  } while (0)
+#else
+#define P6K_TRACE_FLOW(mask, pasynUser, ...)				\
+  do {									\
+    if ((mask) & ASYN_TRACE_FLOW) {					\
+      asynPrint((pasynUser), ASYN_TRACE_FLOW, __VA_ARGS__);		\
+    }									\
+  } while (0)
+#endif
+
+#define P6K_TRACE_IO(mask, pasynUser, ...)				\
+  do {									\
+    if ((mask) & ASYN_TRACEIO_DRIVER) {					\
+      asynPrint((pasynUser), ASYN_TRACEIO_DRIVER, __VA_ARGS__);		\
+    }									\
+  } while (0)
+
+#endif /* parker6kTrace_H */
@@ -0,0 +1,75 @@
+/********************************************
+ *  p6kFuzzBits.cpp
+ *
+ *  libFuzzer entry point for the bit string
+ *  parsers (TAS, TSS, TLIM, TIN and TOUT),
+ *  including the 16 character chunk decode
+ *  that runs off the end of each group.
+ *
+ ********************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "parker6kBits.h"
+
+#define FUZZ_MAX_VALUES 4
+#define FUZZ_BITS_SENTINEL 0xA5A5A5A5A5A5A5A5ULL
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  //The parsers take a null terminated string, as left by trimResponse
+  std::string input(reinterpret_cast<const char *>(data), size);
+  const char *pInput = input.c_str();
+
+  p6kBitMask mask;
+  size_t count = mask.parse(pInput);
+  if (count != mask.size()) {
+    abort();
+  }
+  for (size_t group=0; group<mask.groups(); group++) {
+    if (mask.groupStart(group) > mask.size()) {
+      abort();
+    }
+  }
+
+  //Format it back. Every bit must come out as a 1 or 0.
+  std::string formatted(mask.size() + 1, '\0');
+  if (mask.format(&formatted[0], formatted.size()) != static_cast<int>(mask.size())) {
+    abort();
+  }
+  for (size_t bit=0; bit<mask.size(); bit++) {
+    if (formatted[bit] != (mask.test(bit) ? p6kBitMask::P6K_BIT_ON_ : p6kBitMask::P6K_BIT_OFF_)) {
+      abort();
+    }
+  }
+
+  //The packed integer must agree with the mask
+  epicsUInt64 bits = 0;
+  const char *pEnd = NULL;
+  if (p6kBitMask::parseUInt64(pInput, &bits, &pEnd) != mask.size()) {
+    abort();
+  }
+  if ((pEnd < pInput) || (pEnd > pInput + input.size())) {
+    abort();
+  }
+  for (size_t bit=0; bit<64; bit++) {
+    bool expected = (bit < mask.size()) && mask.test(bit);
+    if ((((bits >> bit) & 0x1) != 0) != expected) {
+      abort();
+    }
+  }
+
+  //One spare value at the end, which must not be written
+  epicsUInt64 values[FUZZ_MAX_VALUES + 1];
+  values[FUZZ_MAX_VALUES] = FUZZ_BITS_SENTINEL;
+  if ((p6kBitMask::parseList(pInput, values, FUZZ_MAX_VALUES) > FUZZ_MAX_VALUES) ||
+      (values[FUZZ_MAX_VALUES] != FUZZ_BITS_SENTINEL)) {
+    abort();
+  }
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+/********************************************
+ *  p6kFuzzMain.cpp
+ *
+ *  Runs a fuzz target over the files (or the
+ *  files in the directories) given on the
+ *  command line. This is linked in place of
+ *  libFuzzer, so the corpus can be checked
+ *  with compilers that don't have libFuzzer,
+ *  and under the sanitizers as a regression
+ *  test.
+ *
+ ********************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/**
+ * Run the target on one file.
+ * @return false if the file could not be read.
+ */
+static bool runFile(const std::string &fileName)
+{
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t nread = 0;
+
+  FILE *fptr = fopen(fileName.c_str(), "rb");
+  if (fptr == NULL) {
+    perror(fileName.c_str());
+    return false;
+  }
+  while ((nread = fread(buffer, 1, sizeof(buffer), fptr)) > 0) {
+    data.insert(data.end(), buffer, buffer + nread);
+  }
+  fclose(fptr);
+
+  LLVMFuzzerTestOneInput(data.empty() ? NULL : &data[0], data.size());
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  int files = 0;
+  int errors = 0;
+  struct stat info;
+
+  for (int arg=1; arg<argc; arg++) {
+    if ((stat(argv[arg], &info) == 0) && S_ISDIR(info.st_mode)) {
+      DIR *pDir = opendir(argv[arg]);
+      struct dirent *pEntry = NULL;
+      while ((pDir != NULL) && ((pEntry = readdir(pDir)) != NULL)) {
+	if (pEntry->d_name[0] == '.') {
+	  continue;
+	}
+	errors += runFile(std::string(argv[arg]) + "/" + pEntry->d_name) ? 0 : 1;
+	files++;
+      }
+      if (pDir != NULL) {
+	closedir(pDir);
+      }
+    } else {
+      errors += runFile(argv[arg]) ? 0 : 1;
+      files++;
+    }
+  }
+
+  printf("%s: ran %d inputs, %d could not be read\n", argv[0], files, errors);
+  return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+/********************************************
+ *  p6kFuzzResponse.cpp
+ *
+ *  libFuzzer entry point for the reply path
+ *  used by every query: the raw reply goes
+ *  through p6kFramer, as in 
+ *  p6kController::lowLevelWriteRead (and
+ *  again one character at a time, which must
+ *  give the same frames), and the text of the
+ *  first frame is decoded as every query in the
+ *  command table, for axes 0 to 8.
+ *
+ *  A decode that fails must leave the value
+ *  alone, because the poller decodes straight
+ *  into the axis status (eg. TAS and TPC).
+ *
+ ********************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parker6kBuffer.h"
+#include "parker6kCommand.h"
+#include "parker6kFramer.h"
+
+#define FUZZ_MAX_AXIS 8
+#define FUZZ_INT_SENTINEL 0x5A5A5A5A
+#define FUZZ_DOUBLE_SENTINEL -12345.5
+#define FUZZ_BITS_SENTINEL 0xA5A5A5A5A5A5A5A5ULL
+#define FUZZ_CHAR_SENTINEL '#'
+
+/**
+ * Decode a trimmed reply in every way that the command allows,
+ * and check that nothing is written when the decode fails.
+ */
+static void fuzzDecode(const char *response, p6kCommandId id, int axis)
+{
+  epicsInt32 intVal = FUZZ_INT_SENTINEL;
+  double doubleVal = FUZZ_DOUBLE_SENTINEL;
+  epicsUInt64 bits = FUZZ_BITS_SENTINEL;
+  size_t count = 0;
+  char text[8];
+
+  if (!p6kCommand::decode(response, id, axis, &intVal) && (intVal != FUZZ_INT_SENTINEL)) {
+    abort();
+  }
+  if (!p6kCommand::decode(response, id, axis, &doubleVal) && (doubleVal != FUZZ_DOUBLE_SENTINEL)) {
+    abort();
+  }
+  if (!p6kCommand::decode(response, id, axis, &bits, &count) && (bits != FUZZ_BITS_SENTINEL)) {
+    abort();
+  }
+
+  //A small buffer, so that truncation is exercised too
+  memset(text, FUZZ_CHAR_SENTINEL, sizeof(text));
+  if (p6kCommand::decode(response, id, axis, text, sizeof(text))) {
+    if (memchr(text, '\0', sizeof(text)) == NULL) {
+      abort();
+    }
+  } else if (text[0] != FUZZ_CHAR_SENTINEL) {
+    abort();
+  }
+}
+
+/**
+ * Check that two frames have the same type and text. 
+ */
+static void fuzzSameFrame(const p6kFramer &framer, const p6kFrame &frame, 
+			  const p6kFramer &other, const p6kFrame &otherFrame)
+{
+  if ((frame.type != otherFrame.type) || (frame.length != otherFrame.length) ||
+      (frame.lineEnd != otherFrame.lineEnd) || (frame.textLength != otherFrame.textLength)) {
+    abort();
+  }
+  for (size_t i=0; i<frame.textLength; i++) {
+    if (framer.at(frame.text + i) != other.at(otherFrame.text + i)) {
+      abort();
+    }
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static p6kFramer framer;
+  static p6kFramer byteFramer;
+  char response[P6K_BUFFER_SIZE];
+  p6kFrame frame;
+  p6kFrame byteFrame;
+
+  //Read into the ring buffer as pasynOctetSyncIO->writeRead would,
+  //and end the frame as if the EOS had removed the prompt.
+  size_t space = 0;
+  framer.reset();
+  char *pReply = framer.prepare(&space);
+  if (size > space) {
+    size = space;
+  }
+  memcpy(pReply, data, size);
+  framer.commit(size);
+  framer.terminate();
+
+  //Take the first frame, as lowLevelWriteRead does
+  response[0] = '\0';
+  if (framer.front(&frame)) {
+    framer.copyText(frame, response, sizeof(response));
+  }
+  if (memchr(response, '\0', sizeof(response)) == NULL) {
+    abort();
+  }
+
+  //The same reply in the smallest chunks. Both stop scanning
+  //at the same place if the frame queue fills up.
+  byteFramer.reset();
+  for (size_t i=0; i<size; i++) {
+    if (byteFramer.consume(reinterpret_cast<const char *>(data) + i, 1) != 1) {
+      break;
+    }
+  }
+  byteFramer.terminate();
+  if (byteFramer.frames() != framer.frames()) {
+    abort();
+  }
+  while (framer.front(&frame) && byteFramer.front(&byteFrame)) {
+    fuzzSameFrame(framer, frame, byteFramer, byteFrame);
+    if (frame.text + frame.textLength > frame.start + frame.length) {
+      abort();
+    }
+    framer.pop();
+    byteFramer.pop();
+  }
+
+  for (int id=0; id<P6K_NUM_COMMANDS; id++) {
+    const p6kCommandInfo *pInfo = p6kCommand::info(static_cast<p6kCommandId>(id));
+    if ((pInfo == NULL) || (pInfo->replyType == P6K_REPLY_NONE)) {
+      continue;
+    }
+    for (int axis=0; axis<=FUZZ_MAX_AXIS; axis++) {
+      fuzzDecode(response, static_cast<p6kCommandId>(id), axis);
+    }
+  }
+
+  return 0;
+}
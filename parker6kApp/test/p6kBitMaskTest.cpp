@@ -0,0 +1,169 @@
+/********************************************
+ *  p6kBitMaskTest.cpp
+ *
+ *  Unit tests for p6kBitMask, which is used
+ *  to build axis masks and parse the bit
+ *  strings returned by TAS, TSS, TLIM, TIN
+ *  and TOUT.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "parker6kBits.h"
+
+/**
+ * GO commands for any number of axes.
+ */
+static void testGoMask(void)
+{
+  char buffer[64] = {0};
+
+  testDiag("GO axis masks");
+
+  p6kBitMask move(8);
+  move.set(0);
+  move.set(2);
+  testOk1(move.format(buffer, sizeof(buffer)) == 8);
+  testOk(strcmp(buffer, "10100000") == 0, "8 axes, axis 1 and 3: %s", buffer);
+
+  p6kBitMask bigMove(12);
+  bigMove.set(11);
+  testOk1(bigMove.format(buffer, sizeof(buffer)) == 12);
+  testOk(strcmp(buffer, "000000000001") == 0, "12 axes, axis 12: %s", buffer);
+
+  p6kBitMask twoAxes(2);
+  twoAxes.setAll(true);
+  twoAxes.format(buffer, sizeof(buffer));
+  testOk(strcmp(buffer, "11") == 0, "2 axes, both: %s", buffer);
+
+  //Setting a bit beyond the end grows the mask
+  p6kBitMask grow;
+  grow.set(69);
+  testOk1(grow.size() == 70);
+  testOk1(grow.test(69) && !grow.test(68) && !grow.test(70));
+
+  //Too small a buffer
+  testOk1(bigMove.format(buffer, 12) == -1);
+}
+
+/**
+ * OUT commands, which use X to leave a bit unchanged.
+ */
+static void testOutMask(void)
+{
+  char buffer[64] = {0};
+
+  testDiag("OUT masks");
+
+  p6kBitMask outBits(8);
+  p6kBitMask changeBits(8);
+  outBits.set(7);
+  changeBits.set(7);
+  outBits.formatMasked(changeBits, buffer, sizeof(buffer));
+  testOk(strcmp(buffer, "XXXXXXX1") == 0, "Onboard bit 8 on: %s", buffer);
+
+  p6kBitMask brickBits(32);
+  p6kBitMask brickChange(32);
+  brickChange.set(20);
+  brickBits.formatMasked(brickChange, buffer, sizeof(buffer));
+  testOk(strcmp(buffer, "XXXXXXXXXXXXXXXXXXXX0XXXXXXXXXXX") == 0, "Bit 21 of 32 off: %s", buffer);
+
+  brickBits.setAll(true);
+  testOk1(brickBits.toUInt32() == 0xFFFFFFFFu);
+  brickBits.resize(40);
+  testOk1(!brickBits.test(39) && brickBits.test(31));
+}
+
+/**
+ * Parsing replies.
+ */
+static void testParse(void)
+{
+  testDiag("Parsing replies");
+
+  p6kBitMask bits;
+
+  //8 axis TLIM. Axis 1 positive limit active (0), axis 8 home active.
+  testOk1(bits.parse("011_111_111_111_111_111_111_111\r\n") == 24);
+  testOk1(bits.groups() == 8);
+  testOk1(!bits.test(bits.groupStart(0)));
+  testOk1(bits.test(bits.groupStart(0)+1));
+  testOk1(bits.groupStart(7) == 21);
+  testOk1(bits.groupStart(8) == bits.size());
+  testOk1(bits.toUInt32() == 0x00FFFFFEu);
+
+  //More bits than fit in 32
+  testOk1(bits.parse("1111_0000_1111_0000_1111_0000_1111_0000_1010_0101") == 40);
+  testOk1(bits.toUInt32() == 0x0F0F0F0Fu);
+  testOk1(bits.toUInt32(32) == 0xA5u);
+  testOk1(bits.test(32) && !bits.test(33) && bits.test(39));
+
+  //Stop at anything that isn't a bit or separator
+  testOk1(bits.parse("10 11") == 2);
+  testOk1(bits.parse("") == 0);
+  testOk1(bits.parse(NULL) == 0);
+  testOk1(!bits.any());
+}
+
+/**
+ * Replies captured from a 6K8, after the command name has been removed.
+ * These are longer than the 16 characters decoded at a time.
+ */
+static void testCaptured(void)
+{
+  epicsUInt64 value = 0;
+  epicsUInt64 values[8] = {0};
+  const char *pEnd = NULL;
+
+  testDiag("Captured replies");
+
+  //TAS for an axis that is moving positive, accelerating, with the drive enabled.
+  static const char *tas = "1110_0000_0000_1000_0000_0000_0000_0000";
+  testOk1(p6kBitMask::parseUInt64(tas, &value) == 32);
+  testOk(value == 0x1007u, "TAS: 0x%llx", static_cast<unsigned long long>(value));
+
+  //TSS with the system ready and a command error (TSS bit 11).
+  static const char *tss = "1001_0000_0010_0000_0000_0000_0000_0000";
+  testOk1(p6kBitMask::parseUInt64(tss, &value) == 32);
+  testOk(value == 0x409u, "TSS: 0x%llx", static_cast<unsigned long long>(value));
+
+  //The parse stops at the end of the bits, wherever that is in a 16 character chunk.
+  static const char *trailer = "0000_0001_1\r\n";
+  testOk1(p6kBitMask::parseUInt64(trailer, &value, &pEnd) == 9);
+  testOk1((value == 0x180u) && (pEnd == (trailer + 11)));
+
+  //TIN for a 6K8 with 3 expansion bricks (24 onboard and 3x32 brick inputs).
+  p6kBitMask bits;
+  static const char *tin = "00000000_00000000_00000000_00000000_00000000_00000000_00000001"
+    "_10000000_00000000_00000000_00000000_00000000_00000000_00000000_00000001";
+  testOk1(bits.parse(tin) == 120);
+  testOk1(bits.groups() == 15);
+  testOk1(bits.test(55) && bits.test(56) && bits.test(119));
+  testOk1(!bits.test(54) && !bits.test(57) && !bits.test(118));
+
+  //One bit string per axis, separated by commas
+  static const char *list = "1000_0000_0000_1000,0000_0000_0000_1000, 0100_0000_0000_0000";
+  testOk1(p6kBitMask::parseList(list, values, 8) == 3);
+  testOk1((values[0] == 0x1001u) && (values[1] == 0x1000u) && (values[2] == 0x2u));
+  testOk1(p6kBitMask::parseList(list, values, 2) == 2);
+  testOk1(p6kBitMask::parseList(",1", values, 8) == 0);
+  testOk1(p6kBitMask::parseList(NULL, values, 8) == 0);
+
+  //Only the first 64 bits are kept
+  static const char *longBits = "00000000000000000000000000000000000000000000000000000000000000011";
+  testOk1((p6kBitMask::parseUInt64(longBits, &value) == 65) && (value == (1ULL << 63)));
+}
+
+MAIN(p6kBitMaskTest)
+{
+  testPlan(43);
+  testGoMask();
+  testOutMask();
+  testParse();
+  testCaptured();
+  return testDone();
+}
@@ -0,0 +1,98 @@
+/********************************************
+ *  p6kBufferTest.cpp
+ *
+ *  Unit tests for p6kBuffer, which is used
+ *  to build commands and hold responses.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "parker6kBuffer.h"
+
+/**
+ * Building commands.
+ */
+static void testFormat(void)
+{
+  testDiag("Building commands");
+
+  p6kBuffer command;
+  testOk1(command.length() == 0);
+  testOk1(strcmp(command.c_str(), "") == 0);
+  testOk1(command.capacity() == P6K_BUFFER_SIZE);
+
+  testOk1(command.format("%d%s", 3, "TAS") == 4);
+  testOk(strcmp(command.c_str(), "3TAS") == 0, "format: %s", command.c_str());
+
+  //format replaces the contents, append adds to them
+  command.format("%s", "GO");
+  testOk1(command.append("%s", "1100") == 6);
+  testOk(strcmp(command.c_str(), "GO1100") == 0, "append: %s", command.c_str());
+  testOk1(!command.overflow());
+
+  command.clear();
+  testOk1((command.length() == 0) && (command.c_str()[0] == '\0'));
+}
+
+/**
+ * Truncation.
+ */
+static void testOverflow(void)
+{
+  char big[P6K_BUFFER_SIZE + 10];
+
+  testDiag("Overflow");
+
+  memset(big, 'A', sizeof(big));
+  big[sizeof(big) - 1] = '\0';
+
+  p6kBuffer buffer;
+  testOk1(buffer.format("%s", big) == -1);
+  testOk1(buffer.overflow());
+  testOk1(buffer.length() == (P6K_BUFFER_SIZE - 1));
+  testOk1(strlen(buffer.c_str()) == buffer.length());
+
+  //Appending to a full buffer
+  testOk1(buffer.append("%s", "B") == -1);
+  testOk1(buffer.length() == (P6K_BUFFER_SIZE - 1));
+
+  //format clears the overflow flag
+  buffer.format("%s", "1S");
+  testOk1(!buffer.overflow() && (buffer.length() == 2));
+
+  testOk1(buffer.assign(big, strlen(big)) == -1);
+  testOk1(buffer.length() == (P6K_BUFFER_SIZE - 1));
+}
+
+/**
+ * Filling in the buffer directly, as done for responses.
+ */
+static void testResponse(void)
+{
+  static const char *reply = "*1TPC1000\r\r\n";
+
+  testDiag("Responses");
+
+  p6kBuffer response;
+  response.format("%s", "a longer old response");
+  memcpy(response.data(), reply, 5);
+  response.setLength(5);
+  testOk(strcmp(response.c_str(), "*1TPC") == 0, "setLength terminates: %s", response.c_str());
+
+  testOk1(response.assign(reply, strlen(reply)) == static_cast<int>(strlen(reply)));
+  testOk1(strcmp(response.c_str(), reply) == 0);
+  testOk1(response.assign(NULL, 10) == 0);
+}
+
+MAIN(p6kBufferTest)
+{
+  testPlan(22);
+  testFormat();
+  testOverflow();
+  testResponse();
+  return testDone();
+}
@@ -0,0 +1,171 @@
+/********************************************
+ *  p6kCaptureTest.cpp
+ *
+ *  Unit tests for the capture file format
+ *  (p6kCaptureWriter and p6kCaptureReader)
+ *  and the replay port that serves it back.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynOctetSyncIO.h"
+#include "parker6kCapture.h"
+#include "parker6kReplayPort.h"
+
+#define TEST_CAPTURE_FILE "p6kCaptureTest.cap"
+#define TEST_TRUNCATED_FILE "p6kCaptureTestTruncated.cap"
+#define TEST_REPLAY_PORT "P6K_TEST_REPLAY"
+#define TEST_TIMEOUT 1.0
+
+/* A reply with the leading characters that some firmware sends before the * */
+static const char *leadingReply = "\r\n*1TPC+5\r\r\n";
+
+/**
+ * Write one record, with a start time offset from the capture start.
+ */
+static void writeRecord(p6kCaptureWriter *pWriter, const epicsTimeStamp *pBase, double offset, double duration,
+			p6kCaptureChannel channel, asynStatus status, const char *command, const char *reply)
+{
+  epicsTimeStamp start = *pBase;
+  epicsTimeStamp end;
+
+  epicsTimeAddSeconds(&start, offset);
+  end = start;
+  epicsTimeAddSeconds(&end, duration);
+  pWriter->write(channel, status, &start, &end, command, strlen(command), reply, strlen(reply));
+}
+
+static void testRoundTrip(void)
+{
+  p6kCaptureWriter writer;
+  std::vector<p6kCaptureRecord> records;
+  epicsTimeStamp base;
+
+  testOk(!writer.isOpen(), "Writer is closed until open is called");
+  testOk(writer.open(TEST_CAPTURE_FILE) == asynSuccess, "Open %s", TEST_CAPTURE_FILE);
+  testOk(writer.isOpen(), "Writer is open");
+
+  epicsTimeGetCurrent(&base);
+  writeRecord(&writer, &base, 0.010, 0.002, P6K_CAPTURE_COMMAND, asynSuccess, "1TPC", leadingReply);
+  writeRecord(&writer, &base, 0.020, 0.003, P6K_CAPTURE_STATUS, asynSuccess, "TSS", "*TSS1000_0000\r\r\n");
+  writeRecord(&writer, &base, 0.030, 5.0, P6K_CAPTURE_COMMAND, asynTimeout, "2TPC", "");
+  writeRecord(&writer, &base, 0.040, 0.001, P6K_CAPTURE_COMMAND, asynSuccess, "!K", "\r\n");
+  testOk(writer.records() == 4, "Four records written");
+  writer.close();
+  testOk(!writer.isOpen(), "Writer is closed");
+
+  testOk(p6kCaptureReader::read(TEST_CAPTURE_FILE, &records) == asynSuccess, "Read back %s", TEST_CAPTURE_FILE);
+  if (records.size() != 4) {
+    testAbort("Read %u records, expected 4", static_cast<unsigned int>(records.size()));
+  }
+  testOk((records[0].channel == P6K_CAPTURE_COMMAND) && (records[0].command == "1TPC") &&
+	 (records[0].reply == leadingReply), "Raw reply kept, including the characters before the *");
+  testOk((records[1].channel == P6K_CAPTURE_STATUS) && (records[1].command == "TSS"), "Status port record");
+  testOk((records[2].status == asynTimeout) && records[2].reply.empty(), "Failed write/read recorded");
+  testOk(records[3].command == "!K", "Immediate command recorded");
+  testOk((records[0].time < records[1].time) && (records[1].time < records[2].time), "Times increase");
+  testOk((records[1].time - records[0].time > 0.0095) && (records[1].time - records[0].time < 0.0105),
+	 "Time between records is kept to the microsecond");
+  testOk((records[2].duration > 4.9999) && (records[2].duration < 5.0001), "Duration is kept");
+}
+
+static void testBadFiles(void)
+{
+  std::vector<p6kCaptureRecord> records;
+  FILE *fptr = NULL;
+  char data[4096] = {0};
+  size_t length = 0;
+
+  testOk(p6kCaptureReader::read("p6kCaptureTestMissing.cap", &records) == asynError, "Missing file");
+
+  //Copy all but the last byte of the good file
+  if ((fptr = fopen(TEST_CAPTURE_FILE, "rb")) != NULL) {
+    length = fread(data, 1, sizeof(data), fptr);
+    fclose(fptr);
+  }
+  if ((fptr = fopen(TEST_TRUNCATED_FILE, "wb")) != NULL) {
+    fwrite(data, 1, length - 1, fptr);
+    fclose(fptr);
+  }
+  testOk((p6kCaptureReader::read(TEST_TRUNCATED_FILE, &records) == asynError) && (records.size() == 3),
+	 "Truncated file is an error, but the complete records are read");
+
+  records.clear();
+  if ((fptr = fopen(TEST_TRUNCATED_FILE, "wb")) != NULL) {
+    fputs("not a capture file", fptr);
+    fclose(fptr);
+  }
+  testOk((p6kCaptureReader::read(TEST_TRUNCATED_FILE, &records) == asynError) && records.empty(),
+	 "File without the header is rejected");
+  remove(TEST_TRUNCATED_FILE);
+}
+
+/**
+ * Send a command to the replay port and return the raw reply.
+ */
+static asynStatus replay(asynUser *pasynUser, const char *command, std::string *pReply)
+{
+  char reply[256] = {0};
+  size_t nwrite = 0;
+  size_t nread = 0;
+  int eomReason = 0;
+
+  asynStatus status = pasynOctetSyncIO->writeRead(pasynUser, command, strlen(command),
+						  reply, sizeof(reply) - 1, TEST_TIMEOUT,
+						  &nwrite, &nread, &eomReason);
+  pReply->assign(reply, nread);
+  return status;
+}
+
+static void testReplay(void)
+{
+  asynUser *pasynUser = NULL;
+  std::string reply;
+
+  p6kReplayPort *pPort = new p6kReplayPort(TEST_REPLAY_PORT, TEST_CAPTURE_FILE, P6K_CAPTURE_COMMAND, 0);
+  testOk(pPort->records() == 3, "Replay port has the three command port records");
+
+  if (pasynOctetSyncIO->connect(TEST_REPLAY_PORT, 0, &pasynUser, NULL) != asynSuccess) {
+    testAbort("Could not connect to %s", TEST_REPLAY_PORT);
+  }
+
+  testOk((replay(pasynUser, "1TPC", &reply) == asynSuccess) && (reply == leadingReply),
+	 "First reply is served byte for byte");
+  testOk((replay(pasynUser, "2TPC", &reply) == asynTimeout) && reply.empty(),
+	 "Recorded timeout is replayed");
+  testOk(pPort->mismatches() == 0, "No mismatches so far");
+  testOk((replay(pasynUser, "!S", &reply) == asynSuccess) && (reply == "\r\n"),
+	 "Reply is served in order even if the command is different");
+  testOk(pPort->mismatches() == 1, "Mismatch is counted");
+  testOk(replay(pasynUser, "1TPC", &reply) != asynSuccess, "Error at the end of the capture");
+  testOk(pPort->served() == 3, "Three replies served");
+
+  pPort->rewind();
+  testOk((pPort->served() == 0) && (pPort->mismatches() == 0), "Rewind resets the counters");
+  testOk((replay(pasynUser, "1TPC", &reply) == asynSuccess) && (reply == leadingReply),
+	 "First reply is served again after rewind");
+
+  pasynOctetSyncIO->disconnect(pasynUser);
+  remove(TEST_CAPTURE_FILE);
+}
+
+MAIN(p6kCaptureTest)
+{
+  testPlan(26);
+
+  testRoundTrip();
+  testBadFiles();
+  testReplay();
+
+  return testDone();
+}
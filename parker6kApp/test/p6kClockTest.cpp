@@ -0,0 +1,313 @@
+/********************************************
+ *  p6kClockTest.cpp
+ *
+ *  Tests for the simulated clock, and for the
+ *  driver timing that uses it (the done move
+ *  delay and settle detection). It also runs an hour of polls and
+ *  moves against a fake 6K in simulated time,
+ *  twice, and checks that both runs agree.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynMotorController.h"
+#include "parker6kController.h"
+#include "parker6kClock.h"
+#include "p6kTestPort.h"
+#include "p6kTestController.h"
+
+#define TEST_CONTROLLER "P6K_CLOCK"
+#define TEST_COMMAND_PORT "P6K_CLOCK_CMD"
+#define TEST_STATUS_PORT "P6K_CLOCK_STATUS"
+#define TEST_NUM_AXES 2
+#define TEST_POLL_PERIOD 0.5      //Simulated time between polls (seconds)
+#define TEST_RUN_TIME 3600.0     //Simulated time for each run (seconds)
+#define TEST_MOVE_PERIOD 60.0    //Simulated time between moves (seconds)
+#define TEST_WALL_TIME 60.0      //Longest real time that a run may take (seconds)
+
+static p6kSimulatedClock simulatedClock;
+static p6kTestPort *pCommandPort = NULL;
+static p6kTestPort *pStatusPort = NULL;
+static p6kController *pController = NULL;
+
+/**
+ * The result of one simulated run.
+ */
+typedef struct runResult {
+  epicsTimeStamp end;
+  epicsUInt32 polls;
+  epicsUInt32 commands;
+  epicsUInt32 slow;
+  double slept;
+} runResult;
+
+/**
+ * @return The done moving status of an axis.
+ */
+static int done(int axis)
+{
+  pController->lock();
+  int value = p6kTestGetIntegerParam(pController, axis, motorStatusDoneString);
+  pController->unlock();
+  return value;
+}
+
+/**
+ * Set the status replies.
+ * @param moving Set the moving bit for axis 1
+ */
+static void setStatusReplies(bool moving)
+{
+  p6kTestReplies replies;
+
+  p6kTestStatusReplies(&replies, TEST_NUM_AXES, P6K_TEST_TAS_IDLE);
+  if (moving) {
+    replies["1TAS"] = "1TAS" P6K_TEST_TAS_MOVING;
+  }
+  pStatusPort->setReplies(replies);
+}
+
+/**
+ * Set the encoder position read back for axis 1.
+ */
+static void setEncoderReply(epicsInt32 position)
+{
+  char reply[P6K_MAXBUF] = {0};
+  epicsSnprintf(reply, sizeof(reply), "1TPE%+d", position);
+  pStatusPort->setReply("1TPE", reply);
+}
+
+/**
+ * The simulated clock on its own.
+ */
+static void testSimulatedClock(void)
+{
+  p6kSimulatedClock clock;
+  epicsTimeStamp time;
+  epicsEventId event = epicsEventMustCreate(epicsEventEmpty);
+
+  testDiag("Simulated clock");
+
+  clock.getCurrent(&time);
+  testOk((time.secPastEpoch == p6kSimulatedClock::P6K_SIMULATED_CLOCK_START_) && (time.nsec == 0),
+	 "The simulated clock starts at a fixed time");
+
+  double start = clock.now();
+  clock.sleep(1.5);
+  testOk(clock.now() - start == 1.5, "Sleeping moves the time on");
+  testOk(clock.slept() == 1.5, "The time slept is counted");
+
+  clock.advance(2.0);
+  testOk((clock.now() - start == 3.5) && (clock.slept() == 1.5), "advance moves the time on without counting it as sleep");
+
+  epicsEventSignal(event);
+  start = clock.now();
+  testOk(clock.waitEvent(event, 5.0) && (clock.now() == start), "Waiting for a signalled event takes no time");
+  testOk(!clock.waitEvent(event, 5.0) && (clock.now() - start == 5.0), "Waiting for an event times out in simulated time");
+
+  p6kClock::setClock(&clock);
+  testOk(p6kClock::getClock() == &clock, "setClock replaces the driver clock");
+  p6kClock::setClock(NULL);
+  testOk(p6kClock::getClock() != &clock, "setClock(NULL) goes back to the system clock");
+
+  epicsEventDestroy(event);
+}
+
+/**
+ * Create the fake ports, the controller and the axes, using the simulated clock.
+ * The poll periods are zero, so the controller's own poller thread only polls on
+ * a wakeup, and the polls in the tests are all made by calling pollSweep.
+ */
+static void createController(void)
+{
+  p6kTestReplies replies;
+
+  p6kClock::setClock(&simulatedClock);
+
+  pCommandPort = new p6kTestPort(TEST_COMMAND_PORT);
+  pStatusPort = new p6kTestPort(TEST_STATUS_PORT);
+  p6kTestStartupReplies(&replies, "6K2", TEST_NUM_AXES);
+  pCommandPort->setReplies(replies);
+  setStatusReplies(false);
+
+  pController = p6kTestCreateController(TEST_CONTROLLER, TEST_COMMAND_PORT, TEST_NUM_AXES,
+					0.0, 0.0, TEST_STATUS_PORT);
+}
+
+/**
+ * The done move delay (P6K_A_DelayTime) in simulated time.
+ */
+static void testDoneDelay(void)
+{
+  testDiag("Done move delay");
+
+  pController->lock();
+  p6kTestSetDoubleParam(pController, 1, P6K_A_DelayTimeString, 2.0);
+  pController->unlock();
+
+  setStatusReplies(true);
+  pController->pollSweep(false);
+  setStatusReplies(false);
+  pController->pollSweep(false);
+  testOk(done(1) == 0, "Done is delayed at the end of a move");
+
+  simulatedClock.advance(1.0);
+  pController->pollSweep(false);
+  testOk(done(1) == 0, "Done is still delayed after 1 second");
+
+  simulatedClock.advance(2.0);
+  pController->pollSweep(false);
+  testOk(done(1) == 1, "Done is set after the delay");
+
+  pController->lock();
+  p6kTestSetDoubleParam(pController, 1, P6K_A_DelayTimeString, 0.0);
+  pController->unlock();
+}
+
+/**
+ * Settle detection ends the done move delay early once the encoder is steady.
+ */
+static void testSettle(void)
+{
+  testDiag("Settle detection");
+
+  pController->lock();
+  p6kTestSetDoubleParam(pController, 1, P6K_A_DelayTimeString, 5.0);
+  p6kTestSetDoubleParam(pController, 1, P6K_A_SettleWindowString, 2.0);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_SettleSamplesString, 3);
+  pController->unlock();
+
+  //Jitter within the window
+  setStatusReplies(true);
+  pController->pollSweep(false);
+  setStatusReplies(false);
+  setEncoderReply(50000);
+  pController->pollSweep(false);
+  setEncoderReply(50001);
+  pController->pollSweep(false);
+  testOk(done(1) == 0, "Done is delayed until the encoder has settled");
+  setEncoderReply(49999);
+  pController->pollSweep(false);
+  testOk(done(1) == 1, "Done is set after 3 samples within the window, without waiting for the delay");
+
+  //Still moving outside the window
+  setStatusReplies(true);
+  pController->pollSweep(false);
+  setStatusReplies(false);
+  bool settled = false;
+  for (int sample=0; sample<10; sample++) {
+    setEncoderReply(50000 + (sample * 10));
+    pController->pollSweep(false);
+    settled = settled || (done(1) == 1);
+  }
+  testOk(!settled, "Done is delayed while the encoder moves outside the window");
+
+  simulatedClock.advance(6.0);
+  setEncoderReply(50200);
+  pController->pollSweep(false);
+  testOk(done(1) == 1, "The delay time is the longest wait");
+
+  pController->lock();
+  p6kTestSetDoubleParam(pController, 1, P6K_A_DelayTimeString, 0.0);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_SettleSamplesString, 0);
+  pController->unlock();
+  setStatusReplies(false);
+}
+
+/**
+ * Poll and move for TEST_RUN_TIME of simulated time, waiting TEST_POLL_PERIOD
+ * between polls. The fake 6K replies slowly.
+ */
+static void simulateRun(runResult *pResult)
+{
+  epicsTimeStamp start;
+  p6kTestFaults faults;
+  p6kAxis *pAxis = pController->getAxis(1);
+
+  memset(pResult, 0, sizeof(runResult));
+  simulatedClock.getCurrent(&start);
+  double slept = simulatedClock.slept();
+
+  p6kTestPort::clearFaults(&faults);
+  faults.latency = 0.002;
+  faults.latencyJitter = 0.003;
+  faults.latencyTail = 0.01;
+  faults.latencyTailDelay = 0.1;
+  pStatusPort->setFaults(faults);
+  pCommandPort->setFaults(faults);
+
+  double nextMove = 0.0;
+  double elapsed = 0.0;
+  while (elapsed < TEST_RUN_TIME) {
+    if (elapsed >= nextMove) {
+      pController->lock();
+      p6kTestSetIntegerParam(pController, 1, motorStatusPowerOnString, 1);
+      pAxis->move(1000.0 * (pResult->polls % 7), 0, 0, 50000, 250000);
+      pController->unlock();
+      nextMove += TEST_MOVE_PERIOD;
+    }
+    pController->pollSweep(false);
+    ++pResult->polls;
+    simulatedClock.advance(TEST_POLL_PERIOD);
+    elapsed = simulatedClock.now() - (start.secPastEpoch + (start.nsec / 1.0e9));
+  }
+
+  simulatedClock.getCurrent(&pResult->end);
+  pResult->commands = pStatusPort->commandCount() + pCommandPort->commandCount();
+  pResult->slow = pStatusPort->faultCount(P6K_TEST_FAULT_SLOW) + pCommandPort->faultCount(P6K_TEST_FAULT_SLOW);
+  pResult->slept = simulatedClock.slept() - slept;
+}
+
+/**
+ * Run the same simulated hour twice, from the same start time.
+ */
+static void testRepeatable(void)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp wallStart;
+  epicsTimeStamp wallEnd;
+  runResult first;
+  runResult second;
+
+  testDiag("Simulated runs");
+
+  simulatedClock.getCurrent(&start);
+
+  epicsTimeGetCurrent(&wallStart);
+  simulateRun(&first);
+  epicsTimeGetCurrent(&wallEnd);
+  double wallTime = epicsTimeDiffInSeconds(&wallEnd, &wallStart);
+  testDiag("%.0f s simulated in %.3f s: %u polls, %u commands, %u slow replies, %.3f s waiting for replies",
+	   TEST_RUN_TIME, wallTime, first.polls, first.commands, first.slow, first.slept);
+  testOk(wallTime < TEST_WALL_TIME, "An hour of simulated time runs in less than %.0f s", TEST_WALL_TIME);
+
+  simulatedClock.set(&start);
+  simulateRun(&second);
+  testOk((first.end.secPastEpoch == second.end.secPastEpoch) && (first.end.nsec == second.end.nsec),
+	 "Both runs end at the same simulated time");
+  testOk((first.polls == second.polls) && (first.commands == second.commands) &&
+	 (first.slow == second.slow) && (first.slept == second.slept),
+	 "Both runs make the same polls and commands");
+}
+
+MAIN(p6kClockTest)
+{
+  testPlan(18);
+
+  testSimulatedClock();
+  createController();
+  testDoneDelay();
+  testSettle();
+  testRepeatable();
+
+  return testDone();
+}
@@ -0,0 +1,152 @@
+/********************************************
+ *  p6kCommandTest.cpp
+ *
+ *  Unit tests for p6kCommand, which builds
+ *  commands and parses responses using the
+ *  command table.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "parker6kCommand.h"
+
+/**
+ * The table must be in the same order as p6kCommandId.
+ */
+static void testTable(void)
+{
+  bool ordered = true;
+
+  testDiag("Command table");
+
+  for (int id=0; id<P6K_NUM_COMMANDS; id++) {
+    const p6kCommandInfo *pInfo = p6kCommand::info(static_cast<p6kCommandId>(id));
+    if ((pInfo == NULL) || (pInfo->id != id)) {
+      ordered = false;
+    }
+  }
+  testOk(ordered, "Table is in p6kCommandId order");
+  testOk1(p6kCommand::info(P6K_NUM_COMMANDS) == NULL);
+  testOk1(strcmp(p6kCommand::info(P6K_CMDID_TAS)->mnemonic, "TAS") == 0);
+}
+
+/**
+ * Building commands.
+ */
+static void testEncode(void)
+{
+  p6kBuffer command;
+
+  testDiag("Building commands");
+
+  testOk1(p6kCommand::encode(&command, P6K_CMDID_TAS, 2) == 4);
+  testOk(strcmp(command.c_str(), "2TAS") == 0, "Query: %s", command.c_str());
+
+  p6kCommand::encode(&command, P6K_CMDID_V, 1, 1.23456, 3);
+  testOk(strcmp(command.c_str(), "1V1.235") == 0, "Double: %s", command.c_str());
+
+  p6kCommand::encode(&command, P6K_CMDID_D, 8, -2000);
+  testOk(strcmp(command.c_str(), "8D-2000") == 0, "Int: %s", command.c_str());
+
+  p6kCommand::encode(&command, P6K_CMDID_GO, 0, "0101");
+  testOk(strcmp(command.c_str(), "GO0101") == 0, "Bits: %s", command.c_str());
+
+  p6kCommand::encode(&command, P6K_CMDID_ECHO, 0, 0);
+  testOk(strcmp(command.c_str(), "ECHO0") == 0, "Controller command: %s", command.c_str());
+
+  //Immediate commands
+  p6kCommand::encode(&command, P6K_CMDID_S, 3);
+  testOk(strcmp(command.c_str(), "!3S") == 0, "Axis stop: %s", command.c_str());
+  p6kCommand::encode(&command, P6K_CMDID_K, 0);
+  testOk(strcmp(command.c_str(), "!K") == 0, "Kill all: %s", command.c_str());
+
+  //Wrong argument type, or wrong use of the axis number
+  testOk1(p6kCommand::encode(&command, P6K_CMDID_V, 1, 5) == -1);
+  testOk1(command.length() == 0);
+  testOk1(p6kCommand::encode(&command, P6K_CMDID_D, 1, 1.0, 2) == -1);
+  testOk1(p6kCommand::encode(&command, P6K_CMDID_TPC, 0) == -1);
+  testOk1(p6kCommand::encode(&command, P6K_CMDID_TSS, 1) == -1);
+}
+
+/**
+ * Parsing responses.
+ */
+static void testDecode(void)
+{
+  epicsInt32 intVal = 0;
+  double doubleVal = 0.0;
+  char bits[16] = {0};
+
+  testDiag("Parsing responses");
+
+  testOk1(p6kCommand::decode("1TPC+12345", P6K_CMDID_TPC, 1, &intVal) && (intVal == 12345));
+  testOk1(p6kCommand::decode("2TPE-7", P6K_CMDID_TPE, 2, &intVal) && (intVal == -7));
+  testOk1(p6kCommand::decode("1LSPOS+100.5", P6K_CMDID_LSPOS, 1, &doubleVal) && (doubleVal == 100.5));
+  testOk1(p6kCommand::decode("1DRES25000", P6K_CMDID_DRES, 1, &doubleVal) && (doubleVal == 25000.0));
+
+  testOk1(p6kCommand::decode("1TAS0000_0001 ", P6K_CMDID_TAS, 1, bits, sizeof(bits)));
+  testOk(strcmp(bits, "0000_0001") == 0, "TAS bits: %s", bits);
+  testOk1(p6kCommand::decode("TSS1110_0000_0000_0000_0000_0000_0000_0000", P6K_CMDID_TSS, 0, bits, sizeof(bits)));
+  testOk(strlen(bits) == (sizeof(bits) - 1), "Truncated: %s", bits);
+
+  //Bit replies packed into an integer
+  epicsUInt64 packed = 0;
+  size_t count = 0;
+  testOk1(p6kCommand::decode("3TAS1000_0000_0000_1000_0000_0000_0000_0000", P6K_CMDID_TAS, 3, &packed, &count));
+  testOk1((packed == 0x1001u) && (count == 32));
+  testOk1(!p6kCommand::decode("3TPC+1", P6K_CMDID_TPC, 3, &packed, &count));
+
+  //Response for another axis or another command
+  testOk1(!p6kCommand::decode("2TPC+1", P6K_CMDID_TPC, 1, &intVal));
+  testOk1(!p6kCommand::decode("1TPE+1", P6K_CMDID_TPC, 1, &intVal));
+  //No value
+  testOk1(!p6kCommand::decode("1TPC", P6K_CMDID_TPC, 1, &intVal));
+  testOk1(!p6kCommand::decode("1TAS", P6K_CMDID_TAS, 1, bits, sizeof(bits)));
+  //Wrong reply type
+  testOk1(!p6kCommand::decode("1TAS1000", P6K_CMDID_TAS, 1, &intVal));
+  testOk1(!p6kCommand::decode("1GO", P6K_CMDID_GO, 1, &intVal));
+  testOk1(!p6kCommand::decode(NULL, P6K_CMDID_TPC, 1, &intVal));
+
+  //A bad reply must not change the value (the poller decodes straight into the axis status)
+  packed = 0x5;
+  testOk1(!p6kCommand::decode("1TASXYZ", P6K_CMDID_TAS, 1, &packed, &count) && (packed == 0x5));
+}
+
+static void testFraming(void)
+{
+  char input[64] = {0};
+  char output[64] = {0};
+  char small[4] = {0};
+
+  testDiag("Framing replies");
+
+  strcpy(input, "*1TPC+5\r\r\n");
+  testOk1(p6kCommand::trimResponse(input, output, sizeof(output)) && (strcmp(output, "1TPC+5") == 0));
+  strcpy(input, " \r\n*1TPC+5\r\r\n");
+  testOk(p6kCommand::trimResponse(input, output, sizeof(output)) && (strcmp(output, "1TPC+5") == 0),
+	 "Leading characters before the *: %s", output);
+  strcpy(input, "*1TPC+5");
+  testOk1(!p6kCommand::trimResponse(input, output, sizeof(output)));
+  strcpy(input, "*TREV92-016740-01\r\r\n");
+  testOk1(p6kCommand::trimResponse(input, small, sizeof(small)) && (strcmp(small, "TRE") == 0));
+
+  strcpy(input, "*INVALID COMMAND\r\n?");
+  testOk1(p6kCommand::errorResponse(input, output, sizeof(output)) && (strcmp(output, "INVALID COMMAND\r\n") == 0));
+  strcpy(input, "*1TPC+5\r\r\n");
+  testOk1(!p6kCommand::errorResponse(input, output, sizeof(output)));
+  testOk1(!p6kCommand::trimResponse(NULL, output, sizeof(output)));
+}
+
+MAIN(p6kCommandTest)
+{
+  testPlan(42);
+  testTable();
+  testEncode();
+  testDecode();
+  testFraming();
+  return testDone();
+}
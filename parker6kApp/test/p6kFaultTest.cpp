@@ -0,0 +1,319 @@
+/********************************************
+ *  p6kFaultTest.cpp
+ *
+ *  Fault injection tests. These run the poller
+ *  and moves against a fake 6K (p6kTestPort)
+ *  that injects latency, dropped replies,
+ *  truncated trailers, error prompts, DRIVE
+ *  SHUTDOWN replies and disconnects, and check
+ *  that the driver recovers once the faults
+ *  stop.
+ *
+ *  The poll time, the time to recover and the
+ *  number of lost moves for each fault are
+ *  printed (as test diagnostics), so that
+ *  changes to the recovery paths can be
+ *  compared.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynMotorController.h"
+#include "parker6kController.h"
+#include "p6kTestPort.h"
+#include "p6kTestController.h"
+
+#define TEST_CONTROLLER "P6K_FAULT"
+#define TEST_COMMAND_PORT "P6K_FAULT_CMD"
+#define TEST_STATUS_PORT "P6K_FAULT_STATUS"
+#define TEST_NUM_AXES 2
+#define TEST_POLL_PERIOD 1000.0
+#define TEST_POLLS 20
+#define TEST_MOVES 10
+#define TEST_TIMEOUT 0.05       //How long dropped replies and error prompts take to time out
+#define TEST_RECOVERY_TIME 30.0 //Longest time to wait for the driver to recover (asyn reconnects every few seconds)
+
+static p6kTestPort *pCommandPort = NULL;
+static p6kTestPort *pStatusPort = NULL;
+static p6kController *pController = NULL;
+
+/**
+ * Poll timing for one scenario.
+ */
+typedef struct pollStats {
+  int polls;
+  int failed;
+  double total;
+  double max;
+} pollStats;
+
+/**
+ * @return true if the move error param for the axis is set.
+ */
+static bool moveError(int axis)
+{
+  char error[P6K_MAXBUF] = {0};
+  int index = 0;
+  if (pController->findParam(P6K_A_MoveErrorString, &index) == asynSuccess) {
+    pController->getStringParam(axis, index, sizeof(error), error);
+  }
+  return (strcmp(error, " ") != 0) && (error[0] != '\0');
+}
+
+/**
+ * @return true if the last poll read everything (no comms errors on the controller or the axes).
+ */
+static bool pollOk(void)
+{
+  bool ok = true;
+  pController->lock();
+  if (p6kTestGetIntegerParam(pController, 0, P6K_C_CommsErrorString) != 0) {
+    ok = false;
+  }
+  for (int axis=1; axis<=TEST_NUM_AXES; axis++) {
+    if (p6kTestGetIntegerParam(pController, axis, motorStatusCommsErrorString) != 0) {
+      ok = false;
+    }
+  }
+  pController->unlock();
+  return ok;
+}
+
+/**
+ * Run one poll of the controller and all the axes, as the poller thread does.
+ * @return How long the poll took (seconds)
+ */
+static double pollOnce(pollStats *pStats)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+
+  epicsTimeGetCurrent(&start);
+  pController->pollSweep(false);
+  epicsTimeGetCurrent(&end);
+
+  double elapsed = epicsTimeDiffInSeconds(&end, &start);
+  if (pStats != NULL) {
+    pStats->polls++;
+    pStats->total += elapsed;
+    if (elapsed > pStats->max) {
+      pStats->max = elapsed;
+    }
+    if (!pollOk()) {
+      pStats->failed++;
+    }
+  }
+  return elapsed;
+}
+
+/**
+ * Poll a number of times with faults on the status port.
+ */
+static void pollWithFaults(const p6kTestFaults &faults, pollStats *pStats)
+{
+  memset(pStats, 0, sizeof(pollStats));
+  pStatusPort->setFaults(faults);
+  for (int poll=0; poll<TEST_POLLS; poll++) {
+    pollOnce(pStats);
+  }
+}
+
+/**
+ * Stop the faults, and poll until the driver has recovered.
+ * @return The time taken to recover (seconds), or a negative number if it didn't.
+ */
+static double recover(void)
+{
+  p6kTestFaults none;
+  epicsTimeStamp start;
+  epicsTimeStamp now;
+
+  p6kTestPort::clearFaults(&none);
+  pStatusPort->setFaults(none);
+  pCommandPort->setFaults(none);
+
+  epicsTimeGetCurrent(&start);
+  for (;;) {
+    pollOnce(NULL);
+    epicsTimeGetCurrent(&now);
+    double elapsed = epicsTimeDiffInSeconds(&now, &start);
+    if (pollOk()) {
+      return elapsed;
+    }
+    if (elapsed > TEST_RECOVERY_TIME) {
+      return -1.0;
+    }
+    epicsThreadSleep(0.1);
+  }
+}
+
+/**
+ * Print the poll timing and check that the driver recovers.
+ */
+static void report(const char *name, const pollStats &stats, epicsUInt32 faults)
+{
+  testDiag("%s: %u faults, %d of %d polls failed, mean poll %.1f ms, max %.1f ms",
+	   name, faults, stats.failed, stats.polls,
+	   (stats.polls > 0) ? (stats.total * 1000.0 / stats.polls) : 0.0, stats.max * 1000.0);
+  double recovery = recover();
+  testDiag("%s: recovered in %.3f s", name, recovery);
+  testOk(recovery >= 0.0, "%s: driver recovers when the faults stop", name);
+}
+
+/**
+ * Create the fake ports, the controller and the axes, and check that polling works without faults.
+ */
+static void testStartup(void)
+{
+  p6kTestReplies startupReplies;
+  p6kTestReplies statusReplies;
+  pollStats stats;
+  p6kTestFaults none;
+
+  testDiag("Startup");
+
+  pCommandPort = new p6kTestPort(TEST_COMMAND_PORT);
+  pStatusPort = new p6kTestPort(TEST_STATUS_PORT);
+  p6kTestStartupReplies(&startupReplies, "6K2", TEST_NUM_AXES);
+  pCommandPort->setReplies(startupReplies);
+  p6kTestStatusReplies(&statusReplies, TEST_NUM_AXES, P6K_TEST_TAS_IDLE);
+  pStatusPort->setReplies(statusReplies);
+
+  pController = p6kTestCreateController(TEST_CONTROLLER, TEST_COMMAND_PORT, TEST_NUM_AXES,
+					TEST_POLL_PERIOD, TEST_POLL_PERIOD, TEST_STATUS_PORT);
+
+  p6kTestPort::clearFaults(&none);
+  pollWithFaults(none, &stats);
+  testOk(stats.failed == 0, "No faults: all %d polls worked", stats.polls);
+  report("No faults", stats, 0);
+}
+
+/**
+ * Slow replies. Every poll should still work, just more slowly.
+ */
+static void testLatency(void)
+{
+  pollStats stats;
+  p6kTestFaults faults;
+
+  testDiag("Latency");
+
+  p6kTestPort::clearFaults(&faults);
+  faults.latency = 0.001;
+  faults.latencyJitter = 0.002;
+  faults.latencyTail = 0.05;
+  faults.latencyTailDelay = 0.02;
+  pollWithFaults(faults, &stats);
+  testOk(stats.failed == 0, "Latency: all %d polls worked", stats.polls);
+  report("Latency", stats, pStatusPort->faultCount(P6K_TEST_FAULT_SLOW));
+}
+
+/**
+ * Each of the faults in the replies to the status queries.
+ */
+static void testReplyFaults(void)
+{
+  pollStats stats;
+  p6kTestFaults faults;
+
+  testDiag("Faults in the replies to status queries");
+
+  p6kTestPort::clearFaults(&faults);
+  faults.dropReply = 0.1;
+  faults.dropTimeout = TEST_TIMEOUT;
+  pollWithFaults(faults, &stats);
+  testOk(stats.failed > 0, "Dropped replies are reported as comms errors");
+  report("Dropped replies", stats, pStatusPort->faultCount(P6K_TEST_FAULT_DROP));
+
+  p6kTestPort::clearFaults(&faults);
+  faults.truncateTrailer = 0.1;
+  pollWithFaults(faults, &stats);
+  testOk(stats.failed > 0, "Truncated replies are reported as comms errors");
+  report("Truncated trailers", stats, pStatusPort->faultCount(P6K_TEST_FAULT_TRUNCATE));
+
+  p6kTestPort::clearFaults(&faults);
+  faults.errorPrompt = 0.1;
+  faults.dropTimeout = TEST_TIMEOUT;
+  pollWithFaults(faults, &stats);
+  testOk(stats.failed > 0, "Error prompts are reported as comms errors");
+  report("Error prompts", stats, pStatusPort->faultCount(P6K_TEST_FAULT_ERROR));
+
+  p6kTestPort::clearFaults(&faults);
+  faults.disconnect = 0.05;
+  faults.disconnectTime = 0.5;
+  pollWithFaults(faults, &stats);
+  testOk(stats.failed > 0, "Disconnects are reported as comms errors");
+  report("Disconnects", stats, pStatusPort->faultCount(P6K_TEST_FAULT_DISCONNECT));
+}
+
+/**
+ * Make some moves with faults on the command port.
+ * @return The number of moves that reported an error.
+ */
+static int moveWithFaults(const p6kTestFaults &faults)
+{
+  int failed = 0;
+  p6kAxis *pAxis = pController->getAxis(1);
+
+  pCommandPort->setFaults(faults);
+  for (int move=0; move<TEST_MOVES; move++) {
+    pController->lock();
+    p6kTestSetIntegerParam(pController, 1, motorStatusPowerOnString, 1);
+    p6kTestSetIntegerParam(pController, 1, P6K_A_DriveRetryString, 0);
+    pAxis->move(1000 * (move + 1), 0, 0, 50000, 250000);
+    if (moveError(1)) {
+      failed++;
+    }
+    pController->unlock();
+  }
+  return failed;
+}
+
+/**
+ * Faults in the replies to motion commands. A move is lost if the GO
+ * command doesn't get through, and the driver should always say so.
+ */
+static void testLostMoves(void)
+{
+  p6kTestFaults faults;
+
+  testDiag("Lost moves");
+
+  p6kTestPort::clearFaults(&faults);
+  faults.driveShutdown = 1.0;
+  faults.dropTimeout = TEST_TIMEOUT;
+  int failed = moveWithFaults(faults);
+  epicsUInt32 shutdowns = pCommandPort->faultCount(P6K_TEST_FAULT_DRIVE_SHUTDOWN);
+  testDiag("DRIVE SHUTDOWN: %u of %d moves shut down, %d reported", shutdowns, TEST_MOVES, failed);
+  testOk((shutdowns == TEST_MOVES) && (failed == TEST_MOVES), "Every DRIVE SHUTDOWN is reported as a move error");
+
+  p6kTestPort::clearFaults(&faults);
+  faults.errorPrompt = 0.1;
+  faults.dropTimeout = TEST_TIMEOUT;
+  failed = moveWithFaults(faults);
+  testDiag("Error prompts: %u errors in %u commands, %d of %d moves reported an error",
+	   pCommandPort->faultCount(P6K_TEST_FAULT_ERROR), pCommandPort->commandCount(), failed, TEST_MOVES);
+
+  p6kTestPort::clearFaults(&faults);
+  failed = moveWithFaults(faults);
+  testOk(failed == 0, "Moves work again when the faults stop");
+}
+
+MAIN(p6kFaultTest)
+{
+  testPlan(14);
+  testStartup();
+  testLatency();
+  testReplyFaults();
+  testLostMoves();
+  return testDone();
+}
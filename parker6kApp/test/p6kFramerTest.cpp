@@ -0,0 +1,226 @@
+/********************************************
+ *  p6kFramerTest.cpp
+ *
+ *  Unit tests for p6kFramer, which splits
+ *  the replies from the controller into
+ *  frames.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "parker6kFramer.h"
+
+/**
+ * Take the oldest frame, and check its type and text.
+ */
+static bool popFrame(p6kFramer *pFramer, p6kFrameType type, const char *text)
+{
+  p6kFrame frame;
+  char output[64];
+
+  if (!pFramer->front(&frame)) {
+    testDiag("no frame");
+    return false;
+  }
+  pFramer->copyText(frame, output, sizeof(output));
+  pFramer->pop();
+  if ((frame.type != type) || (strcmp(output, text) != 0)) {
+    testDiag("frame type %d, text '%s'", frame.type, output);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Single replies.
+ */
+static void testReplies(void)
+{
+  static const char *reply = "*1TPC+5\r\r\n>";
+  static const char *error = "*UNKNOWN COMMAND\r\n?";
+  p6kFramer framer;
+  p6kFrame frame;
+
+  testDiag("Replies");
+
+  testOk1(framer.prompt() == '>');
+  testOk1(framer.consume(reply, strlen(reply)) == strlen(reply));
+  testOk1(framer.front(&frame) && (frame.start == 0) && (frame.length == strlen(reply)) && frame.lineEnd);
+  testOk1((framer.at(frame.text) == '1') && (frame.textLength == 6));
+  testOk1(popFrame(&framer, P6K_FRAME_REPLY, "1TPC+5"));
+  testOk1((framer.frames() == 0) && (framer.pending() == 0));
+
+  //Errors end with a ?
+  framer.consume(error, strlen(error));
+  testOk1(popFrame(&framer, P6K_FRAME_ERROR, "UNKNOWN COMMAND"));
+
+  //A command with no reply, and some leading chars before the '*'
+  framer.consume("\r\n> *1TAS\r\r\n>", 13);
+  testOk1(popFrame(&framer, P6K_FRAME_REPLY, ""));
+  testOk1(popFrame(&framer, P6K_FRAME_REPLY, "1TAS"));
+
+  //A prompt char in the middle of a line is part of the reply
+  framer.consume("*1DRES>4000\r\r\n>", 15);
+  testOk1(popFrame(&framer, P6K_FRAME_REPLY, "1DRES>4000"));
+}
+
+/**
+ * Replies split up and coalesced in every way.
+ */
+static void testChunks(void)
+{
+  static const char *stream = "*1TAS0000_0000\r\r\n>*UNKNOWN COMMAND\r\n?*2TPC-12\r\r\n>";
+  size_t length = strlen(stream);
+  bool ok = true;
+
+  testDiag("Chunks");
+
+  //Every way of splitting the stream in two
+  for (size_t split=0; split<=length; split++) {
+    p6kFramer framer;
+    ok = (framer.consume(stream, split) == split) && ok;
+    ok = (framer.consume(stream + split, length - split) == length - split) && ok;
+    ok = (framer.frames() == 3) && ok;
+    ok = popFrame(&framer, P6K_FRAME_REPLY, "1TAS0000_0000") && ok;
+    ok = popFrame(&framer, P6K_FRAME_ERROR, "UNKNOWN COMMAND") && ok;
+    ok = popFrame(&framer, P6K_FRAME_REPLY, "2TPC-12") && ok;
+  }
+  testOk(ok, "Split in two");
+
+  //One character at a time, taking each frame as soon as it is complete
+  p6kFramer framer;
+  size_t found = 0;
+  for (size_t i=0; i<length; i++) {
+    framer.consume(stream + i, 1);
+    found += framer.frames();
+    while (framer.frames() > 0) {
+      framer.pop();
+    }
+  }
+  testOk1(found == 3);
+
+  //Reading straight into the ring buffer
+  size_t space = 0;
+  framer.reset();
+  char *pSpace = framer.prepare(&space);
+  testOk1(space == P6K_FRAMER_SIZE);
+  memcpy(pSpace, stream, 20);
+  framer.commit(20);
+  testOk1((framer.frames() == 1) && (framer.pending() == 20));
+}
+
+/**
+ * The prompt while defining a program.
+ */
+static void testProgram(void)
+{
+  static const char *reply = "*TREV92-016740-01-7.3\r\r\n-";
+  p6kFramer framer;
+
+  testDiag("Program definition");
+
+  testOk1(!framer.command("1TAS"));
+  testOk1(framer.command("DEF PROG1") && (framer.prompt() == '-'));
+  testOk1(!framer.command("DEF PROG2"));
+
+  //The - in the TREV reply is not the prompt
+  framer.consume(reply, strlen(reply));
+  testOk1(popFrame(&framer, P6K_FRAME_PROGRAM, "TREV92-016740-01-7.3"));
+  framer.consume("\r\n>\r\n-", 6);
+  testOk1(popFrame(&framer, P6K_FRAME_PROGRAM, ""));
+
+  testOk1(framer.command("END") && (framer.prompt() == '>'));
+  testOk1(!framer.command(NULL));
+}
+
+/**
+ * Replies that the low level port has already removed the prompt from.
+ */
+static void testTerminate(void)
+{
+  p6kFramer framer;
+  p6kFrame frame;
+
+  testDiag("Terminate");
+
+  framer.consume("*1TPC+5\r\r\n", 10);
+  testOk1((framer.frames() == 0) && framer.terminate());
+  testOk1(framer.front(&frame) && frame.lineEnd);
+  testOk1(popFrame(&framer, P6K_FRAME_REPLY, "1TPC+5"));
+
+  //A missing line ending
+  framer.consume("*1TPC+5", 7);
+  framer.terminate();
+  testOk1(framer.front(&frame) && !frame.lineEnd);
+  testOk1(popFrame(&framer, P6K_FRAME_REPLY, "1TPC+5"));
+
+  //Nothing read
+  framer.reset();
+  framer.terminate();
+  testOk1(framer.front(&frame) && !frame.lineEnd && (frame.length == 0));
+}
+
+/**
+ * Wrapping around the ring buffer, and filling it up.
+ */
+static void testRing(void)
+{
+  static const char *reply = "*1TPC+123456789\r\r\n>";
+  char text[8];
+  p6kFramer framer;
+  p6kFrame frame;
+  bool ok = true;
+
+  testDiag("Ring buffer");
+
+  //Enough replies to wrap around several times, so some of the text wraps too
+  for (size_t i=0; i<(3 * P6K_FRAMER_SIZE / strlen(reply)); i++) {
+    ok = (framer.consume(reply, strlen(reply)) == strlen(reply)) && ok;
+    ok = popFrame(&framer, P6K_FRAME_REPLY, "1TPC+123456789") && ok;
+  }
+  testOk(ok, "Wrap around");
+
+  //Truncating the text
+  framer.consume(reply, strlen(reply));
+  framer.front(&frame);
+  testOk1((framer.copyText(frame, text, sizeof(text)) == 7) && (strcmp(text, "1TPC+12") == 0));
+  testOk1(framer.copyText(frame, text, 0) == 0);
+
+  //The frame queue fills up, and the rest is scanned when there is room
+  framer.reset();
+  for (size_t i=0; i<(P6K_FRAMER_FRAMES + 4); i++) {
+    framer.consume(">", 1);
+  }
+  testOk1(framer.frames() == P6K_FRAMER_FRAMES);
+  testOk1(!framer.terminate());
+  framer.pop();
+  testOk1(framer.frames() == P6K_FRAMER_FRAMES);
+  testOk1(framer.pending() == (P6K_FRAMER_FRAMES + 3));
+
+  //A partial frame that fills the ring buffer is thrown away
+  char junk[100];
+  memset(junk, 'A', sizeof(junk));
+  framer.reset();
+  for (size_t i=0; i<(P6K_FRAMER_SIZE / sizeof(junk)) + 1; i++) {
+    framer.consume(junk, sizeof(junk));
+  }
+  testOk1(framer.overflows() == 1);
+  framer.consume(reply, strlen(reply));
+  testOk1(framer.frames() == 1);
+  testOk1((framer.front(&frame)) && (frame.textLength == 14));
+}
+
+MAIN(p6kFramerTest)
+{
+  testPlan(37);
+  testReplies();
+  testChunks();
+  testProgram();
+  testTerminate();
+  testRing();
+  return testDone();
+}
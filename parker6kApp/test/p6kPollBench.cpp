@@ -0,0 +1,259 @@
+/********************************************
+ *  p6kPollBench.cpp
+ *
+ *  Benchmark of one poll of an 8 axis
+ *  controller against a fake 6K, of the
+ *  flow trace calls on the poll path, and of
+ *  the axis config reads made by a move.
+ *
+ *  This compares asynPrint (which locks the
+ *  trace mask on every call) with P6K_TRACE_FLOW
+ *  (which tests the copy of the mask), and
+ *  times the whole poll with tracing off and on.
+ *  It also compares reading the config params 
+ *  from the param list (as the move used to) with 
+ *  reading the axis copies (p6kAxisConfig).
+ *  Build it with P6K_FLOW_TRACE=NO as well to
+ *  compare with the flow trace compiled out.
+ *  It is not run by 'make runtests'. Run it by hand:
+ *
+ *  ./p6kPollBench [number of polls]
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "asynDriver.h"
+#include "parker6kController.h"
+#include "parker6kTrace.h"
+#include "p6kTestPort.h"
+#include "p6kTestController.h"
+
+#define BENCH_CONTROLLER "P6K_BENCH"
+#define BENCH_COMMAND_PORT "P6K_BENCH_CMD"
+#define BENCH_STATUS_PORT "P6K_BENCH_STATUS"
+#define BENCH_AXES 8
+#define BENCH_CALLS_PER_POLL 100  //Trace calls timed for each poll
+
+static p6kTestPort *pCommandPort = NULL;
+static p6kTestPort *pStatusPort = NULL;
+static p6kController *pController = NULL;
+
+/* Stop the compiler throwing away the work */
+static volatile double sink = 0.0;
+
+static double timePolls(long polls)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+
+  epicsTimeGetCurrent(&start);
+  for (long i=0; i<polls; i++) {
+    pController->pollSweep(false);
+  }
+  epicsTimeGetCurrent(&end);
+
+  return epicsTimeDiffInSeconds(&end, &start);
+}
+
+/**
+ * Time the flow trace calls made in a poll, the old way (asynPrint).
+ */
+static double timeAsynPrint(asynUser *pasynUser, long polls)
+{
+  static const char *functionName = "timeAsynPrint";
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+
+  epicsTimeGetCurrent(&start);
+  for (long i=0; i<polls; i++) {
+    for (int call=0; call<BENCH_CALLS_PER_POLL; call++) {
+      asynPrint(pasynUser, ASYN_TRACE_FLOW, "%s axis %d\n", functionName, call);
+    }
+  }
+  epicsTimeGetCurrent(&end);
+
+  return epicsTimeDiffInSeconds(&end, &start);
+}
+
+/**
+ * Time the flow trace calls made in a poll, using P6K_TRACE_FLOW.
+ */
+static double timeTraceFlow(asynUser *pasynUser, long polls)
+{
+  static const char *functionName = "timeTraceFlow";
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  int traceMask = pasynTrace->getTraceMask(pasynUser);
+
+  epicsTimeGetCurrent(&start);
+  for (long i=0; i<polls; i++) {
+    for (int call=0; call<BENCH_CALLS_PER_POLL; call++) {
+      P6K_TRACE_FLOW(traceMask, pasynUser, "%s axis %d\n", functionName, call);
+    }
+  }
+  epicsTimeGetCurrent(&end);
+
+  return epicsTimeDiffInSeconds(&end, &start);
+}
+
+/**
+ * Time the config reads made by a move and a poll, from the param list.
+ */
+static double timeParamReads(long polls)
+{
+  static const char *intParams[] = {
+    P6K_A_DRESString, P6K_A_ERESString, P6K_A_MaxDigitsString, P6K_A_LimitDriveEnableString,
+    P6K_A_SendPositionOnlyString, P6K_A_AutoDriveEnableString, P6K_A_AutoDriveEnableDelayString,
+    P6K_A_DriveRetryString, P6K_A_ExternalEncoderUseString, P6K_A_ModbusEncoderCheckString,
+    P6K_A_SettleSamplesString
+  };
+  static const char *doubleParams[] = {P6K_A_DelayTimeString, P6K_A_SettleWindowString};
+  const size_t numInt = sizeof(intParams)/sizeof(intParams[0]);
+  const size_t numDouble = sizeof(doubleParams)/sizeof(doubleParams[0]);
+  int intIndex[numInt];
+  int doubleIndex[numDouble];
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  epicsInt32 intSum = 0;
+  double doubleSum = 0.0;
+
+  for (size_t i=0; i<numInt; i++) {
+    pController->findParam(intParams[i], &intIndex[i]);
+  }
+  for (size_t i=0; i<numDouble; i++) {
+    pController->findParam(doubleParams[i], &doubleIndex[i]);
+  }
+
+  pController->lock();
+  epicsTimeGetCurrent(&start);
+  for (long i=0; i<polls; i++) {
+    for (int axis=1; axis<=BENCH_AXES; axis++) {
+      for (size_t param=0; param<numInt; param++) {
+	epicsInt32 value = 0;
+	pController->getIntegerParam(axis, intIndex[param], &value);
+	intSum += value;
+      }
+      for (size_t param=0; param<numDouble; param++) {
+	double value = 0.0;
+	pController->getDoubleParam(axis, doubleIndex[param], &value);
+	doubleSum += value;
+      }
+    }
+  }
+  epicsTimeGetCurrent(&end);
+  pController->unlock();
+
+  sink += intSum + doubleSum;
+  return epicsTimeDiffInSeconds(&end, &start);
+}
+
+/**
+ * Time the same reads from the axis copies.
+ */
+static double timeConfigReads(long polls)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  epicsInt32 intSum = 0;
+  double doubleSum = 0.0;
+
+  pController->lock();
+  epicsTimeGetCurrent(&start);
+  for (long i=0; i<polls; i++) {
+    for (int axis=1; axis<=BENCH_AXES; axis++) {
+      const volatile p6kAxisConfig *pConfig = pController->getAxis(axis)->getConfig();
+      intSum += pConfig->dres + pConfig->eres + pConfig->maxDigits + pConfig->limitDriveEnable +
+	pConfig->sendPositionOnly + pConfig->autoDriveEnable + pConfig->autoDriveEnableDelay +
+	pConfig->driveRetry + pConfig->externalEncoderUse + pConfig->modbusEncoderCheck +
+	pConfig->settleSamples;
+      doubleSum += pConfig->delayTime + pConfig->settleWindow;
+    }
+  }
+  epicsTimeGetCurrent(&end);
+  pController->unlock();
+
+  sink += intSum + doubleSum;
+  return epicsTimeDiffInSeconds(&end, &start);
+}
+
+int main(int argc, char *argv[])
+{
+  p6kTestReplies startupReplies;
+  p6kTestReplies statusReplies;
+  long polls = 10000;
+
+  if (argc > 1) {
+    polls = atol(argv[1]);
+  }
+  if (polls <= 0) {
+    printf("Usage: %s [number of polls]\n", argv[0]);
+    return 1;
+  }
+
+  pCommandPort = new p6kTestPort(BENCH_COMMAND_PORT);
+  pStatusPort = new p6kTestPort(BENCH_STATUS_PORT);
+  p6kTestStartupReplies(&startupReplies, "6K8", BENCH_AXES);
+  pCommandPort->setReplies(startupReplies);
+  p6kTestStatusReplies(&statusReplies, BENCH_AXES, P6K_TEST_TAS_IDLE);
+  pStatusPort->setReplies(statusReplies);
+
+  pController = p6kTestCreateController(BENCH_CONTROLLER, BENCH_COMMAND_PORT, BENCH_AXES,
+					0.0, 0.0, BENCH_STATUS_PORT);
+
+  asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+  pasynManager->connectDevice(pasynUser, BENCH_CONTROLLER, 0);
+  int traceMask = pasynTrace->getTraceMask(pasynUser);
+
+#ifdef P6K_NO_FLOW_TRACE
+  printf("Built with P6K_FLOW_TRACE=NO (flow trace compiled out)\n");
+#else
+  printf("Built with the flow trace\n");
+#endif
+
+  //Warm up
+  timePolls(polls/10 + 1);
+
+  double pollTime = timePolls(polls);
+  double printTime = timeAsynPrint(pasynUser, polls);
+  double traceTime = timeTraceFlow(pasynUser, polls);
+
+  //The same with the flow trace on, written to /dev/null
+  double pollTraceTime = 0.0;
+  FILE *pNull = fopen("/dev/null", "w");
+  if (pNull != NULL) {
+    pasynTrace->setTraceFile(pasynUser, pNull);
+    pasynTrace->setTraceMask(pasynUser, traceMask | ASYN_TRACE_FLOW);
+    timePolls(1);
+    pollTraceTime = timePolls(polls);
+    pasynTrace->setTraceMask(pasynUser, traceMask);
+    pasynTrace->setTraceFile(pasynUser, stdout);
+    fclose(pNull);
+  }
+
+  double paramTime = timeParamReads(polls);
+  double configTime = timeConfigReads(polls);
+
+  double calls = static_cast<double>(polls) * BENCH_CALLS_PER_POLL;
+  printf("%ld polls of %d axes\n", polls, BENCH_AXES);
+  printf("  poll, trace off:        %8.3f us per poll\n", (pollTime * 1e6) / polls);
+  if (pNull != NULL) {
+    printf("  poll, flow trace on:    %8.3f us per poll\n", (pollTraceTime * 1e6) / polls);
+  }
+  printf("%.0f flow trace calls, trace off\n", calls);
+  printf("  asynPrint:              %8.3f ns per call\n", (printTime * 1e9) / calls);
+  printf("  P6K_TRACE_FLOW:         %8.3f ns per call\n", (traceTime * 1e9) / calls);
+  printf("Config reads (13 per axis), %d axes\n", BENCH_AXES);
+  printf("  param list:             %8.3f us per poll\n", (paramTime * 1e6) / polls);
+  printf("  p6kAxisConfig:          %8.3f us per poll\n", (configTime * 1e6) / polls);
+  printf("  (checksum %.0f)\n", sink);
+
+  pasynManager->freeAsynUser(pasynUser);
+
+  return 0;
+}
@@ -0,0 +1,235 @@
+/********************************************
+ *  p6kPollSchedulerTest.cpp
+ *
+ *  Tests for the shared poll scheduler, using
+ *  fake poll clients on one worker thread. It
+ *  checks the first poll, the requeue after each
+ *  sweep, the order of wakeups, and shutdown.
+ *
+ ********************************************/
+
+#include <string.h>
+#include <string>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "parker6kPollScheduler.h"
+#include "parker6kClock.h"
+
+#define TEST_PERIOD 0.05         //Poll period for the periodic client (seconds)
+#define TEST_WAIT 2.0            //Longest time to wait for a poll (seconds)
+
+static epicsMutex logMutex;
+static std::string pollLog;
+
+/**
+ * A poll client that counts its sweeps. It can be told to block
+ * in a sweep (to hold up the single worker), or to stop polling.
+ */
+class testClient : public p6kPollClient {
+
+ public:
+  testClient(const char *name, double period)
+    : name_(name), period_(period), sweeps_(0), wakeups_(0),
+      block_(false), stop_(false), lastTime_(0.0), minInterval_(1e9)
+  {
+    entered_ = epicsEventMustCreate(epicsEventEmpty);
+    release_ = epicsEventMustCreate(epicsEventEmpty);
+  }
+
+  double pollSweep(bool wakeup)
+  {
+    double now = p6kClock::getClock()->now();
+
+    logMutex.lock();
+    pollLog += name_;
+    if ((sweeps_ > 0) && !wakeup && ((now - lastTime_) < minInterval_)) {
+      minInterval_ = now - lastTime_;
+    }
+    lastTime_ = now;
+    ++sweeps_;
+    if (wakeup) {
+      ++wakeups_;
+    }
+    bool block = block_;
+    double timeout = stop_ ? -1.0 : period_;
+    logMutex.unlock();
+
+    if (block) {
+      epicsEventSignal(entered_);
+      epicsEventWait(release_);
+    }
+    return timeout;
+  }
+
+  const char *pollName(void) const { return name_; }
+
+  int sweeps(void) { logMutex.lock(); int n = sweeps_; logMutex.unlock(); return n; }
+  int wakeups(void) { logMutex.lock(); int n = wakeups_; logMutex.unlock(); return n; }
+  double minInterval(void) { logMutex.lock(); double t = minInterval_; logMutex.unlock(); return t; }
+  void setBlock(bool block) { logMutex.lock(); block_ = block; logMutex.unlock(); }
+  void setStop(bool stop) { logMutex.lock(); stop_ = stop; logMutex.unlock(); }
+
+  epicsEventId entered_;
+  epicsEventId release_;
+
+ private:
+  const char *name_;
+  double period_;
+  int sweeps_;
+  int wakeups_;
+  bool block_;
+  bool stop_;
+  double lastTime_;
+  double minInterval_;
+};
+
+/**
+ * Wait for a client to reach a number of sweeps.
+ */
+static bool waitSweeps(testClient *pClient, int sweeps)
+{
+  for (double waited=0.0; waited<TEST_WAIT; waited+=0.01) {
+    if (pClient->sweeps() >= sweeps) {
+      return true;
+    }
+    epicsThreadSleep(0.01);
+  }
+  testDiag("%s only did %d sweeps", pClient->pollName(), pClient->sweeps());
+  return false;
+}
+
+static std::string takeLog(void)
+{
+  logMutex.lock();
+  std::string log = pollLog;
+  pollLog.clear();
+  logMutex.unlock();
+  return log;
+}
+
+/**
+ * Stop a client, and check that it is not polled again.
+ */
+static void stopClient(p6kPollScheduler *pScheduler, testClient *pClient)
+{
+  pClient->setStop(true);
+  int sweeps = pClient->sweeps();
+  pScheduler->wakeup(pClient);
+  waitSweeps(pClient, sweeps + 1);
+  testOk(pScheduler->wakeup(pClient) == asynSuccess, "%s: wakeup after stop is accepted", pClient->pollName());
+  epicsThreadSleep(0.2);
+  testOk(pClient->sweeps() == sweeps + 1, "%s: no polls after stop", pClient->pollName());
+}
+
+/**
+ * Registering a client, and polls that only happen on a wakeup (a zero poll period).
+ */
+static void testRegister(p6kPollScheduler *pScheduler)
+{
+  static testClient client("A", 0.0);
+  static testClient unknown("X", 0.0);
+
+  testDiag("Register");
+
+  testOk1(pScheduler->addController(&client) == asynSuccess);
+  testOk(waitSweeps(&client, 1) && (client.wakeups() == 1), "First poll is straight away, as a wakeup");
+  testOk1(pScheduler->addController(&client) == asynError);
+  testOk1(pScheduler->wakeup(&unknown) == asynError);
+
+  epicsThreadSleep(0.2);
+  testOk(client.sweeps() == 1, "Zero period only polls on a wakeup");
+  pScheduler->wakeup(&client);
+  testOk1(waitSweeps(&client, 2) && (client.wakeups() == 2));
+
+  stopClient(pScheduler, &client);
+  takeLog();
+}
+
+/**
+ * A client with a poll period is put back on the queue after each sweep.
+ */
+static void testPeriodic(p6kPollScheduler *pScheduler)
+{
+  static testClient client("P", TEST_PERIOD);
+
+  testDiag("Periodic");
+
+  pScheduler->addController(&client);
+  testOk1(waitSweeps(&client, 6));
+  testOk(client.wakeups() == 1, "Only the first poll was a wakeup");
+  testOk(client.minInterval() >= (TEST_PERIOD * 0.9), "Polls are at least one period apart (%f s)", client.minInterval());
+
+  stopClient(pScheduler, &client);
+  takeLog();
+}
+
+/**
+ * Clients are polled in deadline order, and a wakeup during
+ * a sweep polls the client again once the sweep is done.
+ */
+static void testOrder(p6kPollScheduler *pScheduler)
+{
+  static testClient blocker("Z", 0.0);
+  static testClient clientA("A", 0.0);
+  static testClient clientB("B", 0.0);
+  static testClient clientC("C", 0.0);
+
+  testDiag("Order");
+
+  pScheduler->addController(&clientA);
+  pScheduler->addController(&clientB);
+  pScheduler->addController(&clientC);
+  waitSweeps(&clientA, 1);
+  waitSweeps(&clientB, 1);
+  waitSweeps(&clientC, 1);
+
+  //Hold up the only worker thread, then queue the wakeups behind it
+  blocker.setBlock(true);
+  pScheduler->addController(&blocker);
+  testOk(epicsEventWaitWithTimeout(blocker.entered_, TEST_WAIT) == epicsEventOK, "Worker is busy");
+  takeLog();
+  pScheduler->wakeup(&clientC);
+  epicsThreadSleep(0.01);
+  pScheduler->wakeup(&clientA);
+  epicsThreadSleep(0.01);
+  pScheduler->wakeup(&blocker);
+  pScheduler->wakeup(&clientB);
+  epicsThreadSleep(0.01);
+  pScheduler->wakeup(&clientA);
+
+  blocker.setBlock(false);
+  epicsEventSignal(blocker.release_);
+  waitSweeps(&clientB, 2);
+  waitSweeps(&blocker, 2);
+
+  std::string log = takeLog();
+  testOk(log == "CABZ", "Wakeups are polled in order, once each (%s)", log.c_str());
+  testOk(blocker.wakeups() == 2, "A wakeup during a sweep polls again after it");
+
+  stopClient(pScheduler, &blocker);
+  stopClient(pScheduler, &clientA);
+  stopClient(pScheduler, &clientB);
+  stopClient(pScheduler, &clientC);
+}
+
+MAIN(p6kPollSchedulerTest)
+{
+  testPlan(28);
+
+  testOk1(p6kPollScheduler::getInstance() == NULL);
+  testOk1(p6kPollScheduler::create(0) == asynError);
+  testOk1(p6kPollScheduler::create(1) == asynSuccess);
+  testOk1(p6kPollScheduler::create(1) == asynError);
+
+  p6kPollScheduler *pScheduler = p6kPollScheduler::getInstance();
+  testRegister(pScheduler);
+  testPeriodic(pScheduler);
+  testOrder(pScheduler);
+
+  return testDone();
+}
@@ -0,0 +1,294 @@
+/********************************************
+ *  p6kSimPort.cpp
+ *
+ *  A fake 6K with a simple motion model,
+ *  for soak tests. It answers the motion
+ *  commands and status queries that the
+ *  driver sends, and moves the axes in
+ *  (real or simulated) time.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <epicsStdio.h>
+
+#include "parker6kClock.h"
+#include "p6kSimPort.h"
+
+#define P6K_SIM_MAXBUF 64
+
+/**
+ * Constructor. All the axes start at position 0, not moving, in absolute mode.
+ * @param numAxes The number of axes (numbered from 1)
+ * @param dres The steps per rev, used to turn V into steps per second
+ */
+p6kSimController::p6kSimController(int numAxes, epicsInt32 dres)
+  : dres_(dres),
+    moves_(0),
+    stops_(0)
+{
+  p6kSimAxis axis;
+  axis.position = 0.0;
+  axis.target = 0.0;
+  axis.startTime = 0.0;
+  axis.endTime = 0.0;
+  axis.moving = false;
+  axis.absolute = true;
+  axis.distance = 0;
+  axis.velocity = 0.0;
+  axes_.assign(numAxes, axis);
+}
+
+p6kSimController::~p6kSimController()
+{
+}
+
+/**
+ * Handle a command, as the 6K would.
+ * @param command The command, as sent by the driver (eg. 1D1000 or !1S)
+ * @param pReply Set to the reply to a query (eg. 1TPC+1000)
+ * @return true if the command is a query that was answered, false otherwise
+ */
+bool p6kSimController::command(const std::string &command, std::string *pReply)
+{
+  char reply[P6K_SIM_MAXBUF] = {0};
+  const char *pCommand = command.c_str();
+  int axisNo = 0;
+  bool answered = false;
+
+  if (*pCommand == '!') {
+    ++pCommand;
+  }
+  while (isdigit(*pCommand)) {
+    axisNo = (axisNo * 10) + (*pCommand - '0');
+    ++pCommand;
+  }
+  const char *pName = pCommand;
+  while (isupper(*pCommand)) {
+    ++pCommand;
+  }
+  std::string name(pName, pCommand - pName);
+  const char *pArg = pCommand;
+
+  double now = p6kClock::getClock()->now();
+
+  mutex_.lock();
+
+  for (size_t axis=0; axis<axes_.size(); ++axis) {
+    update(&axes_[axis], now);
+  }
+  p6kSimAxis *pAxis = getAxis(axisNo);
+
+  if (name == "GO") {
+    if (pAxis != NULL) {
+      startMove(pAxis, now);
+    } else {
+      //GO with axis bits (GO11), or all the axes (GO)
+      size_t axis = 0;
+      for (const char *pBit = pArg; (*pBit != '\0') && (axis < axes_.size()); ++pBit) {
+	if (*pBit == '_') {
+	  continue;
+	}
+	if (*pBit == '1') {
+	  startMove(&axes_[axis], now);
+	}
+	++axis;
+      }
+      if (*pArg == '\0') {
+	for (axis=0; axis<axes_.size(); ++axis) {
+	  startMove(&axes_[axis], now);
+	}
+      }
+    }
+  } else if ((name == "S") || (name == "K")) {
+    if (pAxis != NULL) {
+      stopMove(pAxis, now);
+    } else {
+      for (size_t axis=0; axis<axes_.size(); ++axis) {
+	stopMove(&axes_[axis], now);
+      }
+    }
+  } else if (pAxis != NULL) {
+    if (name == "MA") {
+      pAxis->absolute = (atoi(pArg) != 0);
+    } else if (name == "D") {
+      pAxis->distance = atoi(pArg);
+    } else if (name == "V") {
+      pAxis->velocity = atof(pArg);
+    } else if ((name == "PSET") && !pAxis->moving) {
+      pAxis->position = atoi(pArg);
+    } else if ((name == "TPC") || (name == "TPE")) {
+      epicsSnprintf(reply, sizeof(reply), "%d%s%+d", axisNo, name.c_str(), position(pAxis, now));
+      answered = true;
+    } else if (name == "TAS") {
+      //Bit 1 is moving, bit 2 is the direction (1=negative)
+      bool negative = pAxis->moving && (pAxis->target < pAxis->position);
+      epicsSnprintf(reply, sizeof(reply), "%dTAS%d%d00_0000_0000_0000_0000_0000_0000_0000",
+		    axisNo, pAxis->moving ? 1 : 0, negative ? 1 : 0);
+      answered = true;
+    }
+  }
+
+  mutex_.unlock();
+
+  if (answered) {
+    *pReply = reply;
+  }
+  return answered;
+}
+
+/**
+ * @return The current position of an axis (steps).
+ */
+epicsInt32 p6kSimController::position(int axis)
+{
+  double now = p6kClock::getClock()->now();
+  epicsInt32 steps = 0;
+
+  mutex_.lock();
+  p6kSimAxis *pAxis = getAxis(axis);
+  if (pAxis != NULL) {
+    update(pAxis, now);
+    steps = position(pAxis, now);
+  }
+  mutex_.unlock();
+  return steps;
+}
+
+/**
+ * @return true if an axis is moving.
+ */
+bool p6kSimController::moving(int axis)
+{
+  double now = p6kClock::getClock()->now();
+  bool moving = false;
+
+  mutex_.lock();
+  p6kSimAxis *pAxis = getAxis(axis);
+  if (pAxis != NULL) {
+    update(pAxis, now);
+    moving = pAxis->moving;
+  }
+  mutex_.unlock();
+  return moving;
+}
+
+/**
+ * @return The number of moves started.
+ */
+epicsUInt32 p6kSimController::moves(void)
+{
+  mutex_.lock();
+  epicsUInt32 moves = moves_;
+  mutex_.unlock();
+  return moves;
+}
+
+/**
+ * @return The number of moves stopped before they finished.
+ */
+epicsUInt32 p6kSimController::stops(void)
+{
+  mutex_.lock();
+  epicsUInt32 stops = stops_;
+  mutex_.unlock();
+  return stops;
+}
+
+/**
+ * @return The state of an axis (numbered from 1), or NULL for an invalid axis.
+ */
+p6kSimController::p6kSimAxis* p6kSimController::getAxis(int axis)
+{
+  if ((axis < 1) || (axis > static_cast<int>(axes_.size()))) {
+    return NULL;
+  }
+  return &axes_[axis - 1];
+}
+
+/**
+ * Finish the move if it's time. Call with the mutex held.
+ */
+void p6kSimController::update(p6kSimAxis *pAxis, double now)
+{
+  if (pAxis->moving && (now >= pAxis->endTime)) {
+    pAxis->position = pAxis->target;
+    pAxis->moving = false;
+  }
+}
+
+/**
+ * Start a move using the last MA, D and V. Call with the mutex held.
+ */
+void p6kSimController::startMove(p6kSimAxis *pAxis, double now)
+{
+  double start = position(pAxis, now);
+  double target = pAxis->absolute ? pAxis->distance : (start + pAxis->distance);
+  double speed = pAxis->velocity * dres_;
+
+  pAxis->position = start;
+  pAxis->target = target;
+  pAxis->startTime = now;
+  pAxis->endTime = now;
+  if (speed > 0.0) {
+    pAxis->endTime += fabs(target - start) / speed;
+  }
+  pAxis->moving = true;
+  ++moves_;
+  update(pAxis, now);
+}
+
+/**
+ * Stop a move where it is. Call with the mutex held.
+ */
+void p6kSimController::stopMove(p6kSimAxis *pAxis, double now)
+{
+  if (pAxis->moving) {
+    pAxis->position = position(pAxis, now);
+    pAxis->moving = false;
+    ++stops_;
+  }
+}
+
+/**
+ * The position of an axis (steps), part way through a move. Call with the mutex held.
+ */
+epicsInt32 p6kSimController::position(const p6kSimAxis *pAxis, double now)
+{
+  double position = pAxis->position;
+  if (pAxis->moving && (pAxis->endTime > pAxis->startTime)) {
+    position += (pAxis->target - pAxis->position) * (now - pAxis->startTime) / (pAxis->endTime - pAxis->startTime);
+  }
+  return static_cast<epicsInt32>(floor(position + 0.5));
+}
+
+
+/**
+ * p6kSimPort constructor. This creates and registers the asyn port.
+ * @param portName The asyn port name to give to p6kCreateController
+ * @param pSim The motion model (shared with the other port for the same 6K)
+ */
+p6kSimPort::p6kSimPort(const char *portName, p6kSimController *pSim)
+  : p6kTestPort(portName),
+    pSim_(pSim)
+{
+}
+
+p6kSimPort::~p6kSimPort()
+{
+}
+
+/**
+ * Pass every command to the motion model, then look in the reply table.
+ */
+bool p6kSimPort::findReply(const std::string &command, std::string *pReply)
+{
+  if (pSim_->command(command, pReply)) {
+    return true;
+  }
+  return p6kTestPort::findReply(command, pReply);
+}
@@ -0,0 +1,89 @@
+/********************************************
+ *  p6kSimPort.h
+ *
+ *  A fake 6K with a simple motion model,
+ *  for soak tests. It answers the motion
+ *  commands and status queries that the
+ *  driver sends, and moves the axes in
+ *  (real or simulated) time.
+ *
+ ********************************************/
+
+#ifndef p6kSimPort_H
+#define p6kSimPort_H
+
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+
+#include "p6kTestPort.h"
+
+/**
+ * The motion model, shared by the command and status ports of one fake 6K.
+ *
+ * Moves run at the last V sent (revs/s, DRES steps per rev) with no
+ * acceleration, and finish exactly on the target. MA, D, GO (for one axis or
+ * with axis bits), S, K and PSET are handled, and TPC, TPE and TAS report the
+ * current state. The encoder follows the commanded position. Time comes from
+ * p6kClock, so a p6kSimulatedClock makes the moves take no real time.
+ */
+class p6kSimController {
+
+ public:
+  p6kSimController(int numAxes, epicsInt32 dres);
+  virtual ~p6kSimController();
+
+  bool command(const std::string &command, std::string *pReply);
+  epicsInt32 position(int axis);
+  bool moving(int axis);
+  epicsUInt32 moves(void);
+  epicsUInt32 stops(void);
+
+ private:
+  /**
+   * The state of one axis.
+   */
+  struct p6kSimAxis {
+    double position;        /**< Position when the move started (or when stopped) */
+    double target;          /**< Target of the move in progress */
+    double startTime;       /**< When the move started (seconds) */
+    double endTime;         /**< When the move will finish (seconds) */
+    bool moving;
+    bool absolute;          /**< Set by MA */
+    epicsInt32 distance;    /**< Set by D */
+    double velocity;        /**< Set by V (revs/s) */
+  };
+
+  p6kSimAxis* getAxis(int axis);
+  void update(p6kSimAxis *pAxis, double now);
+  void startMove(p6kSimAxis *pAxis, double now);
+  void stopMove(p6kSimAxis *pAxis, double now);
+  static epicsInt32 position(const p6kSimAxis *pAxis, double now);
+
+  epicsMutex mutex_;
+  std::vector<p6kSimAxis> axes_;
+  epicsInt32 dres_;
+  epicsUInt32 moves_;
+  epicsUInt32 stops_;
+};
+
+/**
+ * A p6kTestPort that gets its replies from a p6kSimController. Commands
+ * that the model doesn't handle are answered from the setReply table.
+ */
+class p6kSimPort : public p6kTestPort {
+
+ public:
+  p6kSimPort(const char *portName, p6kSimController *pSim);
+  virtual ~p6kSimPort();
+
+ protected:
+  bool findReply(const std::string &command, std::string *pReply);
+
+ private:
+  p6kSimController *pSim_;
+};
+
+#endif /* p6kSimPort_H */
@@ -0,0 +1,490 @@
+/********************************************
+ *  p6kSoakTest.cpp
+ *
+ *  Soak test. This runs random moves, deferred
+ *  move groups, stops and set positions against
+ *  a simulated 6K (p6kSimPort), in simulated
+ *  time, and checks the final positions and the
+ *  done moving status after every poll.
+ *
+ *  It reports the throughput, the latency of
+ *  the driver calls and of the moves, and the
+ *  memory and file handles used by the process.
+ *
+ *  The number of operations and the random seed
+ *  can be set with the environment variables
+ *  P6K_SOAK_OPERATIONS and P6K_SOAK_SEED, for
+ *  long runs (eg. overnight).
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynInt32SyncIO.h"
+#include "asynMotorController.h"
+#include "parker6kController.h"
+#include "parker6kClock.h"
+#include "p6kSimPort.h"
+#include "p6kTestController.h"
+
+#define SOAK_CONTROLLER "P6K_SOAK"
+#define SOAK_COMMAND_PORT "P6K_SOAK_CMD"
+#define SOAK_STATUS_PORT "P6K_SOAK_STATUS"
+#define SOAK_NUM_AXES 2
+#define SOAK_DRES 25000
+#define SOAK_OPERATIONS 2000       //Default number of operations
+#define SOAK_POLL_PERIOD 0.1       //Simulated time between polls (seconds)
+#define SOAK_MOVE_TIMEOUT 60.0     //Longest simulated time for a move to finish (seconds)
+#define SOAK_MAX_POSITION 100000   //Moves are within +/- this (steps)
+#define SOAK_VELOCITY 50000.0      //Steps per second
+#define SOAK_ACCELERATION 250000.0 //Steps per second per second
+#define SOAK_WARMUP 100            //Operations before the memory and handle baseline is taken
+#define SOAK_REPORT_INTERVAL 1000  //Operations between progress reports
+#define SOAK_STOP_TIMEOUT 1.0      //Timeout for writing the StopAll param (seconds)
+
+/** The operations that the soak test chooses from */
+typedef enum {
+  SOAK_MOVE_ABSOLUTE,
+  SOAK_MOVE_RELATIVE,
+  SOAK_MOVE_DEFERRED,
+  SOAK_STOP_AXIS,
+  SOAK_STOP_ALL,
+  SOAK_SET_POSITION,
+  SOAK_NUM_OPERATIONS
+} soakOperation;
+
+static const char *soakOperationNames[SOAK_NUM_OPERATIONS] = {
+  "absolute move", "relative move", "deferred move", "stop axis", "stop all", "set position"
+};
+
+static p6kSimulatedClock simulatedClock;
+static p6kSimController *pSim = NULL;
+static p6kSimPort *pCommandPort = NULL;
+static p6kSimPort *pStatusPort = NULL;
+static p6kController *pController = NULL;
+static asynUser *pStopAllUser = NULL;
+static epicsUInt32 randomState = 1;
+
+/**
+ * Counts and timings for the whole run.
+ */
+typedef struct soakStats {
+  epicsUInt32 operations[SOAK_NUM_OPERATIONS];
+  epicsUInt32 polls;
+  epicsUInt32 dmovErrors;      /**< Polls where DMOV didn't agree with the controller */
+  epicsUInt32 positionErrors;  /**< Operations that didn't end at the expected position */
+  epicsUInt32 timeouts;        /**< Moves that never finished */
+  std::vector<double> callLatency;  /**< Real time taken by the driver call for each operation (s) */
+  std::vector<double> moveTime;     /**< Simulated time from the operation to DMOV (s) */
+} soakStats;
+
+/**
+ * Uniform random integer from 0 to range-1, from a simple LCG so that a run
+ * can be repeated with the same seed.
+ */
+static epicsUInt32 soakRandom(epicsUInt32 range)
+{
+  randomState = (randomState * 1664525u) + 1013904223u;
+  return static_cast<epicsUInt32>((randomState >> 8) % range);
+}
+
+/**
+ * Random position from -SOAK_MAX_POSITION to SOAK_MAX_POSITION.
+ */
+static epicsInt32 randomPosition(void)
+{
+  return static_cast<epicsInt32>(soakRandom(2 * SOAK_MAX_POSITION + 1)) - SOAK_MAX_POSITION;
+}
+
+/**
+ * Read an environment variable as a number.
+ */
+static epicsUInt32 envNumber(const char *name, epicsUInt32 defaultValue)
+{
+  const char *value = getenv(name);
+  if ((value == NULL) || (*value == '\0')) {
+    return defaultValue;
+  }
+  return static_cast<epicsUInt32>(strtoul(value, NULL, 0));
+}
+
+/**
+ * @return The resident memory of the process (kB), or -1 if we can't tell.
+ */
+static long residentKb(void)
+{
+#ifdef __linux__
+  long size = 0;
+  long resident = 0;
+  FILE *fptr = fopen("/proc/self/statm", "r");
+  if (fptr == NULL) {
+    return -1;
+  }
+  int count = fscanf(fptr, "%ld %ld", &size, &resident);
+  fclose(fptr);
+  if (count != 2) {
+    return -1;
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+  return -1;
+#endif
+}
+
+/**
+ * @return The number of open file handles in the process, or -1 if we can't tell.
+ */
+static long openHandles(void)
+{
+#ifdef __linux__
+  long handles = 0;
+  DIR *pDir = opendir("/proc/self/fd");
+  struct dirent *pEntry = NULL;
+  if (pDir == NULL) {
+    return -1;
+  }
+  while ((pEntry = readdir(pDir)) != NULL) {
+    if (pEntry->d_name[0] != '.') {
+      ++handles;
+    }
+  }
+  closedir(pDir);
+  //Don't count the handle used to read the directory
+  return handles - 1;
+#else
+  return -1;
+#endif
+}
+
+/**
+ * The value at a percentile of a sorted list.
+ */
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+/**
+ * Print the percentiles of a list of times.
+ */
+static void reportTimes(const char *name, std::vector<double> times, double scale, const char *units)
+{
+  std::sort(times.begin(), times.end());
+  testDiag("%s (%s): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f", name, units,
+	   percentile(times, 0.5) * scale, percentile(times, 0.9) * scale,
+	   percentile(times, 0.99) * scale, percentile(times, 0.999) * scale,
+	   times.empty() ? 0.0 : times.back() * scale);
+}
+
+/**
+ * Set the replies to the startup and status queries. The motion model
+ * answers the axis queries ahead of these (see p6kSimPort::findReply).
+ */
+static void setStartupReplies(void)
+{
+  char command[P6K_MAXBUF] = {0};
+  char reply[P6K_MAXBUF] = {0};
+  p6kTestReplies startupReplies;
+  p6kTestReplies statusReplies;
+
+  p6kTestStartupReplies(&startupReplies, "6K2", SOAK_NUM_AXES);
+  for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+    epicsSnprintf(command, sizeof(command), "%dDRES", axis);
+    epicsSnprintf(reply, sizeof(reply), "%dDRES%d", axis, SOAK_DRES);
+    startupReplies[command] = reply;
+  }
+  pCommandPort->setReplies(startupReplies);
+  p6kTestStatusReplies(&statusReplies, SOAK_NUM_AXES, P6K_TEST_TAS_IDLE);
+  pStatusPort->setReplies(statusReplies);
+}
+
+/**
+ * Create the simulated 6K, the controller and the axes. The poll periods
+ * are zero, so the controller's own poller thread only polls on a wakeup,
+ * and the test makes the rest of the polls by calling pollSweep.
+ */
+static void createController(void)
+{
+  p6kClock::setClock(&simulatedClock);
+
+  pSim = new p6kSimController(SOAK_NUM_AXES, SOAK_DRES);
+  pCommandPort = new p6kSimPort(SOAK_COMMAND_PORT, pSim);
+  pStatusPort = new p6kSimPort(SOAK_STATUS_PORT, pSim);
+  setStartupReplies();
+
+  pController = p6kTestCreateController(SOAK_CONTROLLER, SOAK_COMMAND_PORT, SOAK_NUM_AXES,
+					0.0, 0.0, SOAK_STATUS_PORT);
+  for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+    pController->lock();
+    p6kTestSetIntegerParam(pController, axis, motorStatusPowerOnString, 1);
+    p6kTestSetDoubleParam(pController, axis, motorEncoderRatioString, 1.0);
+    pController->unlock();
+  }
+
+  if (pasynInt32SyncIO->connect(SOAK_CONTROLLER, 0, &pStopAllUser, P6K_C_StopAllString) != asynSuccess) {
+    testAbort("Could not connect to %s %s", SOAK_CONTROLLER, P6K_C_StopAllString);
+  }
+}
+
+/**
+ * Poll once, and check that DMOV (and the moving bit) agree with the simulated 6K.
+ * @return true if all the axes are done
+ */
+static bool pollAndCheck(soakStats *pStats)
+{
+  bool allDone = true;
+
+  pController->pollSweep(false);
+  ++pStats->polls;
+
+  pController->lock();
+  for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+    bool moving = pSim->moving(axis);
+    int done = p6kTestGetIntegerParam(pController, axis, motorStatusDoneString);
+    int movingParam = p6kTestGetIntegerParam(pController, axis, motorStatusMovingString);
+    if ((done == (moving ? 1 : 0)) || (movingParam == done)) {
+      if (pStats->dmovErrors < 10) {
+	testDiag("Axis %d: DMOV=%d and MOVN=%d, but the controller is %s",
+		 axis, done, movingParam, moving ? "moving" : "stopped");
+      }
+      ++pStats->dmovErrors;
+    }
+    if (!done) {
+      allDone = false;
+    }
+  }
+  pController->unlock();
+
+  return allDone;
+}
+
+/**
+ * Poll until every axis is done.
+ * @param maxTime The longest simulated time to wait (seconds)
+ * @return The simulated time taken (seconds), or a negative number if the axes didn't finish
+ */
+static double waitDone(soakStats *pStats, double maxTime)
+{
+  double start = simulatedClock.now();
+  while (!pollAndCheck(pStats)) {
+    simulatedClock.advance(SOAK_POLL_PERIOD);
+    if ((simulatedClock.now() - start) > maxTime) {
+      return -1.0;
+    }
+  }
+  return simulatedClock.now() - start;
+}
+
+/**
+ * Check that an axis ended where we expected, on the 6K and in the driver.
+ */
+static void checkPosition(soakStats *pStats, int axis, epicsInt32 expected, soakOperation operation)
+{
+  epicsInt32 actual = pSim->position(axis);
+  pController->lock();
+  double reported = p6kTestGetDoubleParam(pController, axis, motorPositionString);
+  pController->unlock();
+  if ((actual != expected) || (reported != expected)) {
+    if (pStats->positionErrors < 10) {
+      testDiag("Axis %d after %s: expected %d, the controller is at %d, the driver says %.0f",
+	       axis, soakOperationNames[operation], expected, actual, reported);
+    }
+    ++pStats->positionErrors;
+  }
+}
+
+/**
+ * Do one random operation, wait for it to finish and check the positions.
+ * @param expected The expected position of each axis (index 0 is axis 1). This is updated.
+ */
+static void runOperation(soakStats *pStats, epicsInt32 *expected)
+{
+  soakOperation operation = static_cast<soakOperation>(soakRandom(SOAK_NUM_OPERATIONS));
+  int axisNo = soakRandom(SOAK_NUM_AXES) + 1;
+  p6kAxis *pAxis = pController->getAxis(axisNo);
+  epicsInt32 position = randomPosition();
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  double callLatency = 0.0;
+
+  ++pStats->operations[operation];
+
+  pController->lock();
+  epicsTimeGetCurrent(&start);
+  switch (operation) {
+  case SOAK_MOVE_ABSOLUTE:
+    pAxis->move(position, 0, 0, SOAK_VELOCITY, SOAK_ACCELERATION);
+    expected[axisNo - 1] = position;
+    break;
+  case SOAK_MOVE_RELATIVE:
+    position = position / 10;
+    pAxis->move(position, 1, 0, SOAK_VELOCITY, SOAK_ACCELERATION);
+    expected[axisNo - 1] += position;
+    break;
+  case SOAK_MOVE_DEFERRED:
+    pController->setDeferredMoves(true);
+    for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+      position = randomPosition();
+      pController->getAxis(axis)->move(position, 0, 0, SOAK_VELOCITY, SOAK_ACCELERATION);
+      expected[axis - 1] = position;
+    }
+    pController->setDeferredMoves(false);
+    break;
+  case SOAK_STOP_AXIS:
+  case SOAK_STOP_ALL:
+    //Start a move, let it run for a while, then stop it.
+    pAxis->move(position, 0, 0, SOAK_VELOCITY, SOAK_ACCELERATION);
+    pController->unlock();
+    for (epicsUInt32 poll=soakRandom(10); poll>0; --poll) {
+      simulatedClock.advance(SOAK_POLL_PERIOD);
+      pollAndCheck(pStats);
+    }
+    epicsTimeGetCurrent(&start);
+    if (operation == SOAK_STOP_AXIS) {
+      pController->lock();
+      pAxis->stop(SOAK_ACCELERATION);
+    } else {
+      //As the StopAll record would (this goes through the port thread, which takes the lock)
+      pasynInt32SyncIO->write(pStopAllUser, 1, SOAK_STOP_TIMEOUT);
+      pController->lock();
+    }
+    break;
+  default:
+    pAxis->setPosition(position);
+    expected[axisNo - 1] = position;
+    break;
+  }
+  epicsTimeGetCurrent(&end);
+  callLatency = epicsTimeDiffInSeconds(&end, &start);
+  pController->unlock();
+
+  pStats->callLatency.push_back(callLatency);
+
+  //The stopped axes stay where the 6K stopped them
+  if ((operation == SOAK_STOP_AXIS) || (operation == SOAK_STOP_ALL)) {
+    for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+      expected[axis - 1] = pSim->position(axis);
+    }
+  }
+
+  double moveTime = waitDone(pStats, SOAK_MOVE_TIMEOUT);
+  if (moveTime < 0.0) {
+    ++pStats->timeouts;
+  } else {
+    pStats->moveTime.push_back(moveTime);
+  }
+
+  for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+    checkPosition(pStats, axis, expected[axis - 1], operation);
+  }
+
+  //Don't let the recorded commands grow
+  pCommandPort->clearTranscript();
+  pStatusPort->clearTranscript();
+}
+
+/**
+ * The soak test itself.
+ */
+static void testSoak(epicsUInt32 operations)
+{
+  soakStats stats;
+  epicsInt32 expected[SOAK_NUM_AXES];
+  epicsTimeStamp wallStart;
+  epicsTimeStamp wallEnd;
+  double simulatedStart = simulatedClock.now();
+  long memoryStart = -1;
+  long handlesStart = -1;
+  long memoryMax = -1;
+  long handlesMax = -1;
+
+  memset(stats.operations, 0, sizeof(stats.operations));
+  stats.polls = 0;
+  stats.dmovErrors = 0;
+  stats.positionErrors = 0;
+  stats.timeouts = 0;
+  stats.callLatency.reserve(operations);
+  stats.moveTime.reserve(operations);
+
+  for (int axis=1; axis<=SOAK_NUM_AXES; axis++) {
+    expected[axis - 1] = pSim->position(axis);
+  }
+
+  epicsTimeGetCurrent(&wallStart);
+  for (epicsUInt32 operation=0; operation<operations; operation++) {
+    if (operation == SOAK_WARMUP) {
+      memoryStart = residentKb();
+      handlesStart = openHandles();
+    }
+    runOperation(&stats, expected);
+    if ((operation >= SOAK_WARMUP) && ((operation % SOAK_REPORT_INTERVAL) == 0)) {
+      memoryMax = std::max(memoryMax, residentKb());
+      handlesMax = std::max(handlesMax, openHandles());
+      testDiag("%u operations, %ld kB, %ld handles", operation, residentKb(), openHandles());
+    }
+  }
+  epicsTimeGetCurrent(&wallEnd);
+
+  long memoryEnd = residentKb();
+  long handlesEnd = openHandles();
+  memoryMax = std::max(memoryMax, memoryEnd);
+  handlesMax = std::max(handlesMax, handlesEnd);
+
+  double wallTime = epicsTimeDiffInSeconds(&wallEnd, &wallStart);
+  epicsUInt32 commands = pCommandPort->commandCount() + pStatusPort->commandCount();
+  testDiag("%u operations in %.2f s (%.0f per second), %.0f s simulated",
+	   operations, wallTime, (wallTime > 0.0) ? (operations / wallTime) : 0.0,
+	   simulatedClock.now() - simulatedStart);
+  for (int operation=0; operation<SOAK_NUM_OPERATIONS; operation++) {
+    testDiag("  %s: %u", soakOperationNames[operation], stats.operations[operation]);
+  }
+  testDiag("%u polls, %u commands (%.0f per second), %u moves started, %u stopped on the 6K",
+	   stats.polls, commands, (wallTime > 0.0) ? (commands / wallTime) : 0.0, pSim->moves(), pSim->stops());
+  reportTimes("Driver call latency", stats.callLatency, 1.0e6, "us");
+  reportTimes("Time to DMOV", stats.moveTime, 1.0e3, "ms simulated");
+  testDiag("Memory: %ld kB after warm up, %ld kB at the end (max %ld kB)", memoryStart, memoryEnd, memoryMax);
+  testDiag("File handles: %ld after warm up, %ld at the end (max %ld)", handlesStart, handlesEnd, handlesMax);
+
+  testOk(stats.timeouts == 0, "Every operation finished (%u did not)", stats.timeouts);
+  testOk(stats.dmovErrors == 0, "DMOV agreed with the controller on every poll (%u polls did not)", stats.dmovErrors);
+  testOk(stats.positionErrors == 0, "Every axis ended at the expected position (%u errors)", stats.positionErrors);
+  if ((handlesStart >= 0) && (operations > SOAK_WARMUP)) {
+    testOk(handlesEnd <= handlesStart, "No file handles leaked (%ld then %ld)", handlesStart, handlesEnd);
+  } else {
+    testSkip(1, "The number of file handles is not available");
+  }
+}
+
+MAIN(p6kSoakTest)
+{
+  epicsUInt32 operations = envNumber("P6K_SOAK_OPERATIONS", SOAK_OPERATIONS);
+  randomState = envNumber("P6K_SOAK_SEED", 1);
+
+  testPlan(4);
+  testDiag("Soak test: %u operations, seed %u", operations, randomState);
+
+  createController();
+  testSoak(operations);
+
+  return testDone();
+}
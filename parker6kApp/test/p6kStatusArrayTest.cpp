@@ -0,0 +1,234 @@
+/********************************************
+ *  p6kStatusArrayTest.cpp
+ *
+ *  Tests for the packed status array
+ *  (P6K_C_STATUS_ARRAY). The polls are run
+ *  by the real pollers (asynMotorPoller, and
+ *  then the shared poll scheduler), and the
+ *  array is read from its interrupt callback,
+ *  as an I/O Intr waveform record would.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynDriver.h"
+#include "asynFloat64Array.h"
+#include "asynMotorController.h"
+#include "parker6kController.h"
+#include "parker6kPollScheduler.h"
+#include "p6kTestPort.h"
+#include "p6kTestController.h"
+
+#define TEST_NUM_AXES 2
+#define TEST_POLL_PERIOD 1000.0   //Long enough that only wakeups poll
+#define TEST_TIMEOUT 0.05         //How long dropped replies take to time out
+#define TEST_WAIT 5.0             //Longest time to wait for a poll (seconds)
+
+/**
+ * A controller on fake ports, with an interrupt client for its status array.
+ */
+typedef struct testController {
+  p6kTestPort *pCommandPort;
+  p6kTestPort *pStatusPort;
+  p6kController *pController;
+  asynUser *pasynUser;
+  void *interruptPvt;
+  epicsMutex *pMutex;
+  epicsEventId callback;
+  epicsFloat64 values[TEST_NUM_AXES * P6K_STATUS_ARRAY_STRIDE];
+  size_t nElements;
+  epicsTimeStamp timestamp;
+  int callbacks;
+} testController;
+
+/**
+ * Interrupt callback for the status array. This is called from the poller, with the driver lock held.
+ */
+static void arrayCallback(void *userPvt, asynUser *pasynUser, epicsFloat64 *value, size_t nElements)
+{
+  testController *pTest = static_cast<testController *>(userPvt);
+
+  pTest->pMutex->lock();
+  if (nElements > (sizeof(pTest->values) / sizeof(pTest->values[0]))) {
+    nElements = sizeof(pTest->values) / sizeof(pTest->values[0]);
+  }
+  memcpy(pTest->values, value, nElements * sizeof(epicsFloat64));
+  pTest->nElements = nElements;
+  pTest->timestamp = pasynUser->timestamp;
+  ++pTest->callbacks;
+  pTest->pMutex->unlock();
+  epicsEventSignal(pTest->callback);
+}
+
+/**
+ * Set the status replies. Axis 1 is idle.
+ * @param tas2 The axis status for axis 2
+ */
+static void setStatusReplies(testController *pTest, const char *tas2)
+{
+  p6kTestReplies replies;
+
+  p6kTestStatusReplies(&replies, TEST_NUM_AXES, P6K_TEST_TAS_IDLE);
+  replies["2TAS"] = std::string("2TAS") + tas2;
+  pTest->pStatusPort->setReplies(replies);
+}
+
+/**
+ * Create the fake ports, the controller and the axes, and register for the status array callbacks.
+ */
+static bool createController(testController *pTest, const char *name)
+{
+  char portName[P6K_MAXBUF] = {0};
+  p6kTestReplies replies;
+  asynInterface *pInterface = NULL;
+  int reason = 0;
+
+  pTest->pMutex = new epicsMutex;
+  pTest->callback = epicsEventMustCreate(epicsEventEmpty);
+  pTest->nElements = 0;
+  pTest->callbacks = 0;
+  memset(&pTest->timestamp, 0, sizeof(pTest->timestamp));
+
+  epicsSnprintf(portName, sizeof(portName), "%s_CMD", name);
+  pTest->pCommandPort = new p6kTestPort(portName);
+  epicsSnprintf(portName, sizeof(portName), "%s_STATUS", name);
+  pTest->pStatusPort = new p6kTestPort(portName);
+  p6kTestStartupReplies(&replies, "6K2", TEST_NUM_AXES);
+  pTest->pCommandPort->setReplies(replies);
+  setStatusReplies(pTest, P6K_TEST_TAS_IDLE);
+
+  pTest->pController = p6kTestCreateController(name, pTest->pCommandPort->portName, TEST_NUM_AXES,
+					       TEST_POLL_PERIOD, TEST_POLL_PERIOD, pTest->pStatusPort->portName);
+
+  pTest->pasynUser = pasynManager->createAsynUser(NULL, NULL);
+  if ((pasynManager->connectDevice(pTest->pasynUser, name, 0) != asynSuccess) ||
+      ((pInterface = pasynManager->findInterface(pTest->pasynUser, asynFloat64ArrayType, 1)) == NULL) ||
+      (pTest->pController->findParam(P6K_C_StatusArrayString, &reason) != asynSuccess)) {
+    return false;
+  }
+  pTest->pasynUser->reason = reason;
+  asynFloat64Array *pArray = static_cast<asynFloat64Array *>(pInterface->pinterface);
+  return (pArray->registerInterruptUser(pInterface->drvPvt, pTest->pasynUser,
+					arrayCallback, pTest, &pTest->interruptPvt) == asynSuccess);
+}
+
+/**
+ * Wake up the poller, and wait for a status array callback with the TAS of axis 2.
+ * A poll that had already started may post the old status first, so keep waiting.
+ */
+static bool waitForTas(testController *pTest, double tas2)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&start);
+  pTest->pController->wakeupPoller();
+  for (;;) {
+    epicsEventWaitWithTimeout(pTest->callback, 0.1);
+    pTest->pMutex->lock();
+    bool found = (pTest->nElements == (TEST_NUM_AXES * P6K_STATUS_ARRAY_STRIDE)) &&
+      (pTest->values[P6K_STATUS_ARRAY_STRIDE + P6K_STATUS_ARRAY_TAS] == tas2);
+    pTest->pMutex->unlock();
+    if (found) {
+      return true;
+    }
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &start) > TEST_WAIT) {
+      return false;
+    }
+    pTest->pController->wakeupPoller();
+  }
+}
+
+/**
+ * Check the status array of one controller, polled by its own poller.
+ */
+static void testPoller(testController *pTest, const char *name)
+{
+  epicsTimeStamp portBefore;
+  epicsTimeStamp portAfter;
+  p6kTestFaults faults;
+
+  testDiag("%s", name);
+
+  pTest->pController->lock();
+  pTest->pController->getTimeStamp(&portBefore);
+  pTest->pController->unlock();
+
+  setStatusReplies(pTest, P6K_TEST_TAS_MOVING);
+  testOk(waitForTas(pTest, 1.0), "%s: the status array is posted by the poller", name);
+
+  pTest->pMutex->lock();
+  bool ok = true;
+  for (int axis=1; axis<=TEST_NUM_AXES; axis++) {
+    epicsFloat64 *pAxis = &pTest->values[(axis - 1) * P6K_STATUS_ARRAY_STRIDE];
+    ok = ok && (pAxis[P6K_STATUS_ARRAY_POSITION] == 50000.0) && (pAxis[P6K_STATUS_ARRAY_ENCODER] == 50000.0) &&
+      (pAxis[P6K_STATUS_ARRAY_TAS] == ((axis == 2) ? 1.0 : 0.0)) && (pAxis[P6K_STATUS_ARRAY_ERROR] == 0.0);
+  }
+  epicsTimeStamp arrayTime = pTest->timestamp;
+  pTest->pMutex->unlock();
+  testOk(ok, "%s: the status array has the position, encoder, TAS and error of each axis", name);
+
+  pTest->pController->lock();
+  pTest->pController->getTimeStamp(&portAfter);
+  pTest->pController->unlock();
+  testOk(arrayTime.secPastEpoch != 0, "%s: the status array has the poll time", name);
+  testOk((portAfter.secPastEpoch == portBefore.secPastEpoch) && (portAfter.nsec == portBefore.nsec),
+	 "%s: the port time stamp is not changed", name);
+
+  //A status that can't be read is flagged in the error code
+  p6kTestPort::clearFaults(&faults);
+  faults.dropReply = 1.0;
+  faults.dropTimeout = TEST_TIMEOUT;
+  pTest->pStatusPort->setFaults(faults);
+  pTest->pMutex->lock();
+  int callbacks = pTest->callbacks;
+  pTest->pMutex->unlock();
+  pTest->pController->wakeupPoller();
+  bool flagged = false;
+  for (int i=0; (i<(TEST_WAIT / 0.1)) && !flagged; i++) {
+    epicsEventWaitWithTimeout(pTest->callback, 0.1);
+    pTest->pMutex->lock();
+    flagged = (pTest->callbacks > callbacks) &&
+      ((static_cast<int>(pTest->values[P6K_STATUS_ARRAY_ERROR]) & P6K_STATUS_ERROR_NOSTATUS) != 0);
+    pTest->pMutex->unlock();
+  }
+  testOk(flagged, "%s: the error code says when the status could not be read", name);
+
+  p6kTestPort::clearFaults(&faults);
+  pTest->pStatusPort->setFaults(faults);
+  setStatusReplies(pTest, P6K_TEST_TAS_IDLE);
+  bool cleared = waitForTas(pTest, 0.0);
+  pTest->pMutex->lock();
+  cleared = cleared && (pTest->values[P6K_STATUS_ARRAY_ERROR] == 0.0);
+  pTest->pMutex->unlock();
+  testOk(cleared, "%s: the error code is cleared when the status is read again", name);
+}
+
+MAIN(p6kStatusArrayTest)
+{
+  static testController own;
+  static testController shared;
+
+  testPlan(14);
+
+  testOk(createController(&own, "P6K_ARRAY"), "Controller with its own poller");
+  testPoller(&own, "asynMotorPoller");
+
+  //Controllers created after this use the shared poll scheduler
+  p6kPollScheduler::create(1);
+  testOk(createController(&shared, "P6K_ARRAY_SHARED"), "Controller on the shared poll scheduler");
+  testPoller(&shared, "Shared poll scheduler");
+
+  return testDone();
+}
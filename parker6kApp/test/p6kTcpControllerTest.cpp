@@ -0,0 +1,185 @@
+/********************************************
+ *  p6kTcpControllerTest.cpp
+ *
+ *  Tests for a controller on native TCP links
+ *  (p6kCreateTcpLink), with a local stand-in
+ *  for each session on the 6K (p6kTcpServer).
+ *  The commands and the status polls go
+ *  through the same lowLevelWriteRead paths
+ *  as they do on an asyn IP port.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynMotorController.h"
+#include "parker6kController.h"
+#include "parker6kTcpLink.h"
+#include "p6kTcpServer.h"
+#include "p6kTestController.h"
+
+#define TEST_CONTROLLER "P6K_TCP"
+#define TEST_COMMAND_LINK "P6K_TCP_CMD"
+#define TEST_STATUS_LINK "P6K_TCP_STATUS"
+#define TEST_NUM_AXES 2
+#define TEST_POLL_PERIOD 1000.0   //Long enough that only wakeups poll
+#define TEST_WAIT 5.0             //Longest time to wait for a poll (seconds)
+
+static p6kTcpServer *pCommandServer = NULL;
+static p6kTcpServer *pStatusServer = NULL;
+static p6kController *pController = NULL;
+
+/**
+ * Put an axis in a known state before a move. This must be called with the lock held.
+ */
+static void resetAxis(int axis)
+{
+  p6kTestSetIntegerParam(pController, axis, motorStatusDoneString, 1);
+  p6kTestSetIntegerParam(pController, axis, motorStatusPowerOnString, 1);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_AutoDriveEnableString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_SendPositionOnlyString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_LimitDriveEnableString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_DriveRetryString, 0);
+}
+
+static int commsError(void)
+{
+  pController->lock();
+  int value = p6kTestGetIntegerParam(pController, 0, P6K_C_CommsErrorString);
+  pController->unlock();
+  return value;
+}
+
+static bool sent(p6kTcpServer *pServer, const char *command)
+{
+  std::vector<std::string> transcript = pServer->transcript();
+  for (size_t i=0; i<transcript.size(); i++) {
+    if (transcript[i] == command) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Wake up the poller, and wait for it to read the encoder position of the last axis.
+ */
+static bool waitForPoll(void)
+{
+  char command[P6K_MAXBUF] = {0};
+
+  epicsSnprintf(command, sizeof(command), "%dTPE", TEST_NUM_AXES);
+  pStatusServer->clearTranscript();
+  pController->wakeupPoller();
+  for (double waited=0.0; waited<TEST_WAIT; waited+=0.01) {
+    if (sent(pStatusServer, command)) {
+      return true;
+    }
+    epicsThreadSleep(0.01);
+  }
+  return false;
+}
+
+/**
+ * Create the stand-in servers, the links, the controller and the axes.
+ */
+static void testStartup(void)
+{
+  p6kTestReplies startupReplies;
+  p6kTestReplies statusReplies;
+  char address[64];
+
+  testDiag("Startup");
+
+  pCommandServer = new p6kTcpServer();
+  pStatusServer = new p6kTcpServer();
+  p6kTestStartupReplies(&startupReplies, "6K2", TEST_NUM_AXES);
+  pCommandServer->setReplies(startupReplies);
+  p6kTestStatusReplies(&statusReplies, TEST_NUM_AXES, P6K_TEST_TAS_IDLE);
+  pStatusServer->setReplies(statusReplies);
+
+  epicsSnprintf(address, sizeof(address), "127.0.0.1:%d", pCommandServer->port());
+  testOk1(p6kTcpLink::create(TEST_COMMAND_LINK, address) == asynSuccess);
+  epicsSnprintf(address, sizeof(address), "127.0.0.1:%d", pStatusServer->port());
+  testOk1(p6kTcpLink::create(TEST_STATUS_LINK, address) == asynSuccess);
+
+  pController = p6kTestCreateController(TEST_CONTROLLER, TEST_COMMAND_LINK, TEST_NUM_AXES,
+					TEST_POLL_PERIOD, TEST_POLL_PERIOD, TEST_STATUS_LINK);
+
+  std::vector<std::string> transcript = pCommandServer->transcript();
+  testOk((transcript.size() > 3) && (transcript[0] == "ECHO0") && (transcript[1] == "COMEXC1"),
+	 "The startup commands are sent on the command link");
+  testOk1(sent(pCommandServer, "2ESTALL"));
+  testOk(commsError() == 0, "No comms error");
+  testOk((pCommandServer->sessions() == 1) && (pStatusServer->sessions() == 1), "One session on each link");
+}
+
+/**
+ * Moves and stops go on the command link. A TCP link is one session,
+ * so immediate commands go on it too.
+ */
+static void testCommands(void)
+{
+  p6kAxis *pAxis = pController->getAxis(1);
+
+  testDiag("Commands");
+
+  pCommandServer->clearTranscript();
+  pController->lock();
+  resetAxis(1);
+  pAxis->move(10000, 0, 0, 50000, 250000);
+  pController->unlock();
+  testOk(sent(pCommandServer, "1D10000") && sent(pCommandServer, "1GO"), "Move");
+
+  pController->lock();
+  pAxis->stop(1.0);
+  pController->unlock();
+  testOk(sent(pCommandServer, "!1S"), "Stop");
+  testOk(!sent(pStatusServer, "!1S") && !sent(pStatusServer, "1GO"), "Nothing is sent on the status link");
+
+  //An error reply is a comms error, as it is on an asyn port
+  pCommandServer->setErrorReply("2GO");
+  pController->lock();
+  resetAxis(2);
+  pController->getAxis(2)->move(100, 0, 0, 50000, 250000);
+  pController->unlock();
+  testOk(commsError() == 1, "Error reply");
+}
+
+/**
+ * The poller's status queries for each axis are written together.
+ */
+static void testPoll(void)
+{
+  testDiag("Poll");
+
+  testOk1(waitForPoll());
+  testOk(pStatusServer->maxPipeline() >= 3, "TAS, TPC and TPE are written before the replies are read (%d)",
+	 static_cast<int>(pStatusServer->maxPipeline()));
+  testOk(pCommandServer->sessions() == 1, "The poll does not use the command link");
+
+  //The controller closes the status session. The next poll connects again.
+  pStatusServer->closeSession();
+  epicsThreadSleep(0.2);
+  testOk1(waitForPoll());
+  testOk(pStatusServer->sessions() == 2, "The status link connected again");
+}
+
+MAIN(p6kTcpControllerTest)
+{
+  testPlan(15);
+  testStartup();
+  testCommands();
+  testPoll();
+  return testDone();
+}
@@ -0,0 +1,269 @@
+/********************************************
+ *  p6kTcpLinkTest.cpp
+ *
+ *  Tests for the native TCP link (p6kTcpLink)
+ *  against a local stand-in for the 6K
+ *  (p6kTcpServer). It checks the replies,
+ *  error replies, pipelined commands,
+ *  timeouts and reconnects.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "parker6kTcpLink.h"
+#include "parker6kFramer.h"
+#include "p6kTcpServer.h"
+
+#define TEST_TIMEOUT 1.0         //Timeout for replies that should arrive (seconds)
+#define TEST_DROP_TIMEOUT 0.2    //Timeout for replies that are dropped (seconds)
+
+static p6kTcpServer *pServer = NULL;
+static p6kFramer framer;
+
+/**
+ * Send one command, and read the reply.
+ * @param pLink The link
+ * @param command The command
+ * @param pFrame Returns the frame
+ * @param text Returns the reply text
+ * @return The status of the write, or of the read if the write worked.
+ */
+static asynStatus writeRead(p6kTcpLink *pLink, const char *command, p6kFrame *pFrame, char *text, size_t maxChars)
+{
+  size_t nread = 0;
+
+  text[0] = '\0';
+  framer.command(command);
+  framer.reset();
+  asynStatus status = pLink->write(&command, 1, TEST_TIMEOUT);
+  if (status == asynSuccess) {
+    status = pLink->read(&framer, TEST_TIMEOUT, &nread);
+  }
+  if ((status == asynSuccess) && framer.front(pFrame)) {
+    framer.copyText(*pFrame, text, maxChars);
+  }
+  return status;
+}
+
+/**
+ * Check a query gets its reply.
+ */
+static bool replyIs(p6kTcpLink *pLink, const char *command, const char *reply)
+{
+  p6kFrame frame;
+  char text[256];
+
+  if (writeRead(pLink, command, &frame, text, sizeof(text)) != asynSuccess) {
+    testDiag("%s failed: %s", command, pLink->error());
+    return false;
+  }
+  if ((frame.type != P6K_FRAME_REPLY) || !frame.lineEnd || (strcmp(text, reply) != 0)) {
+    testDiag("%s: got '%s' (type %d, lineEnd %d)", command, text, frame.type, frame.lineEnd);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Creating and finding links.
+ */
+static void testCreate(void)
+{
+  char address[64];
+
+  testDiag("Create");
+
+  epicsSnprintf(address, sizeof(address), "127.0.0.1:%d", pServer->port());
+  testOk1(p6kTcpLink::create("TEST_LINK", address) == asynSuccess);
+  testOk(p6kTcpLink::create("TEST_LINK", address) == asynError, "A name can only be used once");
+  testOk(p6kTcpLink::create("TEST_BAD", "127.0.0.1") == asynError, "An address without a port is refused");
+  testOk(p6kTcpLink::create("TEST_BAD", ":5002") == asynError, "An address without a host is refused");
+  testOk1(p6kTcpLink::find("TEST_BAD") == NULL);
+
+  p6kTcpLink *pLink = p6kTcpLink::find("TEST_LINK");
+  testOk1(pLink != NULL);
+  testOk(pLink->claim() && !pLink->claim(), "A link can only be claimed once");
+  testOk(!pLink->isConnected() && (pLink->connects() == 0), "The link does not connect until it is used");
+}
+
+/**
+ * Replies, empty replies and error replies.
+ */
+static void testReplies(p6kTcpLink *pLink)
+{
+  p6kFrame frame;
+  char text[256];
+
+  testDiag("Replies");
+
+  pServer->setReply("1TPC", "1TPC+50000");
+  pServer->setErrorReply("1BAD");
+
+  testOk(replyIs(pLink, "1TPC", "1TPC+50000"), "Query reply");
+  testOk(pLink->isConnected() && (pLink->connects() == 1) && (pServer->sessions() == 1), "The first command connects");
+  testOk(replyIs(pLink, "1V1", ""), "Empty reply to a command");
+
+  asynStatus status = writeRead(pLink, "1BAD", &frame, text, sizeof(text));
+  testOk((status == asynSuccess) && (frame.type == P6K_FRAME_ERROR) && (strcmp(text, "UNKNOWN COMMAND") == 0),
+	 "Error reply (%s)", text);
+  testOk(replyIs(pLink, "1TPC", "1TPC+50000"), "Reply after an error reply");
+  testOk(pLink->connects() == 1, "Still on the first session");
+
+  p6kTcpServerFaults faults;
+  p6kTcpServer::clearFaults(&faults);
+  faults.splitReplies = true;
+  pServer->setFaults(faults);
+  testOk(replyIs(pLink, "1TPC", "1TPC+50000"), "Reply sent a character at a time");
+
+  p6kTcpServer::clearFaults(&faults);
+  faults.extraPrompt = true;
+  pServer->setFaults(faults);
+  bool ok = replyIs(pLink, "1TPC", "1TPC+50000");
+  ok = replyIs(pLink, "1V1", "") && ok;
+  ok = replyIs(pLink, "1TPC", "1TPC+50000") && ok;
+  testOk(ok, "A second prompt after each reply is skipped");
+
+  p6kTcpServer::clearFaults(&faults);
+  pServer->setFaults(faults);
+}
+
+/**
+ * Several commands written before the first reply is read.
+ */
+static void testPipeline(p6kTcpLink *pLink)
+{
+  const char *commands[] = {"1TAS", "1TPC", "1BAD", "1TPE"};
+  const char *expected[] = {"1TAS0000_0000", "1TPC+50000", "UNKNOWN COMMAND", "1TPE-20"};
+  const size_t count = sizeof(commands) / sizeof(commands[0]);
+  size_t nread = 0;
+  bool ok = true;
+  char text[256];
+
+  testDiag("Pipeline");
+
+  pServer->setReply("1TAS", "1TAS0000_0000");
+  pServer->setReply("1TPE", "1TPE-20");
+  pServer->clearTranscript();
+
+  framer.reset();
+  testOk1(pLink->write(commands, count, TEST_TIMEOUT) == asynSuccess);
+  for (size_t i=0; i<count; i++) {
+    p6kFrame frame;
+    asynStatus status = pLink->read(&framer, TEST_TIMEOUT, &nread);
+    if ((status != asynSuccess) || !framer.front(&frame)) {
+      testDiag("Reply %d failed: %s", static_cast<int>(i), pLink->error());
+      ok = false;
+      break;
+    }
+    framer.copyText(frame, text, sizeof(text));
+    if (strcmp(text, expected[i]) != 0) {
+      testDiag("Reply %d was '%s'", static_cast<int>(i), text);
+      ok = false;
+    }
+    framer.pop();
+  }
+  testOk(ok, "The replies are read in order");
+  testOk(pServer->maxPipeline() == count, "The server had all the commands before it replied (%d)",
+	 static_cast<int>(pServer->maxPipeline()));
+  testOk(pServer->transcript().size() == count, "Each command was sent once");
+}
+
+/**
+ * A reply that never comes, and a controller that closes the session.
+ */
+static void testReconnect(p6kTcpLink *pLink)
+{
+  p6kTcpServerFaults faults;
+  p6kFrame frame;
+  size_t nread = 0;
+  char text[256];
+
+  testDiag("Reconnect");
+
+  //A timeout disconnects, as a late reply would be taken for the next one
+  p6kTcpServer::clearFaults(&faults);
+  faults.dropReplies = 1;
+  pServer->setFaults(faults);
+  epicsUInt32 connects = pLink->connects();
+  const char *command = "1TPC";
+  framer.reset();
+  pLink->write(&command, 1, TEST_TIMEOUT);
+  asynStatus status = pLink->read(&framer, TEST_DROP_TIMEOUT, &nread);
+  testOk(status == asynTimeout, "Dropped reply times out");
+  testOk(!pLink->isConnected(), "The link is disconnected after a timeout (%s)", pLink->error());
+  testOk(replyIs(pLink, "1TPC", "1TPC+50000") && (pLink->connects() == connects + 1),
+	 "The next command connects again");
+
+  //The session is closed while waiting for a reply
+  p6kTcpServer::clearFaults(&faults);
+  faults.closeSession = true;
+  pServer->setFaults(faults);
+  status = writeRead(pLink, "1TPC", &frame, text, sizeof(text));
+  testOk(status == asynError, "Session closed while waiting for a reply (%s)", pLink->error());
+  testOk(replyIs(pLink, "1TPC", "1TPC+50000") && (pLink->connects() == connects + 2),
+	 "The next command connects again");
+
+  //The session is closed between commands, which the next command finds before it is sent
+  pServer->closeSession();
+  epicsThreadSleep(0.2);
+  testOk(replyIs(pLink, "1TPC", "1TPC+50000") && (pLink->connects() == connects + 3),
+	 "Session closed between commands is connected again straight away");
+}
+
+/**
+ * Connecting to a port that nothing is listening on.
+ */
+static void testConnectFail(void)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  char address[64];
+  const char *command = "1TPC";
+
+  testDiag("Connect fail");
+
+  //Find a free port, then stop listening on it
+  p6kTcpServer *pClosed = new p6kTcpServer();
+  epicsSnprintf(address, sizeof(address), "127.0.0.1:%d", pClosed->port());
+  delete pClosed;
+
+  p6kTcpLink::create("TEST_CLOSED", address);
+  p6kTcpLink *pLink = p6kTcpLink::find("TEST_CLOSED");
+  asynStatus status = pLink->write(&command, 1, TEST_TIMEOUT);
+  testOk(status == asynError, "Connect is refused (%s)", pLink->error());
+  testOk1(!pLink->isConnected() && (pLink->connects() == 0));
+
+  epicsTimeGetCurrent(&start);
+  status = pLink->write(&command, 1, TEST_TIMEOUT);
+  epicsTimeGetCurrent(&end);
+  testOk((status == asynError) && (epicsTimeDiffInSeconds(&end, &start) < 0.1),
+	 "The next write fails straight away, until the retry time");
+}
+
+MAIN(p6kTcpLinkTest)
+{
+  testPlan(29);
+
+  pServer = new p6kTcpServer();
+  if (pServer->port() == 0) {
+    testAbort("Can't start the stand-in server");
+  }
+
+  testCreate();
+  p6kTcpLink *pLink = p6kTcpLink::find("TEST_LINK");
+  testReplies(pLink);
+  testPipeline(pLink);
+  testReconnect(pLink);
+  testConnectFail();
+
+  return testDone();
+}
@@ -0,0 +1,356 @@
+/********************************************
+ *  p6kTcpServer.cpp
+ *
+ *  Local TCP server that stands in for the
+ *  Ethernet port of a 6K, for the tests of
+ *  the native TCP link (p6kTcpLink). It
+ *  replies from a table of canned responses,
+ *  and can be told to misbehave.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "p6kTcpServer.h"
+
+#define P6K_TCP_SERVER_POLL 100   //How often the server checks if it should stop (ms)
+
+static const char *P6K_TCP_SERVER_HEADER = "*";
+static const char *P6K_TCP_SERVER_TRAILER = "\r\r\n>";
+static const char *P6K_TCP_SERVER_EMPTY_REPLY = "\r\n>";
+static const char *P6K_TCP_SERVER_ERROR_REPLY = "*UNKNOWN COMMAND\r\n?";
+static const char *P6K_TCP_SERVER_EXTRA_PROMPT = " \n>";
+
+/**
+ * Constructor. This starts listening, and starts the server thread.
+ * If the socket can't be set up, port returns 0.
+ */
+p6kTcpServer::p6kTcpServer(void)
+  : listenFd_(-1),
+    port_(0),
+    sessionFd_(-1),
+    stop_(false),
+    sessions_(0),
+    maxPipeline_(0)
+{
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+
+  clearFaults(&faults_);
+  done_ = epicsEventMustCreate(epicsEventEmpty);
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+
+  listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if ((listenFd_ < 0) ||
+      (bind(listenFd_, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) ||
+      (listen(listenFd_, 4) != 0) ||
+      (getsockname(listenFd_, reinterpret_cast<struct sockaddr *>(&address), &length) != 0)) {
+    printf("p6kTcpServer: ERROR Can't listen: %s\n", strerror(errno));
+    epicsEventSignal(done_);
+    return;
+  }
+  port_ = ntohs(address.sin_port);
+
+  epicsThreadCreate("p6kTcpServer", epicsThreadPriorityMedium,
+		    epicsThreadGetStackSize(epicsThreadStackMedium),
+		    serverTask, this);
+}
+
+/**
+ * Destructor. This stops the server thread, and closes the sockets.
+ */
+p6kTcpServer::~p6kTcpServer()
+{
+  mutex_.lock();
+  stop_ = true;
+  mutex_.unlock();
+  epicsEventWait(done_);
+  if (listenFd_ >= 0) {
+    close(listenFd_);
+  }
+  epicsEventDestroy(done_);
+}
+
+/**
+ * @return The port that the server is listening on (on 127.0.0.1).
+ */
+int p6kTcpServer::port(void) const
+{
+  return port_;
+}
+
+/**
+ * Set the reply to a query.
+ * @param command The command, without the \n
+ * @param reply The text between the * and the \r\r\n
+ */
+void p6kTcpServer::setReply(const char *command, const char *reply)
+{
+  mutex_.lock();
+  replies_[command] = reply;
+  mutex_.unlock();
+}
+
+/**
+ * Set the replies to several queries (see p6kTestStartupReplies).
+ * @param replies The replies, by command, in the same format as setReply
+ */
+void p6kTcpServer::setReplies(const std::map<std::string, std::string> &replies)
+{
+  mutex_.lock();
+  for (std::map<std::string, std::string>::const_iterator entry = replies.begin(); entry != replies.end(); ++entry) {
+    replies_[entry->first] = entry->second;
+  }
+  mutex_.unlock();
+}
+
+/**
+ * Answer a command with the error prompt.
+ * @param command The command, without the \n
+ */
+void p6kTcpServer::setErrorReply(const char *command)
+{
+  mutex_.lock();
+  errors_.insert(command);
+  mutex_.unlock();
+}
+
+/**
+ * Turn all the faults off.
+ */
+void p6kTcpServer::clearFaults(p6kTcpServerFaults *pFaults)
+{
+  memset(pFaults, 0, sizeof(p6kTcpServerFaults));
+}
+
+void p6kTcpServer::setFaults(const p6kTcpServerFaults &faults)
+{
+  mutex_.lock();
+  faults_ = faults;
+  mutex_.unlock();
+}
+
+/**
+ * Close the current session from the server end, as the 6K would if it was reset.
+ */
+void p6kTcpServer::closeSession(void)
+{
+  mutex_.lock();
+  if (sessionFd_ >= 0) {
+    shutdown(sessionFd_, SHUT_RDWR);
+  }
+  mutex_.unlock();
+}
+
+void p6kTcpServer::clearTranscript(void)
+{
+  mutex_.lock();
+  transcript_.clear();
+  maxPipeline_ = 0;
+  mutex_.unlock();
+}
+
+/**
+ * @return The commands received since the last clearTranscript.
+ */
+std::vector<std::string> p6kTcpServer::transcript(void)
+{
+  mutex_.lock();
+  std::vector<std::string> transcript = transcript_;
+  mutex_.unlock();
+  return transcript;
+}
+
+/**
+ * @return The number of sessions that have been accepted.
+ */
+epicsUInt32 p6kTcpServer::sessions(void)
+{
+  mutex_.lock();
+  epicsUInt32 sessions = sessions_;
+  mutex_.unlock();
+  return sessions;
+}
+
+/**
+ * @return The most commands that were read before the first of them was
+ * answered, since the last clearTranscript.
+ */
+size_t p6kTcpServer::maxPipeline(void)
+{
+  mutex_.lock();
+  size_t maxPipeline = maxPipeline_;
+  mutex_.unlock();
+  return maxPipeline;
+}
+
+void p6kTcpServer::serverTask(void *pPvt)
+{
+  static_cast<p6kTcpServer *>(pPvt)->serve();
+}
+
+/**
+ * Accept sessions, one at a time, until the server is stopped.
+ */
+void p6kTcpServer::serve(void)
+{
+  for (;;) {
+    mutex_.lock();
+    bool stop = stop_;
+    mutex_.unlock();
+    if (stop) {
+      break;
+    }
+
+    struct pollfd pollFd = {listenFd_, POLLIN, 0};
+    if (poll(&pollFd, 1, P6K_TCP_SERVER_POLL) <= 0) {
+      continue;
+    }
+    int fd = accept(listenFd_, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+
+    mutex_.lock();
+    sessionFd_ = fd;
+    ++sessions_;
+    mutex_.unlock();
+
+    session(fd);
+
+    mutex_.lock();
+    sessionFd_ = -1;
+    mutex_.unlock();
+    close(fd);
+  }
+
+  epicsEventSignal(done_);
+}
+
+/**
+ * Read commands, and answer each one, until the client or the server closes the session.
+ */
+void p6kTcpServer::session(int fd)
+{
+  std::string input;
+  char buffer[256];
+
+  for (;;) {
+    mutex_.lock();
+    bool stop = stop_;
+    mutex_.unlock();
+    if (stop) {
+      return;
+    }
+
+    struct pollfd pollFd = {fd, POLLIN, 0};
+    if (poll(&pollFd, 1, P6K_TCP_SERVER_POLL) <= 0) {
+      continue;
+    }
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return;
+    }
+    input.append(buffer, n);
+
+    //Count the complete commands that are waiting, before answering any of them
+    size_t pending = 0;
+    for (size_t i=0; i<input.size(); i++) {
+      if (input[i] == '\n') {
+	++pending;
+      }
+    }
+    mutex_.lock();
+    if (pending > maxPipeline_) {
+      maxPipeline_ = pending;
+    }
+    mutex_.unlock();
+
+    size_t end = 0;
+    while ((end = input.find('\n')) != std::string::npos) {
+      std::string command = input.substr(0, end);
+      input.erase(0, end + 1);
+
+      mutex_.lock();
+      transcript_.push_back(command);
+      bool closeSession = faults_.closeSession;
+      faults_.closeSession = false;
+      bool drop = (faults_.dropReplies > 0);
+      if (drop) {
+	--faults_.dropReplies;
+      }
+      double latency = faults_.latency;
+      mutex_.unlock();
+
+      if (closeSession) {
+	return;
+      }
+      if (drop) {
+	continue;
+      }
+      if (latency > 0.0) {
+	epicsThreadSleep(latency);
+      }
+      reply(fd, command);
+    }
+  }
+}
+
+/**
+ * Send the reply to one command.
+ */
+void p6kTcpServer::reply(int fd, const std::string &command)
+{
+  std::string data;
+
+  mutex_.lock();
+  std::map<std::string, std::string>::iterator pReply = replies_.find(command);
+  if (errors_.find(command) != errors_.end()) {
+    data = P6K_TCP_SERVER_ERROR_REPLY;
+  } else if (pReply != replies_.end()) {
+    data = P6K_TCP_SERVER_HEADER + pReply->second + P6K_TCP_SERVER_TRAILER;
+  } else {
+    data = P6K_TCP_SERVER_EMPTY_REPLY;
+  }
+  if (faults_.extraPrompt) {
+    data += P6K_TCP_SERVER_EXTRA_PROMPT;
+  }
+  bool split = faults_.splitReplies;
+  mutex_.unlock();
+
+  sendAll(fd, data, split);
+}
+
+/**
+ * Send all of a string, in one go or a character at a time.
+ */
+void p6kTcpServer::sendAll(int fd, const std::string &data, bool split)
+{
+  size_t done = 0;
+
+  while (done < data.size()) {
+    size_t length = split ? 1 : (data.size() - done);
+    ssize_t n = send(fd, data.data() + done, length, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    done += n;
+    if (split) {
+      epicsThreadSleep(0.001);
+    }
+  }
+}
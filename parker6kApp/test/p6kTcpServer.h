@@ -0,0 +1,89 @@
+/********************************************
+ *  p6kTcpServer.h
+ *
+ *  Local TCP server that stands in for the
+ *  Ethernet port of a 6K, for the tests of
+ *  the native TCP link (p6kTcpLink). It
+ *  replies from a table of canned responses,
+ *  and can be told to misbehave.
+ *
+ ********************************************/
+
+#ifndef p6kTcpServer_H
+#define p6kTcpServer_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTypes.h>
+
+/**
+ * The ways that p6kTcpServer can misbehave. Unlike p6kTestFaults these are
+ * not random, so each test knows which command is affected.
+ */
+typedef struct p6kTcpServerFaults {
+  double latency;            /**< Delay before each reply (seconds) */
+  epicsUInt32 dropReplies;   /**< Don't reply to this many of the next commands */
+  bool closeSession;         /**< Close the session instead of replying to the next command */
+  bool splitReplies;         /**< Send each reply one character at a time */
+  bool extraPrompt;          /**< Send another prompt after each reply (" \n>") */
+} p6kTcpServerFaults;
+
+/**
+ * p6kTcpServer listens on a free port on 127.0.0.1 (see port), and serves
+ * one session at a time on its own thread. Each command is a line ending
+ * with \n. A reply is sent as the 6K would send it: "*1TPC+0\r\r\n>" for a
+ * query (setReply takes the text between the * and the \r\r\n), "\r\n>" for
+ * a command with no reply, and "*UNKNOWN COMMAND\r\n?" for a command given
+ * to setErrorReply.
+ *
+ * The server records how many commands it had read but not yet answered
+ * (see maxPipeline), which shows whether the client wrote several commands
+ * before waiting for the first reply.
+ */
+class p6kTcpServer {
+
+ public:
+  p6kTcpServer(void);
+  ~p6kTcpServer();
+
+  int port(void) const;
+  void setReply(const char *command, const char *reply);
+  void setReplies(const std::map<std::string, std::string> &replies);
+  void setErrorReply(const char *command);
+  void setFaults(const p6kTcpServerFaults &faults);
+  static void clearFaults(p6kTcpServerFaults *pFaults);
+
+  void closeSession(void);
+  void clearTranscript(void);
+  std::vector<std::string> transcript(void);
+  epicsUInt32 sessions(void);
+  size_t maxPipeline(void);
+
+ private:
+  static void serverTask(void *pPvt);
+  void serve(void);
+  void session(int fd);
+  void reply(int fd, const std::string &command);
+  void sendAll(int fd, const std::string &data, bool split);
+
+  epicsMutex mutex_;
+  int listenFd_;
+  int port_;
+  int sessionFd_;
+  bool stop_;
+  epicsEventId done_;
+  std::map<std::string, std::string> replies_;
+  std::set<std::string> errors_;
+  std::vector<std::string> transcript_;
+  p6kTcpServerFaults faults_;
+  epicsUInt32 sessions_;
+  size_t maxPipeline_;
+};
+
+#endif /* p6kTcpServer_H */
@@ -0,0 +1,153 @@
+/********************************************
+ *  p6kTestController.cpp
+ *
+ *  Helpers shared by the tests that run a
+ *  controller against a fake 6K: the canned
+ *  replies to the startup and status queries,
+ *  creating the controller and its axes, and
+ *  reading and writing params by name.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsStdio.h>
+#include <epicsUnitTest.h>
+
+#include "p6kTestController.h"
+
+/**
+ * Replies to the queries made by the controller and axis constructors.
+ * The axes are stepper drives (DRES 25000), so velocity and acceleration
+ * are scaled by 25000.
+ * @param pReplies The replies are added to this
+ * @param model The model in the TREV reply (eg. 6K2)
+ * @param numAxes The number of axes
+ */
+void p6kTestStartupReplies(p6kTestReplies *pReplies, const char *model, int numAxes)
+{
+  static const char *queries[][2] = {
+    {"AXSDEF", "0"}, {"DRES", "25000"}, {"ERES", "4000"}, {"DRIVE", "1"},
+    {"LH", "3"}, {"LS", "3"}, {"LSPOS", "+0"}, {"LSNEG", "+0"},
+    {"CMDDIR", "0"}, {"DRFEN", "0"}, {"ENCPOL", "0"}, {"ESK", "0"}, {"ESTALL", "0"}
+  };
+  char command[P6K_MAXBUF] = {0};
+  char reply[P6K_MAXBUF] = {0};
+
+  epicsSnprintf(reply, sizeof(reply), "TREV92-016740-01-7.3 %s", model);
+  (*pReplies)["TREV"] = reply;
+  for (int axis=1; axis<=numAxes; axis++) {
+    for (size_t i=0; i<(sizeof(queries)/sizeof(queries[0])); i++) {
+      epicsSnprintf(command, sizeof(command), "%d%s", axis, queries[i][0]);
+      epicsSnprintf(reply, sizeof(reply), "%d%s%s", axis, queries[i][0], queries[i][1]);
+      (*pReplies)[command] = reply;
+    }
+  }
+}
+
+/**
+ * Replies to the status queries made by the poller. Each axis is at P6K_TEST_POSITION.
+ * @param pReplies The replies are added to this
+ * @param numAxes The number of axes
+ * @param tas The axis status for every axis (eg. P6K_TEST_TAS_IDLE)
+ */
+void p6kTestStatusReplies(p6kTestReplies *pReplies, int numAxes, const char *tas)
+{
+  char command[P6K_MAXBUF] = {0};
+  char reply[P6K_MAXBUF] = {0};
+
+  (*pReplies)["TSS"] = "TSS1000_0000_0000_0000_0000_0000_0000_0000";
+  for (int axis=1; axis<=numAxes; axis++) {
+    epicsSnprintf(command, sizeof(command), "%dTAS", axis);
+    epicsSnprintf(reply, sizeof(reply), "%dTAS%s", axis, tas);
+    (*pReplies)[command] = reply;
+    epicsSnprintf(command, sizeof(command), "%dTPC", axis);
+    epicsSnprintf(reply, sizeof(reply), "%dTPC%+d", axis, P6K_TEST_POSITION);
+    (*pReplies)[command] = reply;
+    epicsSnprintf(command, sizeof(command), "%dTPE", axis);
+    epicsSnprintf(reply, sizeof(reply), "%dTPE%+d", axis, P6K_TEST_POSITION);
+    (*pReplies)[command] = reply;
+  }
+}
+
+/**
+ * Create a controller and its axes. The replies to the startup queries
+ * must already be set on the command port.
+ * @param name The controller port name
+ * @param commandPort The command port (or TCP link)
+ * @param numAxes The number of axes
+ * @param movingPollPeriod The moving poll period (seconds)
+ * @param idlePollPeriod The idle poll period (seconds)
+ * @param statusPort The status port (or TCP link), or NULL to poll on the command port
+ */
+p6kController *p6kTestCreateController(const char *name, const char *commandPort, int numAxes,
+				       double movingPollPeriod, double idlePollPeriod,
+				       const char *statusPort)
+{
+  p6kController *pController = new p6kController(name, commandPort, 0, numAxes,
+						 movingPollPeriod, idlePollPeriod, statusPort);
+  for (int axis=1; axis<=numAxes; axis++) {
+    pController->lock();
+    new p6kAxis(pController, axis);
+    pController->unlock();
+  }
+  return pController;
+}
+
+/**
+ * Read an integer param by name. Call with the lock held.
+ */
+int p6kTestGetIntegerParam(p6kController *pController, int axis, const char *name)
+{
+  int index = 0;
+  int value = 0;
+  if (pController->findParam(name, &index) == asynSuccess) {
+    pController->getIntegerParam(axis, index, &value);
+  } else {
+    testDiag("Unknown param %s", name);
+  }
+  return value;
+}
+
+/**
+ * Read a double param by name. Call with the lock held.
+ */
+double p6kTestGetDoubleParam(p6kController *pController, int axis, const char *name)
+{
+  int index = 0;
+  double value = 0.0;
+  if (pController->findParam(name, &index) == asynSuccess) {
+    pController->getDoubleParam(axis, index, &value);
+  } else {
+    testDiag("Unknown param %s", name);
+  }
+  return value;
+}
+
+/**
+ * Set an integer param by name. Call with the lock held.
+ */
+void p6kTestSetIntegerParam(p6kController *pController, int axis, const char *name, int value)
+{
+  int index = 0;
+  if (pController->findParam(name, &index) == asynSuccess) {
+    pController->setIntegerParam(axis, index, value);
+  } else {
+    testDiag("Unknown param %s", name);
+  }
+}
+
+/**
+ * Set a double param by name. Call with the lock held.
+ */
+void p6kTestSetDoubleParam(p6kController *pController, int axis, const char *name, double value)
+{
+  int index = 0;
+  if (pController->findParam(name, &index) == asynSuccess) {
+    pController->setDoubleParam(axis, index, value);
+  } else {
+    testDiag("Unknown param %s", name);
+  }
+}
@@ -0,0 +1,47 @@
+/********************************************
+ *  p6kTestController.h
+ *
+ *  Helpers shared by the tests that run a
+ *  controller against a fake 6K: the canned
+ *  replies to the startup and status queries,
+ *  creating the controller and its axes, and
+ *  reading and writing params by name.
+ *
+ ********************************************/
+
+#ifndef p6kTestController_H
+#define p6kTestController_H
+
+#include <map>
+#include <string>
+
+#include "parker6kController.h"
+
+/* Axis status (the TAS reply after the axis number and TAS) */
+#define P6K_TEST_TAS_IDLE    "0000_0000_0000_0000_0000_0000_0000_0000"
+#define P6K_TEST_TAS_MOVING  "1000_0000_0000_0000_0000_0000_0000_0000"
+
+/* Encoder and commanded position in the status replies */
+#define P6K_TEST_POSITION 50000
+
+/**
+ * Canned replies, by command. These are given to p6kTestPort::setReplies
+ * or p6kTcpServer::setReplies, and use the same format as setReply
+ * (the text between the * and the \r\r\n, eg. 1TPC+0). A test can change
+ * or add entries before it sets them.
+ */
+typedef std::map<std::string, std::string> p6kTestReplies;
+
+void p6kTestStartupReplies(p6kTestReplies *pReplies, const char *model, int numAxes);
+void p6kTestStatusReplies(p6kTestReplies *pReplies, int numAxes, const char *tas);
+
+p6kController *p6kTestCreateController(const char *name, const char *commandPort, int numAxes,
+				       double movingPollPeriod, double idlePollPeriod,
+				       const char *statusPort);
+
+int p6kTestGetIntegerParam(p6kController *pController, int axis, const char *name);
+double p6kTestGetDoubleParam(p6kController *pController, int axis, const char *name);
+void p6kTestSetIntegerParam(p6kController *pController, int axis, const char *name, int value);
+void p6kTestSetDoubleParam(p6kController *pController, int axis, const char *name, double value);
+
+#endif /* p6kTestController_H */
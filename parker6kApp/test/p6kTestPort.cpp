@@ -0,0 +1,327 @@
+/********************************************
+ *  p6kTestPort.cpp
+ *
+ *  Fake asyn octet port that stands in for
+ *  the 6K in the unit tests. It records every
+ *  command written to it and replies from a
+ *  table of canned responses. It can also
+ *  inject faults into the link, to test the
+ *  recovery paths in the driver.
+ *
+ ********************************************/
+
+#include <string.h>
+
+#include <epicsStdio.h>
+
+#include "parker6kClock.h"
+#include "p6kTestPort.h"
+
+const char *p6kTestPort::P6K_TEST_HEADER_ = "*";
+const char *p6kTestPort::P6K_TEST_TRAILER_ = "\r\r\n";
+const char *p6kTestPort::P6K_TEST_EMPTY_REPLY_ = "\r\n";
+const char *p6kTestPort::P6K_TEST_ERROR_TRAILER_ = "\r\n?";
+const char *p6kTestPort::P6K_TEST_ERROR_REPLY_ = "UNKNOWN COMMAND";
+const char *p6kTestPort::P6K_TEST_DRIVE_SHUTDOWN_REPLY_ = "DRIVE SHUTDOWN";
+
+/**
+ * p6kTestPort constructor. This creates and registers the asyn port.
+ * @param portName The asyn port name to give to p6kCreateController
+ */
+p6kTestPort::p6kTestPort(const char *portName)
+  : asynPortDriver(portName, 1, 
+		   1, // Param table size (no params are used)
+		   asynOctetMask | asynDrvUserMask,
+		   0, // No interrupts
+		   0, // Not ASYN_CANBLOCK, so each writeRead runs to completion with the port locked
+		   1, // autoconnect
+		   0, 0), // Default priority and stack size
+    pendingDelay_(0.0),
+    pendingStatus_(asynSuccess),
+    random_(0),
+    commands_(0)
+{
+  clearFaults(&faults_);
+  for (int fault=0; fault<P6K_TEST_NUM_FAULTS; fault++) {
+    faultCounts_[fault] = 0;
+  }
+  reconnectTime_.secPastEpoch = 0;
+  reconnectTime_.nsec = 0;
+}
+
+p6kTestPort::~p6kTestPort()
+{
+}
+
+/**
+ * Set the reply to a command.
+ * @param command The command, as sent by the driver (eg. 1TPC)
+ * @param reply The reply, without the * and \r\r\n (eg. 1TPC+0)
+ */
+void p6kTestPort::setReply(const char *command, const char *reply)
+{
+  mutex_.lock();
+  replies_[command] = reply;
+  mutex_.unlock();
+}
+
+/**
+ * Set the replies to several queries (see p6kTestStartupReplies).
+ * @param replies The replies, by command, in the same format as setReply
+ */
+void p6kTestPort::setReplies(const std::map<std::string, std::string> &replies)
+{
+  mutex_.lock();
+  for (std::map<std::string, std::string>::const_iterator entry = replies.begin(); entry != replies.end(); ++entry) {
+    replies_[entry->first] = entry->second;
+  }
+  mutex_.unlock();
+}
+
+/**
+ * Forget the commands that have been recorded so far.
+ */
+void p6kTestPort::clearTranscript(void)
+{
+  mutex_.lock();
+  transcript_.clear();
+  mutex_.unlock();
+}
+
+/**
+ * @return A copy of the commands recorded since the last clearTranscript, in order.
+ */
+std::vector<std::string> p6kTestPort::transcript(void)
+{
+  mutex_.lock();
+  std::vector<std::string> commands(transcript_);
+  mutex_.unlock();
+  return commands;
+}
+
+/**
+ * Set up a p6kTestFaults with no faults.
+ */
+void p6kTestPort::clearFaults(p6kTestFaults *pFaults)
+{
+  pFaults->latency = 0.0;
+  pFaults->latencyJitter = 0.0;
+  pFaults->latencyTail = 0.0;
+  pFaults->latencyTailDelay = 0.0;
+  pFaults->dropReply = 0.0;
+  pFaults->dropTimeout = -1.0;
+  pFaults->truncateTrailer = 0.0;
+  pFaults->errorPrompt = 0.0;
+  pFaults->driveShutdown = 0.0;
+  pFaults->disconnect = 0.0;
+  pFaults->disconnectTime = 0.0;
+  pFaults->seed = 1;
+}
+
+/**
+ * Start injecting faults (or stop, if they are all zero). This
+ * resets the random numbers and the counts.
+ */
+void p6kTestPort::setFaults(const p6kTestFaults &faults)
+{
+  mutex_.lock();
+  faults_ = faults;
+  random_ = faults.seed;
+  for (int fault=0; fault<P6K_TEST_NUM_FAULTS; fault++) {
+    faultCounts_[fault] = 0;
+  }
+  commands_ = 0;
+  mutex_.unlock();
+}
+
+/**
+ * @return The number of times a fault was injected since setFaults.
+ */
+epicsUInt32 p6kTestPort::faultCount(p6kTestFault fault)
+{
+  epicsUInt32 count = 0;
+  mutex_.lock();
+  if ((fault >= 0) && (fault < P6K_TEST_NUM_FAULTS)) {
+    count = faultCounts_[fault];
+  }
+  mutex_.unlock();
+  return count;
+}
+
+/**
+ * @return The number of commands received since setFaults.
+ */
+epicsUInt32 p6kTestPort::commandCount(void)
+{
+  mutex_.lock();
+  epicsUInt32 count = commands_;
+  mutex_.unlock();
+  return count;
+}
+
+/**
+ * Record a command, and look up the reply that the next read will return.
+ * This is where the faults are chosen.
+ */
+asynStatus p6kTestPort::writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual)
+{
+  std::string command(value, maxChars);
+  std::string reply;
+  bool disconnect = false;
+
+  mutex_.lock();
+  transcript_.push_back(command);
+  ++commands_;
+
+  bool found = findReply(command, &reply);
+
+  double timeout = (faults_.dropTimeout < 0.0) ? pasynUser->timeout : faults_.dropTimeout;
+  pendingStatus_ = asynSuccess;
+  pendingDelay_ = faults_.latency + (faults_.latencyJitter * random());
+  if (chance(faults_.latencyTail)) {
+    pendingDelay_ += faults_.latencyTailDelay;
+    ++faultCounts_[P6K_TEST_FAULT_SLOW];
+  }
+
+  if (chance(faults_.dropReply)) {
+    //Nothing comes back, so the read times out
+    pendingReply_.clear();
+    pendingStatus_ = asynTimeout;
+    pendingDelay_ += timeout;
+    ++faultCounts_[P6K_TEST_FAULT_DROP];
+  } else if (chance(faults_.truncateTrailer)) {
+    pendingReply_ = std::string(P6K_TEST_HEADER_) + reply;
+    ++faultCounts_[P6K_TEST_FAULT_TRUNCATE];
+  } else if (chance(faults_.errorPrompt)) {
+    //Error replies end with a ? rather than the > prompt, so like the real
+    //port the read times out, and the driver finds the error in what was read.
+    pendingReply_ = std::string(P6K_TEST_HEADER_) + P6K_TEST_ERROR_REPLY_ + P6K_TEST_ERROR_TRAILER_;
+    pendingStatus_ = asynTimeout;
+    pendingDelay_ += timeout;
+    ++faultCounts_[P6K_TEST_FAULT_ERROR];
+  } else if ((command.find("GO") != std::string::npos) && chance(faults_.driveShutdown)) {
+    pendingReply_ = std::string(P6K_TEST_HEADER_) + P6K_TEST_DRIVE_SHUTDOWN_REPLY_ + P6K_TEST_ERROR_TRAILER_;
+    pendingStatus_ = asynTimeout;
+    pendingDelay_ += timeout;
+    ++faultCounts_[P6K_TEST_FAULT_DRIVE_SHUTDOWN];
+  } else if (chance(faults_.disconnect)) {
+    pendingReply_.clear();
+    p6kClock::getClock()->getCurrent(&reconnectTime_);
+    epicsTimeAddSeconds(&reconnectTime_, faults_.disconnectTime);
+    ++faultCounts_[P6K_TEST_FAULT_DISCONNECT];
+    disconnect = true;
+  } else if (found) {
+    pendingReply_ = std::string(P6K_TEST_HEADER_) + reply + P6K_TEST_TRAILER_;
+  } else {
+    pendingReply_ = P6K_TEST_EMPTY_REPLY_;
+  }
+  mutex_.unlock();
+
+  if (disconnect) {
+    //Like the IP port, report the disconnect so that asynManager stops
+    //queueing requests until connect works again.
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, "%s disconnected", portName);
+    pasynManager->exceptionDisconnect(pasynUser);
+    *nActual = 0;
+    return asynError;
+  }
+
+  *nActual = maxChars;
+  return asynSuccess;
+}
+
+/**
+ * Look up the reply to a command in the table set by setReply.
+ * This is called with the mutex held, for every command.
+ * @param command The command, as sent by the driver
+ * @param pReply Set to the reply, without the * and \r\r\n
+ * @return true if there is a reply, false if the command just gets an empty line
+ */
+bool p6kTestPort::findReply(const std::string &command, std::string *pReply)
+{
+  std::map<std::string, std::string>::const_iterator entry = replies_.find(command);
+  if (entry == replies_.end()) {
+    return false;
+  }
+  *pReply = entry->second;
+  return true;
+}
+
+/**
+ * Return the reply to the last command written.
+ */
+asynStatus p6kTestPort::readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason)
+{
+  mutex_.lock();
+  size_t length = pendingReply_.size();
+  if (length > maxChars) {
+    length = maxChars;
+  }
+  memcpy(value, pendingReply_.data(), length);
+  if (length < maxChars) {
+    value[length] = '\0';
+  }
+  pendingReply_.clear();
+  double delay = pendingDelay_;
+  asynStatus status = pendingStatus_;
+  pendingDelay_ = 0.0;
+  pendingStatus_ = asynSuccess;
+  mutex_.unlock();
+
+  if (delay > 0.0) {
+    p6kClock::getClock()->sleep(delay);
+  }
+
+  *nActual = length;
+  if (eomReason != NULL) {
+    *eomReason = (status == asynSuccess) ? ASYN_EOM_EOS : 0;
+  }
+  return status;
+}
+
+/**
+ * Refuse to connect while the link is down after an injected disconnect.
+ */
+asynStatus p6kTestPort::connect(asynUser *pasynUser)
+{
+  if (linkDown()) {
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, "%s link is down", portName);
+    return asynError;
+  }
+  return asynPortDriver::connect(pasynUser);
+}
+
+/**
+ * @return true if we are still in the disconnectTime after an injected disconnect.
+ */
+bool p6kTestPort::linkDown(void)
+{
+  epicsTimeStamp now;
+  p6kClock::getClock()->getCurrent(&now);
+  mutex_.lock();
+  bool down = (epicsTimeDiffInSeconds(&reconnectTime_, &now) > 0.0);
+  mutex_.unlock();
+  return down;
+}
+
+/**
+ * Uniform random number from 0 to 1, from a simple LCG so that
+ * a run can be repeated with the same seed. Call with the mutex held.
+ */
+double p6kTestPort::random(void)
+{
+  random_ = (random_ * 1664525u) + 1013904223u;
+  return random_ / 4294967296.0;
+}
+
+/**
+ * Call with the mutex held.
+ * @return true with the given probability.
+ */
+bool p6kTestPort::chance(double probability)
+{
+  if (probability <= 0.0) {
+    return false;
+  }
+  return (random() < probability);
+}
@@ -0,0 +1,124 @@
+/********************************************
+ *  p6kTestPort.h
+ *
+ *  Fake asyn octet port that stands in for
+ *  the 6K in the unit tests. It records every
+ *  command written to it and replies from a
+ *  table of canned responses. It can also
+ *  inject faults into the link, to test the
+ *  recovery paths in the driver.
+ *
+ ********************************************/
+
+#ifndef p6kTestPort_H
+#define p6kTestPort_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsTypes.h>
+
+#include "asynPortDriver.h"
+
+/**
+ * The faults that p6kTestPort can inject. Each probability is from 0 to 1,
+ * and is tested for every command. At most one of the reply faults
+ * (drop, truncate, error prompt, drive shutdown or disconnect) happens
+ * to each command, in that order of precedence. The latency applies to
+ * every reply, including faulty ones.
+ */
+typedef struct p6kTestFaults {
+  double latency;            /**< Fixed delay before each reply (seconds) */
+  double latencyJitter;      /**< Extra delay, uniformly distributed from 0 to this (seconds) */
+  double latencyTail;        /**< Probability of a slow reply */
+  double latencyTailDelay;   /**< Extra delay for a slow reply (seconds) */
+  double dropReply;          /**< Probability of no reply, so the read times out */
+  double dropTimeout;        /**< How long a dropped reply takes to time out (seconds, <0 for the asynUser timeout) */
+  double truncateTrailer;    /**< Probability that the \r\r\n is missing from the reply */
+  double errorPrompt;        /**< Probability of an error reply (eg. *UNKNOWN COMMAND) instead of the real reply */
+  double driveShutdown;      /**< Probability that a GO is answered with DRIVE SHUTDOWN */
+  double disconnect;         /**< Probability that the link disconnects instead of replying */
+  double disconnectTime;     /**< How long the link stays down (seconds) */
+  epicsUInt32 seed;          /**< Seed for the random numbers, so that a run can be repeated */
+} p6kTestFaults;
+
+/** The faults counted by p6kTestPort::faultCount */
+typedef enum {
+  P6K_TEST_FAULT_SLOW,
+  P6K_TEST_FAULT_DROP,
+  P6K_TEST_FAULT_TRUNCATE,
+  P6K_TEST_FAULT_ERROR,
+  P6K_TEST_FAULT_DRIVE_SHUTDOWN,
+  P6K_TEST_FAULT_DISCONNECT,
+  P6K_TEST_NUM_FAULTS
+} p6kTestFault;
+
+/**
+ * p6kTestPort is registered as a normal asyn port, so the controller
+ * connects to it with asynOctetSyncIO exactly as it would to the IP port
+ * for a real 6K.
+ *
+ * A reply is what the 6K would send back after the low level port has removed
+ * the > prompt. setReply takes the text between the * and the \r\r\n (eg. 1TPC+0).
+ * Commands that have no reply in the table get an empty line, as the 6K sends
+ * for commands that aren't queries.
+ *
+ * A subclass can override findReply to work out the replies itself (see p6kSimPort).
+ *
+ * Faults are off until setFaults is called. The faults are injected in the
+ * calling thread (the port is not ASYN_CANBLOCK), so a slow reply holds up the
+ * caller in the same way as a slow controller.
+ */
+class p6kTestPort : public asynPortDriver {
+
+ public:
+  p6kTestPort(const char *portName);
+  virtual ~p6kTestPort();
+
+  void setReply(const char *command, const char *reply);
+  void setReplies(const std::map<std::string, std::string> &replies);
+  void clearTranscript(void);
+  std::vector<std::string> transcript(void);
+
+  static void clearFaults(p6kTestFaults *pFaults);
+  void setFaults(const p6kTestFaults &faults);
+  epicsUInt32 faultCount(p6kTestFault fault);
+  epicsUInt32 commandCount(void);
+
+  /* These are the methods that we override from asynPortDriver */
+  asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual);
+  asynStatus readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason);
+  asynStatus connect(asynUser *pasynUser);
+
+ protected:
+  virtual bool findReply(const std::string &command, std::string *pReply);
+
+ private:
+  double random(void);
+  bool chance(double probability);
+  bool linkDown(void);
+
+  epicsMutex mutex_;
+  std::map<std::string, std::string> replies_;
+  std::vector<std::string> transcript_;
+  std::string pendingReply_;
+  double pendingDelay_;
+  asynStatus pendingStatus_;
+  p6kTestFaults faults_;
+  epicsUInt32 random_;
+  epicsUInt32 faultCounts_[P6K_TEST_NUM_FAULTS];
+  epicsUInt32 commands_;
+  epicsTimeStamp reconnectTime_;
+
+  static const char *P6K_TEST_HEADER_;
+  static const char *P6K_TEST_TRAILER_;
+  static const char *P6K_TEST_EMPTY_REPLY_;
+  static const char *P6K_TEST_ERROR_TRAILER_;
+  static const char *P6K_TEST_ERROR_REPLY_;
+  static const char *P6K_TEST_DRIVE_SHUTDOWN_REPLY_;
+};
+
+#endif /* p6kTestPort_H */
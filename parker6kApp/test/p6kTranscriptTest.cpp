@@ -0,0 +1,704 @@
+/********************************************
+ *  p6kTranscriptTest.cpp
+ *
+ *  Golden transcript tests. These drive the
+ *  axis and controller functions against a
+ *  fake 6K (p6kTestPort), and compare the
+ *  exact commands sent with the transcripts
+ *  in the golden directory.
+ *
+ *  The status queries made by the poller go
+ *  to a second fake port, so the command port
+ *  only sees what the test asked for.
+ *
+ *  To update the golden files after an
+ *  intended change to the command stream:
+ *
+ *  P6K_GOLDEN_UPDATE=1 ./p6kTranscriptTest
+ *
+ *  and check the diff before committing it.
+ *
+ ********************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "asynInt32SyncIO.h"
+#include "asynFloat64SyncIO.h"
+#include "asynMotorController.h"
+#include "parker6kController.h"
+#include "p6kTestPort.h"
+#include "p6kTestController.h"
+
+#define TEST_CONTROLLER "P6K_TEST"
+#define TEST_COMMAND_PORT "P6K_TEST_CMD"
+#define TEST_STATUS_PORT "P6K_TEST_STATUS"
+#define TEST_NUM_AXES 2
+#define TEST_POLL_PERIOD 1000.0
+#define TEST_UPLOAD_FILE "p6kTranscriptTest.prg"
+
+/* The golden files are in ../golden relative to O.<arch>, where the tests are run. */
+#define TEST_GOLDEN_DIR "../golden"
+
+#define TEST_TAS_POSLIM  "0000_0000_0000_0010_0000_0000_0000_0000"
+#define TEST_TAS_FAULT   "0000_0000_0000_0100_0000_0000_0000_0000"
+
+static p6kTestPort *pCommandPort = NULL;
+static p6kTestPort *pStatusPort = NULL;
+static p6kController *pController = NULL;
+
+/**
+ * Read a golden transcript. Each command is on a line starting with "> ",
+ * and an empty command is a line with just ">". Lines starting with # are comments.
+ */
+static bool readGolden(const char *fileName, std::vector<std::string> *pCommands)
+{
+  char line[P6K_MAXBUF] = {0};
+  FILE *fptr = NULL;
+
+  if ((fptr = fopen(fileName, "r")) == NULL) {
+    return false;
+  }
+  while (fgets(line, sizeof(line), fptr) != NULL) {
+    size_t length = strlen(line);
+    while ((length > 0) && ((line[length-1] == '\n') || (line[length-1] == '\r'))) {
+      line[--length] = '\0';
+    }
+    if (strncmp(line, "> ", 2) == 0) {
+      pCommands->push_back(std::string(line + 2));
+    } else if (strcmp(line, ">") == 0) {
+      pCommands->push_back(std::string());
+    }
+  }
+  fclose(fptr);
+
+  return true;
+}
+
+/**
+ * Write a golden transcript, in the format read by readGolden.
+ */
+static bool writeGolden(const char *fileName, const char *description,
+			const std::vector<std::string> &commands)
+{
+  FILE *fptr = NULL;
+
+  if ((fptr = fopen(fileName, "w")) == NULL) {
+    return false;
+  }
+  fprintf(fptr, "# %s\n", description);
+  for (size_t i=0; i<commands.size(); i++) {
+    if (commands[i].empty()) {
+      fprintf(fptr, ">\n");
+    } else {
+      fprintf(fptr, "> %s\n", commands[i].c_str());
+    }
+  }
+  fclose(fptr);
+
+  return true;
+}
+
+/**
+ * Compare the commands sent since the last call with a golden transcript,
+ * then clear the transcript ready for the next scenario.
+ * @param name The golden file name, without the directory or .txt
+ * @param description Written at the top of the file when the golden files are updated.
+ */
+static void checkTranscript(const char *name, const char *description)
+{
+  char fileName[P6K_MAXBUF] = {0};
+  const char *goldenDir = getenv("P6K_GOLDEN_DIR");
+  std::vector<std::string> expected;
+  std::vector<std::string> actual = pCommandPort->transcript();
+
+  pCommandPort->clearTranscript();
+
+  if (goldenDir == NULL) {
+    goldenDir = TEST_GOLDEN_DIR;
+  }
+  epicsSnprintf(fileName, sizeof(fileName), "%s/%s.txt", goldenDir, name);
+
+  if (getenv("P6K_GOLDEN_UPDATE") != NULL) {
+    testOk(writeGolden(fileName, description, actual), "%s: updated %s", name, fileName);
+    return;
+  }
+
+  if (!readGolden(fileName, &expected)) {
+    testFail("%s: could not read %s", name, fileName);
+    return;
+  }
+
+  bool same = (expected.size() == actual.size());
+  for (size_t i=0; (i<expected.size()) && (i<actual.size()); i++) {
+    if (expected[i] != actual[i]) {
+      testDiag("%s: command %u was '%s', expected '%s'", name,
+	       static_cast<unsigned int>(i+1), actual[i].c_str(), expected[i].c_str());
+      same = false;
+      break;
+    }
+  }
+  if (expected.size() != actual.size()) {
+    testDiag("%s: %u commands sent, expected %u", name,
+	     static_cast<unsigned int>(actual.size()), static_cast<unsigned int>(expected.size()));
+  }
+  testOk(same, "%s: %s", name, description);
+}
+
+/**
+ * Put an axis in a known state before each scenario. This must be called with the lock held,
+ * so that the poller can't change the params before the scenario runs.
+ */
+static void resetAxis(int axis)
+{
+  p6kTestSetIntegerParam(pController, axis, motorStatusDoneString, 1);
+  p6kTestSetIntegerParam(pController, axis, motorStatusPowerOnString, 1);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_AutoDriveEnableString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_AutoDriveEnableDelayString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_SendPositionOnlyString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_LimitDriveEnableString, 0);
+  p6kTestSetIntegerParam(pController, axis, P6K_A_DriveRetryString, 0);
+}
+
+/**
+ * Set the status replies, with the same axis status for both axes.
+ * The poller here also reads the limits and digital I/O.
+ */
+static void setStatusReplies(const char *tas)
+{
+  p6kTestReplies replies;
+
+  p6kTestStatusReplies(&replies, TEST_NUM_AXES, tas);
+  replies["TLIM"] = "TLIM111_111";
+  replies["TIN"] = "TIN0000_0000";
+  replies["TOUT"] = "TOUT0000_0000";
+  pStatusPort->setReplies(replies);
+}
+
+/**
+ * Create the fake ports, the controller and the axes.
+ */
+static void testStartup(void)
+{
+  p6kTestReplies replies;
+
+  testDiag("Startup");
+
+  pCommandPort = new p6kTestPort(TEST_COMMAND_PORT);
+  pStatusPort = new p6kTestPort(TEST_STATUS_PORT);
+  p6kTestStartupReplies(&replies, "6K8", TEST_NUM_AXES);
+  pCommandPort->setReplies(replies);
+  setStatusReplies(P6K_TEST_TAS_IDLE);
+
+  //The poll periods are long so that the poller mostly stays out of the way,
+  //although it only ever uses the status port.
+  pController = p6kTestCreateController(TEST_CONTROLLER, TEST_COMMAND_PORT, TEST_NUM_AXES,
+					TEST_POLL_PERIOD, TEST_POLL_PERIOD, TEST_STATUS_PORT);
+
+  checkTranscript("startup", "Controller and axis constructors");
+}
+
+/**
+ * The axis copies of the config params used by the move and poll functions
+ * follow the params, whether they are set by the driver or written through asyn.
+ */
+static void testConfig(void)
+{
+  asynUser *pInt32User = NULL;
+  asynUser *pFloat64User = NULL;
+  int index = 0;
+  int maxDigits = -1;
+  const p6kAxisConfig *pConfig = pController->getAxis(2)->getConfig();
+
+  testDiag("Axis config");
+
+  pController->lock();
+  if (pController->findParam(P6K_A_MaxDigitsString, &index) == asynSuccess) {
+    pController->getIntegerParam(2, index, &maxDigits);
+  }
+  pController->unlock();
+  testOk((pConfig->dres == 25000) && (pConfig->eres == 4000) && (pConfig->maxDigits == maxDigits),
+	 "DRES, ERES and MaxDigits are copied when they are read at startup");
+
+  pasynInt32SyncIO->connect(TEST_CONTROLLER, 2, &pInt32User, P6K_A_SendPositionOnlyString);
+  pasynInt32SyncIO->write(pInt32User, 1, 1.0);
+  bool written = (pConfig->sendPositionOnly == 1);
+  pasynInt32SyncIO->write(pInt32User, 0, 1.0);
+  testOk(written && (pConfig->sendPositionOnly == 0), "Integer params written through asyn are copied");
+  pasynInt32SyncIO->disconnect(pInt32User);
+
+  pasynFloat64SyncIO->connect(TEST_CONTROLLER, 2, &pFloat64User, P6K_A_DelayTimeString);
+  pasynFloat64SyncIO->write(pFloat64User, 1.5, 1.0);
+  written = (pConfig->delayTime == 1.5);
+  pasynFloat64SyncIO->write(pFloat64User, -1.0, 1.0);
+  testOk(written && (pConfig->delayTime == 0.0), "Double params written through asyn are copied, after they are checked");
+  pasynFloat64SyncIO->disconnect(pFloat64User);
+}
+
+/**
+ * The poll periods and forced fast poll count can be changed at run time, and 
+ * are used from the next poll. They stay long so the poller keeps out of the way.
+ */
+static void testPollPeriods(void)
+{
+  asynUser *pFloat64User = NULL;
+  asynUser *pInt32User = NULL;
+  const double moving = TEST_POLL_PERIOD + 1.0;
+  const double idle = TEST_POLL_PERIOD + 2.0;
+
+  testDiag("Poll periods");
+
+  pasynFloat64SyncIO->connect(TEST_CONTROLLER, 0, &pFloat64User, P6K_C_MovingPollPeriodString);
+  pasynFloat64SyncIO->write(pFloat64User, moving * 1000.0, 1.0);
+  pasynFloat64SyncIO->disconnect(pFloat64User);
+  pasynFloat64SyncIO->connect(TEST_CONTROLLER, 0, &pFloat64User, P6K_C_IdlePollPeriodString);
+  pasynFloat64SyncIO->write(pFloat64User, idle * 1000.0, 1.0);
+  pasynFloat64SyncIO->disconnect(pFloat64User);
+  pasynInt32SyncIO->connect(TEST_CONTROLLER, 0, &pInt32User, P6K_C_ForcedFastPollsString);
+  pasynInt32SyncIO->write(pInt32User, 2, 1.0);
+
+  testOk(pController->pollSweep(false) == idle, "The new idle poll period is used by the next poll");
+  bool fast = (pController->pollSweep(true) == moving);
+  fast = (pController->pollSweep(false) == moving) && fast;
+  testOk(fast && (pController->pollSweep(false) == idle), "A wakeup uses the new moving period for the new number of forced fast polls");
+
+  //A moving period of zero would stop the polls during a move
+  double readback = -1.0;
+  pasynFloat64SyncIO->connect(TEST_CONTROLLER, 0, &pFloat64User, P6K_C_MovingPollPeriodString);
+  pasynFloat64SyncIO->write(pFloat64User, 0.0, 1.0);
+  pasynFloat64SyncIO->read(pFloat64User, &readback, 1.0);
+  testOk((readback == 10.0) && (pController->pollSweep(true) == 0.01),
+	 "The moving poll period can't be set below 10 ms (%g)", readback);
+
+  pasynInt32SyncIO->write(pInt32User, 10, 1.0);
+  pasynInt32SyncIO->disconnect(pInt32User);
+  pasynFloat64SyncIO->write(pFloat64User, TEST_POLL_PERIOD * 1000.0, 1.0);
+  pasynFloat64SyncIO->disconnect(pFloat64User);
+  pasynFloat64SyncIO->connect(TEST_CONTROLLER, 0, &pFloat64User, P6K_C_IdlePollPeriodString);
+  pasynFloat64SyncIO->write(pFloat64User, TEST_POLL_PERIOD * 1000.0, 1.0);
+  pasynFloat64SyncIO->disconnect(pFloat64User);
+  pCommandPort->clearTranscript();
+}
+
+/**
+ * Moves, including the SendPositionOnly and automatic drive enable branches.
+ */
+static void testMove(void)
+{
+  testDiag("Moves");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+  p6kAxis *pAxis2 = pController->getAxis(2);
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->move(10000, 0, 0, 50000, 250000);
+  pController->unlock();
+  checkTranscript("move_absolute", "Absolute move, with velocity and acceleration");
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->move(500, 1, 0, 12500, 7.5);
+  pController->unlock();
+  checkTranscript("move_relative", "Relative move, with an odd acceleration (AA rounded up)");
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->move(100, 0, 0, 0, 250000);
+  pController->unlock();
+  checkTranscript("move_zero_velocity", "Move with zero velocity (no V or A commands)");
+
+  pController->lock();
+  resetAxis(2);
+  p6kTestSetIntegerParam(pController, 2, P6K_A_SendPositionOnlyString, 1);
+  pAxis2->move(2000, 0, 0, 50000, 250000);
+  pController->unlock();
+  checkTranscript("move_position_only", "Move with SendPositionOnly set");
+
+  pController->lock();
+  resetAxis(1);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_AutoDriveEnableString, 1);
+  p6kTestSetIntegerParam(pController, 1, motorStatusPowerOnString, 0);
+  pAxis1->move(10000, 0, 0, 50000, 250000);
+  pController->unlock();
+  checkTranscript("move_auto_enable", "Move with automatic drive enable, drive off");
+
+  pController->lock();
+  resetAxis(1);
+  p6kTestSetIntegerParam(pController, 1, motorStatusPowerOnString, 0);
+  pAxis1->move(10000, 0, 0, 50000, 250000);
+  pController->unlock();
+  checkTranscript("move_drive_off", "Move with the drive off (not sent)");
+}
+
+/**
+ * Moves with LimitDriveEnable set. The status is read before the move,
+ * and a move towards an active limit is not sent.
+ */
+static void testLimitDrive(void)
+{
+  testDiag("Limit drive");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+
+  setStatusReplies(TEST_TAS_POSLIM);
+
+  pController->lock();
+  resetAxis(1);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_LimitDriveEnableString, 1);
+  pAxis1->move(100000, 0, 0, 50000, 250000);
+  pAxis1->move(5, 0, 0, 50000, 250000);
+  pController->unlock();
+  checkTranscript("move_limit_drive", "Moves with LimitDriveEnable and the high limit active");
+
+  setStatusReplies(P6K_TEST_TAS_IDLE);
+}
+
+/**
+ * With a status freshness set, a move with LimitDriveEnable uses the status
+ * from a recent poll instead of reading it again. This checks the status
+ * queries, rather than the commands (which are the same as without it).
+ */
+static void testStatusFreshness(void)
+{
+  testDiag("Status freshness");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+
+  pController->lock();
+  resetAxis(1);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_LimitDriveEnableString, 1);
+  p6kTestSetDoubleParam(pController, 1, P6K_A_StatusFreshnessString, 60.0);
+  pController->unlock();
+
+  pController->pollSweep(false);
+
+  //Keep the lock, so that the poller can't read the status in the meantime
+  pController->lock();
+  epicsUInt32 queries = pStatusPort->commandCount();
+  pAxis1->move(1000, 0, 0, 50000, 250000);
+  testOk(pStatusPort->commandCount() == queries, "A move with LimitDriveEnable uses the status from a recent poll");
+
+  queries = pStatusPort->commandCount();
+  pAxis1->move(2000, 0, 0, 50000, 250000);
+  testOk(pStatusPort->commandCount() > queries, "The status is read again after a move");
+
+  queries = pStatusPort->commandCount();
+  pAxis1->setPosition(1234);
+  testOk(pStatusPort->commandCount() == queries, "Set position leaves reading the new position to the poller");
+
+  p6kTestSetDoubleParam(pController, 1, P6K_A_StatusFreshnessString, 0.0);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_LimitDriveEnableString, 0);
+  pController->unlock();
+
+  pCommandPort->clearTranscript();
+}
+
+/**
+ * @return true if the move error message for an axis contains text.
+ */
+static bool moveErrorIs(int axis, const char *text)
+{
+  char message[P6K_MAXBUF] = {0};
+  int index = 0;
+  if (pController->findParam(P6K_A_MoveErrorString, &index) == asynSuccess) {
+    pController->getStringParam(axis, index, sizeof(message), message);
+  }
+  return (strstr(message, text) != NULL);
+}
+
+/**
+ * With MoveCheck set, moves that the controller would refuse are rejected
+ * without sending anything.
+ */
+static void testMoveCheck(void)
+{
+  testDiag("Move check");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+
+  //Read the current position (50000)
+  pController->pollSweep(false);
+  pCommandPort->clearTranscript();
+
+  pController->lock();
+  resetAxis(1);
+  p6kTestSetIntegerParam(pController, 1, P6K_A_MoveCheckString, 1);
+  p6kTestSetDoubleParam(pController, 1, motorHighLimitString, 60000);
+  p6kTestSetDoubleParam(pController, 1, motorLowLimitString, 40000);
+  bool rejected = (pAxis1->move(70000, 0, 0, 50000, 250000) == asynError);
+  rejected = rejected && pCommandPort->transcript().empty();
+  testOk(rejected && moveErrorIs(1, "above the soft limit"), "A move above LSPOS is rejected without sending anything");
+  rejected = (pAxis1->move(-25000, 1, 0, 50000, 250000) == asynError);
+  rejected = rejected && pCommandPort->transcript().empty();
+  testOk(rejected && moveErrorIs(1, "below the soft limit"), "A relative move below LSNEG is rejected without sending anything");
+  bool sent = (pAxis1->move(55000, 0, 0, 50000, 250000) == asynSuccess) && !pCommandPort->transcript().empty();
+  testOk(sent, "A move inside the soft limits is sent");
+  pController->unlock();
+
+  setStatusReplies(TEST_TAS_FAULT);
+  pController->pollSweep(false);
+  pCommandPort->clearTranscript();
+
+  pController->lock();
+  rejected = (pAxis1->home(0, 50000, 250000, 1) == asynError) && pCommandPort->transcript().empty();
+  testOk(rejected && moveErrorIs(1, "Drive fault"), "A home with a drive fault is rejected without sending anything");
+  p6kTestSetIntegerParam(pController, 1, P6K_A_MoveCheckString, 0);
+  p6kTestSetDoubleParam(pController, 1, motorHighLimitString, 0);
+  p6kTestSetDoubleParam(pController, 1, motorLowLimitString, 0);
+  pController->unlock();
+
+  setStatusReplies(P6K_TEST_TAS_IDLE);
+  pController->pollSweep(false);
+  pCommandPort->clearTranscript();
+}
+
+/**
+ * @return true if the last poll only read the status of one axis. Clears the status port transcript.
+ */
+static bool onlyAxisPolled(char axis)
+{
+  std::vector<std::string> commands = pStatusPort->transcript();
+  pStatusPort->clearTranscript();
+  if (commands.empty()) {
+    return false;
+  }
+  for (size_t i=0; i<commands.size(); i++) {
+    if (commands[i].empty() || (commands[i][0] != axis)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * With BurstPolls set, a move is followed by fast polls of just that axis.
+ */
+static void testBurst(void)
+{
+  testDiag("Burst polls");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+
+  setStatusReplies(P6K_TEST_TAS_MOVING);
+  pController->lock();
+  p6kTestSetIntegerParam(pController, 1, P6K_A_BurstPollsString, 2);
+  p6kTestSetDoubleParam(pController, 1, P6K_A_BurstPeriodString, 5.0);
+  pAxis1->move(55000, 0, 0, 50000, 250000);
+  pController->unlock();
+  pStatusPort->clearTranscript();
+
+  double timeout = pController->pollSweep(true);
+  testOk((timeout == 0.005) && onlyAxisPolled('1'), "The first poll after a move only reads the moving axis, and the next is a burst period later");
+  timeout = pController->pollSweep(false);
+  testOk((timeout == TEST_POLL_PERIOD) && onlyAxisPolled('1'), "The last burst poll is followed by the moving poll period");
+  pController->pollSweep(false);
+  testOk(!onlyAxisPolled('1'), "All the axes are read again after the burst");
+
+  //A move that is done by the first poll
+  setStatusReplies(P6K_TEST_TAS_IDLE);
+  pController->lock();
+  p6kTestSetIntegerParam(pController, 1, P6K_A_BurstPollsString, 5);
+  pAxis1->move(50000, 0, 0, 50000, 250000);
+  pController->unlock();
+  pStatusPort->clearTranscript();
+  pController->pollSweep(true);
+  bool first = onlyAxisPolled('1');
+  pController->pollSweep(false);
+  testOk(first && !onlyAxisPolled('1'), "A burst ends once the axis is done");
+
+  pController->lock();
+  p6kTestSetIntegerParam(pController, 1, P6K_A_BurstPollsString, 0);
+  p6kTestSetDoubleParam(pController, 1, P6K_A_BurstPeriodString, 0.0);
+  pController->unlock();
+  pController->pollSweep(false);
+  pStatusPort->clearTranscript();
+  pCommandPort->clearTranscript();
+}
+
+/**
+ * Homing.
+ */
+static void testHome(void)
+{
+  testDiag("Homing");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+  p6kAxis *pAxis2 = pController->getAxis(2);
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->home(0, 50000, 250000, 1);
+  pController->unlock();
+  checkTranscript("home_forward", "Home forwards, with velocity and acceleration");
+
+  pController->lock();
+  resetAxis(2);
+  p6kTestSetIntegerParam(pController, 2, P6K_A_SendPositionOnlyString, 1);
+  pAxis2->home(0, 50000, 250000, 0);
+  pController->unlock();
+  checkTranscript("home_reverse_position_only", "Home in reverse, with SendPositionOnly set");
+}
+
+/**
+ * Setting the position, stopping and drive enable/disable.
+ */
+static void testAxisCommands(void)
+{
+  testDiag("Axis commands");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->setEncoderRatio(2.0);
+  pAxis1->setPosition(1234.4);
+  pController->unlock();
+  checkTranscript("set_position", "Set the motor and encoder position (encoder ratio 2)");
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->stop(250000);
+  pController->unlock();
+  checkTranscript("stop", "Stop an axis");
+
+  pController->lock();
+  resetAxis(1);
+  pAxis1->setClosedLoop(true);
+  pAxis1->setClosedLoop(false);
+  pAxis1->setClosedLoop(false);
+  pAxis1->setClosedLoop(true);
+  p6kTestSetIntegerParam(pController, 1, motorStatusDoneString, 0);
+  pAxis1->setClosedLoop(false);
+  pController->unlock();
+  checkTranscript("closed_loop", "Drive enable and disable (nothing is sent if there is no change, or when moving)");
+}
+
+/**
+ * Coordinated moves.
+ */
+static void testDeferredMoves(void)
+{
+  testDiag("Deferred moves");
+
+  p6kAxis *pAxis1 = pController->getAxis(1);
+  p6kAxis *pAxis2 = pController->getAxis(2);
+
+  pController->lock();
+  resetAxis(1);
+  resetAxis(2);
+  pController->setDeferredMoves(true);
+  pAxis1->move(1000, 0, 0, 50000, 250000);
+  pAxis2->move(2000, 0, 0, 50000, 250000);
+  pController->setDeferredMoves(false);
+  pController->unlock();
+  checkTranscript("deferred_moves", "Deferred move of both axes, then GO");
+}
+
+/**
+ * Uploading a program file.
+ */
+static void testUpload(void)
+{
+  FILE *fptr = NULL;
+
+  testDiag("Upload");
+
+  if ((fptr = fopen(TEST_UPLOAD_FILE, "w")) == NULL) {
+    testFail("upload: could not write %s", TEST_UPLOAD_FILE);
+    return;
+  }
+  fprintf(fptr, "1V1\n1A10\nIF(1TAS.1=b0)\nGO1\nNIF\n");
+  fclose(fptr);
+
+  pController->lock();
+  pController->upload(TEST_UPLOAD_FILE);
+  pController->unlock();
+  checkTranscript("upload", "Upload a program file");
+
+  remove(TEST_UPLOAD_FILE);
+}
+
+/**
+ * Thread that uploads the test file, for testUploadMove.
+ */
+static void uploadTask(void *pPvt)
+{
+  epicsEventId done = static_cast<epicsEventId>(pPvt);
+
+  pController->lock();
+  pController->upload(TEST_UPLOAD_FILE);
+  pController->unlock();
+  epicsEventSignal(done);
+}
+
+/**
+ * A move during an upload. The lock is released between upload lines
+ * (because there is a status port), but the move must not be sent
+ * inside the program definition.
+ */
+static void testUploadMove(void)
+{
+  FILE *fptr = NULL;
+  asynStatus status = asynSuccess;
+
+  testDiag("Move during upload");
+
+  if ((fptr = fopen(TEST_UPLOAD_FILE, "w")) == NULL) {
+    testFail("upload_move: could not write %s", TEST_UPLOAD_FILE);
+    return;
+  }
+  fprintf(fptr, "DEFPROG1\n1V1\n1A10\nGO1\nEND\n");
+  fclose(fptr);
+
+  epicsEventId done = epicsEventMustCreate(epicsEventEmpty);
+  epicsThreadCreate("p6kUploadTest", epicsThreadPriorityMedium,
+		    epicsThreadGetStackSize(epicsThreadStackMedium),
+		    uploadTask, done);
+
+  //Wait for the DEF to be sent
+  for (int i=0; (i<100) && pCommandPort->transcript().empty(); i++) {
+    epicsThreadSleep(0.01);
+  }
+
+  pController->lock();
+  resetAxis(1);
+  status = pController->getAxis(1)->move(10000, 0, 0, 50000, 250000);
+  pController->unlock();
+  testOk(status != asynSuccess, "Move is refused during the upload");
+
+  epicsEventWait(done);
+  epicsEventDestroy(done);
+  checkTranscript("upload_move", "Upload a program, with a move attempted during the upload");
+
+  remove(TEST_UPLOAD_FILE);
+}
+
+MAIN(p6kTranscriptTest)
+{
+  testPlan(34);
+  testStartup();
+  testConfig();
+  testPollPeriods();
+  testMove();
+  testLimitDrive();
+  testStatusFreshness();
+  testMoveCheck();
+  testBurst();
+  testHome();
+  testAxisCommands();
+  testDeferredMoves();
+  testUpload();
+  testUploadMove();
+  return testDone();
+}